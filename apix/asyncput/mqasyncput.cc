@@ -0,0 +1,306 @@
+/*
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+  Copyright (c) IBM Corporation 2024
+*/
+
+// A plugin for the mqmux exit that turns eligible MQPUT and MQPUT1 calls into asynchronous
+// puts. A client application then does not wait for a network round trip on each message.
+//
+// A put is eligible if it is a non-persistent datagram, outside syncpoint, to a queue named
+// in MQASYNCPUT_QUEUES, and the application did not choose a response type itself. The PMO
+// options are changed in the Before phase and put back in the After phase.
+//
+// Errors from asynchronous puts are only reported by MQSTAT. The exit calls it every so often,
+// and at MQDISC, and logs any failures. Results collected this way are also added into the
+// MQSTS of the application's own MQSTAT calls, so nothing is hidden from an application that
+// does check.
+
+#include <unordered_set>
+
+#include <cmqc.h>
+#include <cmqec.h>
+#include <cmqxc.h>
+
+#include "../mux/mqmux_plugin.hpp"
+
+using namespace mqmux;
+
+#define ENV_QUEUES "MQASYNCPUT_QUEUES"
+#define ENV_STAT_SECS "MQASYNCPUT_STAT_SECS"
+#define ENV_STAT_PUTS "MQASYNCPUT_STAT_PUTS"
+
+#define DEFAULT_STAT_SECS 10
+#define DEFAULT_STAT_PUTS 10000
+
+#define RESPONSE_OPTIONS (MQPMO_ASYNC_RESPONSE | MQPMO_SYNC_RESPONSE)
+
+static queueList queues;
+static unsigned long long statInterval = 0; // Microseconds
+static long statPuts = DEFAULT_STAT_PUTS;
+
+static const MQBYTE24 noMsgId = {0};
+
+// Totals from MQSTAT calls that the application has not yet seen
+typedef struct {
+  MQLONG successes;
+  MQLONG warnings;
+  MQLONG failures;
+  MQLONG compCode; // The first problem
+  MQLONG reason;
+  MQCHAR48 objectName;
+} asyncResults;
+
+struct apConn {
+  std::unordered_set<MQHOBJ> eligible; // Handles opened for output to a configured queue
+
+  MQLONG addedOptions = 0; // What PutBefore added to the PMO
+  MQHCONN hConn = MQHC_UNUSABLE_HCONN; // For the final MQSTAT from Terminate
+
+  unsigned long long lastStat = 0;
+  long putsSinceStat = 0;
+  asyncResults pending = {};
+
+  unsigned long asyncPuts = 0;
+  unsigned long statCalls = 0;
+  unsigned long successes = 0;
+  unsigned long warnings = 0;
+  unsigned long failures = 0;
+};
+
+static void addResults(asyncResults *r, PMQSTS sts) {
+  r->successes += sts->PutSuccessCount;
+  r->warnings += sts->PutWarningCount;
+  r->failures += sts->PutFailureCount;
+  if (r->compCode == MQCC_OK && sts->CompCode != MQCC_OK) {
+    r->compCode = sts->CompCode;
+    r->reason = sts->Reason;
+    memcpy(r->objectName, sts->ObjectName, sizeof(r->objectName));
+  }
+}
+
+// Collect the results of the asynchronous puts since the last MQSTAT on this connection
+static void collect(PMQAXP pExitParms, MQHCONN hConn, apConn *ac) {
+  MQSTS sts = {MQSTS_DEFAULT};
+  MQLONG CC, RC;
+
+  ac->lastStat = now();
+  ac->putsSinceStat = 0;
+  ac->statCalls++;
+
+  pExitParms->Hconfig->MQSTAT_Call(hConn, MQSTAT_TYPE_ASYNC_ERROR, &sts, &CC, &RC);
+  if (CC != MQCC_OK) {
+    rptmqrc("MQSTAT", CC, RC);
+    return;
+  }
+
+  ac->successes += sts.PutSuccessCount;
+  ac->warnings += sts.PutWarningCount;
+  ac->failures += sts.PutFailureCount;
+  if (sts.PutFailureCount > 0 || sts.PutWarningCount > 0) {
+    rpt("Asynchronous puts: %d failed, %d warnings. First error CC=%d RC=%d on %.*s", sts.PutFailureCount, sts.PutWarningCount, sts.CompCode, sts.Reason,
+        (int)nameLength(sts.ObjectName, sizeof(sts.ObjectName)), sts.ObjectName);
+  }
+  addResults(&ac->pending, &sts);
+}
+
+static bool statDue(apConn *ac) {
+  return (statPuts > 0 && ac->putsSinceStat >= statPuts) || (statInterval > 0 && now() - ac->lastStat >= statInterval);
+}
+
+// Can this put be made asynchronous?
+static bool eligible(PMQMD md, PMQPMO pmo) {
+  return md->MsgType == MQMT_DATAGRAM && md->Persistence == MQPER_NOT_PERSISTENT && (pmo->Options & MQPMO_SYNCPOINT) == 0 &&
+         (pmo->Options & RESPONSE_OPTIONS) == 0;
+}
+
+// Switch the response type. The client generates the MsgId for an asynchronous put if it
+// is asked to, so that the application still gets one back.
+static void makeAsync(apConn *ac, PMQMD md, PMQPMO pmo) {
+  ac->addedOptions = MQPMO_ASYNC_RESPONSE;
+  if ((pmo->Options & MQPMO_NEW_MSG_ID) == 0 && !memcmp(md->MsgId, noMsgId, sizeof(noMsgId))) {
+    ac->addedOptions |= MQPMO_NEW_MSG_ID;
+  }
+  pmo->Options |= ac->addedOptions;
+}
+
+static void restore(PMQAXP pExitParms, PMQHCONN pHconn, apConn *ac, PMQPMO pmo, MQLONG compCode) {
+  pmo->Options &= ~ac->addedOptions;
+  ac->addedOptions = 0;
+  if (compCode != MQCC_FAILED) {
+    ac->hConn = *pHconn;
+    ac->asyncPuts++;
+    ac->putsSinceStat++;
+    if (statDue(ac)) {
+      collect(pExitParms, *pHconn, ac);
+    }
+  }
+}
+
+extern "C" {
+MQLONG MqmuxPlugin(mqmuxPlugin *p);
+}
+
+static MQLONG apInit(MQMUX_RPT *_rpt, char *buf, size_t len) {
+  rptFn = _rpt;
+  rptPrefix = "asyncput: ";
+
+  queues.parse(getenv(ENV_QUEUES), 0);
+  statInterval = (unsigned long long)envLong(ENV_STAT_SECS, DEFAULT_STAT_SECS, 0, 86400) * 1000000ULL;
+  statPuts = envLong(ENV_STAT_PUTS, DEFAULT_STAT_PUTS, 0, 1000000000);
+
+  for (const queueRule &r : queues.all()) {
+    rpt("Asynchronous puts for %s%s", r.name.c_str(), r.prefix ? "*" : "");
+  }
+  if (queues.empty()) {
+    snprintf(buf, len, "No queues configured in %s", ENV_QUEUES);
+    return MQRC_ENVIRONMENT_ERROR;
+  }
+  snprintf(buf, len, "Checking results every %lu seconds or %ld puts", (unsigned long)(statInterval / 1000000), statPuts);
+  return MQRC_NONE;
+}
+
+static void MQENTRY apOpenAfter(PMQAXP pExitParms, PMQAXC pExitContext, PMQHCONN pHconn, PPMQOD ppObjDesc, PMQLONG pOptions, PPMQHOBJ ppHobj,
+                                PMQLONG pCompCode, PMQLONG pReason) {
+  PMQOD od = *ppObjDesc;
+  if (*pCompCode != MQCC_FAILED && od->ObjectType == MQOT_Q && (*pOptions & MQOO_OUTPUT) != 0 && queues.find(od->ObjectName)) {
+    apConn *ac = getConn<apConn>(pExitParms);
+    if (ac->lastStat == 0) {
+      ac->lastStat = now();
+    }
+    ac->eligible.insert(**ppHobj);
+  }
+}
+
+// Forget the handle whether or not the close works. At worst, later puts are left synchronous.
+static void MQENTRY apCloseBefore(PMQAXP pExitParms, PMQAXC pExitContext, PMQHCONN pHconn, PPMQHOBJ ppHobj, PMQLONG pOptions, PMQLONG pCompCode,
+                                  PMQLONG pReason) {
+  apConn *ac = findConn<apConn>(pExitParms);
+  if (ac) {
+    ac->eligible.erase(**ppHobj);
+  }
+}
+
+static void MQENTRY apPutBefore(PMQAXP pExitParms, PMQAXC pExitContext, PMQHCONN pHconn, PMQHOBJ pHobj, PPMQMD ppMsgDesc, PPMQPMO ppPutMsgOpts,
+                                PMQLONG pBufferLength, PPMQVOID ppBuffer, PMQLONG pCompCode, PMQLONG pReason) {
+  apConn *ac = findConn<apConn>(pExitParms);
+  if (ac && ac->eligible.count(*pHobj) && eligible(*ppMsgDesc, *ppPutMsgOpts)) {
+    makeAsync(ac, *ppMsgDesc, *ppPutMsgOpts);
+  }
+}
+
+static void MQENTRY apPutAfter(PMQAXP pExitParms, PMQAXC pExitContext, PMQHCONN pHconn, PMQHOBJ pHobj, PPMQMD ppMsgDesc, PPMQPMO ppPutMsgOpts,
+                               PMQLONG pBufferLength, PPMQVOID ppBuffer, PMQLONG pCompCode, PMQLONG pReason) {
+  apConn *ac = findConn<apConn>(pExitParms);
+  if (ac && ac->addedOptions) {
+    restore(pExitParms, pHconn, ac, *ppPutMsgOpts, *pCompCode);
+  }
+}
+
+static void MQENTRY apPut1Before(PMQAXP pExitParms, PMQAXC pExitContext, PMQHCONN pHconn, PPMQOD ppObjDesc, PPMQMD ppMsgDesc, PPMQPMO ppPutMsgOpts,
+                                 PMQLONG pBufferLength, PPMQVOID ppBuffer, PMQLONG pCompCode, PMQLONG pReason) {
+  PMQOD od = *ppObjDesc;
+  if (od->ObjectType == MQOT_Q && queues.find(od->ObjectName) && eligible(*ppMsgDesc, *ppPutMsgOpts)) {
+    apConn *ac = getConn<apConn>(pExitParms);
+    if (ac->lastStat == 0) {
+      ac->lastStat = now();
+    }
+    makeAsync(ac, *ppMsgDesc, *ppPutMsgOpts);
+  }
+}
+
+static void MQENTRY apPut1After(PMQAXP pExitParms, PMQAXC pExitContext, PMQHCONN pHconn, PPMQOD ppObjDesc, PPMQMD ppMsgDesc, PPMQPMO ppPutMsgOpts,
+                                PMQLONG pBufferLength, PPMQVOID ppBuffer, PMQLONG pCompCode, PMQLONG pReason) {
+  apConn *ac = findConn<apConn>(pExitParms);
+  if (ac && ac->addedOptions) {
+    restore(pExitParms, pHconn, ac, *ppPutMsgOpts, *pCompCode);
+  }
+}
+
+// The application's MQSTAT only reports what happened since the last one, and the exit may
+// have made that call. Add in what the exit collected.
+static void MQENTRY apStatAfter(PMQAXP pExitParms, PMQAXC pExitContext, PMQHCONN pHconn, PMQLONG pType, PPMQSTS ppStatus, PMQLONG pCompCode,
+                                PMQLONG pReason) {
+  apConn *ac = findConn<apConn>(pExitParms);
+  PMQSTS sts = *ppStatus;
+  asyncResults *r;
+
+  if (!ac || *pType != MQSTAT_TYPE_ASYNC_ERROR || *pCompCode != MQCC_OK) {
+    return;
+  }
+  r = &ac->pending;
+
+  // These ones have not been seen by the exit, so count them too
+  ac->successes += sts->PutSuccessCount;
+  ac->warnings += sts->PutWarningCount;
+  ac->failures += sts->PutFailureCount;
+
+  sts->PutSuccessCount += r->successes;
+  sts->PutWarningCount += r->warnings;
+  sts->PutFailureCount += r->failures;
+  if (r->compCode != MQCC_OK) {
+    // The exit's collection happened earlier, so its first error comes first
+    sts->CompCode = r->compCode;
+    sts->Reason = r->reason;
+    memcpy(sts->ObjectName, r->objectName, sizeof(sts->ObjectName));
+  }
+  memset(r, 0, sizeof(*r));
+}
+
+// Collect the last results, report and release the connection's state
+static void apEnd(PMQAXP pExitParms, MQHCONN hConn) {
+  apConn *ac = findConn<apConn>(pExitParms);
+  if (ac) {
+    if (ac->putsSinceStat > 0) {
+      collect(pExitParms, hConn, ac);
+    }
+    rpt("Asynchronous puts: %lu. MQSTAT calls: %lu. Reported successes: %lu warnings: %lu failures: %lu", ac->asyncPuts, ac->statCalls, ac->successes,
+        ac->warnings, ac->failures);
+    freeConn<apConn>(pExitParms);
+  }
+}
+
+static void MQENTRY apDiscBefore(PMQAXP pExitParms, PMQAXC pExitContext, PPMQHCONN ppHconn, PMQLONG pCompCode, PMQLONG pReason) {
+  apEnd(pExitParms, **ppHconn);
+}
+
+// The connection ended without an MQDISC
+static void MQENTRY apTerminate(PMQAXP pExitParms, PMQAXC pExitContext, PMQLONG pCompCode, PMQLONG pReason) {
+  apConn *ac = findConn<apConn>(pExitParms);
+  if (ac) {
+    apEnd(pExitParms, ac->hConn);
+  }
+}
+
+MQLONG MqmuxPlugin(mqmuxPlugin *p) {
+  if (p->Version < MQMUX_PLUGIN_VERSION_1) {
+    return MQRC_WRONG_VERSION;
+  }
+
+  p->Name = "asyncput";
+  p->init = apInit;
+
+  p->openAfter = apOpenAfter;
+  p->closeBefore = apCloseBefore;
+  p->putBefore = apPutBefore;
+  p->putAfter = apPutAfter;
+  p->put1Before = apPut1Before;
+  p->put1After = apPut1After;
+  p->statAfter = apStatAfter;
+  p->discBefore = apDiscBefore;
+  if (p->Version >= MQMUX_PLUGIN_VERSION_2) {
+    p->terminate = apTerminate;
+  }
+
+  return MQRC_NONE;
+}
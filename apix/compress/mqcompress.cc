@@ -0,0 +1,887 @@
+/*
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+  Copyright (c) IBM Corporation 2024
+*/
+
+// A plugin for the mqmux exit that compresses message bodies. Large messages put to a queue
+// named in MQCOMPRESS_QUEUES are compressed with LZ4 or Zstd, and a header is put in front
+// of the compressed data that describes the original message. Any message with that header
+// is decompressed on MQGET, or before it is given to an MQCB callback, whichever queue it is
+// read from.
+//
+// The MQMD Format, Encoding and CodedCharSetId describe the compression header. The
+// original values are held in the header, and put back into the MQMD on the GET side.
+//
+// Zstd dictionaries trained for a queue's messages can be given in MQCOMPRESS_DICT_DIR.
+// The file QUEUE.NAME.dict is used when compressing messages for QUEUE.NAME. Messages
+// carry the dictionary's id, so any dictionary in the directory can be used to decompress.
+
+#include <dirent.h>
+#include <time.h>
+
+#include <map>
+#include <unordered_map>
+
+#include <lz4.h>
+#include <zstd.h>
+
+#include <cmqc.h>
+#include <cmqec.h>
+#include <cmqxc.h>
+
+#include "../mux/mqmux_plugin.hpp"
+
+using namespace mqmux;
+
+#define ENV_QUEUES "MQCOMPRESS_QUEUES"
+#define ENV_ALGORITHM "MQCOMPRESS_ALGORITHM"
+#define ENV_LEVEL "MQCOMPRESS_LEVEL"
+#define ENV_MIN_BYTES "MQCOMPRESS_MIN_BYTES"
+#define ENV_DICT_DIR "MQCOMPRESS_DICT_DIR"
+
+#define DEFAULT_LEVEL 3
+#define DEFAULT_MIN_BYTES 1024
+
+#define DICT_SUFFIX ".dict"
+#define MAX_DICT_BYTES (16 * 1024 * 1024)
+
+// The largest message a queue manager will handle
+#define MAX_MSG_LENGTH (100 * 1024 * 1024)
+
+// Format name and structure of the compression header. Numbers in the header are in the
+// native encoding of the putting application, and the MQMD Encoding says what that was.
+#define MQCOMPRESS_FORMAT "APXCMPR "
+#define MQCOMPRESS_STRUC_ID "CMPH"
+#define MQCOMPRESS_VERSION_1 1
+
+#define ALGORITHM_LZ4 1
+#define ALGORITHM_ZSTD 2
+
+typedef struct {
+  MQCHAR4 StrucId;
+  MQLONG Version;
+  MQLONG StrucLength;
+  MQLONG Encoding;       // Of the original data
+  MQLONG CodedCharSetId; // Of the original data
+  MQCHAR8 Format;        // Of the original data
+  MQLONG Algorithm;
+  MQLONG OriginalLength;
+  MQLONG DictId; // 0 if no dictionary was used
+} compressHeader;
+
+#define GET_BROWSE_OPTIONS (MQGMO_BROWSE_FIRST | MQGMO_BROWSE_NEXT | MQGMO_BROWSE_MSG_UNDER_CURSOR)
+#define SIMPLE_MATCH_OPTIONS (MQMO_MATCH_MSG_ID | MQMO_MATCH_CORREL_ID)
+
+static const MQBYTE24 noId = {0};
+
+struct dictEntry {
+  std::string queue;
+  unsigned id;
+  ZSTD_CDict *cdict;
+  ZSTD_DDict *ddict;
+};
+
+// Counters for one queue
+struct queueStats {
+  unsigned long compressed = 0;
+  unsigned long skipped = 0; // Eligible, but compression did not make them smaller
+  unsigned long long bytesIn = 0;
+  unsigned long long bytesOut = 0;
+  unsigned long long compressNs = 0;
+
+  unsigned long decompressed = 0;
+  unsigned long long compressedBytes = 0;
+  unsigned long long originalBytes = 0;
+  unsigned long long decompressNs = 0;
+};
+
+struct czObject {
+  std::string name;
+  const queueRule *rule = NULL; // Set when puts to this handle are compressed
+  const dictEntry *dict = NULL;
+
+  // A decompressed message that did not fit the application's buffer
+  bool held = false;
+  bool heldBrowse = false;
+  bool heldSyncpoint = false; // Removed by a get in a unit of work that is not yet committed
+  std::vector<char> heldData;
+  MQMD heldMd; // Always a version 2 MQMD, whatever version the truncated get used
+};
+
+struct czConn {
+  std::unordered_map<MQHOBJ, czObject> objects;
+  std::map<std::string, queueStats> stats;
+
+  std::vector<char> work;     // Compressed or decompressed message
+  std::vector<char> cbBuffer; // Decompressed message given to a callback
+
+  ZSTD_CCtx *cctx = NULL;
+  ZSTD_DCtx *dctx = NULL;
+
+  // What PutBefore changed
+  bool swapped = false;
+  PMQVOID appBuffer = NULL;
+  MQLONG appLength = 0;
+  MQLONG appEncoding = 0;
+  MQCHAR8 appFormat;
+
+  MQLONG requestedCcsid = 0; // From the application's MQMD on MQGET
+  bool served = false;       // GetBefore returned a held message
+  unsigned long discarded = 0; // Held messages removed from a queue that the application never got
+
+  ~czConn() {
+    if (cctx) {
+      ZSTD_freeCCtx(cctx);
+    }
+    if (dctx) {
+      ZSTD_freeDCtx(dctx);
+    }
+  }
+};
+
+static queueList queues;
+static MQLONG algorithm = ALGORITHM_LZ4;
+static int level = DEFAULT_LEVEL;
+static long minBytes = DEFAULT_MIN_BYTES;
+static std::vector<dictEntry> dicts;
+
+// CPU time used by this thread, in nanoseconds
+static unsigned long long cpuNow() {
+  struct timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return (unsigned long long)ts.tv_sec * 1000000000ULL + (unsigned long long)ts.tv_nsec;
+}
+
+static std::string queueName(const MQCHAR *name) {
+  return std::string(name, nameLength(name, MQ_Q_NAME_LENGTH));
+}
+
+static const dictEntry *findDict(const std::string &queue) {
+  for (const dictEntry &d : dicts) {
+    if (d.queue == queue) {
+      return &d;
+    }
+  }
+  return NULL;
+}
+
+static const dictEntry *findDict(unsigned id) {
+  for (const dictEntry &d : dicts) {
+    if (d.id == id) {
+      return &d;
+    }
+  }
+  return NULL;
+}
+
+// Load each trained dictionary in the directory. Raw-content dictionaries have no id, so a
+// reader could not tell which one to use, and they are skipped.
+static void loadDicts(const char *dir) {
+  DIR *d = opendir(dir);
+  struct dirent *e;
+  size_t sl = strlen(DICT_SUFFIX);
+
+  if (!d) {
+    rpt("Cannot open dictionary directory %s", dir);
+    return;
+  }
+
+  while ((e = readdir(d)) != NULL) {
+    std::string file = e->d_name;
+    if (file.length() <= sl || file.compare(file.length() - sl, sl, DICT_SUFFIX) != 0) {
+      continue;
+    }
+
+    std::string path = std::string(dir) + "/" + file;
+    std::vector<char> buf;
+    FILE *fp = fopen(path.c_str(), "rb");
+    if (!fp) {
+      rpt("Cannot read dictionary %s", path.c_str());
+      continue;
+    }
+    char chunk[4096];
+    size_t n;
+    while ((n = fread(chunk, 1, sizeof(chunk), fp)) > 0 && buf.size() <= MAX_DICT_BYTES) {
+      buf.insert(buf.end(), chunk, chunk + n);
+    }
+    fclose(fp);
+
+    dictEntry de;
+    de.queue = file.substr(0, file.length() - sl);
+    de.id = buf.size() <= MAX_DICT_BYTES ? ZSTD_getDictID_fromDict(buf.data(), buf.size()) : 0;
+    if (de.id == 0 || de.queue.length() > MQ_Q_NAME_LENGTH) {
+      rpt("Ignoring dictionary %s", path.c_str());
+      continue;
+    }
+    if (findDict(de.id)) {
+      rpt("Ignoring dictionary %s: id %u already loaded", path.c_str(), de.id);
+      continue;
+    }
+    de.cdict = ZSTD_createCDict(buf.data(), buf.size(), level);
+    de.ddict = ZSTD_createDDict(buf.data(), buf.size());
+    if (!de.cdict || !de.ddict) {
+      rpt("Cannot load dictionary %s", path.c_str());
+      ZSTD_freeCDict(de.cdict);
+      ZSTD_freeDDict(de.ddict);
+      continue;
+    }
+    dicts.push_back(de);
+    rpt("Dictionary %u for %s", de.id, de.queue.c_str());
+  }
+  closedir(d);
+}
+
+static queueStats *statsFor(czConn *cc, const std::string &name) {
+  return &cc->stats[name];
+}
+
+// Should this message be compressed? A segment that the application built itself is left
+// alone, as the queue manager needs each segment's data to be the length its Offset implies.
+static bool eligible(PMQMD md, MQLONG len, const queueRule *r) {
+  long threshold = r->limit >= 0 ? r->limit : minBytes;
+  if (md->Version >= MQMD_VERSION_2 && (md->MsgFlags & (MQMF_SEGMENT | MQMF_LAST_SEGMENT))) {
+    return false;
+  }
+  return len > 0 && len >= threshold && (!memcmp(md->Format, MQFMT_STRING, MQ_FORMAT_LENGTH) || !memcmp(md->Format, MQFMT_NONE, MQ_FORMAT_LENGTH));
+}
+
+// Compress the application's message into the work buffer, and point the put at that
+// instead. Nothing is changed if the result would not be smaller.
+static void compress(czConn *cc, const std::string &name, const dictEntry *dict, PMQMD md, PMQLONG pBufferLength, PPMQVOID ppBuffer) {
+  MQLONG len = *pBufferLength;
+  const char *src = (const char *)*ppBuffer;
+  queueStats *qs = statsFor(cc, name);
+  size_t hl = sizeof(compressHeader);
+  size_t bound;
+  size_t out = 0;
+  unsigned long long start = cpuNow();
+
+  if (algorithm == ALGORITHM_ZSTD) {
+    bound = ZSTD_compressBound(len);
+  } else {
+    bound = LZ4_compressBound(len);
+  }
+  if (cc->work.size() < hl + bound) {
+    cc->work.resize(hl + bound);
+  }
+  char *dst = cc->work.data() + hl;
+
+  if (algorithm == ALGORITHM_ZSTD) {
+    if (!cc->cctx) {
+      cc->cctx = ZSTD_createCCtx();
+    }
+    if (cc->cctx) {
+      size_t rc = dict ? ZSTD_compress_usingCDict(cc->cctx, dst, bound, src, len, dict->cdict) : ZSTD_compressCCtx(cc->cctx, dst, bound, src, len, level);
+      if (ZSTD_isError(rc)) {
+        rpt("Compression failed for %s: %s", name.c_str(), ZSTD_getErrorName(rc));
+      } else {
+        out = rc;
+      }
+    }
+  } else {
+    int rc = LZ4_compress_default(src, dst, len, (int)bound);
+    if (rc > 0) {
+      out = rc;
+    }
+  }
+  qs->compressNs += cpuNow() - start;
+
+  if (out == 0 || hl + out >= (size_t)len) {
+    qs->skipped++;
+    return;
+  }
+
+  compressHeader *h = (compressHeader *)cc->work.data();
+  memcpy(h->StrucId, MQCOMPRESS_STRUC_ID, sizeof(h->StrucId));
+  h->Version = MQCOMPRESS_VERSION_1;
+  h->StrucLength = (MQLONG)hl;
+  h->Encoding = md->Encoding;
+  h->CodedCharSetId = md->CodedCharSetId;
+  memcpy(h->Format, md->Format, sizeof(h->Format));
+  h->Algorithm = algorithm;
+  h->OriginalLength = len;
+  h->DictId = (algorithm == ALGORITHM_ZSTD && dict) ? (MQLONG)dict->id : 0;
+
+  cc->swapped = true;
+  cc->appBuffer = *ppBuffer;
+  cc->appLength = len;
+  cc->appEncoding = md->Encoding;
+  memcpy(cc->appFormat, md->Format, sizeof(cc->appFormat));
+
+  // The character fields of the header are in the same CCSID as the original message
+  memcpy(md->Format, MQCOMPRESS_FORMAT, MQ_FORMAT_LENGTH);
+  md->Encoding = MQENC_NATIVE;
+  *ppBuffer = cc->work.data();
+  *pBufferLength = (MQLONG)(hl + out);
+
+  qs->compressed++;
+  qs->bytesIn += len;
+  qs->bytesOut += hl + out;
+}
+
+static void restorePut(czConn *cc, PMQMD md, PMQLONG pBufferLength, PPMQVOID ppBuffer) {
+  memcpy(md->Format, cc->appFormat, MQ_FORMAT_LENGTH);
+  md->Encoding = cc->appEncoding;
+  *ppBuffer = cc->appBuffer;
+  *pBufferLength = cc->appLength;
+  cc->swapped = false;
+}
+
+// Returns the header if this looks like a message we compressed, otherwise NULL
+static const compressHeader *header(PMQMD md, const void *buffer, MQLONG len) {
+  const compressHeader *h = (const compressHeader *)buffer;
+  if (memcmp(md->Format, MQCOMPRESS_FORMAT, MQ_FORMAT_LENGTH) || md->Encoding != MQENC_NATIVE || !buffer || len < (MQLONG)sizeof(compressHeader)) {
+    return NULL;
+  }
+  if (memcmp(h->StrucId, MQCOMPRESS_STRUC_ID, sizeof(h->StrucId)) || h->Version != MQCOMPRESS_VERSION_1 || h->StrucLength < (MQLONG)sizeof(compressHeader) ||
+      h->StrucLength > len || h->OriginalLength < 0 || h->OriginalLength > MAX_MSG_LENGTH) {
+    return NULL;
+  }
+  return h;
+}
+
+// Put the application's view of the message back into the MQMD
+static void restoreMd(PMQMD md, const compressHeader *h) {
+  memcpy(md->Format, h->Format, MQ_FORMAT_LENGTH);
+  md->Encoding = h->Encoding;
+  if (h->CodedCharSetId != MQCCSI_Q_MGR) {
+    md->CodedCharSetId = h->CodedCharSetId;
+  }
+}
+
+// Decompress into the work buffer. Returns false if that can't be done.
+static bool decompress(czConn *cc, const std::string &name, const compressHeader *h, const char *buffer, MQLONG len) {
+  const char *src = buffer + h->StrucLength;
+  size_t srcLen = len - h->StrucLength;
+  size_t orig = h->OriginalLength;
+  queueStats *qs = statsFor(cc, name);
+  unsigned long long start = cpuNow();
+  bool ok = false;
+
+  if (cc->work.size() < orig) {
+    cc->work.resize(orig);
+  }
+
+  if (h->Algorithm == ALGORITHM_ZSTD) {
+    const dictEntry *dict = NULL;
+    if (h->DictId != 0) {
+      dict = findDict((unsigned)h->DictId);
+      if (!dict) {
+        rpt("No dictionary %u for a message from %s", (unsigned)h->DictId, name.c_str());
+        return false;
+      }
+    }
+    if (!cc->dctx) {
+      cc->dctx = ZSTD_createDCtx();
+    }
+    if (cc->dctx) {
+      size_t rc = dict ? ZSTD_decompress_usingDDict(cc->dctx, cc->work.data(), orig, src, srcLen, dict->ddict)
+                       : ZSTD_decompressDCtx(cc->dctx, cc->work.data(), orig, src, srcLen);
+      ok = !ZSTD_isError(rc) && rc == orig;
+    }
+  } else if (h->Algorithm == ALGORITHM_LZ4) {
+    ok = LZ4_decompress_safe(src, cc->work.data(), (int)srcLen, (int)orig) == (int)orig;
+  }
+  qs->decompressNs += cpuNow() - start;
+
+  if (!ok) {
+    rpt("Cannot decompress a message from %s", name.c_str());
+    return false;
+  }
+  qs->decompressed++;
+  qs->compressedBytes += len;
+  qs->originalBytes += orig;
+  return true;
+}
+
+// Decompress as much of the start of a message as can be had from the truncated compressed
+// data, up to want bytes, into the work buffer. Returns the number of bytes produced.
+static size_t decompressPrefix(czConn *cc, const compressHeader *h, const char *buffer, MQLONG len, size_t want) {
+  const char *src = buffer + h->StrucLength;
+  size_t srcLen = len - h->StrucLength;
+  size_t out = 0;
+
+  if (want > (size_t)h->OriginalLength) {
+    want = h->OriginalLength;
+  }
+  if (cc->work.size() < want) {
+    cc->work.resize(want);
+  }
+
+  if (h->Algorithm == ALGORITHM_ZSTD) {
+    const dictEntry *dict = h->DictId != 0 ? findDict((unsigned)h->DictId) : NULL;
+    if (h->DictId != 0 && !dict) {
+      return 0;
+    }
+    if (!cc->dctx) {
+      cc->dctx = ZSTD_createDCtx();
+    }
+    if (!cc->dctx) {
+      return 0;
+    }
+    ZSTD_inBuffer in = {src, srcLen, 0};
+    ZSTD_outBuffer ob = {cc->work.data(), want, 0};
+    if (!dict || !ZSTD_isError(ZSTD_DCtx_refDDict(cc->dctx, dict->ddict))) {
+      while (ob.pos < ob.size) {
+        size_t before = ob.pos;
+        size_t rc = ZSTD_decompressStream(cc->dctx, &ob, &in);
+        if (ZSTD_isError(rc) || rc == 0 || (ob.pos == before && in.pos == in.size)) {
+          break;
+        }
+      }
+      out = ob.pos;
+    }
+    // The dictionary would otherwise stay attached for the next whole message
+    ZSTD_DCtx_reset(cc->dctx, ZSTD_reset_session_and_parameters);
+  } else if (h->Algorithm == ALGORITHM_LZ4) {
+    int rc = LZ4_decompress_safe_partial(src, cc->work.data(), (int)srcLen, (int)want, (int)want);
+    if (rc > 0) {
+      out = rc;
+    }
+  }
+  return out;
+}
+
+static size_t mdLength(PMQMD md) {
+  return md->Version >= MQMD_VERSION_2 ? sizeof(MQMD) : offsetof(MQMD, GroupId);
+}
+
+// Give a decompressed message to the application, following the MQGET rules for a buffer
+// that is too short. Unless the application accepts truncation, the message is held so
+// that the next MQGET on the handle can return it.
+static void deliver(czObject *o, PMQMD md, PMQGMO gmo, MQLONG bufLen, PMQVOID buffer, PMQLONG pDataLength, const char *data, MQLONG len, PMQLONG pCompCode,
+                    PMQLONG pReason) {
+  if (len <= bufLen) {
+    memcpy(buffer, data, len);
+  } else {
+    memcpy(buffer, data, bufLen);
+    if (gmo->Options & MQGMO_ACCEPT_TRUNCATED_MSG) {
+      *pCompCode = MQCC_WARNING;
+      *pReason = MQRC_TRUNCATED_MSG_ACCEPTED;
+    } else {
+      *pCompCode = MQCC_WARNING;
+      *pReason = MQRC_TRUNCATED_MSG_FAILED;
+      if (data != o->heldData.data()) {
+        // A version 1 MQMD leaves the later fields at their defaults
+        MQMD full = {MQMD_DEFAULT};
+        o->heldData.assign(data, data + len);
+        o->heldMd = full;
+        memcpy(&o->heldMd, md, mdLength(md));
+        o->heldMd.Version = MQMD_VERSION_2;
+      }
+      o->held = true;
+      o->heldBrowse = (gmo->Options & GET_BROWSE_OPTIONS) != 0;
+      o->heldSyncpoint = !o->heldBrowse && ((gmo->Options & MQGMO_SYNCPOINT) ||
+                                            ((gmo->Options & MQGMO_SYNCPOINT_IF_PERSISTENT) && md->Persistence == MQPER_PERSISTENT));
+    }
+  }
+  if (pDataLength) {
+    *pDataLength = len;
+  }
+}
+
+// Forget a held message. One from a destructive get is no longer on the queue, so it is counted.
+static void dropHeld(czConn *cc, czObject *o) {
+  if (o->held && !o->heldBrowse) {
+    cc->discarded++;
+  }
+  o->held = false;
+  o->heldData.clear();
+}
+
+static MQLONG matchOptions(PMQGMO gmo) {
+  return gmo->Version >= MQGMO_VERSION_2 ? gmo->MatchOptions : SIMPLE_MATCH_OPTIONS;
+}
+
+// Does the held message satisfy this MQGET? It must be the same kind of get that was
+// truncated, selecting at most on MsgId and CorrelId, and those must match.
+static bool matches(czObject *o, PMQMD md, PMQGMO gmo) {
+  bool browse = (gmo->Options & GET_BROWSE_OPTIONS) != 0;
+  MQLONG mo = matchOptions(gmo);
+
+  if (browse != o->heldBrowse || (gmo->Options & MQGMO_BROWSE_FIRST) || (mo & ~SIMPLE_MATCH_OPTIONS) != 0) {
+    return false;
+  }
+  if ((mo & MQMO_MATCH_MSG_ID) && memcmp(md->MsgId, noId, sizeof(noId)) && memcmp(md->MsgId, o->heldMd.MsgId, sizeof(md->MsgId))) {
+    return false;
+  }
+  if ((mo & MQMO_MATCH_CORREL_ID) && memcmp(md->CorrelId, noId, sizeof(noId)) && memcmp(md->CorrelId, o->heldMd.CorrelId, sizeof(md->CorrelId))) {
+    return false;
+  }
+  return true;
+}
+
+extern "C" {
+MQLONG MqmuxPlugin(mqmuxPlugin *p);
+}
+
+static MQLONG czInit(MQMUX_RPT *_rpt, char *buf, size_t len) {
+  const char *e;
+
+  rptFn = _rpt;
+  rptPrefix = "compress: ";
+
+  queues.parse(getenv(ENV_QUEUES), -1);
+  minBytes = envLong(ENV_MIN_BYTES, DEFAULT_MIN_BYTES, 0, MAX_MSG_LENGTH);
+  level = (int)envLong(ENV_LEVEL, DEFAULT_LEVEL, 1, 19);
+
+  e = getenv(ENV_ALGORITHM);
+  if (e && !strcmp(e, "zstd")) {
+    algorithm = ALGORITHM_ZSTD;
+  } else if (e && *e && strcmp(e, "lz4")) {
+    rpt("Ignoring %s=%s", ENV_ALGORITHM, e);
+  }
+
+  e = getenv(ENV_DICT_DIR);
+  if (e && *e) {
+    loadDicts(e);
+  }
+
+  for (const queueRule &r : queues.all()) {
+    rpt("Compressing messages for %s%s", r.name.c_str(), r.prefix ? "*" : "");
+  }
+  if (queues.empty()) {
+    snprintf(buf, len, "No queues configured in %s. Messages will only be decompressed", ENV_QUEUES);
+  } else {
+    snprintf(buf, len, "Using %s for messages of at least %ld bytes", algorithm == ALGORITHM_ZSTD ? "zstd" : "lz4", minBytes);
+  }
+  return MQRC_NONE;
+}
+
+static void czTerm() {
+  for (dictEntry &d : dicts) {
+    ZSTD_freeCDict(d.cdict);
+    ZSTD_freeDDict(d.ddict);
+  }
+  dicts.clear();
+}
+
+// Remember every queue handle, so that counters and held messages can be kept for it
+static void MQENTRY czOpenAfter(PMQAXP pExitParms, PMQAXC pExitContext, PMQHCONN pHconn, PPMQOD ppObjDesc, PMQLONG pOptions, PPMQHOBJ ppHobj,
+                                PMQLONG pCompCode, PMQLONG pReason) {
+  PMQOD od = *ppObjDesc;
+  if (*pCompCode != MQCC_FAILED && od->ObjectType == MQOT_Q) {
+    czConn *cc = getConn<czConn>(pExitParms);
+    czObject &o = cc->objects[**ppHobj];
+    o = czObject();
+    o.name = queueName(od->ObjectName);
+    if (*pOptions & MQOO_OUTPUT) {
+      o.rule = queues.find(od->ObjectName);
+      if (o.rule && algorithm == ALGORITHM_ZSTD) {
+        o.dict = findDict(o.name);
+      }
+    }
+  }
+}
+
+static void MQENTRY czCloseBefore(PMQAXP pExitParms, PMQAXC pExitContext, PMQHCONN pHconn, PPMQHOBJ ppHobj, PMQLONG pOptions, PMQLONG pCompCode,
+                                  PMQLONG pReason) {
+  czConn *cc = findConn<czConn>(pExitParms);
+  if (cc) {
+    auto it = cc->objects.find(**ppHobj);
+    if (it != cc->objects.end()) {
+      dropHeld(cc, &it->second);
+      cc->objects.erase(it);
+    }
+  }
+}
+
+static void MQENTRY czPutBefore(PMQAXP pExitParms, PMQAXC pExitContext, PMQHCONN pHconn, PMQHOBJ pHobj, PPMQMD ppMsgDesc, PPMQPMO ppPutMsgOpts,
+                                PMQLONG pBufferLength, PPMQVOID ppBuffer, PMQLONG pCompCode, PMQLONG pReason) {
+  czConn *cc = findConn<czConn>(pExitParms);
+  if (!cc) {
+    return;
+  }
+  auto it = cc->objects.find(*pHobj);
+  if (it != cc->objects.end() && it->second.rule && eligible(*ppMsgDesc, *pBufferLength, it->second.rule)) {
+    compress(cc, it->second.name, it->second.dict, *ppMsgDesc, pBufferLength, ppBuffer);
+  }
+}
+
+static void MQENTRY czPutAfter(PMQAXP pExitParms, PMQAXC pExitContext, PMQHCONN pHconn, PMQHOBJ pHobj, PPMQMD ppMsgDesc, PPMQPMO ppPutMsgOpts,
+                               PMQLONG pBufferLength, PPMQVOID ppBuffer, PMQLONG pCompCode, PMQLONG pReason) {
+  czConn *cc = findConn<czConn>(pExitParms);
+  if (cc && cc->swapped) {
+    restorePut(cc, *ppMsgDesc, pBufferLength, ppBuffer);
+  }
+}
+
+static void MQENTRY czPut1Before(PMQAXP pExitParms, PMQAXC pExitContext, PMQHCONN pHconn, PPMQOD ppObjDesc, PPMQMD ppMsgDesc, PPMQPMO ppPutMsgOpts,
+                                 PMQLONG pBufferLength, PPMQVOID ppBuffer, PMQLONG pCompCode, PMQLONG pReason) {
+  PMQOD od = *ppObjDesc;
+  const queueRule *r;
+  if (od->ObjectType == MQOT_Q && (r = queues.find(od->ObjectName)) != NULL && eligible(*ppMsgDesc, *pBufferLength, r)) {
+    czConn *cc = getConn<czConn>(pExitParms);
+    std::string name = queueName(od->ObjectName);
+    compress(cc, name, algorithm == ALGORITHM_ZSTD ? findDict(name) : NULL, *ppMsgDesc, pBufferLength, ppBuffer);
+  }
+}
+
+static void MQENTRY czPut1After(PMQAXP pExitParms, PMQAXC pExitContext, PMQHCONN pHconn, PPMQOD ppObjDesc, PPMQMD ppMsgDesc, PPMQPMO ppPutMsgOpts,
+                                PMQLONG pBufferLength, PPMQVOID ppBuffer, PMQLONG pCompCode, PMQLONG pReason) {
+  czConn *cc = findConn<czConn>(pExitParms);
+  if (cc && cc->swapped) {
+    restorePut(cc, *ppMsgDesc, pBufferLength, ppBuffer);
+  }
+}
+
+// A message held from an earlier truncated MQGET is returned without going to the queue
+// manager, if this MQGET would have selected it. A browse held message is still on the
+// queue, so one that does not match is dropped. A destructive get's message is kept until
+// it is asked for, the handle is closed, or its unit of work is backed out.
+static void MQENTRY czGetBefore(PMQAXP pExitParms, PMQAXC pExitContext, PMQHCONN pHconn, PMQHOBJ pHobj, PPMQMD ppMsgDesc, PPMQGMO ppGetMsgOpts,
+                                PMQLONG pBufferLength, PPMQVOID ppBuffer, PPMQLONG ppDataLength, PMQLONG pCompCode, PMQLONG pReason) {
+  czConn *cc = findConn<czConn>(pExitParms);
+  PMQGMO gmo = *ppGetMsgOpts;
+  PMQMD md = *ppMsgDesc;
+
+  if (!cc) {
+    return;
+  }
+  cc->requestedCcsid = md->CodedCharSetId;
+
+  auto it = cc->objects.find(*pHobj);
+  if (it == cc->objects.end() || !it->second.held) {
+    return;
+  }
+  czObject *o = &it->second;
+  if (!matches(o, md, gmo)) {
+    if (o->heldBrowse) {
+      dropHeld(cc, o);
+    }
+    return;
+  }
+
+  // Only as much of the held MQMD as this get asked for, keeping the caller's version
+  MQLONG version = md->Version;
+  memcpy(md, &o->heldMd, mdLength(md));
+  md->Version = version;
+  *pCompCode = MQCC_OK;
+  *pReason = MQRC_NONE;
+  o->held = false;
+  deliver(o, md, gmo, *pBufferLength, *ppBuffer, *ppDataLength, o->heldData.data(), (MQLONG)o->heldData.size(), pCompCode, pReason);
+  if (!o->held) {
+    o->heldData.clear();
+  }
+  cc->served = true;
+  pExitParms->ExitResponse = MQXCC_SUPPRESS_FUNCTION;
+}
+
+static void MQENTRY czGetAfter(PMQAXP pExitParms, PMQAXC pExitContext, PMQHCONN pHconn, PMQHOBJ pHobj, PPMQMD ppMsgDesc, PPMQGMO ppGetMsgOpts,
+                               PMQLONG pBufferLength, PPMQVOID ppBuffer, PPMQLONG ppDataLength, PMQLONG pCompCode, PMQLONG pReason) {
+  czConn *cc = findConn<czConn>(pExitParms);
+  PMQMD md = *ppMsgDesc;
+  PMQGMO gmo = *ppGetMsgOpts;
+  MQLONG bufLen = *pBufferLength;
+  MQLONG len;
+  const compressHeader *h;
+
+  if (cc && cc->served) {
+    cc->served = false;
+    return;
+  }
+  if (!*ppDataLength || memcmp(md->Format, MQCOMPRESS_FORMAT, MQ_FORMAT_LENGTH)) {
+    return;
+  }
+  if (!cc) {
+    cc = getConn<czConn>(pExitParms);
+  }
+  len = **ppDataLength < bufLen ? **ppDataLength : bufLen;
+  h = header(md, *ppBuffer, len);
+
+  // The compressed message did not fit. Report the length the application will need.
+  if (*pReason == MQRC_TRUNCATED_MSG_FAILED) {
+    if (h) {
+      **ppDataLength = h->OriginalLength;
+      restoreMd(md, h);
+    }
+    return;
+  }
+
+  // The message is gone from the queue, and only the start of the compressed data was
+  // returned. Give the application as much of the original as that holds.
+  if (*pReason == MQRC_TRUNCATED_MSG_ACCEPTED) {
+    if (h) {
+      compressHeader saved = *h;
+      size_t n = decompressPrefix(cc, &saved, (const char *)*ppBuffer, len, bufLen);
+      memcpy(*ppBuffer, cc->work.data(), n);
+      memset((char *)*ppBuffer + n, 0, bufLen - n);
+      **ppDataLength = saved.OriginalLength;
+      restoreMd(md, &saved);
+      if (n < (size_t)bufLen) {
+        rpt("Only %lu bytes of a truncated message from %s could be decompressed", (unsigned long)n, cc->objects[*pHobj].name.c_str());
+      }
+    }
+    return;
+  }
+
+  // MQRC_FORMAT_ERROR comes from a request to convert a format the queue manager does not know
+  if (*pCompCode == MQCC_FAILED || (*pCompCode == MQCC_WARNING && *pReason != MQRC_FORMAT_ERROR)) {
+    return;
+  }
+
+  czObject *o = &cc->objects[*pHobj];
+  if (!h || !decompress(cc, o->name, h, (const char *)*ppBuffer, len)) {
+    *pCompCode = MQCC_WARNING;
+    *pReason = MQRC_FORMAT_ERROR;
+    return;
+  }
+
+  *pCompCode = MQCC_OK;
+  *pReason = MQRC_NONE;
+  compressHeader saved = *h; // The buffer is about to be overwritten
+  restoreMd(md, &saved);
+
+  // The exit cannot convert the data itself
+  if ((gmo->Options & MQGMO_CONVERT) && !memcmp(saved.Format, MQFMT_STRING, MQ_FORMAT_LENGTH) && cc->requestedCcsid != MQCCSI_Q_MGR &&
+      cc->requestedCcsid != md->CodedCharSetId) {
+    *pCompCode = MQCC_WARNING;
+    *pReason = MQRC_NOT_CONVERTED;
+  }
+
+  deliver(o, md, gmo, bufLen, *ppBuffer, *ppDataLength, cc->work.data(), saved.OriginalLength, pCompCode, pReason);
+}
+
+// Messages for an MQCB consumer are read by the queue manager into its own buffer, so the
+// callback can be given a different one holding the decompressed message.
+static void MQENTRY czCallbackBefore(PMQAXP pExitParms, PMQAXC pExitContext, PMQHCONN pHconn, PPMQMD ppMsgDesc, PPMQGMO ppGetMsgOpts, PPMQVOID ppBuffer,
+                                     PPMQCBC ppMQCBContext) {
+  PMQCBC cbc = *ppMQCBContext;
+  PMQMD md = *ppMsgDesc;
+  MQLONG len;
+  const compressHeader *h;
+
+  if (!md || memcmp(md->Format, MQCOMPRESS_FORMAT, MQ_FORMAT_LENGTH)) {
+    return;
+  }
+  len = cbc->DataLength < cbc->BufferLength ? cbc->DataLength : cbc->BufferLength;
+  h = header(md, *ppBuffer, len);
+  if (!h) {
+    return;
+  }
+
+  if (cbc->Reason == MQRC_TRUNCATED_MSG_FAILED) {
+    cbc->DataLength = h->OriginalLength;
+    restoreMd(md, h);
+    return;
+  }
+  if (cbc->CallType != MQCBCT_MSG_REMOVED && cbc->CallType != MQCBCT_MSG_NOT_REMOVED) {
+    return;
+  }
+  if (cbc->CompCode == MQCC_FAILED || (cbc->CompCode == MQCC_WARNING && cbc->Reason != MQRC_FORMAT_ERROR)) {
+    return;
+  }
+
+  czConn *cc = getConn<czConn>(pExitParms);
+  auto it = cc->objects.find(cbc->Hobj);
+  std::string name = it != cc->objects.end() ? it->second.name : "";
+  if (!decompress(cc, name, h, (const char *)*ppBuffer, len)) {
+    cbc->CompCode = MQCC_WARNING;
+    cbc->Reason = MQRC_FORMAT_ERROR;
+    return;
+  }
+
+  restoreMd(md, h);
+  cc->cbBuffer.swap(cc->work);
+  cbc->CompCode = MQCC_OK;
+  cbc->Reason = MQRC_NONE;
+  cbc->DataLength = h->OriginalLength;
+  cbc->BufferLength = h->OriginalLength;
+  *ppBuffer = cc->cbBuffer.data();
+}
+
+// A backout puts messages got under syncpoint back on the queue, so held copies of them must
+// not be returned as well. After a commit they are gone from the queue for good.
+static void MQENTRY czBackBefore(PMQAXP pExitParms, PMQAXC pExitContext, PMQHCONN pHconn, PMQLONG pCompCode, PMQLONG pReason) {
+  czConn *cc = findConn<czConn>(pExitParms);
+  if (cc) {
+    for (auto &o : cc->objects) {
+      if (o.second.held && o.second.heldSyncpoint) {
+        o.second.held = false;
+        o.second.heldData.clear();
+      }
+    }
+  }
+}
+
+static void MQENTRY czCmitAfter(PMQAXP pExitParms, PMQAXC pExitContext, PMQHCONN pHconn, PMQLONG pCompCode, PMQLONG pReason) {
+  czConn *cc = findConn<czConn>(pExitParms);
+  if (cc && *pCompCode != MQCC_FAILED) {
+    for (auto &o : cc->objects) {
+      o.second.heldSyncpoint = false;
+    }
+  }
+}
+
+// Report, drop any held messages and release the connection's state
+static void czEnd(PMQAXP pExitParms) {
+  czConn *cc = findConn<czConn>(pExitParms);
+  if (cc) {
+    for (auto &s : cc->stats) {
+      const queueStats &q = s.second;
+      if (q.compressed > 0 || q.skipped > 0) {
+        rpt("%s: compressed %lu messages (%llu to %llu bytes, ratio %.2f, %llu us CPU). Not smaller: %lu", s.first.c_str(), q.compressed, q.bytesIn,
+            q.bytesOut, q.bytesOut > 0 ? (double)q.bytesIn / q.bytesOut : 0.0, q.compressNs / 1000, q.skipped);
+      }
+      if (q.decompressed > 0) {
+        rpt("%s: decompressed %lu messages (%llu to %llu bytes, ratio %.2f, %llu us CPU)", s.first.c_str(), q.decompressed, q.compressedBytes,
+            q.originalBytes, q.compressedBytes > 0 ? (double)q.originalBytes / q.compressedBytes : 0.0, q.decompressNs / 1000);
+      }
+    }
+    for (auto &o : cc->objects) {
+      dropHeld(cc, &o.second);
+    }
+    if (cc->discarded > 0) {
+      rpt("Held messages discarded before the application got them: %lu", cc->discarded);
+    }
+    freeConn<czConn>(pExitParms);
+  }
+}
+
+static void MQENTRY czDiscBefore(PMQAXP pExitParms, PMQAXC pExitContext, PPMQHCONN ppHconn, PMQLONG pCompCode, PMQLONG pReason) {
+  czEnd(pExitParms);
+}
+
+// The connection ended without an MQDISC
+static void MQENTRY czTerminate(PMQAXP pExitParms, PMQAXC pExitContext, PMQLONG pCompCode, PMQLONG pReason) {
+  czEnd(pExitParms);
+}
+
+MQLONG MqmuxPlugin(mqmuxPlugin *p) {
+  if (p->Version < MQMUX_PLUGIN_VERSION_1) {
+    return MQRC_WRONG_VERSION;
+  }
+
+  p->Name = "compress";
+  p->init = czInit;
+  p->term = czTerm;
+
+  p->openAfter = czOpenAfter;
+  p->closeBefore = czCloseBefore;
+  p->putBefore = czPutBefore;
+  p->putAfter = czPutAfter;
+  p->put1Before = czPut1Before;
+  p->put1After = czPut1After;
+  p->getBefore = czGetBefore;
+  p->getAfter = czGetAfter;
+  p->callbackBefore = czCallbackBefore;
+  p->cmitAfter = czCmitAfter;
+  p->backBefore = czBackBefore;
+  p->discBefore = czDiscBefore;
+  if (p->Version >= MQMUX_PLUGIN_VERSION_2) {
+    p->terminate = czTerminate;
+  }
+
+  return MQRC_NONE;
+}
@@ -0,0 +1,449 @@
+/*
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+  Copyright (c) IBM Corporation 2024
+*/
+
+// A plugin for the mqmux exit that groups persistent puts made outside syncpoint into
+// batches. Each of those puts would otherwise force its own write to the queue manager's log.
+//
+// For the configured queues, an eligible MQPUT is made under syncpoint. The exit issues an
+// MQCMIT when the batch reaches MQGCOMMIT_BATCH messages, or when an MQI call is made more than
+// MQGCOMMIT_USECS after the first message in the batch, whichever comes first. A batch is also
+// committed before anything that the application itself does under syncpoint, before an MQGET
+// that might wait, and before MQBACK and MQDISC. The application's own units of work then
+// never include any of the exit's messages. Closing a queue with messages in the batch, or
+// putting a message that is not batched to it, also commits the batch, so that messages
+// reach the queue in the order they were put.
+//
+// If the exit's MQCMIT fails, the MQPUT that caused it gets the failure, and the number of
+// messages lost is logged. All the state and counters are in a per-hConn record.
+
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+
+#include <cmqc.h>
+#include <cmqec.h>
+#include <cmqxc.h>
+
+#include "../mux/mqmux_plugin.hpp"
+
+using namespace mqmux;
+
+#define ENV_QUEUES "MQGCOMMIT_QUEUES"
+#define ENV_BATCH "MQGCOMMIT_BATCH"
+#define ENV_USECS "MQGCOMMIT_USECS"
+
+#define DEFAULT_BATCH 50
+#define DEFAULT_USECS 10000
+
+#define GET_SYNCPOINT_OPTIONS (MQGMO_SYNCPOINT | MQGMO_SYNCPOINT_IF_PERSISTENT)
+
+static queueList queues;
+static long batchSize = DEFAULT_BATCH;
+static unsigned long long batchTime = DEFAULT_USECS;
+
+struct gcConn {
+  std::unordered_map<MQHOBJ, std::string> eligible; // Handles opened for output to a configured queue
+  std::unordered_set<std::string> batched;          // Queues with messages in the current batch
+
+  bool changed = false;  // PutBefore switched this put to syncpoint
+  MQLONG savedOptions;   // The application's PMO options
+  bool appUow = false;   // The application has its own unit of work in progress
+  bool disabled = false; // Async consumers are in use on this hConn
+
+  long pending = 0; // Messages in the exit's current batch
+  MQHCONN hConn = MQHC_UNUSABLE_HCONN; // The batch's connection, for a flush from Terminate
+  unsigned long long batchStart = 0;
+
+  unsigned long batchedPuts = 0;
+  unsigned long commits = 0;
+  unsigned long fullCommits = 0;
+  unsigned long timedCommits = 0;
+  unsigned long forcedCommits = 0;
+  unsigned long failedCommits = 0;
+  unsigned long lostMessages = 0;
+  unsigned long limitRetries = 0;
+};
+
+// Commit the exit's batch. Returns the MQCMIT completion code, with the reason in *pRC.
+static MQLONG commitBatch(PMQAXP pExitParms, MQHCONN hConn, gcConn *gc, PMQLONG pRC) {
+  MQLONG CC = MQCC_OK;
+  MQLONG RC = MQRC_NONE;
+
+  if (gc->pending > 0) {
+    pExitParms->Hconfig->MQCMIT_Call(hConn, &CC, &RC);
+    gc->commits++;
+    if (CC != MQCC_OK) {
+      gc->failedCommits++;
+      gc->lostMessages += gc->pending;
+      rpt("MQCMIT of %ld messages failed: CC=%d RC=%d", gc->pending, CC, RC);
+    }
+    gc->pending = 0;
+    gc->batched.clear();
+  }
+  if (pRC) {
+    *pRC = RC;
+  }
+  return CC;
+}
+
+// Commit the batch before something that must not be mixed up with it
+static void flush(PMQAXP pExitParms, MQHCONN hConn, gcConn *gc) {
+  if (gc->pending > 0) {
+    gc->forcedCommits++;
+    commitBatch(pExitParms, hConn, gc, NULL);
+  }
+}
+
+static bool timeUp(gcConn *gc) {
+  return gc->pending > 0 && batchTime > 0 && now() - gc->batchStart >= batchTime;
+}
+
+// Other calls end a batch that has been open for too long
+static void checkTime(PMQAXP pExitParms, MQHCONN hConn, gcConn *gc) {
+  if (timeUp(gc)) {
+    gc->timedCommits++;
+    commitBatch(pExitParms, hConn, gc, NULL);
+  }
+}
+
+static std::string queueName(const MQCHAR *name) {
+  return std::string(name, nameLength(name, MQ_Q_NAME_LENGTH));
+}
+
+// Does the current batch hold messages for the queue opened with this handle?
+static bool inBatch(gcConn *gc, MQHOBJ hObj) {
+  auto it = gc->eligible.find(hObj);
+  return it != gc->eligible.end() && gc->batched.count(it->second);
+}
+
+extern "C" {
+MQLONG MqmuxPlugin(mqmuxPlugin *p);
+}
+
+static MQLONG gcInit(MQMUX_RPT *_rpt, char *buf, size_t len) {
+  rptFn = _rpt;
+  rptPrefix = "gcommit: ";
+
+  queues.parse(getenv(ENV_QUEUES), 0);
+  batchSize = envLong(ENV_BATCH, DEFAULT_BATCH, 1, 100000);
+  batchTime = (unsigned long long)envLong(ENV_USECS, DEFAULT_USECS, 0, 60000000);
+
+  for (const queueRule &r : queues.all()) {
+    rpt("Grouping commits for %s%s", r.name.c_str(), r.prefix ? "*" : "");
+  }
+  if (queues.empty()) {
+    snprintf(buf, len, "No queues configured in %s", ENV_QUEUES);
+    return MQRC_ENVIRONMENT_ERROR;
+  }
+  snprintf(buf, len, "Committing every %ld messages or %llu microseconds", batchSize, batchTime);
+  return MQRC_NONE;
+}
+
+static void MQENTRY gcOpenAfter(PMQAXP pExitParms, PMQAXC pExitContext, PMQHCONN pHconn, PPMQOD ppObjDesc, PMQLONG pOptions, PPMQHOBJ ppHobj,
+                                PMQLONG pCompCode, PMQLONG pReason) {
+  PMQOD od = *ppObjDesc;
+  if (*pCompCode != MQCC_FAILED && od->ObjectType == MQOT_Q && (*pOptions & MQOO_OUTPUT) != 0 && queues.find(od->ObjectName)) {
+    getConn<gcConn>(pExitParms)->eligible[**ppHobj] = queueName(od->ObjectName);
+  }
+}
+
+// Calls that don't affect the batch still end it if it has been open for too long
+static void MQENTRY gcOpenBefore(PMQAXP pExitParms, PMQAXC pExitContext, PMQHCONN pHconn, PPMQOD ppObjDesc, PMQLONG pOptions, PPMQHOBJ ppHobj,
+                                 PMQLONG pCompCode, PMQLONG pReason) {
+  gcConn *gc = findConn<gcConn>(pExitParms);
+  if (gc) {
+    checkTime(pExitParms, *pHconn, gc);
+  }
+}
+
+// The messages must be committed while the queue is still open. Otherwise, for example,
+// deleting a dynamic queue would fail because it is not empty.
+static void MQENTRY gcCloseBefore(PMQAXP pExitParms, PMQAXC pExitContext, PMQHCONN pHconn, PPMQHOBJ ppHobj, PMQLONG pOptions, PMQLONG pCompCode,
+                                  PMQLONG pReason) {
+  gcConn *gc = findConn<gcConn>(pExitParms);
+  if (gc) {
+    if (inBatch(gc, **ppHobj)) {
+      flush(pExitParms, *pHconn, gc);
+    } else {
+      checkTime(pExitParms, *pHconn, gc);
+    }
+    gc->eligible.erase(**ppHobj);
+  }
+}
+
+static void MQENTRY gcPutBefore(PMQAXP pExitParms, PMQAXC pExitContext, PMQHCONN pHconn, PMQHOBJ pHobj, PPMQMD ppMsgDesc, PPMQPMO ppPutMsgOpts,
+                                PMQLONG pBufferLength, PPMQVOID ppBuffer, PMQLONG pCompCode, PMQLONG pReason) {
+  gcConn *gc = findConn<gcConn>(pExitParms);
+  PMQPMO pmo = *ppPutMsgOpts;
+
+  if (!gc) {
+    return;
+  }
+  gc->changed = false;
+
+  if (pmo->Options & MQPMO_SYNCPOINT) {
+    // The application's own unit of work. Keep the batch out of it.
+    flush(pExitParms, *pHconn, gc);
+    return;
+  }
+  if (gc->appUow || gc->disabled || (*ppMsgDesc)->Persistence != MQPER_PERSISTENT || !gc->eligible.count(*pHobj)) {
+    // A message put straight to the queue must not overtake the ones in the batch
+    if (inBatch(gc, *pHobj)) {
+      flush(pExitParms, *pHconn, gc);
+    } else {
+      checkTime(pExitParms, *pHconn, gc);
+    }
+    return;
+  }
+
+  gc->changed = true;
+  gc->savedOptions = pmo->Options;
+  pmo->Options = (pmo->Options & ~MQPMO_NO_SYNCPOINT) | MQPMO_SYNCPOINT;
+}
+
+static void MQENTRY gcPutAfter(PMQAXP pExitParms, PMQAXC pExitContext, PMQHCONN pHconn, PMQHOBJ pHobj, PPMQMD ppMsgDesc, PPMQPMO ppPutMsgOpts,
+                               PMQLONG pBufferLength, PPMQVOID ppBuffer, PMQLONG pCompCode, PMQLONG pReason) {
+  gcConn *gc = findConn<gcConn>(pExitParms);
+  PMQPMO pmo = *ppPutMsgOpts;
+
+  if (!gc) {
+    return;
+  }
+  if (!gc->changed) {
+    if ((pmo->Options & MQPMO_SYNCPOINT) && *pCompCode != MQCC_FAILED) {
+      gc->appUow = true;
+    }
+    return;
+  }
+  gc->changed = false;
+  pmo->Options = gc->savedOptions;
+
+  if (*pCompCode == MQCC_FAILED && *pReason == MQRC_SYNCPOINT_LIMIT_REACHED) {
+    // MAXUMSGS is smaller than the batch. Commit what there is and put this one as the
+    // application asked.
+    gc->limitRetries++;
+    if (gc->pending > 0) {
+      gc->fullCommits++;
+    }
+    if (commitBatch(pExitParms, *pHconn, gc, pReason) == MQCC_OK) {
+      pExitParms->Hconfig->MQPUT_Call(*pHconn, *pHobj, *ppMsgDesc, pmo, *pBufferLength, *ppBuffer, pCompCode, pReason);
+    } else {
+      *pCompCode = MQCC_FAILED;
+    }
+    return;
+  }
+  if (*pCompCode == MQCC_FAILED) {
+    return;
+  }
+
+  if (gc->pending++ == 0) {
+    gc->batchStart = now();
+    gc->hConn = *pHconn;
+  }
+  gc->batchedPuts++;
+  gc->batched.insert(gc->eligible[*pHobj]);
+
+  bool full = (gc->pending >= batchSize);
+  if (full || timeUp(gc)) {
+    MQLONG RC;
+    if (full) {
+      gc->fullCommits++;
+    } else {
+      gc->timedCommits++;
+    }
+    // This message was part of the batch, so the application needs to know if it was lost
+    if (commitBatch(pExitParms, *pHconn, gc, &RC) != MQCC_OK) {
+      *pCompCode = MQCC_FAILED;
+      *pReason = RC;
+    }
+  }
+}
+
+static void MQENTRY gcPut1Before(PMQAXP pExitParms, PMQAXC pExitContext, PMQHCONN pHconn, PPMQOD ppObjDesc, PPMQMD ppMsgDesc, PPMQPMO ppPutMsgOpts,
+                                 PMQLONG pBufferLength, PPMQVOID ppBuffer, PMQLONG pCompCode, PMQLONG pReason) {
+  gcConn *gc = findConn<gcConn>(pExitParms);
+  if (gc) {
+    PMQOD od = *ppObjDesc;
+    if (((*ppPutMsgOpts)->Options & MQPMO_SYNCPOINT) || (od->ObjectType == MQOT_Q && gc->batched.count(queueName(od->ObjectName)))) {
+      flush(pExitParms, *pHconn, gc);
+    } else {
+      checkTime(pExitParms, *pHconn, gc);
+    }
+  }
+}
+
+static void MQENTRY gcPut1After(PMQAXP pExitParms, PMQAXC pExitContext, PMQHCONN pHconn, PPMQOD ppObjDesc, PPMQMD ppMsgDesc, PPMQPMO ppPutMsgOpts,
+                                PMQLONG pBufferLength, PPMQVOID ppBuffer, PMQLONG pCompCode, PMQLONG pReason) {
+  gcConn *gc = findConn<gcConn>(pExitParms);
+  if (gc && ((*ppPutMsgOpts)->Options & MQPMO_SYNCPOINT) && *pCompCode != MQCC_FAILED) {
+    gc->appUow = true;
+  }
+}
+
+// A waiting MQGET might block for a long time, so don't hold the batch across it
+static void MQENTRY gcGetBefore(PMQAXP pExitParms, PMQAXC pExitContext, PMQHCONN pHconn, PMQHOBJ pHobj, PPMQMD ppMsgDesc, PPMQGMO ppGetMsgOpts,
+                                PMQLONG pBufferLength, PPMQVOID ppBuffer, PPMQLONG ppDataLength, PMQLONG pCompCode, PMQLONG pReason) {
+  gcConn *gc = findConn<gcConn>(pExitParms);
+  if (gc) {
+    if ((*ppGetMsgOpts)->Options & (GET_SYNCPOINT_OPTIONS | MQGMO_WAIT)) {
+      flush(pExitParms, *pHconn, gc);
+    } else {
+      checkTime(pExitParms, *pHconn, gc);
+    }
+  }
+}
+
+static void MQENTRY gcGetAfter(PMQAXP pExitParms, PMQAXC pExitContext, PMQHCONN pHconn, PMQHOBJ pHobj, PPMQMD ppMsgDesc, PPMQGMO ppGetMsgOpts,
+                               PMQLONG pBufferLength, PPMQVOID ppBuffer, PPMQLONG ppDataLength, PMQLONG pCompCode, PMQLONG pReason) {
+  gcConn *gc = findConn<gcConn>(pExitParms);
+  MQLONG options = (*ppGetMsgOpts)->Options;
+
+  if (gc && *pCompCode != MQCC_FAILED) {
+    if ((options & MQGMO_SYNCPOINT) || ((options & MQGMO_SYNCPOINT_IF_PERSISTENT) && (*ppMsgDesc)->Persistence == MQPER_PERSISTENT)) {
+      gc->appUow = true;
+    }
+  }
+}
+
+// Callbacks run on their own thread, between the application's calls. Rather than try to
+// keep track of what they do, stop batching on a connection that uses them.
+static void MQENTRY gcCBBefore(PMQAXP pExitParms, PMQAXC pExitContext, PMQHCONN pHconn, PMQLONG pOperation, PPMQCBD ppCallbackDesc, PMQHOBJ pHobj,
+                               PPMQMD ppMsgDesc, PPMQGMO ppGetMsgOpts, PMQLONG pCompCode, PMQLONG pReason) {
+  gcConn *gc = findConn<gcConn>(pExitParms);
+  if (gc && (*pOperation & MQOP_REGISTER)) {
+    flush(pExitParms, *pHconn, gc);
+    if (!gc->disabled) {
+      rpt("Asynchronous consumer registered. No more batching on this connection");
+      gc->disabled = true;
+    }
+  }
+}
+
+static void MQENTRY gcInqBefore(PMQAXP pExitParms, PMQAXC pExitContext, PMQHCONN pHconn, PMQHOBJ pHobj, PMQLONG pSelectorCount, PPMQLONG ppSelectors,
+                                PMQLONG pIntAttrCount, PPMQLONG ppIntAttrs, PMQLONG pCharAttrLength, PPMQCHAR ppCharAttrs, PMQLONG pCompCode,
+                                PMQLONG pReason) {
+  gcConn *gc = findConn<gcConn>(pExitParms);
+  if (gc) {
+    checkTime(pExitParms, *pHconn, gc);
+  }
+}
+
+static void MQENTRY gcSetBefore(PMQAXP pExitParms, PMQAXC pExitContext, PMQHCONN pHconn, PMQHOBJ pHobj, PMQLONG pSelectorCount, PPMQLONG ppSelectors,
+                                PMQLONG pIntAttrCount, PPMQLONG ppIntAttrs, PMQLONG pCharAttrLength, PPMQCHAR ppCharAttrs, PMQLONG pCompCode,
+                                PMQLONG pReason) {
+  gcConn *gc = findConn<gcConn>(pExitParms);
+  if (gc) {
+    checkTime(pExitParms, *pHconn, gc);
+  }
+}
+
+static void MQENTRY gcStatBefore(PMQAXP pExitParms, PMQAXC pExitContext, PMQHCONN pHconn, PMQLONG pType, PPMQSTS ppStatus, PMQLONG pCompCode,
+                                 PMQLONG pReason) {
+  gcConn *gc = findConn<gcConn>(pExitParms);
+  if (gc) {
+    checkTime(pExitParms, *pHconn, gc);
+  }
+}
+
+// The application's MQCMIT includes the batch
+static void MQENTRY gcCmitAfter(PMQAXP pExitParms, PMQAXC pExitContext, PMQHCONN pHconn, PMQLONG pCompCode, PMQLONG pReason) {
+  gcConn *gc = findConn<gcConn>(pExitParms);
+  if (gc) {
+    if (gc->pending > 0) {
+      gc->commits++;
+      gc->forcedCommits++;
+      if (*pCompCode != MQCC_OK) {
+        gc->failedCommits++;
+        gc->lostMessages += gc->pending;
+        rpt("Application MQCMIT of %ld batched messages failed: CC=%d RC=%d", gc->pending, *pCompCode, *pReason);
+      }
+      gc->pending = 0;
+      gc->batched.clear();
+    }
+    gc->appUow = false;
+  }
+}
+
+// Make sure the application's MQBACK doesn't take the batch with it
+static void MQENTRY gcBackBefore(PMQAXP pExitParms, PMQAXC pExitContext, PMQHCONN pHconn, PMQLONG pCompCode, PMQLONG pReason) {
+  gcConn *gc = findConn<gcConn>(pExitParms);
+  if (gc) {
+    flush(pExitParms, *pHconn, gc);
+  }
+}
+
+static void MQENTRY gcBackAfter(PMQAXP pExitParms, PMQAXC pExitContext, PMQHCONN pHconn, PMQLONG pCompCode, PMQLONG pReason) {
+  gcConn *gc = findConn<gcConn>(pExitParms);
+  if (gc) {
+    gc->appUow = false;
+  }
+}
+
+// A normal MQDISC would commit anyway, but doing it here means that any error is reported
+// Commit what is left of the batch, report and release the connection's state
+static void gcEnd(PMQAXP pExitParms, MQHCONN hConn) {
+  gcConn *gc = findConn<gcConn>(pExitParms);
+  if (gc) {
+    flush(pExitParms, hConn, gc);
+    rpt("Batched puts: %lu. Commits: %lu (full: %lu timed: %lu forced: %lu failed: %lu). Lost messages: %lu. MAXUMSGS retries: %lu", gc->batchedPuts,
+        gc->commits, gc->fullCommits, gc->timedCommits, gc->forcedCommits, gc->failedCommits, gc->lostMessages, gc->limitRetries);
+    freeConn<gcConn>(pExitParms);
+  }
+}
+
+static void MQENTRY gcDiscBefore(PMQAXP pExitParms, PMQAXC pExitContext, PPMQHCONN ppHconn, PMQLONG pCompCode, PMQLONG pReason) {
+  gcEnd(pExitParms, **ppHconn);
+}
+
+// The connection ended without an MQDISC. If the MQCMIT fails, the batch is counted as lost.
+static void MQENTRY gcTerminate(PMQAXP pExitParms, PMQAXC pExitContext, PMQLONG pCompCode, PMQLONG pReason) {
+  gcConn *gc = findConn<gcConn>(pExitParms);
+  if (gc) {
+    gcEnd(pExitParms, gc->hConn);
+  }
+}
+
+MQLONG MqmuxPlugin(mqmuxPlugin *p) {
+  if (p->Version < MQMUX_PLUGIN_VERSION_1) {
+    return MQRC_WRONG_VERSION;
+  }
+
+  p->Name = "gcommit";
+  p->init = gcInit;
+
+  p->openBefore = gcOpenBefore;
+  p->openAfter = gcOpenAfter;
+  p->closeBefore = gcCloseBefore;
+  p->putBefore = gcPutBefore;
+  p->putAfter = gcPutAfter;
+  p->put1Before = gcPut1Before;
+  p->put1After = gcPut1After;
+  p->getBefore = gcGetBefore;
+  p->getAfter = gcGetAfter;
+  p->cbBefore = gcCBBefore;
+  p->inqBefore = gcInqBefore;
+  p->setBefore = gcSetBefore;
+  p->cmitAfter = gcCmitAfter;
+  p->backBefore = gcBackBefore;
+  p->backAfter = gcBackAfter;
+  p->statBefore = gcStatBefore;
+  p->discBefore = gcDiscBefore;
+  if (p->Version >= MQMUX_PLUGIN_VERSION_2) {
+    p->terminate = gcTerminate;
+  }
+
+  return MQRC_NONE;
+}
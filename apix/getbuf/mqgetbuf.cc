@@ -0,0 +1,461 @@
+/*
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+  Copyright (c) IBM Corporation 2024
+*/
+
+// A plugin for the mqmux exit that avoids the second MQGET an application makes after
+// MQRC_TRUNCATED_MSG_FAILED. It learns the sizes of messages read from each queue named in
+// MQGETBUF_QUEUES. When the application's buffer looks too short, the real MQGET is given a
+// larger buffer from a pool instead, and the message is copied back into the application's
+// buffer.
+//
+// If the message still does not fit the application's buffer, the application sees the
+// same result as it would have from MQ: the start of the message, the full DataLength, and
+// MQRC_TRUNCATED_MSG_FAILED or MQRC_TRUNCATED_MSG_ACCEPTED. After a browse that failed this
+// way, the copy is held by the exit and the retry is answered without going to the queue
+// manager.
+//
+// Only browses and gets with MQGMO_ACCEPT_TRUNCATED_MSG are given a larger buffer. A
+// destructive get that fails with MQRC_TRUNCATED_MSG_FAILED leaves the message on the queue,
+// and the exit must not take it off before the application really receives it.
+
+#include <atomic>
+#include <mutex>
+#include <unordered_map>
+
+#include <cmqc.h>
+#include <cmqec.h>
+#include <cmqxc.h>
+
+#include "../mux/mqmux_plugin.hpp"
+
+using namespace mqmux;
+
+#define ENV_QUEUES "MQGETBUF_QUEUES"
+#define ENV_MAX_BYTES "MQGETBUF_MAX_BYTES"
+#define ENV_PERCENTILE "MQGETBUF_PERCENTILE"
+#define ENV_MIN_SAMPLES "MQGETBUF_MIN_SAMPLES"
+
+#define DEFAULT_MAX_BYTES (1024 * 1024)
+#define DEFAULT_PERCENTILE 99
+#define DEFAULT_MIN_SAMPLES 10
+
+#define MAX_MSG_LENGTH (100 * 1024 * 1024)
+
+// Sizes are counted in power-of-two buckets. Bucket b holds sizes up to 2^b.
+#define BUCKETS 28
+
+// Counts are halved every so often, so that the profile follows changes in the messages
+#define DECAY_SAMPLES 10000
+
+// Buffers kept for reuse by each connection
+#define POOL_SIZE 4
+
+#define GET_BROWSE_OPTIONS (MQGMO_BROWSE_FIRST | MQGMO_BROWSE_NEXT | MQGMO_BROWSE_MSG_UNDER_CURSOR)
+#define SIMPLE_MATCH_OPTIONS (MQMO_MATCH_MSG_ID | MQMO_MATCH_CORREL_ID)
+
+static const MQBYTE24 noId = {0};
+
+// The learned sizes for one queue, shared by all connections in the process
+struct sizeProfile {
+  std::atomic<unsigned long> buckets[BUCKETS] = {};
+  std::atomic<unsigned long> samples{0};
+
+  static int bucket(MQLONG len) {
+    int b = 0;
+    while (b < BUCKETS - 1 && (1L << b) < len) {
+      b++;
+    }
+    return b;
+  }
+
+  void record(MQLONG len) {
+    buckets[bucket(len)].fetch_add(1, std::memory_order_relaxed);
+    if (samples.fetch_add(1, std::memory_order_relaxed) % DECAY_SAMPLES == DECAY_SAMPLES - 1) {
+      for (auto &b : buckets) {
+        b.store(b.load(std::memory_order_relaxed) / 2, std::memory_order_relaxed);
+      }
+    }
+  }
+
+  // A buffer size that holds the configured share of messages, or 0 if it is not known yet
+  MQLONG predict(long percentile, long minSamples) const {
+    unsigned long counts[BUCKETS];
+    unsigned long total = 0;
+    for (int b = 0; b < BUCKETS; b++) {
+      counts[b] = buckets[b].load(std::memory_order_relaxed);
+      total += counts[b];
+    }
+    if (total == 0 || total < (unsigned long)minSamples) {
+      return 0;
+    }
+    unsigned long target = (total * percentile + 99) / 100;
+    unsigned long seen = 0;
+    for (int b = 0; b < BUCKETS; b++) {
+      seen += counts[b];
+      if (seen >= target) {
+        return 1L << b;
+      }
+    }
+    return 1L << (BUCKETS - 1);
+  }
+};
+
+struct gbObject {
+  sizeProfile *profile = NULL;
+  long maxBytes = 0;
+
+  // A message browsed for an MQGET that ended with MQRC_TRUNCATED_MSG_FAILED
+  bool held = false;
+  std::vector<char> heldData;
+  MQLONG heldLength = 0;
+  size_t heldMdLength = 0;
+  MQMD heldMd = {};
+  MQGMO heldGmo = {};
+};
+
+struct gbConn {
+  std::unordered_map<MQHOBJ, gbObject> objects;
+  std::vector<std::vector<char>> pool;
+
+  // What GetBefore changed
+  bool substituted = false;
+  std::vector<char> buffer;
+  PMQVOID appBuffer = NULL;
+  MQLONG appLength = 0;
+
+  bool served = false; // GetBefore returned a held message
+
+  unsigned long gets = 0;
+  unsigned long larger = 0;    // Gets given a larger buffer
+  unsigned long held = 0;      // Messages held after MQRC_TRUNCATED_MSG_FAILED
+  unsigned long answered = 0;  // Retries answered from a held message
+  unsigned long tooSmall = 0;  // Messages that did not fit the larger buffer either
+};
+
+static queueList queues;
+static long maxBytes = DEFAULT_MAX_BYTES;
+static long percentile = DEFAULT_PERCENTILE;
+static long minSamples = DEFAULT_MIN_SAMPLES;
+
+static std::mutex profileLock;
+static std::unordered_map<std::string, sizeProfile> profiles;
+
+static sizeProfile *profileFor(const MQCHAR *name) {
+  std::lock_guard<std::mutex> lock(profileLock);
+  return &profiles[std::string(name, nameLength(name, MQ_Q_NAME_LENGTH))];
+}
+
+static void takeBuffer(gbConn *gc, size_t len) {
+  if (!gc->pool.empty()) {
+    gc->buffer.swap(gc->pool.back());
+    gc->pool.pop_back();
+  }
+  if (gc->buffer.size() < len) {
+    gc->buffer.resize(len);
+  }
+}
+
+static void returnBuffer(gbConn *gc, std::vector<char> &buf) {
+  if (gc->pool.size() < POOL_SIZE) {
+    gc->pool.push_back(std::vector<char>());
+    gc->pool.back().swap(buf);
+  } else {
+    std::vector<char>().swap(buf);
+  }
+}
+
+// The message is still on the queue, so dropping the copy loses nothing
+static void dropHeld(gbConn *gc, gbObject *o) {
+  if (o->held) {
+    o->held = false;
+    returnBuffer(gc, o->heldData);
+  }
+}
+
+static size_t mdLength(PMQMD md) {
+  return md->Version >= MQMD_VERSION_2 ? sizeof(MQMD) : offsetof(MQMD, GroupId);
+}
+
+static MQLONG matchOptions(PMQGMO gmo) {
+  return gmo->Version >= MQGMO_VERSION_2 ? gmo->MatchOptions : SIMPLE_MATCH_OPTIONS;
+}
+
+// Can the exit stand in for the queue manager on this MQGET? Message properties returned
+// in a handle, and selection on anything but MsgId and CorrelId, are left to MQ.
+static bool supported(PMQGMO gmo) {
+  if (gmo->Version >= MQGMO_VERSION_4 && gmo->MsgHandle != MQHM_NONE && gmo->MsgHandle != MQHM_UNUSABLE_HMSG) {
+    return false;
+  }
+  return (matchOptions(gmo) & ~SIMPLE_MATCH_OPTIONS) == 0;
+}
+
+// Does the held message satisfy this MQGET?
+static bool matches(gbObject *o, PMQMD md, PMQGMO gmo) {
+  MQLONG mo = matchOptions(gmo);
+
+  if ((gmo->Options & GET_BROWSE_OPTIONS) == 0 || (gmo->Options & MQGMO_BROWSE_FIRST) || !supported(gmo)) {
+    return false;
+  }
+  if ((mo & MQMO_MATCH_MSG_ID) && memcmp(md->MsgId, noId, sizeof(noId)) && memcmp(md->MsgId, o->heldMd.MsgId, sizeof(md->MsgId))) {
+    return false;
+  }
+  if ((mo & MQMO_MATCH_CORREL_ID) && memcmp(md->CorrelId, noId, sizeof(noId)) && memcmp(md->CorrelId, o->heldMd.CorrelId, sizeof(md->CorrelId))) {
+    return false;
+  }
+  return true;
+}
+
+// The output fields of the GMO, for the version the application passed
+static void copyGmoOutput(PMQGMO to, PMQGMO from) {
+  memcpy(to->ResolvedQName, from->ResolvedQName, sizeof(to->ResolvedQName));
+  if (to->Version >= MQGMO_VERSION_2) {
+    to->GroupStatus = from->GroupStatus;
+    to->SegmentStatus = from->SegmentStatus;
+    to->Segmentation = from->Segmentation;
+  }
+  if (to->Version >= MQGMO_VERSION_3) {
+    memcpy(to->MsgToken, from->MsgToken, sizeof(to->MsgToken));
+    to->ReturnedLength = from->ReturnedLength;
+  }
+}
+
+extern "C" {
+MQLONG MqmuxPlugin(mqmuxPlugin *p);
+}
+
+static MQLONG gbInit(MQMUX_RPT *_rpt, char *buf, size_t len) {
+  rptFn = _rpt;
+  rptPrefix = "getbuf: ";
+
+  maxBytes = envLong(ENV_MAX_BYTES, DEFAULT_MAX_BYTES, 1, MAX_MSG_LENGTH);
+  percentile = envLong(ENV_PERCENTILE, DEFAULT_PERCENTILE, 1, 100);
+  minSamples = envLong(ENV_MIN_SAMPLES, DEFAULT_MIN_SAMPLES, 1, 1000000);
+  queues.parse(getenv(ENV_QUEUES), maxBytes);
+
+  for (const queueRule &r : queues.all()) {
+    rpt("Sizing buffers for %s%s up to %ld bytes", r.name.c_str(), r.prefix ? "*" : "", r.limit);
+  }
+  if (queues.empty()) {
+    snprintf(buf, len, "No queues configured in %s", ENV_QUEUES);
+    return MQRC_ENVIRONMENT_ERROR;
+  }
+  snprintf(buf, len, "Buffers sized for %ld%% of messages after %ld samples", percentile, minSamples);
+  return MQRC_NONE;
+}
+
+static void MQENTRY gbOpenAfter(PMQAXP pExitParms, PMQAXC pExitContext, PMQHCONN pHconn, PPMQOD ppObjDesc, PMQLONG pOptions, PPMQHOBJ ppHobj,
+                                PMQLONG pCompCode, PMQLONG pReason) {
+  PMQOD od = *ppObjDesc;
+  const queueRule *r;
+  if (*pCompCode != MQCC_FAILED && od->ObjectType == MQOT_Q &&
+      (*pOptions & (MQOO_INPUT_AS_Q_DEF | MQOO_INPUT_SHARED | MQOO_INPUT_EXCLUSIVE | MQOO_BROWSE)) != 0 && (r = queues.find(od->ObjectName)) != NULL) {
+    gbConn *gc = getConn<gbConn>(pExitParms);
+    gbObject &o = gc->objects[**ppHobj];
+    o = gbObject();
+    o.profile = profileFor(od->ObjectName);
+    o.maxBytes = r->limit > 0 ? r->limit : maxBytes;
+  }
+}
+
+static void MQENTRY gbCloseBefore(PMQAXP pExitParms, PMQAXC pExitContext, PMQHCONN pHconn, PPMQHOBJ ppHobj, PMQLONG pOptions, PMQLONG pCompCode,
+                                  PMQLONG pReason) {
+  gbConn *gc = findConn<gbConn>(pExitParms);
+  if (gc) {
+    auto it = gc->objects.find(**ppHobj);
+    if (it != gc->objects.end()) {
+      dropHeld(gc, &it->second);
+      gc->objects.erase(it);
+    }
+  }
+}
+
+static void MQENTRY gbGetBefore(PMQAXP pExitParms, PMQAXC pExitContext, PMQHCONN pHconn, PMQHOBJ pHobj, PPMQMD ppMsgDesc, PPMQGMO ppGetMsgOpts,
+                                PMQLONG pBufferLength, PPMQVOID ppBuffer, PPMQLONG ppDataLength, PMQLONG pCompCode, PMQLONG pReason) {
+  gbConn *gc = findConn<gbConn>(pExitParms);
+  PMQGMO gmo = *ppGetMsgOpts;
+  PMQMD md = *ppMsgDesc;
+  MQLONG bufLen = *pBufferLength;
+
+  if (!gc) {
+    return;
+  }
+  auto it = gc->objects.find(*pHobj);
+  if (it == gc->objects.end()) {
+    return;
+  }
+  gbObject *o = &it->second;
+  gc->gets++;
+
+  if (o->held) {
+    if (matches(o, md, gmo)) {
+      MQLONG len = o->heldLength;
+      memcpy(md, &o->heldMd, mdLength(md) < o->heldMdLength ? mdLength(md) : o->heldMdLength);
+      copyGmoOutput(gmo, &o->heldGmo);
+      memcpy(*ppBuffer, o->heldData.data(), len < bufLen ? len : bufLen);
+      if (*ppDataLength) {
+        **ppDataLength = len;
+      }
+      if (len <= bufLen) {
+        *pCompCode = MQCC_OK;
+        *pReason = MQRC_NONE;
+      } else {
+        *pCompCode = MQCC_WARNING;
+        *pReason = (gmo->Options & MQGMO_ACCEPT_TRUNCATED_MSG) ? MQRC_TRUNCATED_MSG_ACCEPTED : MQRC_TRUNCATED_MSG_FAILED;
+      }
+      if (*pReason != MQRC_TRUNCATED_MSG_FAILED) {
+        o->held = false;
+        returnBuffer(gc, o->heldData);
+        gc->answered++;
+      }
+      gc->served = true;
+      pExitParms->ExitResponse = MQXCC_SUPPRESS_FUNCTION;
+      return;
+    }
+    // A browse that starts again, or a destructive get after a browse, moves on
+    dropHeld(gc, o);
+  }
+
+  if ((gmo->Options & (GET_BROWSE_OPTIONS | MQGMO_ACCEPT_TRUNCATED_MSG)) == 0) {
+    return;
+  }
+  MQLONG want = o->profile->predict(percentile, minSamples);
+  if (want > o->maxBytes) {
+    want = (MQLONG)o->maxBytes;
+  }
+  if (want <= bufLen || !supported(gmo)) {
+    return;
+  }
+
+  takeBuffer(gc, want);
+  gc->substituted = true;
+  gc->appBuffer = *ppBuffer;
+  gc->appLength = bufLen;
+  *ppBuffer = gc->buffer.data();
+  *pBufferLength = want;
+  gc->larger++;
+}
+
+static void MQENTRY gbGetAfter(PMQAXP pExitParms, PMQAXC pExitContext, PMQHCONN pHconn, PMQHOBJ pHobj, PPMQMD ppMsgDesc, PPMQGMO ppGetMsgOpts,
+                               PMQLONG pBufferLength, PPMQVOID ppBuffer, PPMQLONG ppDataLength, PMQLONG pCompCode, PMQLONG pReason) {
+  gbConn *gc = findConn<gbConn>(pExitParms);
+  PMQGMO gmo = *ppGetMsgOpts;
+  MQLONG len;
+
+  if (!gc) {
+    return;
+  }
+  if (gc->served) {
+    gc->served = false;
+    return;
+  }
+  auto it = gc->objects.find(*pHobj);
+  if (it == gc->objects.end()) {
+    return;
+  }
+  gbObject *o = &it->second;
+  len = *ppDataLength ? **ppDataLength : 0;
+
+  bool gotMsg = *pCompCode != MQCC_FAILED || *pReason == MQRC_TRUNCATED_MSG_FAILED;
+  if (gotMsg) {
+    o->profile->record(len);
+  }
+  if (!gc->substituted) {
+    return;
+  }
+
+  MQLONG ourLen = *pBufferLength;
+  MQLONG appLen = gc->appLength;
+  gc->substituted = false;
+  *ppBuffer = gc->appBuffer;
+  *pBufferLength = appLen;
+
+  if (!gotMsg) {
+    returnBuffer(gc, gc->buffer);
+    return;
+  }
+
+  MQLONG got = len < ourLen ? len : ourLen;
+  memcpy(gc->appBuffer, gc->buffer.data(), got < appLen ? got : appLen);
+
+  if (*pReason == MQRC_TRUNCATED_MSG_FAILED || *pReason == MQRC_TRUNCATED_MSG_ACCEPTED) {
+    // Still too long. MQ has already given the right answer.
+    gc->tooSmall++;
+    returnBuffer(gc, gc->buffer);
+    return;
+  }
+
+  if (len > appLen) {
+    *pCompCode = MQCC_WARNING;
+    if (gmo->Options & MQGMO_ACCEPT_TRUNCATED_MSG) {
+      *pReason = MQRC_TRUNCATED_MSG_ACCEPTED;
+    } else {
+      // Only a browse gets here, so the message is still on the queue
+      *pReason = MQRC_TRUNCATED_MSG_FAILED;
+      PMQMD md = *ppMsgDesc;
+      o->held = true;
+      o->heldLength = len;
+      o->heldData.swap(gc->buffer);
+      o->heldMdLength = mdLength(md);
+      memcpy(&o->heldMd, md, o->heldMdLength);
+      o->heldGmo.Version = gmo->Version;
+      copyGmoOutput(&o->heldGmo, gmo);
+      gc->held++;
+      return;
+    }
+  }
+  returnBuffer(gc, gc->buffer);
+}
+
+// Drop any held messages, report and release the connection's state
+static void gbEnd(PMQAXP pExitParms) {
+  gbConn *gc = findConn<gbConn>(pExitParms);
+  if (gc) {
+    for (auto &o : gc->objects) {
+      dropHeld(gc, &o.second);
+    }
+    rpt("Gets: %lu. Larger buffer: %lu. Held after truncation: %lu. Retries answered: %lu. Still truncated: %lu", gc->gets, gc->larger, gc->held,
+        gc->answered, gc->tooSmall);
+    freeConn<gbConn>(pExitParms);
+  }
+}
+
+static void MQENTRY gbDiscBefore(PMQAXP pExitParms, PMQAXC pExitContext, PPMQHCONN ppHconn, PMQLONG pCompCode, PMQLONG pReason) {
+  gbEnd(pExitParms);
+}
+
+// The connection ended without an MQDISC
+static void MQENTRY gbTerminate(PMQAXP pExitParms, PMQAXC pExitContext, PMQLONG pCompCode, PMQLONG pReason) {
+  gbEnd(pExitParms);
+}
+
+MQLONG MqmuxPlugin(mqmuxPlugin *p) {
+  if (p->Version < MQMUX_PLUGIN_VERSION_1) {
+    return MQRC_WRONG_VERSION;
+  }
+
+  p->Name = "getbuf";
+  p->init = gbInit;
+
+  p->openAfter = gbOpenAfter;
+  p->closeBefore = gbCloseBefore;
+  p->getBefore = gbGetBefore;
+  p->getAfter = gbGetAfter;
+  p->discBefore = gbDiscBefore;
+  if (p->Version >= MQMUX_PLUGIN_VERSION_2) {
+    p->terminate = gbTerminate;
+  }
+
+  return MQRC_NONE;
+}
@@ -0,0 +1,360 @@
+/*
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+  Copyright (c) IBM Corporation 2024
+*/
+
+// A plugin for the mqmux exit that keeps object handles open across MQCLOSE/MQOPEN cycles.
+//
+// When the application closes an output handle for one of the configured queues, the real
+// MQCLOSE is suppressed and the handle is parked on the connection. A later MQOPEN with the same
+// object descriptor and options gets the parked handle back, without going to the queue
+// manager. Parked handles are really closed when a queue or the connection has too many of
+// them, when they have been idle for too long, or (implicitly) when the application disconnects.
+//
+// All state is per-hConn. The lists are short, so they are searched linearly.
+
+#include <cmqc.h>
+#include <cmqec.h>
+#include <cmqxc.h>
+
+#include "../mux/mqmux_plugin.hpp"
+
+using namespace mqmux;
+
+#define ENV_QUEUES "MQHCACHE_QUEUES"
+#define ENV_MAX_IDLE "MQHCACHE_MAX_IDLE"
+#define ENV_IDLE_SECS "MQHCACHE_IDLE_SECS"
+
+#define DEFAULT_QUEUE_LIMIT 1
+#define DEFAULT_MAX_IDLE 8
+#define DEFAULT_IDLE_SECS 60
+
+// Only opens that can be shared with no visible difference to the application are cached.
+// Anything to do with input, browse or MQSET would change the queue's behaviour if the
+// handle stayed open.
+#define CACHEABLE_OPTIONS                                                                                                                                      \
+  (MQOO_OUTPUT | MQOO_INQUIRE | MQOO_FAIL_IF_QUIESCING | MQOO_BIND_ON_OPEN | MQOO_BIND_NOT_FIXED | MQOO_BIND_ON_GROUP | MQOO_PASS_IDENTITY_CONTEXT |                \
+   MQOO_PASS_ALL_CONTEXT | MQOO_SET_IDENTITY_CONTEXT | MQOO_SET_ALL_CONTEXT | MQOO_ALTERNATE_USER_AUTHORITY)
+
+static queueList queues;
+static long maxIdle = DEFAULT_MAX_IDLE;
+static unsigned long long idleLimit = 0; // Microseconds; 0 means no limit
+
+// What makes two MQOPENs equivalent
+typedef struct {
+  MQLONG options;
+  MQCHAR48 objectName;
+  MQCHAR48 objectQMgrName;
+  MQCHAR12 alternateUserId;
+} openKey;
+
+typedef struct {
+  MQHOBJ hObj;
+  bool idle;
+  openKey key;
+  const queueRule *rule;
+  MQCHAR48 resolvedQName; // Returned to the application when the handle is reused
+  MQCHAR48 resolvedQMgrName;
+  unsigned long long lastUsed;
+} cachedHandle;
+
+struct hcConn {
+  std::vector<cachedHandle> handles; // Both in use and idle
+  long idleCount = 0;
+
+  // Set by OpenBefore when the real MQOPEN goes ahead
+  bool pending = false;
+  openKey pendingKey;
+  const queueRule *pendingRule = NULL;
+
+  unsigned long hits = 0;
+  unsigned long misses = 0;
+  unsigned long deferred = 0;
+  unsigned long evictions = 0;
+};
+
+static void makeKey(PMQOD od, MQLONG options, openKey *k) {
+  memset(k, 0, sizeof(*k));
+  k->options = options;
+  memcpy(k->objectName, od->ObjectName, sizeof(k->objectName));
+  memcpy(k->objectQMgrName, od->ObjectQMgrName, sizeof(k->objectQMgrName));
+  if (options & MQOO_ALTERNATE_USER_AUTHORITY) {
+    memcpy(k->alternateUserId, od->AlternateUserId, sizeof(k->alternateUserId));
+  }
+}
+
+// Is this MQOPEN one that we might satisfy from, or add to, the cache?
+static const queueRule *cacheable(PMQOD od, MQLONG options) {
+  if (od->ObjectType != MQOT_Q || (options & MQOO_OUTPUT) == 0 || (options & ~CACHEABLE_OPTIONS) != 0) {
+    return NULL;
+  }
+  // Distribution lists and selection strings are not worth the complexity
+  if (od->Version >= MQOD_VERSION_2 && od->RecsPresent != 0) {
+    return NULL;
+  }
+  if (od->Version >= MQOD_VERSION_4 && od->SelectionString.VSLength != 0) {
+    return NULL;
+  }
+  const queueRule *r = queues.find(od->ObjectName);
+  return (r && r->limit > 0) ? r : NULL;
+}
+
+// Really close a parked handle. Errors are reported but otherwise ignored; the handle
+// will go away with the connection anyway.
+static void closeHandle(PMQAXP pExitParms, PMQHCONN pHconn, hcConn *hc, size_t i) {
+  MQLONG CC, RC;
+  MQHOBJ hObj = hc->handles[i].hObj;
+
+  pExitParms->Hconfig->MQCLOSE_Call(*pHconn, &hObj, MQCO_NONE, &CC, &RC);
+  if (CC != MQCC_OK) {
+    rptmqrc("MQCLOSE", CC, RC);
+  }
+  if (hc->handles[i].idle) {
+    hc->idleCount--;
+  }
+  hc->handles.erase(hc->handles.begin() + i);
+  hc->evictions++;
+}
+
+// Close anything that has been idle for too long
+static void expire(PMQAXP pExitParms, PMQHCONN pHconn, hcConn *hc, unsigned long long t) {
+  if (idleLimit == 0 || hc->idleCount == 0) {
+    return;
+  }
+  for (size_t i = hc->handles.size(); i > 0; i--) {
+    cachedHandle *h = &hc->handles[i - 1];
+    if (h->idle && t - h->lastUsed > idleLimit) {
+      closeHandle(pExitParms, pHconn, hc, i - 1);
+    }
+  }
+}
+
+// Close the least recently used idle handle, optionally only for one queue
+static void evictOldest(PMQAXP pExitParms, PMQHCONN pHconn, hcConn *hc, const MQCHAR *objectName) {
+  size_t oldest = hc->handles.size();
+  for (size_t i = 0; i < hc->handles.size(); i++) {
+    cachedHandle *h = &hc->handles[i];
+    if (!h->idle || (objectName && memcmp(h->key.objectName, objectName, MQ_Q_NAME_LENGTH))) {
+      continue;
+    }
+    if (oldest == hc->handles.size() || h->lastUsed < hc->handles[oldest].lastUsed) {
+      oldest = i;
+    }
+  }
+  if (oldest < hc->handles.size()) {
+    closeHandle(pExitParms, pHconn, hc, oldest);
+  }
+}
+
+extern "C" {
+MQLONG MqmuxPlugin(mqmuxPlugin *p);
+}
+
+static MQLONG hcInit(MQMUX_RPT *_rpt, char *buf, size_t len) {
+  rptFn = _rpt;
+  rptPrefix = "hcache: ";
+
+  queues.parse(getenv(ENV_QUEUES), DEFAULT_QUEUE_LIMIT);
+  maxIdle = envLong(ENV_MAX_IDLE, DEFAULT_MAX_IDLE, 0, 1024);
+  idleLimit = (unsigned long long)envLong(ENV_IDLE_SECS, DEFAULT_IDLE_SECS, 0, 86400) * 1000000ULL;
+
+  for (const queueRule &r : queues.all()) {
+    rpt("Caching up to %ld handles for %s%s", r.limit, r.name.c_str(), r.prefix ? "*" : "");
+  }
+  if (queues.empty()) {
+    snprintf(buf, len, "No queues configured in %s", ENV_QUEUES);
+    return MQRC_ENVIRONMENT_ERROR;
+  }
+  snprintf(buf, len, "Up to %ld idle handles per connection", maxIdle);
+  return MQRC_NONE;
+}
+
+// Hand back an idle handle if there is one. Otherwise remember what's being opened, so the
+// After function can start tracking the new handle.
+static void MQENTRY hcOpenBefore(PMQAXP pExitParms, PMQAXC pExitContext, PMQHCONN pHconn, PPMQOD ppObjDesc, PMQLONG pOptions, PPMQHOBJ ppHobj,
+                                 PMQLONG pCompCode, PMQLONG pReason) {
+  PMQOD od = *ppObjDesc;
+  const queueRule *r = cacheable(od, *pOptions);
+  openKey k;
+
+  if (!r) {
+    return;
+  }
+
+  hcConn *hc = getConn<hcConn>(pExitParms);
+  unsigned long long t = now();
+  expire(pExitParms, pHconn, hc, t);
+
+  makeKey(od, *pOptions, &k);
+  for (cachedHandle &h : hc->handles) {
+    if (h.idle && !memcmp(&h.key, &k, sizeof(k))) {
+      h.idle = false;
+      h.lastUsed = t;
+      hc->idleCount--;
+      hc->hits++;
+
+      // Fill in the same output fields that the real MQOPEN would have done
+      if (od->Version >= MQOD_VERSION_3) {
+        memcpy(od->ResolvedQName, h.resolvedQName, sizeof(od->ResolvedQName));
+        memcpy(od->ResolvedQMgrName, h.resolvedQMgrName, sizeof(od->ResolvedQMgrName));
+      }
+      if (od->Version >= MQOD_VERSION_4) {
+        od->ResObjectString.VSLength = 0;
+        od->ResolvedType = MQOT_Q;
+      }
+
+      **ppHobj = h.hObj;
+      *pCompCode = MQCC_OK;
+      *pReason = MQRC_NONE;
+      pExitParms->ExitResponse = MQXCC_SUPPRESS_FUNCTION;
+      return;
+    }
+  }
+
+  hc->misses++;
+  hc->pending = true;
+  hc->pendingKey = k;
+  hc->pendingRule = r;
+}
+
+static void MQENTRY hcOpenAfter(PMQAXP pExitParms, PMQAXC pExitContext, PMQHCONN pHconn, PPMQOD ppObjDesc, PMQLONG pOptions, PPMQHOBJ ppHobj,
+                                PMQLONG pCompCode, PMQLONG pReason) {
+  PMQOD od = *ppObjDesc;
+  hcConn *hc = findConn<hcConn>(pExitParms);
+  cachedHandle h;
+
+  if (!hc || !hc->pending) {
+    return;
+  }
+  hc->pending = false;
+
+  // A model queue gives back the name of the new dynamic queue. Each MQOPEN of it
+  // creates a new queue, so that can never be reused.
+  if (*pCompCode == MQCC_FAILED || memcmp(od->ObjectName, hc->pendingKey.objectName, sizeof(od->ObjectName))) {
+    return;
+  }
+
+  memset(&h, 0, sizeof(h));
+  h.hObj = **ppHobj;
+  h.key = hc->pendingKey;
+  h.rule = hc->pendingRule;
+  if (od->Version >= MQOD_VERSION_3) {
+    memcpy(h.resolvedQName, od->ResolvedQName, sizeof(h.resolvedQName));
+    memcpy(h.resolvedQMgrName, od->ResolvedQMgrName, sizeof(h.resolvedQMgrName));
+  } else {
+    memset(h.resolvedQName, ' ', sizeof(h.resolvedQName));
+    memset(h.resolvedQMgrName, ' ', sizeof(h.resolvedQMgrName));
+  }
+  h.lastUsed = now();
+  hc->handles.push_back(h);
+}
+
+// Park the handle instead of closing it, making room if the queue or connection already
+// has as many idle handles as it's allowed.
+static void MQENTRY hcCloseBefore(PMQAXP pExitParms, PMQAXC pExitContext, PMQHCONN pHconn, PPMQHOBJ ppHobj, PMQLONG pOptions, PMQLONG pCompCode,
+                                  PMQLONG pReason) {
+  hcConn *hc = findConn<hcConn>(pExitParms);
+  MQHOBJ hObj = **ppHobj;
+  size_t i;
+
+  if (!hc) {
+    return;
+  }
+  for (i = 0; i < hc->handles.size(); i++) {
+    if (hc->handles[i].hObj == hObj && !hc->handles[i].idle) {
+      break;
+    }
+  }
+  if (i == hc->handles.size()) {
+    return;
+  }
+
+  if (*pOptions != MQCO_NONE || maxIdle == 0) {
+    // Let the real close happen, and forget about the handle
+    hc->handles.erase(hc->handles.begin() + i);
+    return;
+  }
+
+  // The limit from a wildcard entry applies to each queue that it matches
+  MQCHAR48 objectName;
+  long limit = hc->handles[i].rule->limit;
+  long forQueue = 0;
+  memcpy(objectName, hc->handles[i].key.objectName, sizeof(objectName));
+  for (cachedHandle &h : hc->handles) {
+    if (h.idle && !memcmp(h.key.objectName, objectName, sizeof(objectName))) {
+      forQueue++;
+    }
+  }
+  // Evicting changes the positions in the vector, so the handle is found again by its value
+  if (forQueue >= limit) {
+    evictOldest(pExitParms, pHconn, hc, objectName);
+  }
+  if (hc->idleCount >= maxIdle) {
+    evictOldest(pExitParms, pHconn, hc, NULL);
+  }
+
+  for (cachedHandle &h : hc->handles) {
+    if (h.hObj == hObj) {
+      h.idle = true;
+      h.lastUsed = now();
+      break;
+    }
+  }
+  hc->idleCount++;
+  hc->deferred++;
+
+  **ppHobj = MQHO_UNUSABLE_HOBJ;
+  *pCompCode = MQCC_OK;
+  *pReason = MQRC_NONE;
+  pExitParms->ExitResponse = MQXCC_SUPPRESS_FUNCTION;
+}
+
+// Report and release the connection's state. The queue manager closes all the handles as part
+// of the MQDISC or the end of the connection, including the idle ones.
+static void hcEnd(PMQAXP pExitParms) {
+  hcConn *hc = findConn<hcConn>(pExitParms);
+  if (hc) {
+    rpt("Opens: %lu from cache, %lu real. Closes deferred: %lu. Evictions: %lu. Idle at disconnect: %ld", hc->hits, hc->misses, hc->deferred, hc->evictions,
+        hc->idleCount);
+    freeConn<hcConn>(pExitParms);
+  }
+}
+
+static void MQENTRY hcDiscBefore(PMQAXP pExitParms, PMQAXC pExitContext, PPMQHCONN ppHconn, PMQLONG pCompCode, PMQLONG pReason) {
+  hcEnd(pExitParms);
+}
+
+// The connection ended without an MQDISC
+static void MQENTRY hcTerminate(PMQAXP pExitParms, PMQAXC pExitContext, PMQLONG pCompCode, PMQLONG pReason) {
+  hcEnd(pExitParms);
+}
+
+MQLONG MqmuxPlugin(mqmuxPlugin *p) {
+  if (p->Version < MQMUX_PLUGIN_VERSION_1) {
+    return MQRC_WRONG_VERSION;
+  }
+
+  p->Name = "hcache";
+  p->init = hcInit;
+
+  p->openBefore = hcOpenBefore;
+  p->openAfter = hcOpenAfter;
+  p->closeBefore = hcCloseBefore;
+  p->discBefore = hcDiscBefore;
+  if (p->Version >= MQMUX_PLUGIN_VERSION_2) {
+    p->terminate = hcTerminate;
+  }
+
+  return MQRC_NONE;
+}
@@ -0,0 +1,306 @@
+/*
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+  Copyright (c) IBM Corporation 2024
+*/
+
+// A plugin for the mqmux exit that answers repeated MQINQ calls from a cache. Results are
+// kept for each object handle and set of selectors. How long a result is used for depends
+// on the attributes asked for:
+// - Volatile ones such as CURDEPTH, for MQINQCACHE_VOLATILE_MSECS
+// - INHIBITPUT and INHIBITGET, which an administrator may change at any time, for
+//   MQINQCACHE_STATE_MSECS
+// - Everything else, until the handle is closed
+// The shortest time of any attribute in the set applies to the whole result. An MQSET by any
+// connection in this process clears cached results for that queue.
+
+#include <atomic>
+#include <mutex>
+#include <unordered_map>
+
+#include <cmqc.h>
+#include <cmqec.h>
+#include <cmqxc.h>
+
+#include "../mux/mqmux_plugin.hpp"
+
+using namespace mqmux;
+
+#define ENV_QUEUES "MQINQCACHE_QUEUES"
+#define ENV_VOLATILE_MSECS "MQINQCACHE_VOLATILE_MSECS"
+#define ENV_STATE_MSECS "MQINQCACHE_STATE_MSECS"
+
+#define DEFAULT_VOLATILE_MSECS 100
+#define DEFAULT_STATE_MSECS 1000
+
+// Different selector sets cached for one handle
+#define MAX_ENTRIES 8
+
+#define FOREVER (~0ULL)
+
+struct inqResult {
+  std::vector<MQLONG> selectors;
+  MQLONG charLength; // What the application asked for
+  std::vector<MQLONG> intAttrs;
+  std::vector<MQCHAR> charAttrs;
+  MQLONG compCode;
+  MQLONG reason;
+  unsigned long long expires; // Microseconds, from now()
+  unsigned long generation;
+  unsigned long long lastUsed;
+};
+
+struct icObject {
+  std::atomic<unsigned long> *generation = NULL;
+  std::vector<inqResult> results;
+};
+
+struct icConn {
+  std::unordered_map<MQHOBJ, icObject> objects;
+
+  bool served = false; // InqBefore answered from the cache
+  bool fill = false;   // InqAfter should save the result
+
+  unsigned long hits = 0;
+  unsigned long misses = 0;
+  unsigned long expired = 0;
+  unsigned long invalidated = 0;
+};
+
+static queueList queues;
+static unsigned long long volatileTime = 0; // Microseconds
+static unsigned long long stateTime = 0;
+
+// Bumped by every MQSET on the queue, so that all connections see their results are stale
+static std::mutex generationLock;
+static std::unordered_map<std::string, std::atomic<unsigned long>> generations;
+
+static std::atomic<unsigned long> *generationFor(const MQCHAR *name) {
+  std::lock_guard<std::mutex> lock(generationLock);
+  return &generations[std::string(name, nameLength(name, MQ_Q_NAME_LENGTH))];
+}
+
+// How long a result for this attribute can be used
+static unsigned long long lifetime(MQLONG selector) {
+  switch (selector) {
+  case MQIA_CURRENT_Q_DEPTH:
+  case MQIA_OPEN_INPUT_COUNT:
+  case MQIA_OPEN_OUTPUT_COUNT:
+    return volatileTime;
+  case MQIA_INHIBIT_PUT:
+  case MQIA_INHIBIT_GET:
+    return stateTime;
+  default:
+    return FOREVER;
+  }
+}
+
+static inqResult *find(icObject *o, MQLONG selectorCount, PMQLONG selectors, MQLONG intCount, MQLONG charLength) {
+  for (inqResult &r : o->results) {
+    if (r.selectors.size() == (size_t)selectorCount && r.intAttrs.size() == (size_t)intCount && r.charLength == charLength &&
+        (selectorCount == 0 || !memcmp(r.selectors.data(), selectors, selectorCount * sizeof(MQLONG)))) {
+      return &r;
+    }
+  }
+  return NULL;
+}
+
+extern "C" {
+MQLONG MqmuxPlugin(mqmuxPlugin *p);
+}
+
+static MQLONG icInit(MQMUX_RPT *_rpt, char *buf, size_t len) {
+  rptFn = _rpt;
+  rptPrefix = "inqcache: ";
+
+  queues.parse(getenv(ENV_QUEUES), 0);
+  volatileTime = (unsigned long long)envLong(ENV_VOLATILE_MSECS, DEFAULT_VOLATILE_MSECS, 0, 3600000) * 1000ULL;
+  stateTime = (unsigned long long)envLong(ENV_STATE_MSECS, DEFAULT_STATE_MSECS, 0, 3600000) * 1000ULL;
+
+  for (const queueRule &r : queues.all()) {
+    rpt("Caching MQINQ for %s%s", r.name.c_str(), r.prefix ? "*" : "");
+  }
+  if (queues.empty()) {
+    snprintf(buf, len, "No queues configured in %s", ENV_QUEUES);
+    return MQRC_ENVIRONMENT_ERROR;
+  }
+  snprintf(buf, len, "Volatile attributes kept for %llu ms, queue state for %llu ms", volatileTime / 1000, stateTime / 1000);
+  return MQRC_NONE;
+}
+
+static void MQENTRY icOpenAfter(PMQAXP pExitParms, PMQAXC pExitContext, PMQHCONN pHconn, PPMQOD ppObjDesc, PMQLONG pOptions, PPMQHOBJ ppHobj,
+                                PMQLONG pCompCode, PMQLONG pReason) {
+  PMQOD od = *ppObjDesc;
+  if (*pCompCode != MQCC_FAILED && od->ObjectType == MQOT_Q && (*pOptions & (MQOO_INQUIRE | MQOO_SET)) != 0 && queues.find(od->ObjectName)) {
+    icConn *ic = getConn<icConn>(pExitParms);
+    icObject &o = ic->objects[**ppHobj];
+    o.results.clear();
+    o.generation = generationFor(od->ObjectName);
+  }
+}
+
+static void MQENTRY icCloseBefore(PMQAXP pExitParms, PMQAXC pExitContext, PMQHCONN pHconn, PPMQHOBJ ppHobj, PMQLONG pOptions, PMQLONG pCompCode,
+                                  PMQLONG pReason) {
+  icConn *ic = findConn<icConn>(pExitParms);
+  if (ic) {
+    ic->objects.erase(**ppHobj);
+  }
+}
+
+static void MQENTRY icInqBefore(PMQAXP pExitParms, PMQAXC pExitContext, PMQHCONN pHconn, PMQHOBJ pHobj, PMQLONG pSelectorCount, PPMQLONG ppSelectors,
+                                PMQLONG pIntAttrCount, PPMQLONG ppIntAttrs, PMQLONG pCharAttrLength, PPMQCHAR ppCharAttrs, PMQLONG pCompCode,
+                                PMQLONG pReason) {
+  icConn *ic = findConn<icConn>(pExitParms);
+  if (!ic) {
+    return;
+  }
+  auto it = ic->objects.find(*pHobj);
+  if (it == ic->objects.end()) {
+    return;
+  }
+  icObject *o = &it->second;
+  inqResult *r = find(o, *pSelectorCount, *ppSelectors, *pIntAttrCount, *pCharAttrLength);
+  unsigned long long t = now();
+
+  if (r && r->generation == o->generation->load()) {
+    if (r->expires > t) {
+      if (!r->intAttrs.empty()) {
+        memcpy(*ppIntAttrs, r->intAttrs.data(), r->intAttrs.size() * sizeof(MQLONG));
+      }
+      if (!r->charAttrs.empty()) {
+        memcpy(*ppCharAttrs, r->charAttrs.data(), r->charAttrs.size());
+      }
+      *pCompCode = r->compCode;
+      *pReason = r->reason;
+      r->lastUsed = t;
+      ic->hits++;
+      ic->served = true;
+      pExitParms->ExitResponse = MQXCC_SUPPRESS_FUNCTION;
+      return;
+    }
+    ic->expired++;
+  } else if (r) {
+    ic->invalidated++;
+  }
+  ic->misses++;
+  ic->fill = true;
+}
+
+static void MQENTRY icInqAfter(PMQAXP pExitParms, PMQAXC pExitContext, PMQHCONN pHconn, PMQHOBJ pHobj, PMQLONG pSelectorCount, PPMQLONG ppSelectors,
+                               PMQLONG pIntAttrCount, PPMQLONG ppIntAttrs, PMQLONG pCharAttrLength, PPMQCHAR ppCharAttrs, PMQLONG pCompCode,
+                               PMQLONG pReason) {
+  icConn *ic = findConn<icConn>(pExitParms);
+  if (!ic) {
+    return;
+  }
+  if (ic->served) {
+    ic->served = false;
+    return;
+  }
+  if (!ic->fill) {
+    return;
+  }
+  ic->fill = false;
+
+  auto it = ic->objects.find(*pHobj);
+  if (it == ic->objects.end() || *pCompCode == MQCC_FAILED) {
+    return;
+  }
+  icObject *o = &it->second;
+  MQLONG count = *pSelectorCount;
+  inqResult *r = find(o, count, *ppSelectors, *pIntAttrCount, *pCharAttrLength);
+
+  if (!r) {
+    if (o->results.size() < MAX_ENTRIES) {
+      o->results.push_back(inqResult());
+      r = &o->results.back();
+    } else {
+      r = &o->results[0];
+      for (inqResult &e : o->results) {
+        if (e.lastUsed < r->lastUsed) {
+          r = &e;
+        }
+      }
+    }
+  }
+
+  unsigned long long t = now();
+  unsigned long long life = FOREVER;
+  r->selectors.assign(*ppSelectors, *ppSelectors + count);
+  for (MQLONG s : r->selectors) {
+    unsigned long long l = lifetime(s);
+    if (l < life) {
+      life = l;
+    }
+  }
+  r->intAttrs.assign(*ppIntAttrs, *ppIntAttrs + *pIntAttrCount);
+  r->charLength = *pCharAttrLength;
+  r->charAttrs.assign(*ppCharAttrs, *ppCharAttrs + *pCharAttrLength);
+  r->compCode = *pCompCode;
+  r->reason = *pReason;
+  r->expires = life == FOREVER ? FOREVER : t + life;
+  r->generation = o->generation->load();
+  r->lastUsed = t;
+}
+
+// Clear results for the queue even if the MQSET fails, as some attributes may have changed
+static void MQENTRY icSetAfter(PMQAXP pExitParms, PMQAXC pExitContext, PMQHCONN pHconn, PMQHOBJ pHobj, PMQLONG pSelectorCount, PPMQLONG ppSelectors,
+                               PMQLONG pIntAttrCount, PPMQLONG ppIntAttrs, PMQLONG pCharAttrLength, PPMQCHAR ppCharAttrs, PMQLONG pCompCode,
+                               PMQLONG pReason) {
+  icConn *ic = findConn<icConn>(pExitParms);
+  if (ic) {
+    auto it = ic->objects.find(*pHobj);
+    if (it != ic->objects.end()) {
+      it->second.generation->fetch_add(1);
+    }
+  }
+}
+
+// Report and release the connection's state
+static void icEnd(PMQAXP pExitParms) {
+  icConn *ic = findConn<icConn>(pExitParms);
+  if (ic) {
+    rpt("MQINQ hits: %lu misses: %lu (expired: %lu, cleared by MQSET: %lu)", ic->hits, ic->misses, ic->expired, ic->invalidated);
+    freeConn<icConn>(pExitParms);
+  }
+}
+
+static void MQENTRY icDiscBefore(PMQAXP pExitParms, PMQAXC pExitContext, PPMQHCONN ppHconn, PMQLONG pCompCode, PMQLONG pReason) {
+  icEnd(pExitParms);
+}
+
+// The connection ended without an MQDISC
+static void MQENTRY icTerminate(PMQAXP pExitParms, PMQAXC pExitContext, PMQLONG pCompCode, PMQLONG pReason) {
+  icEnd(pExitParms);
+}
+
+MQLONG MqmuxPlugin(mqmuxPlugin *p) {
+  if (p->Version < MQMUX_PLUGIN_VERSION_1) {
+    return MQRC_WRONG_VERSION;
+  }
+
+  p->Name = "inqcache";
+  p->init = icInit;
+
+  p->openAfter = icOpenAfter;
+  p->closeBefore = icCloseBefore;
+  p->inqBefore = icInqBefore;
+  p->inqAfter = icInqAfter;
+  p->setAfter = icSetAfter;
+  p->discBefore = icDiscBefore;
+  if (p->Version >= MQMUX_PLUGIN_VERSION_2) {
+    p->terminate = icTerminate;
+  }
+
+  return MQRC_NONE;
+}
@@ -0,0 +1,709 @@
+/*
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+  Copyright (c) IBM Corporation 2024
+*/
+
+// An API exit that hosts several plugin modules behind a single set of MQXEP registrations.
+//
+// The plugins are named, in order, in MQMUX_PLUGINS. They are loaded and initialised once per
+// process. For each verb and phase, the host builds a flat array of the plugin functions that
+// want to see it, and only registers its own function with MQ if that array is not empty.
+// Each MQI call then costs one hop through the MQ exit chain however many plugins there are.
+//
+// BEFORE functions are called in the configured order and AFTER functions in the reverse
+// order, which is how MQ itself orders a chain of separate exits. A plugin can stop the rest
+// of a BEFORE chain by setting ExitResponse to MQXCC_SUPPRESS_FUNCTION, MQXCC_SKIP_FUNCTION or
+// MQXCC_FAILED; the later plugins do not then see the matching AFTER call either. Setting
+// MQXCC_SUPPRESS_EXIT stops the host calling that plugin again on this connection.
+//
+// Each plugin has its own ExitUserArea. The host's area holds a pointer to a per-connection
+// block with space for all of them, and the plugin's copy is swapped in around each call.
+
+#include <dlfcn.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <cmqc.h>
+#include <cmqec.h>
+#include <cmqxc.h>
+
+#include "mqmux.h"
+
+#ifndef TRUE
+#define TRUE (1)
+#endif
+
+#ifndef FALSE
+#define FALSE (0)
+#endif
+
+#ifndef PATH_MAX
+#define PATH_MAX 256
+#endif
+
+static void rpt(char *fmt, ...);
+
+static FILE *fp = NULL;
+static int closeFp = TRUE;
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+
+#define ENV_LOGFILE "APIX_LOGFILE"
+#define ENV_PLUGINS "MQMUX_PLUGINS"
+
+#define MAX_PLUGINS 16
+
+#if defined MQ_64_BIT
+#define BITNESS 64
+#define EXITDIR "exits64"
+#else
+#define BITNESS 32
+#define EXITDIR "exits"
+#endif
+
+typedef struct {
+  char name[PATH_MAX];
+  void *hdl;
+  int active; // Successfully initialised
+  mqmuxPlugin fns;
+} muxPlugin;
+
+static muxPlugin plugins[MAX_PLUGINS];
+static int pluginCount = 0;
+static int loaded = FALSE;
+static int initCount = 0;
+
+// The exit functions the host knows about. The order of this enum matches the slots table below.
+enum {
+  SLOT_CONNX_AFTER,
+  SLOT_DISC_BEFORE,
+  SLOT_DISC_AFTER,
+  SLOT_OPEN_BEFORE,
+  SLOT_OPEN_AFTER,
+  SLOT_CLOSE_BEFORE,
+  SLOT_CLOSE_AFTER,
+  SLOT_PUT_BEFORE,
+  SLOT_PUT_AFTER,
+  SLOT_PUT1_BEFORE,
+  SLOT_PUT1_AFTER,
+  SLOT_GET_BEFORE,
+  SLOT_GET_AFTER,
+  SLOT_CB_BEFORE,
+  SLOT_CB_AFTER,
+  SLOT_CALLBACK_BEFORE,
+  SLOT_CALLBACK_AFTER,
+  SLOT_INQ_BEFORE,
+  SLOT_INQ_AFTER,
+  SLOT_SET_BEFORE,
+  SLOT_SET_AFTER,
+  SLOT_CMIT_BEFORE,
+  SLOT_CMIT_AFTER,
+  SLOT_BACK_BEFORE,
+  SLOT_BACK_AFTER,
+  SLOT_STAT_BEFORE,
+  SLOT_STAT_AFTER,
+  SLOT_TERM,
+  SLOT_COUNT
+};
+
+// One entry in a per-slot call vector
+typedef struct {
+  PMQFUNC fn;
+  int plugin;
+} muxEntry;
+
+static muxEntry chains[SLOT_COUNT][MAX_PLUGINS];
+static int chainLength[SLOT_COUNT];
+
+// Per-connection state, pointed to from the host's ExitUserArea
+typedef struct {
+  MQLONG stoppedFunction; // The verb whose BEFORE chain was cut short
+  int stoppedAt;          // and the plugin that did it
+  MQLONG response;
+  unsigned char disabled[MAX_PLUGINS];
+  MQBYTE16 areas[MAX_PLUGINS];
+} muxConn;
+
+/*********************************************************************/
+/* Standard MQ Entrypoint. Not directly used, but                    */
+/* required by some platforms.                                       */
+/*********************************************************************/
+void *MQStart() { return 0; }
+
+static void lock() { pthread_mutex_lock(&mutex); }
+static void unlock() { pthread_mutex_unlock(&mutex); }
+
+/*********************************************************************/
+/* Declare internal functions. All except the                        */
+/* entrypoint can be static as they're not used by any other module. */
+/*********************************************************************/
+MQ_INIT_EXIT EntryPoint;
+static MQ_TERM_EXIT Terminate;
+
+static MQ_CONNX_EXIT ConnxAfter;
+static MQ_DISC_EXIT DiscBefore;
+static MQ_DISC_EXIT DiscAfter;
+static MQ_OPEN_EXIT OpenBefore;
+static MQ_OPEN_EXIT OpenAfter;
+static MQ_CLOSE_EXIT CloseBefore;
+static MQ_CLOSE_EXIT CloseAfter;
+static MQ_PUT_EXIT PutBefore;
+static MQ_PUT_EXIT PutAfter;
+static MQ_PUT1_EXIT Put1Before;
+static MQ_PUT1_EXIT Put1After;
+static MQ_GET_EXIT GetBefore;
+static MQ_GET_EXIT GetAfter;
+static MQ_CB_EXIT CBBefore;
+static MQ_CB_EXIT CBAfter;
+static MQ_CALLBACK_EXIT CallbackBefore;
+static MQ_CALLBACK_EXIT CallbackAfter;
+static MQ_INQ_EXIT InqBefore;
+static MQ_INQ_EXIT InqAfter;
+static MQ_SET_EXIT SetBefore;
+static MQ_SET_EXIT SetAfter;
+static MQ_CMIT_EXIT CmitBefore;
+static MQ_CMIT_EXIT CmitAfter;
+static MQ_BACK_EXIT BackBefore;
+static MQ_BACK_EXIT BackAfter;
+static MQ_STAT_EXIT StatBefore;
+static MQ_STAT_EXIT StatAfter;
+
+static int pluginEnter(PMQAXP pExitParms, muxConn *mc, int plugin);
+static int pluginLeave(PMQAXP pExitParms, muxConn *mc, int plugin);
+
+// How each slot maps to the MQXEP registration and to the plugin's function table
+#define SLOT(R, F, FIELD, FN) {R, F, offsetof(mqmuxPlugin, FIELD), (PMQFUNC)FN}
+static const struct {
+  MQLONG reason;
+  MQLONG function;
+  size_t offset;
+  PMQFUNC hostFn;
+} slots[SLOT_COUNT] = {
+    SLOT(MQXR_AFTER, MQXF_CONNX, connxAfter, ConnxAfter),
+    SLOT(MQXR_BEFORE, MQXF_DISC, discBefore, DiscBefore),
+    SLOT(MQXR_AFTER, MQXF_DISC, discAfter, DiscAfter),
+    SLOT(MQXR_BEFORE, MQXF_OPEN, openBefore, OpenBefore),
+    SLOT(MQXR_AFTER, MQXF_OPEN, openAfter, OpenAfter),
+    SLOT(MQXR_BEFORE, MQXF_CLOSE, closeBefore, CloseBefore),
+    SLOT(MQXR_AFTER, MQXF_CLOSE, closeAfter, CloseAfter),
+    SLOT(MQXR_BEFORE, MQXF_PUT, putBefore, PutBefore),
+    SLOT(MQXR_AFTER, MQXF_PUT, putAfter, PutAfter),
+    SLOT(MQXR_BEFORE, MQXF_PUT1, put1Before, Put1Before),
+    SLOT(MQXR_AFTER, MQXF_PUT1, put1After, Put1After),
+    SLOT(MQXR_BEFORE, MQXF_GET, getBefore, GetBefore),
+    SLOT(MQXR_AFTER, MQXF_GET, getAfter, GetAfter),
+    SLOT(MQXR_BEFORE, MQXF_CB, cbBefore, CBBefore),
+    SLOT(MQXR_AFTER, MQXF_CB, cbAfter, CBAfter),
+    SLOT(MQXR_BEFORE, MQXF_CALLBACK, callbackBefore, CallbackBefore),
+    SLOT(MQXR_AFTER, MQXF_CALLBACK, callbackAfter, CallbackAfter),
+    SLOT(MQXR_BEFORE, MQXF_INQ, inqBefore, InqBefore),
+    SLOT(MQXR_AFTER, MQXF_INQ, inqAfter, InqAfter),
+    SLOT(MQXR_BEFORE, MQXF_SET, setBefore, SetBefore),
+    SLOT(MQXR_AFTER, MQXF_SET, setAfter, SetAfter),
+    SLOT(MQXR_BEFORE, MQXF_CMIT, cmitBefore, CmitBefore),
+    SLOT(MQXR_AFTER, MQXF_CMIT, cmitAfter, CmitAfter),
+    SLOT(MQXR_BEFORE, MQXF_BACK, backBefore, BackBefore),
+    SLOT(MQXR_AFTER, MQXF_BACK, backAfter, BackAfter),
+    SLOT(MQXR_BEFORE, MQXF_STAT, statBefore, StatBefore),
+    SLOT(MQXR_AFTER, MQXF_STAT, statAfter, StatAfter),
+    SLOT(MQXR_CONNECTION, MQXF_TERM, terminate, Terminate),
+};
+
+// So we don't have to keep modifying the dlopen options
+#define DLOPEN(mod) dlopen(mod, RTLD_LOCAL | RTLD_NOW)
+
+// Try the same set of directories as MQ uses for exits, starting with the unqualified name
+// that takes account of LD_LIBRARY_PATH. A name that includes a directory is used as it is.
+static void *loadModule(const char *name, char *modname) {
+  void *h = NULL;
+  char *p;
+  char *p2;
+
+  snprintf(modname, PATH_MAX, "%s", name);
+  h = DLOPEN(modname);
+  if (!h && !strchr(name, '/')) {
+    snprintf(modname, PATH_MAX, "/var/mqm/%s/%s", EXITDIR, name);
+    h = DLOPEN(modname);
+
+    p = getenv("MQ_INSTALLATION_NAME");
+    if (!h && p) {
+      snprintf(modname, PATH_MAX, "/var/mqm/%s/%s/%s", EXITDIR, p, name);
+      h = DLOPEN(modname);
+    }
+
+    p = getenv("MQ_DATA_PATH");
+    if (!h && p) {
+      snprintf(modname, PATH_MAX, "%s/%s/%s", p, EXITDIR, name);
+      h = DLOPEN(modname);
+    }
+
+    p2 = getenv("MQ_INSTALLATION_NAME");
+    if (!h && p && p2) {
+      snprintf(modname, PATH_MAX, "%s/%s/%s/%s", p, EXITDIR, p2, name);
+      h = DLOPEN(modname);
+    }
+  }
+  return h;
+}
+
+// Load and initialise everything in the configured list, then build the call vectors.
+// Called with the lock held, and only until it has been done once.
+static void loadPlugins() {
+  char *e = getenv(ENV_PLUGINS);
+  char name[PATH_MAX];
+  char buf[128];
+  int i, s;
+
+  while (e && *e && pluginCount < MAX_PLUGINS) {
+    size_t l = strcspn(e, ",");
+    while (l > 0 && *e == ' ') {
+      e++;
+      l--;
+    }
+    size_t nl = l;
+    while (nl > 0 && e[nl - 1] == ' ') {
+      nl--;
+    }
+    if (nl > 0 && nl < sizeof(name)) {
+      muxPlugin *p = &plugins[pluginCount];
+      MQMUX_PLUGIN_FN *fn;
+
+      memcpy(name, e, nl);
+      name[nl] = 0;
+      memset(p, 0, sizeof(*p));
+
+      p->hdl = loadModule(name, p->name);
+      if (!p->hdl) {
+        rpt("WARNING: Cannot load \"%s\" because: %s", name, dlerror());
+      } else if ((fn = (MQMUX_PLUGIN_FN *)dlsym(p->hdl, MQMUX_PLUGIN_ENTRY)) == NULL) {
+        rpt("WARNING: Cannot find symbol %s in %s", MQMUX_PLUGIN_ENTRY, p->name);
+        dlclose(p->hdl);
+      } else {
+        p->fns.Version = MQMUX_PLUGIN_CURRENT_VERSION;
+        if (fn(&p->fns) != MQRC_NONE) {
+          rpt("WARNING: Plugin %s did not register", p->name);
+          dlclose(p->hdl);
+        } else {
+          MQLONG rc = MQRC_NONE;
+          if (!p->fns.Name) {
+            p->fns.Name = p->name;
+          }
+          buf[0] = 0;
+          if (p->fns.init) {
+            rc = p->fns.init(rpt, buf, sizeof(buf));
+            if (rc == MQRC_ALREADY_CONNECTED) {
+              rc = MQRC_NONE;
+            }
+          }
+          if (buf[0]) {
+            rpt("%s: %s", p->fns.Name, buf);
+          }
+          if (rc != MQRC_NONE) {
+            // Leave it loaded as the plugin might have started something, but don't call it
+            rpt("WARNING: Plugin %s failed to initialise. rc=%d", p->fns.Name, rc);
+          } else {
+            rpt("Loaded plugin %s from %s", p->fns.Name, p->name);
+            p->active = TRUE;
+          }
+          pluginCount++;
+        }
+      }
+    }
+    e += l;
+    if (*e == ',') {
+      e++;
+    }
+  }
+
+  // BEFORE vectors run in the configured order, AFTER and TERM vectors in reverse
+  for (s = 0; s < SLOT_COUNT; s++) {
+    chainLength[s] = 0;
+    for (i = 0; i < pluginCount; i++) {
+      int pi = (slots[s].reason == MQXR_BEFORE) ? i : (pluginCount - 1 - i);
+      PMQFUNC fn;
+      if (!plugins[pi].active) {
+        continue;
+      }
+      memcpy(&fn, (char *)&plugins[pi].fns + slots[s].offset, sizeof(fn));
+      if (fn) {
+        chains[s][chainLength[s]].fn = fn;
+        chains[s][chainLength[s]].plugin = pi;
+        chainLength[s]++;
+      }
+    }
+  }
+
+  loaded = TRUE;
+}
+
+/*********************************************************************/
+/* Initialisation function.                                          */
+/* This is called as an application connects to the queue manager.   */
+/*********************************************************************/
+void MQENTRY EntryPoint(PMQAXP pExitParms, PMQAXC pExitContext, PMQLONG pCompCode, PMQLONG pReason) {
+
+  char *f = getenv(ENV_LOGFILE);
+  char *msg = NULL;
+  int s;
+  MQLONG env = pExitContext->Environment;
+
+  pExitParms->ExitResponse = MQXCC_OK;
+
+  lock();
+
+  // The Initialisation routine is called for each MQCONN(X) but the plugins are only
+  // loaded once. The corresponding Terminate routine uses this count to know when to unload them.
+  initCount++;
+
+  if (!fp) {
+    if (f) {
+      if (!strcmp(f, "stdout")) {
+        fp = stdout;
+        closeFp = FALSE;
+      } else if (!strcmp(f, "stderr")) {
+        fp = stderr;
+        closeFp = FALSE;
+      } else {
+        fp = fopen(f, "a");
+      }
+      if (fp) {
+        setbuf(fp, NULL); /* try to reduce interleaved output; auto-flush */
+        rpt("Opened logfile %s", f);
+      } else {
+        pExitParms->ExitResponse = MQXCC_FAILED;
+        strncpy(pExitParms->ExitPDArea, "Cannot open logfile", sizeof(pExitParms->ExitPDArea));
+      }
+    }
+  }
+
+  if (pExitParms->ExitResponse != MQXCC_OK) {
+    // Couldn't open logfile, so error is directly reported above
+  } else if (pExitParms->APICallerType != MQXACT_EXTERNAL || env != MQXE_OTHER) {
+    msg = "MQMUX Exit: Not supported in qmgr processes";
+  } else {
+    if (!loaded) {
+      loadPlugins();
+    }
+
+    // Only the verbs that at least one plugin is interested in are registered. Terminate is
+    // always needed, to free the per-connection block.
+    for (s = 0; s < SLOT_COUNT; s++) {
+      if (chainLength[s] > 0 && s != SLOT_TERM) {
+        pExitParms->Hconfig->MQXEP_Call(pExitParms->Hconfig, slots[s].reason, slots[s].function, slots[s].hostFn, 0, pCompCode, pReason);
+      }
+    }
+    pExitParms->Hconfig->MQXEP_Call(pExitParms->Hconfig, MQXR_CONNECTION, MQXF_TERM, (PMQFUNC)Terminate, 0, pCompCode, pReason);
+  }
+
+  unlock();
+
+  if (msg != NULL) {
+    strncpy(pExitParms->ExitPDArea, msg, sizeof(pExitParms->ExitPDArea));
+    rpt(msg);
+  }
+
+  return;
+}
+
+// Called at the end of each connection, whether or not there was an MQDISC. The plugins
+// release their own state for the connection first. Process-wide cleanup waits for the last one.
+static void Terminate(PMQAXP pExitParms, PMQAXC pExitContext, PMQLONG pCompCode, PMQLONG pReason) {
+  muxConn *mc;
+  muxEntry *e;
+  int i;
+
+  memcpy(&mc, pExitParms->ExitUserArea, sizeof(mc));
+  if (mc) {
+    for (e = chains[SLOT_TERM]; e < chains[SLOT_TERM] + chainLength[SLOT_TERM]; e++) {
+      if (pluginEnter(pExitParms, mc, e->plugin)) {
+        ((MQ_TERM_EXIT *)e->fn)(pExitParms, pExitContext, pCompCode, pReason);
+        pluginLeave(pExitParms, mc, e->plugin);
+      }
+    }
+    free(mc);
+    memset(pExitParms->ExitUserArea, 0, sizeof(pExitParms->ExitUserArea));
+    pExitParms->ExitResponse = MQXCC_OK;
+  }
+
+  lock();
+
+  initCount--;
+  if (initCount <= 0) {
+    // Unload in the reverse order
+    for (i = pluginCount - 1; i >= 0; i--) {
+      if (plugins[i].active && plugins[i].fns.term) {
+        plugins[i].fns.term();
+      }
+      if (plugins[i].hdl) {
+        dlclose(plugins[i].hdl);
+      }
+    }
+    pluginCount = 0;
+    memset(chainLength, 0, sizeof(chainLength));
+    loaded = FALSE;
+
+    if (fp) {
+      fflush(fp);
+      if (closeFp) {
+        fclose(fp);
+      }
+      fp = NULL;
+    }
+    initCount = 0;
+  }
+  unlock();
+
+  return;
+}
+
+// Find the per-connection block, creating it on the first call for this hConn
+static muxConn *enterMux(PMQAXP pExitParms) {
+  muxConn *mc;
+  memcpy(&mc, pExitParms->ExitUserArea, sizeof(mc));
+  if (!mc) {
+    mc = (muxConn *)calloc(1, sizeof(muxConn));
+    if (mc) {
+      mc->stoppedFunction = -1;
+    }
+  }
+  if (mc) {
+    mc->response = MQXCC_OK;
+    // A stop from an earlier BEFORE whose AFTER never came must not hide plugins from this call
+    if (pExitParms->ExitReason == MQXR_BEFORE) {
+      mc->stoppedFunction = -1;
+    }
+  }
+  return mc;
+}
+
+// Put the host's view of the ExitUserArea back, and give MQ the combined response
+static void leaveMux(PMQAXP pExitParms, muxConn *mc) {
+  memset(pExitParms->ExitUserArea, 0, sizeof(pExitParms->ExitUserArea));
+  memcpy(pExitParms->ExitUserArea, &mc, sizeof(mc));
+  pExitParms->ExitResponse = mc->response;
+  if (pExitParms->ExitReason == MQXR_AFTER && mc->stoppedFunction == pExitParms->Function) {
+    mc->stoppedFunction = -1;
+  }
+}
+
+// Should this plugin be called now? If so, give it its own ExitUserArea.
+static int pluginEnter(PMQAXP pExitParms, muxConn *mc, int plugin) {
+  if (mc->disabled[plugin]) {
+    return FALSE;
+  }
+  if (pExitParms->ExitReason == MQXR_AFTER && mc->stoppedFunction == pExitParms->Function && plugin > mc->stoppedAt) {
+    return FALSE;
+  }
+  memcpy(pExitParms->ExitUserArea, mc->areas[plugin], sizeof(mc->areas[plugin]));
+  pExitParms->ExitResponse = MQXCC_OK;
+  return TRUE;
+}
+
+// Save the plugin's ExitUserArea and look at its response. Returns FALSE if no further
+// plugins should be called.
+static int pluginLeave(PMQAXP pExitParms, muxConn *mc, int plugin) {
+  MQLONG resp = pExitParms->ExitResponse;
+
+  memcpy(mc->areas[plugin], pExitParms->ExitUserArea, sizeof(mc->areas[plugin]));
+
+  switch (resp) {
+  case MQXCC_OK:
+    return TRUE;
+  case MQXCC_SUPPRESS_EXIT:
+    mc->disabled[plugin] = TRUE;
+    return TRUE;
+  default:
+    if (mc->response == MQXCC_OK) {
+      mc->response = resp;
+    }
+    if (pExitParms->ExitReason == MQXR_BEFORE) {
+      mc->stoppedFunction = pExitParms->Function;
+      mc->stoppedAt = plugin;
+      return FALSE;
+    }
+    return TRUE;
+  }
+}
+
+// The body of each host function: walk the precomputed vector for the slot
+#define DISPATCH(SLOT, TYPE, ARGS)                                                                                                                             \
+  {                                                                                                                                                            \
+    muxConn *mc = enterMux(pExitParms);                                                                                                                        \
+    muxEntry *e = chains[SLOT];                                                                                                                                \
+    muxEntry *end = e + chainLength[SLOT];                                                                                                                     \
+    if (mc) {                                                                                                                                                  \
+      for (; e < end; e++) {                                                                                                                                   \
+        if (pluginEnter(pExitParms, mc, e->plugin)) {                                                                                                          \
+          ((TYPE *)e->fn) ARGS;                                                                                                                                \
+          if (!pluginLeave(pExitParms, mc, e->plugin)) {                                                                                                       \
+            break;                                                                                                                                             \
+          }                                                                                                                                                    \
+        }                                                                                                                                                      \
+      }                                                                                                                                                        \
+      leaveMux(pExitParms, mc);                                                                                                                                \
+    }                                                                                                                                                          \
+  }
+
+static void MQENTRY ConnxAfter(PMQAXP pExitParms, PMQAXC pExitContext, PMQCHAR pQMgrName, PPMQCNO ppConnectOpts, PPMQHCONN ppHconn, PMQLONG pCompCode,
+                               PMQLONG pReason) {
+  DISPATCH(SLOT_CONNX_AFTER, MQ_CONNX_EXIT, (pExitParms, pExitContext, pQMgrName, ppConnectOpts, ppHconn, pCompCode, pReason));
+}
+
+static void MQENTRY DiscBefore(PMQAXP pExitParms, PMQAXC pExitContext, PPMQHCONN ppHconn, PMQLONG pCompCode, PMQLONG pReason) {
+  DISPATCH(SLOT_DISC_BEFORE, MQ_DISC_EXIT, (pExitParms, pExitContext, ppHconn, pCompCode, pReason));
+}
+
+static void MQENTRY DiscAfter(PMQAXP pExitParms, PMQAXC pExitContext, PPMQHCONN ppHconn, PMQLONG pCompCode, PMQLONG pReason) {
+  DISPATCH(SLOT_DISC_AFTER, MQ_DISC_EXIT, (pExitParms, pExitContext, ppHconn, pCompCode, pReason));
+}
+
+static void MQENTRY OpenBefore(PMQAXP pExitParms, PMQAXC pExitContext, PMQHCONN pHconn, PPMQOD ppObjDesc, PMQLONG pOptions, PPMQHOBJ ppHobj,
+                               PMQLONG pCompCode, PMQLONG pReason) {
+  DISPATCH(SLOT_OPEN_BEFORE, MQ_OPEN_EXIT, (pExitParms, pExitContext, pHconn, ppObjDesc, pOptions, ppHobj, pCompCode, pReason));
+}
+
+static void MQENTRY OpenAfter(PMQAXP pExitParms, PMQAXC pExitContext, PMQHCONN pHconn, PPMQOD ppObjDesc, PMQLONG pOptions, PPMQHOBJ ppHobj,
+                              PMQLONG pCompCode, PMQLONG pReason) {
+  DISPATCH(SLOT_OPEN_AFTER, MQ_OPEN_EXIT, (pExitParms, pExitContext, pHconn, ppObjDesc, pOptions, ppHobj, pCompCode, pReason));
+}
+
+static void MQENTRY CloseBefore(PMQAXP pExitParms, PMQAXC pExitContext, PMQHCONN pHconn, PPMQHOBJ ppHobj, PMQLONG pOptions, PMQLONG pCompCode,
+                                PMQLONG pReason) {
+  DISPATCH(SLOT_CLOSE_BEFORE, MQ_CLOSE_EXIT, (pExitParms, pExitContext, pHconn, ppHobj, pOptions, pCompCode, pReason));
+}
+
+static void MQENTRY CloseAfter(PMQAXP pExitParms, PMQAXC pExitContext, PMQHCONN pHconn, PPMQHOBJ ppHobj, PMQLONG pOptions, PMQLONG pCompCode,
+                               PMQLONG pReason) {
+  DISPATCH(SLOT_CLOSE_AFTER, MQ_CLOSE_EXIT, (pExitParms, pExitContext, pHconn, ppHobj, pOptions, pCompCode, pReason));
+}
+
+static void MQENTRY PutBefore(PMQAXP pExitParms, PMQAXC pExitContext, PMQHCONN pHconn, PMQHOBJ pHobj, PPMQMD ppMsgDesc, PPMQPMO ppPutMsgOpts,
+                              PMQLONG pBufferLength, PPMQVOID ppBuffer, PMQLONG pCompCode, PMQLONG pReason) {
+  DISPATCH(SLOT_PUT_BEFORE, MQ_PUT_EXIT, (pExitParms, pExitContext, pHconn, pHobj, ppMsgDesc, ppPutMsgOpts, pBufferLength, ppBuffer, pCompCode, pReason));
+}
+
+static void MQENTRY PutAfter(PMQAXP pExitParms, PMQAXC pExitContext, PMQHCONN pHconn, PMQHOBJ pHobj, PPMQMD ppMsgDesc, PPMQPMO ppPutMsgOpts,
+                             PMQLONG pBufferLength, PPMQVOID ppBuffer, PMQLONG pCompCode, PMQLONG pReason) {
+  DISPATCH(SLOT_PUT_AFTER, MQ_PUT_EXIT, (pExitParms, pExitContext, pHconn, pHobj, ppMsgDesc, ppPutMsgOpts, pBufferLength, ppBuffer, pCompCode, pReason));
+}
+
+static void MQENTRY Put1Before(PMQAXP pExitParms, PMQAXC pExitContext, PMQHCONN pHconn, PPMQOD ppObjDesc, PPMQMD ppMsgDesc, PPMQPMO ppPutMsgOpts,
+                               PMQLONG pBufferLength, PPMQVOID ppBuffer, PMQLONG pCompCode, PMQLONG pReason) {
+  DISPATCH(SLOT_PUT1_BEFORE, MQ_PUT1_EXIT, (pExitParms, pExitContext, pHconn, ppObjDesc, ppMsgDesc, ppPutMsgOpts, pBufferLength, ppBuffer, pCompCode, pReason));
+}
+
+static void MQENTRY Put1After(PMQAXP pExitParms, PMQAXC pExitContext, PMQHCONN pHconn, PPMQOD ppObjDesc, PPMQMD ppMsgDesc, PPMQPMO ppPutMsgOpts,
+                              PMQLONG pBufferLength, PPMQVOID ppBuffer, PMQLONG pCompCode, PMQLONG pReason) {
+  DISPATCH(SLOT_PUT1_AFTER, MQ_PUT1_EXIT, (pExitParms, pExitContext, pHconn, ppObjDesc, ppMsgDesc, ppPutMsgOpts, pBufferLength, ppBuffer, pCompCode, pReason));
+}
+
+static void MQENTRY GetBefore(PMQAXP pExitParms, PMQAXC pExitContext, PMQHCONN pHconn, PMQHOBJ pHobj, PPMQMD ppMsgDesc, PPMQGMO ppGetMsgOpts,
+                              PMQLONG pBufferLength, PPMQVOID ppBuffer, PPMQLONG ppDataLength, PMQLONG pCompCode, PMQLONG pReason) {
+  DISPATCH(SLOT_GET_BEFORE, MQ_GET_EXIT,
+           (pExitParms, pExitContext, pHconn, pHobj, ppMsgDesc, ppGetMsgOpts, pBufferLength, ppBuffer, ppDataLength, pCompCode, pReason));
+}
+
+static void MQENTRY GetAfter(PMQAXP pExitParms, PMQAXC pExitContext, PMQHCONN pHconn, PMQHOBJ pHobj, PPMQMD ppMsgDesc, PPMQGMO ppGetMsgOpts,
+                             PMQLONG pBufferLength, PPMQVOID ppBuffer, PPMQLONG ppDataLength, PMQLONG pCompCode, PMQLONG pReason) {
+  DISPATCH(SLOT_GET_AFTER, MQ_GET_EXIT,
+           (pExitParms, pExitContext, pHconn, pHobj, ppMsgDesc, ppGetMsgOpts, pBufferLength, ppBuffer, ppDataLength, pCompCode, pReason));
+}
+
+static void MQENTRY CBBefore(PMQAXP pExitParms, PMQAXC pExitContext, PMQHCONN pHconn, PMQLONG pOperation, PPMQCBD ppCallbackDesc, PMQHOBJ pHobj,
+                             PPMQMD ppMsgDesc, PPMQGMO ppGetMsgOpts, PMQLONG pCompCode, PMQLONG pReason) {
+  DISPATCH(SLOT_CB_BEFORE, MQ_CB_EXIT, (pExitParms, pExitContext, pHconn, pOperation, ppCallbackDesc, pHobj, ppMsgDesc, ppGetMsgOpts, pCompCode, pReason));
+}
+
+static void MQENTRY CBAfter(PMQAXP pExitParms, PMQAXC pExitContext, PMQHCONN pHconn, PMQLONG pOperation, PPMQCBD ppCallbackDesc, PMQHOBJ pHobj,
+                            PPMQMD ppMsgDesc, PPMQGMO ppGetMsgOpts, PMQLONG pCompCode, PMQLONG pReason) {
+  DISPATCH(SLOT_CB_AFTER, MQ_CB_EXIT, (pExitParms, pExitContext, pHconn, pOperation, ppCallbackDesc, pHobj, ppMsgDesc, ppGetMsgOpts, pCompCode, pReason));
+}
+
+static void MQENTRY CallbackBefore(PMQAXP pExitParms, PMQAXC pExitContext, PMQHCONN pHconn, PPMQMD ppMsgDesc, PPMQGMO ppGetMsgOpts, PPMQVOID ppBuffer,
+                                   PPMQCBC ppMQCBContext) {
+  DISPATCH(SLOT_CALLBACK_BEFORE, MQ_CALLBACK_EXIT, (pExitParms, pExitContext, pHconn, ppMsgDesc, ppGetMsgOpts, ppBuffer, ppMQCBContext));
+}
+
+static void MQENTRY CallbackAfter(PMQAXP pExitParms, PMQAXC pExitContext, PMQHCONN pHconn, PPMQMD ppMsgDesc, PPMQGMO ppGetMsgOpts, PPMQVOID ppBuffer,
+                                  PPMQCBC ppMQCBContext) {
+  DISPATCH(SLOT_CALLBACK_AFTER, MQ_CALLBACK_EXIT, (pExitParms, pExitContext, pHconn, ppMsgDesc, ppGetMsgOpts, ppBuffer, ppMQCBContext));
+}
+
+static void MQENTRY InqBefore(PMQAXP pExitParms, PMQAXC pExitContext, PMQHCONN pHconn, PMQHOBJ pHobj, PMQLONG pSelectorCount, PPMQLONG ppSelectors,
+                              PMQLONG pIntAttrCount, PPMQLONG ppIntAttrs, PMQLONG pCharAttrLength, PPMQCHAR ppCharAttrs, PMQLONG pCompCode, PMQLONG pReason) {
+  DISPATCH(SLOT_INQ_BEFORE, MQ_INQ_EXIT,
+           (pExitParms, pExitContext, pHconn, pHobj, pSelectorCount, ppSelectors, pIntAttrCount, ppIntAttrs, pCharAttrLength, ppCharAttrs, pCompCode, pReason));
+}
+
+static void MQENTRY InqAfter(PMQAXP pExitParms, PMQAXC pExitContext, PMQHCONN pHconn, PMQHOBJ pHobj, PMQLONG pSelectorCount, PPMQLONG ppSelectors,
+                             PMQLONG pIntAttrCount, PPMQLONG ppIntAttrs, PMQLONG pCharAttrLength, PPMQCHAR ppCharAttrs, PMQLONG pCompCode, PMQLONG pReason) {
+  DISPATCH(SLOT_INQ_AFTER, MQ_INQ_EXIT,
+           (pExitParms, pExitContext, pHconn, pHobj, pSelectorCount, ppSelectors, pIntAttrCount, ppIntAttrs, pCharAttrLength, ppCharAttrs, pCompCode, pReason));
+}
+
+static void MQENTRY SetBefore(PMQAXP pExitParms, PMQAXC pExitContext, PMQHCONN pHconn, PMQHOBJ pHobj, PMQLONG pSelectorCount, PPMQLONG ppSelectors,
+                              PMQLONG pIntAttrCount, PPMQLONG ppIntAttrs, PMQLONG pCharAttrLength, PPMQCHAR ppCharAttrs, PMQLONG pCompCode, PMQLONG pReason) {
+  DISPATCH(SLOT_SET_BEFORE, MQ_SET_EXIT,
+           (pExitParms, pExitContext, pHconn, pHobj, pSelectorCount, ppSelectors, pIntAttrCount, ppIntAttrs, pCharAttrLength, ppCharAttrs, pCompCode, pReason));
+}
+
+static void MQENTRY SetAfter(PMQAXP pExitParms, PMQAXC pExitContext, PMQHCONN pHconn, PMQHOBJ pHobj, PMQLONG pSelectorCount, PPMQLONG ppSelectors,
+                             PMQLONG pIntAttrCount, PPMQLONG ppIntAttrs, PMQLONG pCharAttrLength, PPMQCHAR ppCharAttrs, PMQLONG pCompCode, PMQLONG pReason) {
+  DISPATCH(SLOT_SET_AFTER, MQ_SET_EXIT,
+           (pExitParms, pExitContext, pHconn, pHobj, pSelectorCount, ppSelectors, pIntAttrCount, ppIntAttrs, pCharAttrLength, ppCharAttrs, pCompCode, pReason));
+}
+
+static void MQENTRY CmitBefore(PMQAXP pExitParms, PMQAXC pExitContext, PMQHCONN pHconn, PMQLONG pCompCode, PMQLONG pReason) {
+  DISPATCH(SLOT_CMIT_BEFORE, MQ_CMIT_EXIT, (pExitParms, pExitContext, pHconn, pCompCode, pReason));
+}
+
+static void MQENTRY CmitAfter(PMQAXP pExitParms, PMQAXC pExitContext, PMQHCONN pHconn, PMQLONG pCompCode, PMQLONG pReason) {
+  DISPATCH(SLOT_CMIT_AFTER, MQ_CMIT_EXIT, (pExitParms, pExitContext, pHconn, pCompCode, pReason));
+}
+
+static void MQENTRY BackBefore(PMQAXP pExitParms, PMQAXC pExitContext, PMQHCONN pHconn, PMQLONG pCompCode, PMQLONG pReason) {
+  DISPATCH(SLOT_BACK_BEFORE, MQ_BACK_EXIT, (pExitParms, pExitContext, pHconn, pCompCode, pReason));
+}
+
+static void MQENTRY BackAfter(PMQAXP pExitParms, PMQAXC pExitContext, PMQHCONN pHconn, PMQLONG pCompCode, PMQLONG pReason) {
+  DISPATCH(SLOT_BACK_AFTER, MQ_BACK_EXIT, (pExitParms, pExitContext, pHconn, pCompCode, pReason));
+}
+
+static void MQENTRY StatBefore(PMQAXP pExitParms, PMQAXC pExitContext, PMQHCONN pHconn, PMQLONG pType, PPMQSTS ppStatus, PMQLONG pCompCode, PMQLONG pReason) {
+  DISPATCH(SLOT_STAT_BEFORE, MQ_STAT_EXIT, (pExitParms, pExitContext, pHconn, pType, ppStatus, pCompCode, pReason));
+}
+
+static void MQENTRY StatAfter(PMQAXP pExitParms, PMQAXC pExitContext, PMQHCONN pHconn, PMQLONG pType, PPMQSTS ppStatus, PMQLONG pCompCode, PMQLONG pReason) {
+  DISPATCH(SLOT_STAT_AFTER, MQ_STAT_EXIT, (pExitParms, pExitContext, pHconn, pType, ppStatus, pCompCode, pReason));
+}
+
+// Simple logger - also passed to the plugins
+static void rpt(char *fmt, ...) {
+  va_list va;
+  va_start(va, fmt);
+  int l;
+  if (fp) {
+    fprintf(fp, "MQMUX Exit: ");
+    vfprintf(fp, fmt, va);
+    l = strlen(fmt);
+    if (l > 0 && fmt[l - 1] != '\n') {
+      fprintf(fp, "\n");
+    }
+  }
+  va_end(va);
+}
@@ -0,0 +1,108 @@
+/*
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+  Copyright (c) IBM Corporation 2024
+*/
+
+#ifndef _MQMUX_H
+#define _MQMUX_H
+
+// The interface between the mqmux API exit and the plugin modules that it loads.
+//
+// A plugin exports a function called MqmuxPlugin. The host calls it once, after loading the
+// module, with a zeroed mqmuxPlugin structure whose Version field says which level the host
+// understands. The plugin fills in its name, and a function pointer for each verb and phase
+// that it wants to see, and returns MQRC_NONE. Anything left NULL is not called.
+//
+// The exit functions have exactly the same signatures as those registered with MQXEP, so a
+// module can be written to work both under the host and as an API exit in its own right. The
+// ExitUserArea seen by a plugin belongs to that plugin alone, just as it would if it was
+// configured as a separate exit.
+
+#include <stddef.h>
+
+#include <cmqc.h>
+#include <cmqxc.h>
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+#define MQMUX_PLUGIN_ENTRY "MqmuxPlugin"
+
+#define MQMUX_PLUGIN_VERSION_1 1
+#define MQMUX_PLUGIN_VERSION_2 2 // Adds terminate
+#define MQMUX_PLUGIN_CURRENT_VERSION MQMUX_PLUGIN_VERSION_2
+
+// Logging function provided by the host
+typedef void MQMUX_RPT(char *fmt, ...);
+
+// Called once per process before any exit function, and once after the last connection ends.
+// The init function can put a message in the buffer for the host to log. A non-zero return
+// means that the plugin is not used; MQRC_ALREADY_CONNECTED is treated as success.
+typedef MQLONG MQMUX_INIT(MQMUX_RPT *rpt, char *msg, size_t msgLength);
+typedef void MQMUX_TERM(void);
+
+typedef struct {
+  MQLONG Version;
+  const char *Name;
+
+  MQMUX_INIT *init;
+  MQMUX_TERM *term;
+
+  MQ_CONNX_EXIT *connxAfter;
+  MQ_DISC_EXIT *discBefore;
+  MQ_DISC_EXIT *discAfter;
+
+  MQ_OPEN_EXIT *openBefore;
+  MQ_OPEN_EXIT *openAfter;
+  MQ_CLOSE_EXIT *closeBefore;
+  MQ_CLOSE_EXIT *closeAfter;
+
+  MQ_PUT_EXIT *putBefore;
+  MQ_PUT_EXIT *putAfter;
+  MQ_PUT1_EXIT *put1Before;
+  MQ_PUT1_EXIT *put1After;
+
+  MQ_GET_EXIT *getBefore;
+  MQ_GET_EXIT *getAfter;
+  MQ_CB_EXIT *cbBefore;
+  MQ_CB_EXIT *cbAfter;
+  MQ_CALLBACK_EXIT *callbackBefore;
+  MQ_CALLBACK_EXIT *callbackAfter;
+
+  MQ_INQ_EXIT *inqBefore;
+  MQ_INQ_EXIT *inqAfter;
+  MQ_SET_EXIT *setBefore;
+  MQ_SET_EXIT *setAfter;
+
+  MQ_CMIT_EXIT *cmitBefore;
+  MQ_CMIT_EXIT *cmitAfter;
+  MQ_BACK_EXIT *backBefore;
+  MQ_BACK_EXIT *backAfter;
+  MQ_STAT_EXIT *statBefore;
+  MQ_STAT_EXIT *statAfter;
+
+  // From MQMUX_PLUGIN_VERSION_2. Called at the end of every connection, including one that ends
+  // without an MQDISC, so that per-connection state can be released. Plugins are called in the
+  // reverse order. The connection may no longer be usable, so any MQI call made here can fail.
+  MQ_TERM_EXIT *terminate;
+} mqmuxPlugin;
+
+typedef MQLONG MQMUX_PLUGIN_FN(mqmuxPlugin *plugin);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif
@@ -0,0 +1,192 @@
+/*
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+  Copyright (c) IBM Corporation 2024
+*/
+
+#ifndef _MQMUX_PLUGIN_HPP
+#define _MQMUX_PLUGIN_HPP
+
+// Helpers shared by the C++ plugins that run under the mqmux exit. Everything here is inline or
+// static, so each plugin module gets its own copy and there is nothing extra to link.
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include <cmqc.h>
+#include <cmqxc.h>
+
+#include "mqmux.h"
+
+namespace mqmux {
+
+// Set from the init function, using the host's logger. These are static rather than inline:
+// inline variables are unique symbols, which the loader shares between every plugin in the
+// process even though the host loads them with RTLD_LOCAL.
+static MQMUX_RPT *rptFn = NULL;
+static const char *rptPrefix = "";
+
+inline void rpt(const char *fmt, ...) {
+  char buf[512];
+  va_list va;
+  if (!rptFn) {
+    return;
+  }
+  va_start(va, fmt);
+  vsnprintf(buf, sizeof(buf), fmt, va);
+  va_end(va);
+  rptFn((char *)"%s%s", rptPrefix, buf);
+}
+
+inline void rptmqrc(const char *verb, MQLONG cc, MQLONG rc) {
+  rpt("%s: CC=%d RC=%d", verb, cc, rc);
+}
+
+// Microseconds from a monotonic clock
+inline unsigned long long now() {
+  return (unsigned long long)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Numeric configuration, with a default for anything missing or out of range
+inline long envLong(const char *name, long dflt, long min, long max) {
+  const char *e = getenv(name);
+  if (e && *e) {
+    char *end;
+    long v = strtol(e, &end, 10);
+    if (*end == 0 && v >= min && v <= max) {
+      return v;
+    }
+    rpt("Ignoring %s=%s", name, e);
+  }
+  return dflt;
+}
+
+// Length of a blank-padded MQ name
+inline size_t nameLength(const MQCHAR *name, size_t max) {
+  size_t l = strnlen(name, max);
+  while (l > 0 && name[l - 1] == ' ') {
+    l--;
+  }
+  return l;
+}
+
+// One entry from a list of queues such as "APP.OUT.*:4,OTHER.Q". A trailing '*' matches any
+// name starting with what comes before it. The number after the ':' is a limit whose meaning
+// is up to the plugin.
+struct queueRule {
+  std::string name;
+  bool prefix;
+  long limit;
+};
+
+class queueList {
+public:
+  // Returns the number of rules. Entries that can't be used are reported and skipped.
+  size_t parse(const char *e, long defaultLimit) {
+    rules.clear();
+    while (e && *e) {
+      size_t l = strcspn(e, ",");
+      std::string entry(e, l);
+      size_t first = entry.find_first_not_of(' ');
+      size_t last = entry.find_last_not_of(' ');
+
+      if (first != std::string::npos) {
+        queueRule r;
+        entry = entry.substr(first, last - first + 1);
+        r.limit = defaultLimit;
+
+        size_t colon = entry.find(':');
+        if (colon != std::string::npos) {
+          char *end;
+          std::string lim = entry.substr(colon + 1);
+          r.limit = strtol(lim.c_str(), &end, 10);
+          if (lim.empty() || *end != 0 || r.limit < 0) {
+            rpt("Ignoring queue entry %s", entry.c_str());
+            r.name = "";
+          } else {
+            r.name = entry.substr(0, colon);
+          }
+        } else {
+          r.name = entry;
+        }
+
+        r.prefix = (!r.name.empty() && r.name.back() == '*');
+        if (r.prefix) {
+          r.name.pop_back();
+        }
+        if (r.name.length() > MQ_Q_NAME_LENGTH) {
+          rpt("Ignoring queue entry %s", entry.c_str());
+        } else if (!r.name.empty() || r.prefix) {
+          rules.push_back(r);
+        }
+      }
+      e += l;
+      if (*e == ',') {
+        e++;
+      }
+    }
+    return rules.size();
+  }
+
+  // The first rule that matches the blank-padded name, or NULL
+  const queueRule *find(const MQCHAR *name) const {
+    size_t l = nameLength(name, MQ_Q_NAME_LENGTH);
+    for (const queueRule &r : rules) {
+      if (r.prefix ? (l >= r.name.length() && !memcmp(name, r.name.data(), r.name.length())) : (l == r.name.length() && !memcmp(name, r.name.data(), l))) {
+        return &r;
+      }
+    }
+    return NULL;
+  }
+
+  bool empty() const { return rules.empty(); }
+  const std::vector<queueRule> &all() const { return rules; }
+
+private:
+  std::vector<queueRule> rules;
+};
+
+// Per-connection state for a plugin, found through a pointer in its ExitUserArea. The area is
+// zeroed by the queue manager (or the mqmux host) before the first call on each hConn.
+template <class T> T *findConn(PMQAXP pExitParms) {
+  T *s;
+  memcpy(&s, pExitParms->ExitUserArea, sizeof(s));
+  return s;
+}
+
+template <class T> T *getConn(PMQAXP pExitParms) {
+  T *s = findConn<T>(pExitParms);
+  if (!s) {
+    s = new T();
+    memcpy(pExitParms->ExitUserArea, &s, sizeof(s));
+  }
+  return s;
+}
+
+template <class T> void freeConn(PMQAXP pExitParms) {
+  T *s = findConn<T>(pExitParms);
+  if (s) {
+    delete s;
+    memset(pExitParms->ExitUserArea, 0, sizeof(pExitParms->ExitUserArea));
+  }
+}
+
+} // namespace mqmux
+
+#endif
@@ -27,6 +27,8 @@
 #include <cmqec.h>
 #include <cmqxc.h>
 
+#include "mqiotel_entry.h"
+
 #ifndef TRUE
 #define TRUE (1)
 #endif
@@ -39,7 +41,7 @@
 #define PATH_MAX 256
 #endif
 
-static void rpt(char *fmt, ...);
+static void rpt(const char *fmt, ...);
 
 FILE *fp = NULL;
 int closeFp = TRUE;
@@ -52,8 +54,13 @@ static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
 static void *hdl = NULL;
 static int initCount = 0;
 
-typedef MQLONG OTEL_INIT(void *, char *, size_t);
-typedef void OTEL_TERM();
+// The static build hides everything except the entrypoints that MQ looks for. The OTel
+// functions then come from this module instead of being found in mqioteldl.so.
+#if defined(__GNUC__)
+#define EXIT_EXPORT __attribute__((visibility("default")))
+#else
+#define EXIT_EXPORT
+#endif
 
 #if defined MQ_64_BIT
 #define BITNESS 64
@@ -65,7 +72,7 @@ typedef void OTEL_TERM();
 /* Standard MQ Entrypoint. Not directly used, but                    */
 /* required by some platforms.                                       */
 /*********************************************************************/
-void *MQStart() { return 0; }
+EXIT_EXPORT void *MQStart() { return 0; }
 
 static void lock() { pthread_mutex_lock(&mutex); }
 static void unlock() { pthread_mutex_unlock(&mutex); }
@@ -74,7 +81,7 @@ static void unlock() { pthread_mutex_unlock(&mutex); }
 /* Declare internal functions. All except the                        */
 /* entrypoint can be static as they're not used by any other module. */
 /*********************************************************************/
-MQ_INIT_EXIT EntryPoint;
+EXIT_EXPORT MQ_INIT_EXIT EntryPoint;
 static MQ_TERM_EXIT Terminate;
 static MQ_PUT_EXIT PutBefore;
 static MQ_PUT_EXIT PutAfter;
@@ -84,37 +91,51 @@ static MQ_PUT1_EXIT Put1After;
 static MQ_GET_EXIT GetBefore;
 static MQ_GET_EXIT GetAfter;
 static MQ_CB_EXIT CBBefore;
+static MQ_CB_EXIT CBAfter;
 static MQ_CALLBACK_EXIT CallbackBefore;
 
+static MQ_OPEN_EXIT OpenBefore;
 static MQ_OPEN_EXIT OpenAfter;
 static MQ_CLOSE_EXIT CloseAfter;
 
 static MQ_DISC_EXIT DiscBefore;
+static MQ_CONNX_EXIT ConnxAfter;
 
 // These are function pointers to the dynamically loaded OTel module
 struct {
   OTEL_INIT *init;
   OTEL_TERM *term;
 
+  MQ_OPEN_EXIT *openBefore;
   MQ_OPEN_EXIT *openAfter;
   MQ_CLOSE_EXIT *closeAfter;
   MQ_DISC_EXIT *discBefore;
+  MQ_CONNX_EXIT *connxAfter;
+  MQ_TERM_EXIT *terminate;
 
   MQ_PUT_EXIT *putBefore;
   MQ_PUT_EXIT *putAfter;
+  MQ_PUT1_EXIT *put1Before;
 
   MQ_GET_EXIT *getBefore;
   MQ_GET_EXIT *getAfter;
+  MQ_CB_EXIT *cbBefore;
+  MQ_CB_EXIT *cbAfter;
 } ot;
 
+#if defined MQIOTEL_STATIC
+// Everything is linked into this one module, so the functions can be used directly
+#define DLSYM(FUNC, Name) FUNC = Name
+#else
 #define DLSYM(FUNC, Name)                                                                                                                                      \
   {                                                                                                                                                            \
-    FUNC = (void *)dlsym(hdl, Name);                                                                                                                           \
+    FUNC = (void *)dlsym(hdl, #Name);                                                                                                                          \
     if (FUNC == NULL) {                                                                                                                                        \
-      rpt("Cannot find symbol %s", Name);                                                                                                                      \
+      rpt("Cannot find symbol %s", #Name);                                                                                                                     \
       rc++;                                                                                                                                                    \
     }                                                                                                                                                          \
   }
+#endif
 
 // So we don't have to keep modifying the dlopen options
 #define DLOPEN(mod) dlopen(mod, RTLD_LOCAL | RTLD_NOW)
@@ -126,10 +147,12 @@ struct {
 void MQENTRY EntryPoint(PMQAXP pExitParms, PMQAXC pExitContext, PMQLONG pCompCode, PMQLONG pReason) {
 
   char *f = getenv(ENV_LOGFILE);
+#if !defined MQIOTEL_STATIC
   char modname[PATH_MAX];
+  char *p;
+#endif
 
   int rc = 0;
-  char *p;
   char *msg = NULL;
   MQLONG env = pExitContext->Environment;
 
@@ -181,6 +204,10 @@ void MQENTRY EntryPoint(PMQAXP pExitParms, PMQAXC pExitContext, PMQLONG pCompCod
   } else {
     lock();
 
+#if defined MQIOTEL_STATIC
+    // Nothing to load. Use the handle only as a flag that the functions are available.
+    hdl = (void *)&ot;
+#else
     // Use dlopen to pull in the real exit module. Try a number of standard paths, starting
     // with the unqualified version that takes account of LD_LIBRARY_PATH
     if (!hdl) {
@@ -222,23 +249,31 @@ void MQENTRY EntryPoint(PMQAXP pExitParms, PMQAXC pExitContext, PMQLONG pCompCod
       rpt("Already loaded %s", DLMODULE);
     }
 
+#endif
+
     if (!hdl) {
       // Continue, even if we can't load the OTel module. Don't set any error.
       rpt("WARNING: Cannot load \"%s\" because: %s", DLMODULE, dlerror());
     } else {
       // Fill in the indirect function pointers
 
-      DLSYM(ot.init, "mqotInit"); // Any initialisation needed?
-      DLSYM(ot.term, "mqotTerm"); // Any initialisation needed?
+      DLSYM(ot.init, mqotInit); // Any initialisation needed?
+      DLSYM(ot.term, mqotTerm); // Any initialisation needed?
 
-      DLSYM(ot.openAfter, "mqotOpenAfter");
-      DLSYM(ot.closeAfter, "mqotCloseAfter");
-      DLSYM(ot.discBefore, "mqotDiscBefore");
+      DLSYM(ot.openBefore, mqotOpenBefore);
+      DLSYM(ot.openAfter, mqotOpenAfter);
+      DLSYM(ot.closeAfter, mqotCloseAfter);
+      DLSYM(ot.discBefore, mqotDiscBefore);
+      DLSYM(ot.connxAfter, mqotConnxAfter);
+      DLSYM(ot.terminate, mqotTerminate);
 
-      DLSYM(ot.putBefore, "mqotPutBefore");
-      DLSYM(ot.putAfter, "mqotPutAfter");
-      DLSYM(ot.getBefore, "mqotGetBefore");
-      DLSYM(ot.getAfter, "mqotGetAfter");
+      DLSYM(ot.putBefore, mqotPutBefore);
+      DLSYM(ot.putAfter, mqotPutAfter);
+      DLSYM(ot.put1Before, mqotPut1Before);
+      DLSYM(ot.getBefore, mqotGetBefore);
+      DLSYM(ot.getAfter, mqotGetAfter);
+      DLSYM(ot.cbBefore, mqotCBBefore);
+      DLSYM(ot.cbAfter, mqotCBAfter);
 
       // Do any initialisation. Pass a reference to the logging output function.
       char buf[128]; // May be longer than PD Areab
@@ -254,6 +289,7 @@ void MQENTRY EntryPoint(PMQAXP pExitParms, PMQAXC pExitContext, PMQLONG pCompCod
     // Only insert our code if the init was successful. Otherwise we will not actually report the error
     /// so that apps that don't match our requirements can still work with this qmgr albeit uninstrumented.
     if (rc == 0) {
+      pExitParms->Hconfig->MQXEP_Call(pExitParms->Hconfig, MQXR_BEFORE, MQXF_OPEN, (PMQFUNC)OpenBefore, 0, pCompCode, pReason);
       pExitParms->Hconfig->MQXEP_Call(pExitParms->Hconfig, MQXR_AFTER, MQXF_OPEN, (PMQFUNC)OpenAfter, 0, pCompCode, pReason);
       pExitParms->Hconfig->MQXEP_Call(pExitParms->Hconfig, MQXR_AFTER, MQXF_CLOSE, (PMQFUNC)CloseAfter, 0, pCompCode, pReason);
       pExitParms->Hconfig->MQXEP_Call(pExitParms->Hconfig, MQXR_BEFORE, MQXF_PUT, (PMQFUNC)PutBefore, 0, pCompCode, pReason);
@@ -263,8 +299,10 @@ void MQENTRY EntryPoint(PMQAXP pExitParms, PMQAXC pExitContext, PMQLONG pCompCod
       pExitParms->Hconfig->MQXEP_Call(pExitParms->Hconfig, MQXR_BEFORE, MQXF_GET, (PMQFUNC)GetBefore, 0, pCompCode, pReason);
       pExitParms->Hconfig->MQXEP_Call(pExitParms->Hconfig, MQXR_AFTER, MQXF_GET, (PMQFUNC)GetAfter, 0, pCompCode, pReason);
       pExitParms->Hconfig->MQXEP_Call(pExitParms->Hconfig, MQXR_BEFORE, MQXF_CB, (PMQFUNC)CBBefore, 0, pCompCode, pReason);
+      pExitParms->Hconfig->MQXEP_Call(pExitParms->Hconfig, MQXR_AFTER, MQXF_CB, (PMQFUNC)CBAfter, 0, pCompCode, pReason);
       pExitParms->Hconfig->MQXEP_Call(pExitParms->Hconfig, MQXR_BEFORE, MQXF_CALLBACK, (PMQFUNC)CallbackBefore, 0, pCompCode, pReason);
       pExitParms->Hconfig->MQXEP_Call(pExitParms->Hconfig, MQXR_AFTER, MQXF_DISC, (PMQFUNC)DiscBefore, 0, pCompCode, pReason);
+      pExitParms->Hconfig->MQXEP_Call(pExitParms->Hconfig, MQXR_AFTER, MQXF_CONNX, (PMQFUNC)ConnxAfter, 0, pCompCode, pReason);
       pExitParms->Hconfig->MQXEP_Call(pExitParms->Hconfig, MQXR_CONNECTION, MQXF_TERM, (PMQFUNC)Terminate, 0, pCompCode, pReason);
     }
 
@@ -290,6 +328,11 @@ static void Terminate(PMQAXP pExitParms, PMQAXC pExitContext, PMQLONG pCompCode,
 
   rpt("Terminate: initCount=%d", initCount);
 
+  // Per-connection cleanup, in case there was no MQDISC
+  if (hdl && ot.terminate) {
+    ot.terminate(pExitParms, pExitContext, pCompCode, pReason);
+  }
+
   initCount--;
   if (initCount <= 0) {
 
@@ -306,7 +349,9 @@ static void Terminate(PMQAXP pExitParms, PMQAXC pExitContext, PMQLONG pCompCode,
     }
 
     if (hdl) {
+#if !defined MQIOTEL_STATIC
       dlclose(hdl);
+#endif
       hdl = NULL;
     }
     initCount = 0;
@@ -318,6 +363,14 @@ static void Terminate(PMQAXP pExitParms, PMQAXC pExitContext, PMQLONG pCompCode,
 
 // These functions are minimal - they pass parameters to the real work in the dynamically-loaded module.
 // It also allows some of the operations to share - so Put and Put1 both do the same thing in the OTel processing
+static void MQENTRY OpenBefore(PMQAXP pExitParms, PMQAXC pExitContext, PMQHCONN pHconn, PPMQOD ppObjDesc, PMQLONG pOptions, PPMQHOBJ ppHobj,
+                               PMQLONG pCompCode, PMQLONG pReason) {
+  if (ot.openBefore) {
+    ot.openBefore(pExitParms, pExitContext, pHconn, ppObjDesc, pOptions, ppHobj, pCompCode, pReason);
+  }
+  return;
+}
+
 static void OpenAfter(PMQAXP pExitParms, PMQAXC pExitContext, PMQHCONN pHconn, PPMQOD ppObjDesc, PMQLONG pOptions, PPMQHOBJ ppHobj, PMQLONG pCompCode,
                       PMQLONG pReason) {
   if (ot.openAfter) {
@@ -340,6 +393,14 @@ static void MQENTRY DiscBefore(PMQAXP pExitParms, PMQAXC pExitContext, PPMQHCONN
   return;
 }
 
+static void MQENTRY ConnxAfter(PMQAXP pExitParms, PMQAXC pExitContext, PMQCHAR pQMgrName, PPMQCNO ppConnectOpts, PPMQHCONN ppHconn, PMQLONG pCompCode,
+                               PMQLONG pReason) {
+  if (ot.connxAfter) {
+    ot.connxAfter(pExitParms, pExitContext, pQMgrName, ppConnectOpts, ppHconn, pCompCode, pReason);
+  }
+  return;
+}
+
 static void MQENTRY PutBefore(PMQAXP pExitParms, PMQAXC pExitContext, PMQHCONN pHconn, PMQHOBJ pHobj, PPMQMD ppMsgDesc, PPMQPMO ppPutMsgOpts,
                               PMQLONG pBufferLength, PPMQVOID ppBuffer, PMQLONG pCompCode, PMQLONG pReason) {
   if (ot.putBefore) {
@@ -360,8 +421,11 @@ static void MQENTRY Put1Before(PMQAXP pExitParms, PMQAXC pExitContext, PMQHCONN
   // We need a way to stash info between the BEFORE/AFTER phases based on hObj which does not exist in MQPUT1
   // As nothing else can happen on this hConn between the BEFORE and AFTER, using a dummy hobj is fine. So we can use the same core code
   // for both PUT and PUT1 operations.
+  // The put1Before function also needs the object descriptor, to know if the context goes in the MQMD.
   MQHOBJ dummy = MQHO_UNUSABLE_HOBJ;
-  if (ot.putBefore) {
+  if (ot.put1Before) {
+    ot.put1Before(pExitParms, pExitContext, pHconn, pHobjDesc, ppMsgDesc, ppPutMsgOpts, pBufferLength, ppBuffer, pCompCode, pReason);
+  } else if (ot.putBefore) {
     ot.putBefore(pExitParms, pExitContext, pHconn, &dummy, ppMsgDesc, ppPutMsgOpts, pBufferLength, ppBuffer, pCompCode, pReason);
   }
   return;
@@ -385,18 +449,19 @@ static void MQENTRY GetBefore(PMQAXP pExitParms, PMQAXC pExitContext, PMQHCONN p
   return;
 }
 
+// Registering an async consumer is similar to GetBefore, but each consumer has its own message handle
 static void MQENTRY CBBefore(PMQAXP pExitParms, PMQAXC pExitContext, PMQHCONN pHconn, PMQLONG pOperation, PPMQCBD ppCallbackDesc, PMQHOBJ pHobj,
                              PPMQMD ppMsgDesc, PPMQGMO ppGetMsgOpts, PMQLONG pCompCode, PMQLONG pReason) {
-  // Can reuse the same code as GetBefore except we don't have the buffer (which we don't care about anyway)
-  MQLONG dummy;
-  PMQLONG pdummy = &dummy;
-  PMQCBD cbd = *ppCallbackDesc;
-  PMQGMO gmo = *ppGetMsgOpts;
-
-  if (cbd->CallbackType == MQCBT_MESSAGE_CONSUMER && gmo != NULL) {
-    if (ot.getBefore) {
-      ot.getBefore(pExitParms, pExitContext, pHconn, pHobj, ppMsgDesc, ppGetMsgOpts, &dummy, NULL, &pdummy, pCompCode, pReason);
-    }
+  if (ot.cbBefore) {
+    ot.cbBefore(pExitParms, pExitContext, pHconn, pOperation, ppCallbackDesc, pHobj, ppMsgDesc, ppGetMsgOpts, pCompCode, pReason);
+  }
+  return;
+}
+
+static void MQENTRY CBAfter(PMQAXP pExitParms, PMQAXC pExitContext, PMQHCONN pHconn, PMQLONG pOperation, PPMQCBD ppCallbackDesc, PMQHOBJ pHobj,
+                            PPMQMD ppMsgDesc, PPMQGMO ppGetMsgOpts, PMQLONG pCompCode, PMQLONG pReason) {
+  if (ot.cbAfter) {
+    ot.cbAfter(pExitParms, pExitContext, pHconn, pOperation, ppCallbackDesc, pHobj, ppMsgDesc, ppGetMsgOpts, pCompCode, pReason);
   }
   return;
 }
@@ -428,7 +493,7 @@ static void MQENTRY CallbackBefore(PMQAXP pExitParms, PMQAXC pExitContext, PMQHC
 }
 
 // Simple logger - also used by the C++ aspect of this exit
-static void rpt(char *fmt, ...) {
+static void rpt(const char *fmt, ...) {
   va_list va;
   va_start(va, fmt);
   int l;
@@ -14,13 +14,19 @@
   Copyright (c) IBM Corporation 2024
 */
 
+#ifndef MQIOTEL_HPP
+#define MQIOTEL_HPP
+
 #include <map>
+#include <set>
 #include <string>
 
 #include <stdarg.h>
 #include <stdio.h>
 
-typedef void  RPT_FN (const char *fmt, ...);
+#include "mqiotel_capture.h"
+#include "mqiotel_entry.h"
+
 extern RPT_FN *rptMain;
 #define rpt(...) if (rptMain) rptMain( __VA_ARGS__)
 extern void rptmqrc(const char *verb, MQLONG mqcc, MQLONG mqrc);
@@ -29,6 +35,27 @@ extern void rptmqrc(const char *verb, MQLONG mqcc, MQLONG mqrc);
 #define TRACEPARENT "traceparent"
 #define TRACESTATE "tracestate"
 
+// Alternative to properties: carry the context in MQMD fields for selected queues
+#define ENV_MQMD_CARRIER "MQIOTEL_MQMD_CARRIER"
+#define CARRIER_NONE 0
+#define CARRIER_ACCOUNTING_TOKEN 1
+#define CARRIER_APPL_IDENTITY 2
+
+// Write the context directly into an application-built RFH2 instead of using a message handle
+#define ENV_RFH2_INJECT "MQIOTEL_RFH2_INJECT"
+
+// Selected W3C baggage entries can be propagated in their own property
+#define ENV_BAGGAGE_KEYS "MQIOTEL_BAGGAGE_KEYS"
+#define ENV_BAGGAGE_MAX_BYTES "MQIOTEL_BAGGAGE_MAX_BYTES"
+#define BAGGAGE_NAME "baggage"
+#define MAX_BAGGAGE_KEYS 16
+
+// Generic queue names whose PROPCTL is found with a single PCF inquiry when the process connects
+#define ENV_PROPCTL_PREWARM "MQIOTEL_PROPCTL_PREWARM"
+#define ENV_PROPCTL_PREWARM_SECS "MQIOTEL_PROPCTL_PREWARM_SECS"
+
+using namespace std;
+
 typedef struct tagHobjOptions hobjOptions;
 typedef hobjOptions *phobjOptions;
 struct tagHobjOptions {
@@ -41,21 +68,124 @@ struct tagHobjOptions {
   MQPMO  myPmo;
   // Same for GMO
   MQGMO myGmo;
+
+  // Which MQMD field, if any, to use for the context on this object
+  int carrier;
+  PMQMD md;
+  MQMD myMd;
+  PMQOD put1Od; // Set between the Before and After phases of an MQPUT1, so that it can be retried
+
+  // The application's message, when the MQPUT has been given a copy with the context added
+  // to its RFH2
+  PMQVOID appBuffer;
+  MQLONG appBufferLength;
+
+  // An async consumer registered with MQCB owns its own message handle, created at
+  // registration and deleted when it is deregistered or the queue is closed. The GMO it
+  // registered with is kept so that each callback can be shown the same options.
+  bool consumer;
+  MQHMSG consumerHandle;
+  MQGMO consumerGmo;
+
+  phobjOptions nextFree; // Chain of unused records in the connection's arena
 };
 
-using namespace std;
-extern map<string, MQHMSG> objectHandleMap;
-extern map<string, phobjOptions> objectOptionsMap;
+// Records are allocated in slabs, and each connection has its own arena of them
+#define SLAB_RECORDS 16
+typedef struct tagHobjSlab hobjSlab;
+typedef struct {
+  hobjSlab *slabs;
+  phobjOptions freeList;
+  size_t inUse;
+} hobjArena;
 
-extern string objectKey(PMQHCONN hc, PMQHOBJ ho);
+// Everything we know about one connection. A pointer to this is kept in the ExitUserArea,
+// which the queue manager preserves separately for each hConn. MQI calls and async callbacks
+// on a single hConn are never running at the same time, so no locking is needed, and
+// different connections have nothing in common to contend on.
+typedef struct tagConnState connState;
+struct tagConnState {
+  map<MQHOBJ, phobjOptions> objects; // MQHO_UNUSABLE_HOBJ is used for MQPUT1 and sync MQGET
+  MQHMSG mh;                         // Shared by MQPUT and sync MQGET on this hConn
+  hobjArena arena;                   // Where the objects' records come from
+  MQCHAR48 qMgrName;                 // As given on the MQCONN, to match against the PROPCTL cache
+  set<string> put1NoContext;         // Queues (qmgr and queue names from the OD) where an MQPUT1
+                                     // was refused the authority to set identity context
+};
+
+extern connState *getConnState(PMQAXP pExitParms);
+extern void freeConnState(PMQAXP pExitParms);
+extern phobjOptions findHobjOptions(PMQAXP pExitParms, PMQHOBJ pHobj);
+extern phobjOptions getHobjOptions(PMQAXP pExitParms, PMQHOBJ pHobj);
+extern void freeHobjOptions(PMQAXP pExitParms, PMQHCONN pHconn, PMQHOBJ pHobj);
 
 extern bool isValidHandle(MQHMSG mh);
-extern MQHMSG getMsgHandle(PMQAXP pExitParms, PMQHCONN pHconn, PMQHOBJ pHobj);
-extern bool compareMsgHandle(PMQHCONN pHconn, PMQHOBJ pHobj, MQHMSG mh);
+extern MQHMSG getMsgHandle(PMQAXP pExitParms, PMQHCONN pHconn);
+extern bool compareMsgHandle(PMQAXP pExitParms, MQHMSG mh);
+extern MQHMSG getConsumerHandle(PMQAXP pExitParms, PMQHCONN pHconn, phobjOptions o);
+extern void deleteConsumerHandle(PMQAXP pExitParms, PMQHCONN pHconn, phobjOptions o);
 
 extern bool propsContain(PMQAXP pExitParms, PMQHCONN pHconn, MQHMSG mh, const char *propertyName);
 extern string propsValue(PMQAXP pExitParms, PMQHCONN pHconn, MQHMSG mh, const char *propertyName, PMQLONG CC, PMQLONG RC);
+extern void propsValueBuf(PMQAXP pExitParms, PMQHCONN pHconn, MQHMSG mh, PMQCHARV propertyNameVS, char *value, MQLONG valueSize, PMQLONG valueLength, PMQLONG CC,
+                          PMQLONG RC);
+extern bool findRFH2Prop(const char *props, int propsLength, const char *prop, const char **value, int *valueLength);
+
+// Recording of intercepted calls for the replay tool
+typedef struct {
+  captureRecord rec;
+  char props[CAPTURE_MAX_PROPS_LEN];
+  size_t propsLen;
+} captureCall;
+
+extern bool capturing;
+extern void captureInit();
+extern void captureTerm();
+extern void captureStart(captureCall *c, int verb, PMQHCONN pHconn, PMQHOBJ pHobj);
+extern void captureMd(captureCall *c, PMQMD md);
+extern void captureOptions(captureCall *c, MQLONG options, MQLONG version, uint32_t flags);
+extern void captureProp(captureCall *c, const char *name, size_t valueLength);
+extern void captureEnd(captureCall *c, MQLONG compCode, MQLONG reason);
+
+// An inbound baggage entry. The value is not null-terminated.
+typedef struct {
+  const char *attrName;
+  const char *value;
+  size_t length;
+} baggageEntry;
+
+extern int baggageKeyCount;
+extern void baggageInit();
+extern size_t baggageSerialize(const char **value);
+extern void injectBaggage(PMQAXP pExitParms, PMQHCONN pHconn, MQHMSG mh, captureCall *cap);
+extern int extractBaggage(PMQAXP pExitParms, PMQHCONN pHconn, MQHMSG mh, const char *rfh2Props, int rfh2Length, baggageEntry *entries, captureCall *cap);
+
+extern void prewarmInit();
+extern void propCtlPrewarm(PMQAXP pExitParms, PMQHCONN pHconn, PMQCHAR pQMgrName);
+extern bool cachedPropCtl(PMQAXP pExitParms, PMQOD od, PMQLONG propCtl);
+
+extern int carriersConfigured;
+extern void carrierInit();
+extern int carrierForQueue(const char *qName);
+
+// A property to be added to the <usr> folder of an RFH2
+typedef struct {
+  const char *name;
+  const char *value;
+  size_t length;
+} rfh2Prop;
+
+extern bool rfh2InjectEnabled;
+extern void rfh2Init();
+extern bool rfh2Inject(PMQMD md, PMQVOID buffer, MQLONG length, const rfh2Prop *props, int count, PMQVOID *newBuffer, PMQLONG newLength);
+
+extern phobjOptions newHobjOptions(hobjArena *a);
+extern void freeHobjRecord(hobjArena *a, phobjOptions o);
+extern void freeHobjArena(hobjArena *a);
+extern void reportMemoryUsage();
 
 extern void *mqotMalloc(size_t l);
 extern void mqotFree(void *p);
 extern void dumpHex(const char *title, const void *buf, int length);
+
+#endif
@@ -0,0 +1,330 @@
+/*
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+  Copyright (c) IBM Corporation 2024
+*/
+
+// Optional propagation of selected W3C baggage entries in a "baggage" message property. Only
+// the keys named in MQIOTEL_BAGGAGE_KEYS are sent or picked up, and the property value is limited
+// to MQIOTEL_BAGGAGE_MAX_BYTES. Entries that would take the value over that limit are left out
+// rather than truncated.
+//
+// Each thread has a pair of buffers of the maximum size, allocated the first time it needs them.
+// The outbound value is built directly in one of them. An inbound value is read into the other
+// and parsed in a single pass, with the entries decoded in place, so neither direction needs any
+// further allocation.
+
+#include <stdarg.h>
+#include <stdio.h>
+
+#include <cstdlib>
+#include <cstring>
+
+#include <cmqc.h>
+#include <cmqec.h>
+
+#include <baggage/baggage.h>
+#include <baggage/baggage_context.h>
+#include <context/runtime_context.h>
+
+#include "mqiotel.hpp"
+#include "mqiotel_propagator.hpp"
+
+#define DEFAULT_BAGGAGE_BYTES 256
+#define MAX_BAGGAGE_BYTES 8192 // The W3C limit for the whole header
+#define MAX_BAGGAGE_KEY_LENGTH 64
+#define ATTR_PREFIX "baggage."
+
+typedef struct {
+  char key[MAX_BAGGAGE_KEY_LENGTH + 1];
+  size_t length;
+  char attrName[sizeof(ATTR_PREFIX) + MAX_BAGGAGE_KEY_LENGTH]; // Used when adding the entry to a span link
+} baggageKey;
+
+static baggageKey keys[MAX_BAGGAGE_KEYS];
+int baggageKeyCount = 0;
+static size_t maxBytes = DEFAULT_BAGGAGE_BYTES;
+
+static MQCHARV baggageVS = {(MQPTR)BAGGAGE_NAME, 0, 0, (MQLONG)strlen(BAGGAGE_NAME), MQCCSI_APPL};
+
+// Released when the thread ends
+struct baggageBuffers {
+  char *out = NULL;
+  char *in = NULL;
+  ~baggageBuffers() {
+    mqotFree(out);
+    mqotFree(in);
+  }
+};
+static thread_local baggageBuffers buffers;
+
+static const char *hexChars = "0123456789ABCDEF";
+
+void baggageInit() {
+  const char *e = getenv(ENV_BAGGAGE_KEYS);
+  const char *m = getenv(ENV_BAGGAGE_MAX_BYTES);
+
+  baggageKeyCount = 0;
+  maxBytes = DEFAULT_BAGGAGE_BYTES;
+  if (m && atoi(m) > 0) {
+    maxBytes = (size_t)atoi(m);
+    if (maxBytes > MAX_BAGGAGE_BYTES) {
+      maxBytes = MAX_BAGGAGE_BYTES;
+    }
+  }
+
+  while (e && *e) {
+    size_t l = strcspn(e, ",");
+    while (l > 0 && *e == ' ') {
+      e++;
+      l--;
+    }
+    size_t kl = l;
+    while (kl > 0 && e[kl - 1] == ' ') {
+      kl--;
+    }
+    if (kl > 0 && kl <= MAX_BAGGAGE_KEY_LENGTH && baggageKeyCount < MAX_BAGGAGE_KEYS) {
+      baggageKey *k = &keys[baggageKeyCount++];
+      memcpy(k->key, e, kl);
+      k->key[kl] = 0;
+      k->length = kl;
+      snprintf(k->attrName, sizeof(k->attrName), "%s%s", ATTR_PREFIX, k->key);
+      rpt("Baggage: propagating key %s", k->key);
+    } else if (kl > 0) {
+      rpt("Baggage: ignoring key %.*s", (int)kl, e);
+    }
+    e += l;
+    if (*e == ',') {
+      e++;
+    }
+  }
+
+  if (baggageKeyCount > 0) {
+    rpt("Baggage: limited to %lu bytes", (unsigned long)maxBytes);
+  }
+}
+
+static int findKey(const char *k, size_t l) {
+  for (int i = 0; i < baggageKeyCount; i++) {
+    if (keys[i].length == l && !memcmp(keys[i].key, k, l)) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+// Characters that can appear unescaped in a W3C baggage value. The XML special characters
+// are also escaped so that the value can go into an RFH2 unchanged.
+static bool plainOctet(unsigned char c) {
+  if (c < 0x21 || c > 0x7E) {
+    return false;
+  }
+  switch (c) {
+  case '"':
+  case ',':
+  case ';':
+  case '\\':
+  case '%':
+  case '<':
+  case '>':
+  case '&':
+    return false;
+  default:
+    return true;
+  }
+}
+
+static size_t encodedLength(nostd::string_view v) {
+  size_t l = 0;
+  for (size_t i = 0; i < v.size(); i++) {
+    l += plainOctet((unsigned char)v[i]) ? 1 : 3;
+  }
+  return l;
+}
+
+// Build the outbound property value from the allowed entries in the current context's baggage.
+// Returns the length, or 0 if there is nothing to send. The value stays valid until the next
+// call on this thread.
+size_t baggageSerialize(const char **value) {
+  if (baggageKeyCount == 0) {
+    return 0;
+  }
+  if (!buffers.out) {
+    buffers.out = (char *)mqotMalloc(maxBytes);
+  }
+
+  char *out = buffers.out;
+  size_t o = 0;
+  auto bag = opentelemetry::baggage::GetBaggage(opentelemetry::context::RuntimeContext::GetCurrent());
+
+  bag->GetAllEntries([out, &o](nostd::string_view k, nostd::string_view v) {
+    if (findKey(k.data(), k.size()) < 0) {
+      return true;
+    }
+    size_t need = (o > 0 ? 1 : 0) + k.size() + 1 + encodedLength(v);
+    if (o + need > maxBytes) {
+      rpt("Baggage: no room for %.*s", (int)k.size(), k.data());
+      return true;
+    }
+    if (o > 0) {
+      out[o++] = ',';
+    }
+    memcpy(&out[o], k.data(), k.size());
+    o += k.size();
+    out[o++] = '=';
+    for (size_t i = 0; i < v.size(); i++) {
+      unsigned char c = (unsigned char)v[i];
+      if (plainOctet(c)) {
+        out[o++] = c;
+      } else {
+        out[o++] = '%';
+        out[o++] = hexChars[c >> 4];
+        out[o++] = hexChars[c & 0x0F];
+      }
+    }
+    return true;
+  });
+
+  *value = out;
+  return o;
+}
+
+// Set the baggage property on an outbound message handle
+void injectBaggage(PMQAXP pExitParms, PMQHCONN pHconn, MQHMSG mh, captureCall *cap) {
+  MQSMPO smpo = {MQSMPO_DEFAULT};
+  MQPD pd = {MQPD_DEFAULT};
+  MQLONG CC, RC;
+  const char *value;
+
+  size_t l = baggageSerialize(&value);
+  if (l == 0) {
+    return;
+  }
+  rpt("Setting %s to %.*s", BAGGAGE_NAME, (int)l, value);
+  pExitParms->Hconfig->MQSETMP_Call(*pHconn, mh, &smpo, &baggageVS, &pd, MQTYPE_STRING, (MQLONG)l, (PMQVOID)value, &CC, &RC);
+  if (CC != MQCC_OK) {
+    rptmqrc("MQSETMP", CC, RC);
+  } else {
+    captureProp(cap, BAGGAGE_NAME, l);
+  }
+}
+
+static inline bool ows(char c) {
+  return c == ' ' || c == '\t';
+}
+
+// Walk the list once, picking out the allowed keys. Values are percent-decoded in place and
+// any entry properties (after a ';') are ignored. A repeated key keeps its first value.
+static int parseBaggage(char *v, size_t l, baggageEntry *entries) {
+  char *p = v;
+  char *end = v + l;
+  int count = 0;
+  uint32_t seen = 0;
+
+  while (p < end && count < baggageKeyCount) {
+    while (p < end && (ows(*p) || *p == ',')) {
+      p++;
+    }
+    char *k = p;
+    while (p < end && *p != '=' && *p != ',' && !ows(*p)) {
+      p++;
+    }
+    size_t kl = p - k;
+    while (p < end && ows(*p)) {
+      p++;
+    }
+    if (p >= end || *p != '=') {
+      // Not a key=value pair; skip to the next member
+      while (p < end && *p != ',') {
+        p++;
+      }
+      continue;
+    }
+    p++;
+    while (p < end && ows(*p)) {
+      p++;
+    }
+
+    int i = findKey(k, kl);
+    bool keep = (i >= 0 && !(seen & (1u << i)));
+    char *value = p;
+    char *o = p;
+    while (p < end && *p != ',' && *p != ';') {
+      if (keep && *p == '%' && p + 2 < end && hexValue(p[1]) >= 0 && hexValue(p[2]) >= 0) {
+        *o++ = (char)((hexValue(p[1]) << 4) | hexValue(p[2]));
+        p += 3;
+      } else {
+        *o++ = *p++;
+      }
+    }
+    while (o > value && ows(o[-1])) {
+      o--;
+    }
+    while (p < end && *p != ',') {
+      p++;
+    }
+
+    if (keep) {
+      seen |= (1u << i);
+      entries[count].attrName = keys[i].attrName;
+      entries[count].value = value;
+      entries[count].length = o - value;
+      count++;
+    }
+  }
+  return count;
+}
+
+// Find the allowed baggage entries in an inbound message. The entries point into a per-thread
+// buffer, and stay valid until the next call on this thread.
+int extractBaggage(PMQAXP pExitParms, PMQHCONN pHconn, MQHMSG mh, const char *rfh2Props, int rfh2Length, baggageEntry *entries, captureCall *cap) {
+  MQLONG l = 0;
+  MQLONG CC, RC;
+
+  if (baggageKeyCount == 0) {
+    return 0;
+  }
+  if (!buffers.in) {
+    buffers.in = (char *)mqotMalloc(maxBytes);
+  }
+
+  if (isValidHandle(mh)) {
+    propsValueBuf(pExitParms, pHconn, mh, &baggageVS, buffers.in, (MQLONG)maxBytes, &l, &CC, &RC);
+    if (CC != MQCC_OK) {
+      if (RC == MQRC_PROPERTY_VALUE_TOO_BIG) {
+        rpt("Baggage: ignoring value longer than %lu bytes", (unsigned long)maxBytes);
+      } else if (RC != MQRC_PROPERTY_NOT_AVAILABLE) {
+        rptmqrc("GetAfter (baggage)", CC, RC);
+      }
+      return 0;
+    }
+  } else if (rfh2Props) {
+    const char *v;
+    int vl;
+    if (!findRFH2Prop(rfh2Props, rfh2Length, BAGGAGE_NAME, &v, &vl)) {
+      return 0;
+    }
+    if ((size_t)vl > maxBytes) {
+      rpt("Baggage: ignoring value longer than %lu bytes", (unsigned long)maxBytes);
+      return 0;
+    }
+    memcpy(buffers.in, v, vl);
+    l = vl;
+  } else {
+    return 0;
+  }
+
+  rpt("Found %s: %.*s", BAGGAGE_NAME, (int)l, buffers.in);
+  captureProp(cap, BAGGAGE_NAME, l);
+  return parseBaggage(buffers.in, l, entries);
+}
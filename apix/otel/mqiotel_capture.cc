@@ -0,0 +1,228 @@
+/*
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+  Copyright (c) IBM Corporation 2024
+*/
+
+// Record the calls that this exit intercepts into a memory-mapped file. The
+// mqiotel_replay program can then feed the same sequence of calls back into
+// the exit without needing a queue manager, so that changes to the exit can be
+// compared for throughput and latency using real traffic shapes.
+//
+// Records are added without any locking: each thread reserves its space by
+// atomically bumping the "used" counter in the file header and then fills in
+// its own area of the mapping.
+
+#include <stdarg.h>
+#include <stdio.h>
+
+#include <cstdlib>
+#include <cstring>
+
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <cmqc.h>
+#include <cmqec.h>
+
+#include "mqiotel.hpp"
+
+bool capturing = false;
+
+static captureFileHeader *capHdr = NULL;
+static size_t capSize = 0;
+static int capFd = -1;
+
+static uint64_t nowNs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Open and map the capture file if the environment asks for it. Failures are reported
+// but not fatal - the exit carries on without capturing.
+void captureInit() {
+  char fileName[PATH_MAX];
+  const char *f = getenv(ENV_CAPTURE_FILE);
+  const char *s = getenv(ENV_CAPTURE_SIZE);
+  const char *p;
+  size_t o = 0;
+
+  if (!f || capHdr) {
+    return;
+  }
+
+  // Allow a pid to be included in the filename so that separate processes don't collide
+  for (p = f; *p && o < sizeof(fileName) - 16; p++) {
+    if (p[0] == '%' && p[1] == 'p') {
+      o += snprintf(&fileName[o], sizeof(fileName) - o, "%d", (int)getpid());
+      p++;
+    } else {
+      fileName[o++] = *p;
+    }
+  }
+  fileName[o] = 0;
+
+  capSize = (size_t)CAPTURE_DEFAULT_SIZE_MB;
+  if (s && atoi(s) > 0) {
+    capSize = (size_t)atoi(s);
+  }
+  capSize *= 1024 * 1024;
+
+  capFd = open(fileName, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (capFd == -1) {
+    rpt("Cannot open capture file %s", fileName);
+    return;
+  }
+  if (ftruncate(capFd, capSize) != 0) {
+    rpt("Cannot size capture file %s", fileName);
+    close(capFd);
+    capFd = -1;
+    return;
+  }
+
+  void *m = mmap(NULL, capSize, PROT_READ | PROT_WRITE, MAP_SHARED, capFd, 0);
+  if (m == MAP_FAILED) {
+    rpt("Cannot map capture file %s", fileName);
+    close(capFd);
+    capFd = -1;
+    return;
+  }
+
+  capHdr = (captureFileHeader *)m;
+  memcpy(capHdr->magic, CAPTURE_MAGIC, sizeof(capHdr->magic));
+  capHdr->version = CAPTURE_VERSION;
+  capHdr->headerLength = sizeof(captureFileHeader);
+  capHdr->fileSize = capSize;
+  capHdr->used = 0;
+  capHdr->dropped = 0;
+  capHdr->startNs = nowNs();
+
+  capturing = true;
+  rpt("Capturing calls to %s (%lu bytes)", fileName, (unsigned long)capSize);
+}
+
+// Flush the mapping and trim the file to the records actually written.
+void captureTerm() {
+  if (!capHdr) {
+    return;
+  }
+  capturing = false;
+
+  uint64_t used = capHdr->used;
+  uint64_t limit = capSize - capHdr->headerLength;
+  if (used > limit) {
+    // Some reservations overshot the end of the file. Walk the records to find the real end.
+    char *p = (char *)capHdr + capHdr->headerLength;
+    used = 0;
+    uint16_t l;
+    while (used + sizeof(captureRecord) <= limit && (l = __atomic_load_n(&((captureRecord *)(p + used))->length, __ATOMIC_ACQUIRE)) != 0) {
+      used += l;
+    }
+    capHdr->used = used;
+  }
+  rpt("Capture ended: %lu bytes, %lu records dropped", (unsigned long)used, (unsigned long)capHdr->dropped);
+
+  size_t finalSize = capHdr->headerLength + used;
+  msync(capHdr, capSize, MS_SYNC);
+  munmap(capHdr, capSize);
+  if (ftruncate(capFd, finalSize) != 0) {
+    rpt("Cannot trim capture file");
+  }
+  close(capFd);
+
+  capHdr = NULL;
+  capFd = -1;
+}
+
+void captureStart(captureCall *c, int verb, PMQHCONN pHconn, PMQHOBJ pHobj) {
+  if (!capturing) {
+    return;
+  }
+  memset(&c->rec, 0, sizeof(c->rec));
+  c->propsLen = 0;
+  c->rec.verb = (uint8_t)verb;
+  c->rec.hConn = pHconn ? *pHconn : MQHC_UNUSABLE_HCONN;
+  c->rec.hObj = pHobj ? *pHobj : MQHO_UNUSABLE_HOBJ;
+  c->rec.propCtl = -1;
+  c->rec.startNs = nowNs();
+}
+
+void captureMd(captureCall *c, PMQMD md) {
+  if (!capturing || !md) {
+    return;
+  }
+  memcpy(c->rec.format, md->Format, sizeof(c->rec.format));
+  c->rec.msgType = md->MsgType;
+  c->rec.persistence = md->Persistence;
+  c->rec.encoding = md->Encoding;
+  c->rec.ccsid = md->CodedCharSetId;
+  c->rec.flags |= CAPTURE_FLAG_MD;
+}
+
+void captureOptions(captureCall *c, MQLONG options, MQLONG version, uint32_t flags) {
+  if (!capturing) {
+    return;
+  }
+  c->rec.options = options;
+  c->rec.structVersion = version;
+  c->rec.flags |= flags;
+}
+
+// Note the name and size of a property that has been set or found. Silently
+// ignore any that would not fit in the record.
+void captureProp(captureCall *c, const char *name, size_t valueLength) {
+  if (!capturing) {
+    return;
+  }
+  size_t nameLength = strlen(name);
+  if (nameLength > 255 || c->rec.propCount >= CAPTURE_MAX_PROPS || c->propsLen + nameLength + 3 > CAPTURE_MAX_PROPS_LEN) {
+    return;
+  }
+  uint16_t vl = (uint16_t)(valueLength > 0xFFFF ? 0xFFFF : valueLength);
+  c->props[c->propsLen++] = (char)nameLength;
+  memcpy(&c->props[c->propsLen], name, nameLength);
+  c->propsLen += nameLength;
+  memcpy(&c->props[c->propsLen], &vl, sizeof(vl));
+  c->propsLen += sizeof(vl);
+  c->rec.propCount++;
+}
+
+void captureEnd(captureCall *c, MQLONG compCode, MQLONG reason) {
+  if (!capturing) {
+    return;
+  }
+  uint64_t end = nowNs();
+  // Keep every record aligned, so that the atomic store of the next one's length is too
+  uint32_t length = (sizeof(captureRecord) + c->propsLen + alignof(captureRecord) - 1) & ~(uint32_t)(alignof(captureRecord) - 1);
+
+  c->rec.length = (uint16_t)length;
+  c->rec.compCode = compCode;
+  c->rec.reason = reason;
+  c->rec.durationNs = (uint32_t)(end - c->rec.startNs);
+  c->rec.startNs -= capHdr->startNs;
+
+  uint64_t offset = __atomic_fetch_add(&capHdr->used, length, __ATOMIC_RELAXED);
+  if (offset + length > capSize - capHdr->headerLength) {
+    __atomic_fetch_add(&capHdr->dropped, 1, __ATOMIC_RELAXED);
+    return;
+  }
+  char *p = (char *)capHdr + capHdr->headerLength + offset;
+  memcpy(p + sizeof(uint16_t), (char *)&c->rec + sizeof(uint16_t), sizeof(captureRecord) - sizeof(uint16_t));
+  memcpy(p + sizeof(captureRecord), c->props, c->propsLen);
+  // Set the length last so a partially-written record still looks like the end of the data
+  __atomic_store_n((uint16_t *)p, c->rec.length, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,94 @@
+/*
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+  Copyright (c) IBM Corporation 2024
+*/
+
+// Layout of the capture file written when MQIOTEL_CAPTURE_FILE is set, and read back by the
+// mqiotel_replay program. This header is plain C so that it can be shared by both of them.
+//
+// The file starts with a captureFileHeader. Records follow immediately afterwards, each one a
+// captureRecord optionally followed by propCount property entries. A property entry is a
+// one-byte name length, the name itself (not NULL-terminated) and then a two-byte value length.
+// We don't keep the property values, only their sizes. The record length includes padding to keep
+// the next record aligned. A zero record length marks the end of the data.
+
+#ifndef MQIOTEL_CAPTURE_H
+#define MQIOTEL_CAPTURE_H
+
+#include <stdint.h>
+
+#define ENV_CAPTURE_FILE "MQIOTEL_CAPTURE_FILE" // Where to write. "%p" in the name is replaced by the pid
+#define ENV_CAPTURE_SIZE "MQIOTEL_CAPTURE_SIZE" // Size of the mapped file in MB
+
+#define CAPTURE_MAGIC "MQOTCAP1"
+#define CAPTURE_VERSION 1
+#define CAPTURE_DEFAULT_SIZE_MB 64
+#define CAPTURE_MAX_PROPS 8     // Maximum property entries kept in a single record
+#define CAPTURE_MAX_PROPS_LEN 256 // And the space they can take
+
+// Which of the exit's entrypoints was invoked
+#define CAPTURE_OPEN_AFTER 1
+#define CAPTURE_CLOSE_AFTER 2
+#define CAPTURE_DISC_BEFORE 3
+#define CAPTURE_PUT_BEFORE 4
+#define CAPTURE_PUT_AFTER 5
+#define CAPTURE_GET_BEFORE 6
+#define CAPTURE_GET_AFTER 7
+#define CAPTURE_VERB_COUNT 8
+
+// Bits in the flags field
+#define CAPTURE_FLAG_APP_HANDLE 0x0001 // App supplied its own message handle in the PMO/GMO
+#define CAPTURE_FLAG_MD 0x0002         // The MQMD fields are valid
+#define CAPTURE_FLAG_ASYNC 0x0004      // GET processing was driven by an MQCB consumer
+#define CAPTURE_FLAG_RFH2 0x0008       // Properties were in an RFH2 rather than a handle
+
+#pragma pack(push, 4)
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  uint32_t headerLength; // Offset to the first record
+  uint64_t fileSize;     // Total mapped size, including this header
+  uint64_t used;         // Bytes reserved for records. May overshoot fileSize if records were dropped
+  uint64_t dropped;      // Number of records that did not fit
+  uint64_t startNs;      // Monotonic clock when the capture started
+} captureFileHeader;
+
+typedef struct {
+  uint16_t length; // Of the whole record, including property entries
+  uint8_t verb;    // CAPTURE_xxx value
+  uint8_t propCount;
+  uint32_t flags;
+
+  int32_t hConn;
+  int32_t hObj;
+  int32_t options; // Options from the PMO, GMO, MQOPEN or MQCLOSE as appropriate
+  int32_t structVersion; // Version of the PMO or GMO
+  int32_t compCode;
+  int32_t reason;
+  int32_t bufferLength;
+  int32_t propCtl; // Discovered PROPCTL value for an MQOPEN
+
+  // A subset of the MQMD
+  char format[8];
+  int32_t msgType;
+  int32_t persistence;
+  int32_t encoding;
+  int32_t ccsid;
+
+  uint64_t startNs;    // Offset from the start of the capture
+  uint32_t durationNs; // Time spent inside the exit for this call
+} captureRecord;
+#pragma pack(pop)
+
+#endif
@@ -0,0 +1,242 @@
+/*
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+  Copyright (c) IBM Corporation 2024
+*/
+
+// Carry the trace context in MQMD identity fields instead of message properties. This is
+// for queues where properties would be stripped (PROPCTL(NONE)) or turned into an RFH2 that
+// legacy consumers cannot handle. No message handle or MQSETMP is needed, and the message
+// does not get any bigger.
+//
+// The configuration is a list of queue names (with an optional trailing '*') and the field
+// to use, for example
+//     MQIOTEL_MQMD_CARRIER="APP.LEGACY.*=AccountingToken,PAYROLL.IN=ApplIdentityData"
+//
+// AccountingToken: a 3-byte marker, the 16-byte trace id, 8-byte span id and the trace flags.
+//    The final byte is set to MQACTT_USER. Because of the marker, receivers can recognise
+//    these tokens without needing to know which queue the message came from.
+// ApplIdentityData: a marker and version number followed by the trace and span ids, as one
+//    number written in base 80 in exactly 32 characters. The characters are ones that are the
+//    same in all ASCII and EBCDIC code pages, so the field survives MQMD conversion. There is
+//    no room for the flags, so a receiver treats the context as sampled.
+//
+// Setting these fields needs MQPMO_SET_IDENTITY_CONTEXT, which in turn needs the queue to be opened
+// with MQOO_SET_IDENTITY_CONTEXT. The exit adds that to matching MQOPENs, and the application needs
+// "setid" authority on the queue. If the application is already controlling the message context
+// itself, then the exit falls back to using properties.
+
+#include <stdarg.h>
+#include <stdio.h>
+
+#include <cstdlib>
+#include <cstring>
+
+#include <cmqc.h>
+#include <cmqec.h>
+
+#include "mqiotel.hpp"
+#include "mqiotel_propagator.hpp"
+
+#define MAX_CARRIER_RULES 32
+
+#define ACCT_MARKER_0 'O'
+#define ACCT_MARKER_1 'T'
+#define ACCT_VERSION 1
+
+// The high part of the number in ApplIdentityData. 80^32 leaves just over 10 bits above the ids.
+#define APPL_VERSION 1
+#define APPL_MARKER (('O' << 3) | APPL_VERSION)
+#define APPL_BASE 80
+#define APPL_VALUE_BYTES (2 + trace_api::TraceId::kSize + trace_api::SpanId::kSize)
+
+typedef struct {
+  char pattern[MQ_Q_NAME_LENGTH + 1];
+  size_t length; // Characters to compare
+  bool generic;  // Pattern ended with '*'
+  int carrier;
+} carrierRule;
+
+static carrierRule rules[MAX_CARRIER_RULES];
+static int ruleCount = 0;
+
+// Which carriers are configured for any queue. The receiver only looks at the MQMD
+// if this is non-zero
+int carriersConfigured = 0;
+
+static const char *applChars = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+-*/%&()<>=,.:;?_'";
+
+// Write a big-endian number as exactly MQ_APPL_IDENTITY_DATA_LENGTH digits
+static void applEncode(const uint8_t *in, char *out) {
+  uint8_t n[APPL_VALUE_BYTES];
+
+  memcpy(n, in, sizeof(n));
+  for (int i = MQ_APPL_IDENTITY_DATA_LENGTH - 1; i >= 0; i--) {
+    unsigned rem = 0;
+    for (size_t j = 0; j < sizeof(n); j++) {
+      unsigned v = (rem << 8) | n[j];
+      n[j] = (uint8_t)(v / APPL_BASE);
+      rem = v % APPL_BASE;
+    }
+    out[i] = applChars[rem];
+  }
+}
+
+static bool applDecode(const char *in, uint8_t *out) {
+  memset(out, 0, APPL_VALUE_BYTES);
+  for (int i = 0; i < MQ_APPL_IDENTITY_DATA_LENGTH; i++) {
+    const char *p = in[i] ? strchr(applChars, in[i]) : NULL;
+    if (!p) {
+      return false;
+    }
+    unsigned carry = (unsigned)(p - applChars);
+    for (int j = APPL_VALUE_BYTES - 1; j >= 0; j--) {
+      unsigned v = out[j] * APPL_BASE + carry;
+      out[j] = v & 0xFF;
+      carry = v >> 8;
+    }
+    if (carry) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static bool allZero(const uint8_t *b, size_t l) {
+  for (size_t i = 0; i < l; i++) {
+    if (b[i]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void carrierInit() {
+  const char *e = getenv(ENV_MQMD_CARRIER);
+
+  ruleCount = 0;
+  carriersConfigured = 0;
+
+  while (e && *e && ruleCount < MAX_CARRIER_RULES) {
+    size_t l = strcspn(e, ",");
+    const char *eq = (const char *)memchr(e, '=', l);
+    if (eq && eq > e && (size_t)(eq - e) <= MQ_Q_NAME_LENGTH) {
+      carrierRule *r = &rules[ruleCount];
+      const char *f = eq + 1;
+      size_t fl = l - (f - e);
+
+      memset(r, 0, sizeof(*r));
+      memcpy(r->pattern, e, eq - e);
+      r->length = eq - e;
+      if (r->pattern[r->length - 1] == '*') {
+        r->generic = true;
+        r->length--;
+      }
+      if (fl == strlen("AccountingToken") && !strncasecmp(f, "AccountingToken", fl)) {
+        r->carrier = CARRIER_ACCOUNTING_TOKEN;
+      } else if (fl == strlen("ApplIdentityData") && !strncasecmp(f, "ApplIdentityData", fl)) {
+        r->carrier = CARRIER_APPL_IDENTITY;
+      }
+
+      if (r->carrier != CARRIER_NONE) {
+        rpt("MQMD carrier: %s uses %.*s", r->pattern, (int)fl, f);
+        carriersConfigured |= r->carrier;
+        ruleCount++;
+      } else {
+        rpt("MQMD carrier: ignoring unknown field %.*s", (int)fl, f);
+      }
+    }
+    e += l;
+    if (*e == ',') {
+      e++;
+    }
+  }
+}
+
+// Which carrier, if any, is configured for the queue. The name is blank-padded, as in the MQOD.
+int carrierForQueue(const char *qName) {
+  size_t ql = MQ_Q_NAME_LENGTH;
+
+  if (ruleCount == 0) {
+    return CARRIER_NONE;
+  }
+  while (ql > 0 && (qName[ql - 1] == ' ' || qName[ql - 1] == 0)) {
+    ql--;
+  }
+  for (int i = 0; i < ruleCount; i++) {
+    carrierRule *r = &rules[i];
+    if ((r->generic && ql >= r->length) || (!r->generic && ql == r->length)) {
+      if (!memcmp(qName, r->pattern, r->length)) {
+        return r->carrier;
+      }
+    }
+  }
+  return CARRIER_NONE;
+}
+
+// Write the span's ids into the MQMD
+void carrierEncode(int carrier, const trace_api::SpanContext &ctx, PMQMD md) {
+  uint8_t ids[trace_api::TraceId::kSize + trace_api::SpanId::kSize];
+
+  memcpy(ids, ctx.trace_id().Id().data(), trace_api::TraceId::kSize);
+  memcpy(&ids[trace_api::TraceId::kSize], ctx.span_id().Id().data(), trace_api::SpanId::kSize);
+
+  if (carrier == CARRIER_ACCOUNTING_TOKEN) {
+    MQBYTE *t = md->AccountingToken;
+    memset(t, 0, MQ_ACCOUNTING_TOKEN_LENGTH);
+    t[0] = ACCT_MARKER_0;
+    t[1] = ACCT_MARKER_1;
+    t[2] = ACCT_VERSION;
+    memcpy(&t[3], ids, sizeof(ids));
+    t[3 + sizeof(ids)] = ctx.trace_flags().flags();
+    t[MQ_ACCOUNTING_TOKEN_LENGTH - 1] = MQACTT_USER;
+  } else if (carrier == CARRIER_APPL_IDENTITY) {
+    uint8_t n[APPL_VALUE_BYTES];
+    n[0] = (APPL_MARKER >> 8) & 0xFF;
+    n[1] = APPL_MARKER & 0xFF;
+    memcpy(&n[2], ids, sizeof(ids));
+    applEncode(n, md->ApplIdentityData);
+  }
+}
+
+// Look for a context in whichever MQMD fields have been configured as carriers
+bool carrierDecode(PMQMD md, propagatedContext *pc) {
+  if (carriersConfigured & CARRIER_ACCOUNTING_TOKEN) {
+    MQBYTE *t = md->AccountingToken;
+    if (t[0] == ACCT_MARKER_0 && t[1] == ACCT_MARKER_1 && t[2] == ACCT_VERSION && t[MQ_ACCOUNTING_TOKEN_LENGTH - 1] == MQACTT_USER) {
+      memcpy(pc->traceId, &t[3], sizeof(pc->traceId));
+      memcpy(pc->spanId, &t[3 + sizeof(pc->traceId)], sizeof(pc->spanId));
+      pc->flags = t[3 + sizeof(pc->traceId) + sizeof(pc->spanId)];
+      pc->stateLength = 0;
+      if (!allZero(pc->traceId, sizeof(pc->traceId)) && !allZero(pc->spanId, sizeof(pc->spanId))) {
+        rpt("Found context in AccountingToken");
+        return true;
+      }
+    }
+  }
+
+  if (carriersConfigured & CARRIER_APPL_IDENTITY) {
+    uint8_t n[APPL_VALUE_BYTES];
+    if (applDecode(md->ApplIdentityData, n) && ((n[0] << 8) | n[1]) == APPL_MARKER) {
+      memcpy(pc->traceId, &n[2], sizeof(pc->traceId));
+      memcpy(pc->spanId, &n[2 + sizeof(pc->traceId)], sizeof(pc->spanId));
+      pc->flags = trace_api::TraceFlags::kIsSampled;
+      pc->stateLength = 0;
+      if (!allZero(pc->traceId, sizeof(pc->traceId)) && !allZero(pc->spanId, sizeof(pc->spanId))) {
+        rpt("Found context in ApplIdentityData");
+        return true;
+      }
+    }
+  }
+  return false;
+}
@@ -0,0 +1,338 @@
+/*
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+  Copyright (c) IBM Corporation 2024
+*/
+
+// Stress the mqioteldl.so module's handling of object handles, in the way that an application
+// using many dynamic reply queues would: a set of connections each randomly opening and closing
+// queues, followed by disconnecting them all. This is repeated for several rounds. No queue
+// manager is needed; the MQI calls that the module makes for itself go to stub functions.
+//
+// After each phase, the process RSS is reported alongside the module's own view of how much
+// memory it has reserved in its arenas and how much of that is actually in use.
+
+#include <dlfcn.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <cmqc.h>
+#include <cmqec.h>
+#include <cmqxc.h>
+
+#include "mqiotel_entry.h"
+
+#define DLMODULE "mqioteldl.so"
+
+static struct {
+  OTEL_INIT *init;
+  OTEL_TERM *term;
+  OTEL_MEMORY *memoryUsage;
+
+  MQ_OPEN_EXIT *openAfter;
+  MQ_CLOSE_EXIT *closeAfter;
+  MQ_DISC_EXIT *discBefore;
+} ot;
+
+typedef struct {
+  MQHCONN hConn;
+  MQAXP axp;
+  MQHOBJ *open; // Handles currently open on this connection
+  int openCount;
+  MQHOBJ nextHobj;
+} churnConn;
+
+static MQHMSG nextHmsg = 1;
+
+static void usage(char *name) {
+  fprintf(stderr, "Usage: %s [-m module] [-c connections] [-o maxOpen] [-n operations] [-r rounds] [-s seed] [-v]\n", name);
+  fprintf(stderr, "  -m Path to the mqioteldl.so module. Default is to search the library path\n");
+  fprintf(stderr, "  -c Number of connections. Default 16\n");
+  fprintf(stderr, "  -o Most queues open at once on each connection. Default 1000\n");
+  fprintf(stderr, "  -n Number of MQOPEN/MQCLOSE operations in each round. Default 1000000\n");
+  fprintf(stderr, "  -r Number of rounds of connect/churn/disconnect. Default 3\n");
+  fprintf(stderr, "  -s Seed for the random choices. Default 1\n");
+  fprintf(stderr, "  -v Print the module's debug output\n");
+  exit(1);
+}
+
+static void rptChurn(const char *fmt, ...) {
+  va_list va;
+  va_start(va, fmt);
+  printf("Churn: ");
+  vprintf(fmt, va);
+  printf("\n");
+  va_end(va);
+}
+
+static uint64_t nowNs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static size_t rssBytes() {
+  long size = 0;
+  long pages = 0;
+  FILE *f = fopen("/proc/self/statm", "r");
+  if (f) {
+    // The first field is the total size, the second is the resident set
+    if (fscanf(f, "%ld %ld", &size, &pages) != 2) {
+      pages = 0;
+    }
+    fclose(f);
+  }
+  return (size_t)pages * (size_t)sysconf(_SC_PAGESIZE);
+}
+
+static void report(const char *phase, uint64_t elapsed, long ops) {
+  size_t recordSize = 0, inUse = 0, reserved = 0, peak = 0;
+
+  if (ot.memoryUsage) {
+    ot.memoryUsage(&recordSize, &inUse, &reserved, &peak);
+  }
+  printf("%-12s RSS %8lu KB  Arena %8lu KB (peak %8lu KB)  Records %8lu", phase, (unsigned long)(rssBytes() / 1024), (unsigned long)(reserved / 1024),
+         (unsigned long)(peak / 1024), (unsigned long)inUse);
+  if (reserved > 0) {
+    printf("  Used %5.1f%%", 100.0 * (double)(inUse * recordSize) / (double)reserved);
+  }
+  if (elapsed > 0 && ops > 0) {
+    printf("  %.0f ns/op", (double)elapsed / ops);
+  }
+  printf("\n");
+}
+
+/*********************************************************************/
+/* Stub versions of the MQI calls that the module makes via Hconfig  */
+/*********************************************************************/
+static void MQENTRY stubCRTMH(MQHCONN Hconn, PMQVOID pCrtMsgHOpts, PMQHMSG pHmsg, PMQLONG pCompCode, PMQLONG pReason) {
+  *pHmsg = nextHmsg++;
+  *pCompCode = MQCC_OK;
+  *pReason = MQRC_NONE;
+}
+
+static void MQENTRY stubDLTMH(MQHCONN Hconn, PMQHMSG pHmsg, PMQVOID pDltMsgHOpts, PMQLONG pCompCode, PMQLONG pReason) {
+  *pHmsg = MQHM_NONE;
+  *pCompCode = MQCC_OK;
+  *pReason = MQRC_NONE;
+}
+
+static void MQENTRY stubOPEN(MQHCONN Hconn, PMQVOID pObjDesc, MQLONG Options, PMQHOBJ pHobj, PMQLONG pCompCode, PMQLONG pReason) {
+  *pHobj = 1;
+  *pCompCode = MQCC_OK;
+  *pReason = MQRC_NONE;
+}
+
+static void MQENTRY stubINQ(MQHCONN Hconn, MQHOBJ Hobj, MQLONG SelectorCount, PMQLONG pSelectors, MQLONG IntAttrCount, PMQLONG pIntAttrs,
+                            MQLONG CharAttrLength, PMQCHAR pCharAttrs, PMQLONG pCompCode, PMQLONG pReason) {
+  if (IntAttrCount > 0) {
+    pIntAttrs[0] = MQPROP_COMPATIBILITY;
+  }
+  *pCompCode = MQCC_OK;
+  *pReason = MQRC_NONE;
+}
+
+static void MQENTRY stubCLOSE(MQHCONN Hconn, PMQHOBJ pHobj, MQLONG Options, PMQLONG pCompCode, PMQLONG pReason) {
+  *pHobj = MQHO_UNUSABLE_HOBJ;
+  *pCompCode = MQCC_OK;
+  *pReason = MQRC_NONE;
+}
+
+/*********************************************************************/
+/* Drive the module                                                  */
+/*********************************************************************/
+static void openOne(churnConn *c, PMQAXC pExitContext) {
+  MQOD od = {MQOD_DEFAULT};
+  PMQOD pOd = &od;
+  MQHOBJ hObj = c->nextHobj++;
+  PMQHOBJ pHobj = &hObj;
+  MQLONG options = MQOO_INPUT_AS_Q_DEF | MQOO_INQUIRE;
+  MQLONG cc = MQCC_OK;
+  MQLONG rc = MQRC_NONE;
+
+  od.ObjectType = MQOT_Q;
+  snprintf(od.ObjectName, MQ_Q_NAME_LENGTH, "AMQ.%08X%08X", (unsigned int)c->hConn, (unsigned int)hObj);
+  ot.openAfter(&c->axp, pExitContext, &c->hConn, &pOd, &options, &pHobj, &cc, &rc);
+  c->open[c->openCount++] = hObj;
+}
+
+static void closeOne(churnConn *c, PMQAXC pExitContext, int i) {
+  MQHOBJ hObj = c->open[i];
+  PMQHOBJ pHobj = &hObj;
+  MQLONG options = MQCO_DELETE_PURGE;
+  MQLONG cc = MQCC_OK;
+  MQLONG rc = MQRC_NONE;
+
+  ot.closeAfter(&c->axp, pExitContext, &c->hConn, &pHobj, &options, &cc, &rc);
+  c->open[i] = c->open[--c->openCount];
+}
+
+int main(int argc, char **argv) {
+  char *modName = DLMODULE;
+  int connCount = 16;
+  int maxOpen = 1000;
+  long operations = 1000000;
+  int rounds = 3;
+  unsigned int seed = 1;
+  int verbose = 0;
+  int opt;
+  int rc = 0;
+  int i, r;
+  long n;
+  char msg[256] = {0};
+
+  while ((opt = getopt(argc, argv, "m:c:o:n:r:s:v")) != -1) {
+    switch (opt) {
+    case 'm':
+      modName = optarg;
+      break;
+    case 'c':
+      connCount = atoi(optarg);
+      break;
+    case 'o':
+      maxOpen = atoi(optarg);
+      break;
+    case 'n':
+      operations = atol(optarg);
+      break;
+    case 'r':
+      rounds = atoi(optarg);
+      break;
+    case 's':
+      seed = (unsigned int)atoi(optarg);
+      break;
+    case 'v':
+      verbose = 1;
+      break;
+    default:
+      usage(argv[0]);
+    }
+  }
+  if (connCount < 1 || maxOpen < 1 || operations < 1 || rounds < 1) {
+    usage(argv[0]);
+  }
+
+  void *hdl = dlopen(modName, RTLD_LOCAL | RTLD_NOW);
+  if (!hdl) {
+    fprintf(stderr, "Cannot load %s: %s\n", modName, dlerror());
+    exit(1);
+  }
+
+#define DLSYM(FUNC, Name)                                                                                                                                      \
+  {                                                                                                                                                            \
+    FUNC = (void *)dlsym(hdl, Name);                                                                                                                           \
+    if (FUNC == NULL) {                                                                                                                                        \
+      fprintf(stderr, "Cannot find symbol %s\n", Name);                                                                                                        \
+      rc++;                                                                                                                                                    \
+    }                                                                                                                                                          \
+  }
+
+  DLSYM(ot.init, "mqotInit");
+  DLSYM(ot.term, "mqotTerm");
+  DLSYM(ot.openAfter, "mqotOpenAfter");
+  DLSYM(ot.closeAfter, "mqotCloseAfter");
+  DLSYM(ot.discBefore, "mqotDiscBefore");
+  if (rc != 0) {
+    exit(1);
+  }
+  // Older modules don't report their memory use, but can still be measured by RSS
+  ot.memoryUsage = (OTEL_MEMORY *)dlsym(hdl, "mqotMemoryUsage");
+
+  unsetenv("MQIOTEL_CAPTURE_FILE");
+  rc = ot.init(verbose ? rptChurn : NULL, msg, sizeof(msg));
+  printf("Module: %s\n", msg);
+  if (rc != MQRC_NONE) {
+    fprintf(stderr, "Module initialisation failed with %d\n", rc);
+    exit(1);
+  }
+
+  MQIEP iep;
+  memset(&iep, 0, sizeof(iep));
+  memcpy(iep.StrucId, MQIEP_STRUC_ID, sizeof(iep.StrucId));
+  iep.Version = MQIEP_VERSION_1;
+  iep.StrucLength = sizeof(iep);
+  iep.MQCRTMH_Call = (PMQ_CRTMH_CALL)stubCRTMH;
+  iep.MQDLTMH_Call = (PMQ_DLTMH_CALL)stubDLTMH;
+  iep.MQOPEN_Call = (PMQ_OPEN_CALL)stubOPEN;
+  iep.MQINQ_Call = (PMQ_INQ_CALL)stubINQ;
+  iep.MQCLOSE_Call = (PMQ_CLOSE_CALL)stubCLOSE;
+
+  MQAXC axc;
+  memset(&axc, 0, sizeof(axc));
+  axc.Environment = MQXE_OTHER;
+
+  churnConn *conns = calloc(connCount, sizeof(churnConn));
+  if (!conns) {
+    fprintf(stderr, "Cannot allocate memory\n");
+    exit(1);
+  }
+  for (i = 0; i < connCount; i++) {
+    conns[i].open = malloc(sizeof(MQHOBJ) * maxOpen);
+    if (!conns[i].open) {
+      fprintf(stderr, "Cannot allocate memory\n");
+      exit(1);
+    }
+  }
+
+  printf("%d connections, up to %d queues open on each, %ld operations per round\n\n", connCount, maxOpen, operations);
+  report("Start", 0, 0);
+
+  for (r = 0; r < rounds; r++) {
+    char phase[32];
+
+    for (i = 0; i < connCount; i++) {
+      churnConn *c = &conns[i];
+      memset(&c->axp, 0, sizeof(c->axp));
+      c->axp.Hconfig = &iep;
+      c->axp.APICallerType = MQXACT_EXTERNAL;
+      c->hConn = (MQHCONN)(r * connCount + i + 1);
+      c->openCount = 0;
+      c->nextHobj = 1;
+    }
+
+    // Open or close a queue on a random connection. Opening is favoured until the connection
+    // is half full, then the two balance out.
+    uint64_t start = nowNs();
+    for (n = 0; n < operations; n++) {
+      churnConn *c = &conns[rand_r(&seed) % connCount];
+      int target = maxOpen / 2;
+      int roll = rand_r(&seed) % maxOpen;
+      if (c->openCount == 0 || (c->openCount < maxOpen && (c->openCount < target || roll >= c->openCount))) {
+        openOne(c, &axc);
+      } else {
+        closeOne(c, &axc, rand_r(&seed) % c->openCount);
+      }
+    }
+    uint64_t elapsed = nowNs() - start;
+    snprintf(phase, sizeof(phase), "Round %d", r + 1);
+    report(phase, elapsed, operations);
+
+    // The module releases a connection's records all together when it disconnects
+    for (i = 0; i < connCount; i++) {
+      churnConn *c = &conns[i];
+      PMQHCONN pHconn = &c->hConn;
+      MQLONG cc = MQCC_OK;
+      MQLONG rc = MQRC_NONE;
+      ot.discBefore(&c->axp, &axc, &pHconn, &cc, &rc);
+    }
+    report("Disconnected", 0, 0);
+  }
+
+  ot.term();
+  return 0;
+}
@@ -0,0 +1,62 @@
+/*
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+  Copyright (c) IBM Corporation 2024
+*/
+
+// The functions that mqioteldl.so exports. They are found with dlsym by the mqiotel stub and
+// the replay and churn programs, or called directly by the static build and the mqmux plugin.
+// This header is plain C so that it can be shared by all of them.
+
+#ifndef MQIOTEL_ENTRY_H
+#define MQIOTEL_ENTRY_H
+
+#include <stddef.h>
+
+#include <cmqc.h>
+#include <cmqxc.h>
+
+// The logging function given to mqotInit
+typedef void RPT_FN(const char *fmt, ...);
+
+typedef MQLONG OTEL_INIT(RPT_FN *rpt, char *buf, size_t len);
+typedef void OTEL_TERM(void);
+typedef void OTEL_MEMORY(size_t *recordSize, size_t *inUse, size_t *reserved, size_t *peakReserved);
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+OTEL_INIT mqotInit;
+OTEL_TERM mqotTerm;
+OTEL_MEMORY mqotMemoryUsage;
+
+MQ_OPEN_EXIT mqotOpenBefore;
+MQ_OPEN_EXIT mqotOpenAfter;
+MQ_CLOSE_EXIT mqotCloseAfter;
+MQ_DISC_EXIT mqotDiscBefore;
+MQ_CONNX_EXIT mqotConnxAfter;
+MQ_TERM_EXIT mqotTerminate;
+MQ_PUT_EXIT mqotPutBefore;
+MQ_PUT_EXIT mqotPutAfter;
+MQ_PUT1_EXIT mqotPut1Before;
+MQ_GET_EXIT mqotGetBefore;
+MQ_GET_EXIT mqotGetAfter;
+MQ_CB_EXIT mqotCBBefore;
+MQ_CB_EXIT mqotCBAfter;
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif
@@ -20,17 +20,14 @@
 #include <cmqc.h>
 #include <cmqec.h>
 
-#include <trace/span.h>
-#include <trace/trace_state.h>
-#include <trace/tracer.h>
+#include <common/attribute_value.h>
 
 #include "mqiotel.hpp"
-
-namespace trace_api = opentelemetry::trace;
+#include "mqiotel_propagator.hpp"
 
 // Use this as a bitmap filter to pull out relevant value from GMO.
 // The AS_Q_DEF value is 0 so would not contribute.
-#define GETPROPSOPTIONS MQGMO_PROPERTIES_FORCE_MQRFH2 | MQGMO_PROPERTIES_IN_HANDLE | MQGMO_NO_PROPERTIES | MQGMO_PROPERTIES_COMPATIBILITY
+#define GETPROPSOPTIONS (MQGMO_PROPERTIES_FORCE_MQRFH2 | MQGMO_PROPERTIES_IN_HANDLE | MQGMO_NO_PROPERTIES | MQGMO_PROPERTIES_COMPATIBILITY)
 
 static MQLONG gmoLength(PMQGMO gmo) {
   switch (gmo->Version) {
@@ -46,68 +43,69 @@ static MQLONG gmoLength(PMQGMO gmo) {
   }
 }
 
-static phobjOptions saveGmo(PMQHCONN hc, PMQHOBJ ho, PMQGMO gmo) {
-  phobjOptions o;
-  string key = objectKey(hc, ho);
-  if (objectOptionsMap.count(key) == 0) {
-    o = (hobjOptions *)mqotMalloc(sizeof(hobjOptions));
-    objectOptionsMap[key] = o;
-  } else {
-    o = objectOptionsMap[key];
+// Copy the output fields from the GMO that the queue manager really used into the
+// application's view of it, leaving the application's own options and handle alone.
+static void copyGmoOutput(PMQGMO to, PMQGMO from, MQLONG length) {
+  MQLONG options = to->Options;
+  MQLONG version = to->Version;
+  MQHMSG mh = (version >= MQGMO_VERSION_4) ? to->MsgHandle : MQHM_NONE;
+
+  memcpy(to, from, length);
+  to->Options = options;
+  to->Version = version;
+  if (version >= MQGMO_VERSION_4) {
+    to->MsgHandle = mh;
   }
-  o->gmo = gmo;
-  return o;
-}
-
-static PMQGMO restoreGmo(PMQHCONN hc, PMQHOBJ ho) {
-  string key = objectKey(hc, ho);
-  return objectOptionsMap[key]->gmo;
 }
 
-string extractRFH2PropVal(const char *propsC, int l, const char *prop) {
-  string props = string(propsC, l);
-
-  // rpt("Props: %s Prop:%s",props.c_str(),prop);
-  string val = "";
-  string propXml = "<" + string(prop) + ">";
-  size_t start = props.find(propXml);
-  if (start != string::npos) {
-    // Where does the next tag begin
-    size_t end = props.find("<", start + propXml.length());
-    if (end != string::npos) {
+// Stash a copy of the original GMO and build a new one that is guaranteed to be
+// at least Version4 length (to recognise handles). If we know that the app or queue
+// is configured for not returning any properties, then we will override that into a handle.
+static PMQGMO buildGmo(phobjOptions o, PMQGMO gmo, bool *needHandle) {
+  MQLONG propGetOptions = gmo->Options & GETPROPSOPTIONS;
+  PMQGMO myGmo = &o->myGmo;
 
-      val = props.substr(start + propXml.length(), end - start - propXml.length());
-    }
+  o->myGmo = {MQGMO_DEFAULT};
+  memcpy(myGmo, gmo, gmoLength(gmo));
+  if (myGmo->Version < MQGMO_VERSION_4) {
+    myGmo->Version = MQGMO_VERSION_4;
   }
-  return val;
-}
 
-vector<string> split(const string &str, const string &delim) {
-  vector<string> tokens;
-  size_t prev = 0, pos = 0;
-  do {
-    pos = str.find(delim, prev);
-    if (pos == string::npos)
-      pos = str.length();
-    string token = str.substr(prev, pos - prev);
-    if (!token.empty())
-      tokens.push_back(token);
-    prev = pos + delim.length();
-  } while (pos < str.length() && prev < str.length());
-  return tokens;
+  *needHandle = false;
+  if ((propGetOptions == MQGMO_NO_PROPERTIES) || (propGetOptions == MQGMO_PROPERTIES_AS_Q_DEF && o->propCtl == MQPROP_NONE)) {
+    myGmo->Options &= ~MQGMO_NO_PROPERTIES;
+    myGmo->Options |= MQGMO_PROPERTIES_IN_HANDLE;
+    *needHandle = true;
+    rpt("Using mqiotel msg handle. getPropsOptions=%d propCtl=%d\n", propGetOptions, o->propCtl);
+  } else {
+    // Hopefully they will have set something suitable on the PROPCTL attribute
+    // or are asking specifically for an RFH2-style response
+    rpt("Not setting a message handle. propGetOptions=%08X\n", propGetOptions);
+  }
+  return myGmo;
 }
 
-static void HexToBinary(const string hex, uint8_t *buf, const int buflen) {
-  // printf("Converting %s: ",hex.c_str());
-  for (size_t i = 0; i * 2 < hex.length() && i < buflen; i++) {
-    string byteString = hex.substr(i * 2, 2);
-
-    uint8_t byteValue = static_cast<uint8_t>(stoi(byteString, nullptr, 16));
-    // printf("%02X",byteValue);
-    buf[i] = byteValue;
+// Find a property in an RFH2 folder without copying anything. The value runs
+// up to the start of the next tag.
+bool findRFH2Prop(const char *props, int propsLength, const char *prop, const char **value, int *valueLength) {
+  size_t nl = strlen(prop);
+  const char *end = props + propsLength;
+  const char *p = props;
+
+  while (p < end && (p = (const char *)memchr(p, '<', end - p)) != NULL) {
+    p++;
+    if ((size_t)(end - p) > nl && !memcmp(p, prop, nl) && p[nl] == '>') {
+      const char *v = p + nl + 1;
+      const char *e = (const char *)memchr(v, '<', end - v);
+      if (e) {
+        *value = v;
+        *valueLength = e - v;
+        return true;
+      }
+      return false;
+    }
   }
-  // printf("\n");
-  return;
+  return false;
 }
 
 // Create an empty attributes map, used when linking the inbound to the active span
@@ -118,15 +116,31 @@ static const opentelemetry::common::KeyValueIterableView<std::array<std::pair<st
   return kEmptyAttributes;
 }
 
+// Baggage entries become attributes on the link. The names and values are not copied.
+typedef std::pair<nostd::string_view, opentelemetry::common::AttributeValue> linkAttribute;
+
 extern "C" {
 MQ_GET_EXIT mqotGetBefore;
 MQ_GET_EXIT mqotGetAfter;
+MQ_CB_EXIT mqotCBBefore;
+MQ_CB_EXIT mqotCBAfter;
 
+// Only synchronous MQGET calls come through here, always with an unusable hObj so that
+// they share one entry and one message handle for the hConn.
 void mqotGetBefore(PMQAXP pExitParms, PMQAXC pExitContext, PMQHCONN pHconn, PMQHOBJ pHobj, PPMQMD ppMsgDesc, PPMQGMO ppGetMsgOpts, PMQLONG pBufferLength,
                    PPMQVOID ppBuffer, PPMQLONG ppDataLength, PMQLONG pCompCode, PMQLONG pReason) {
 
-  MQLONG propCtl;
   PMQGMO gmo = *ppGetMsgOpts;
+  captureCall cap;
+
+  // No link will be added for an unsampled consumer span, so there's no need to ask for the properties
+  if (unsampledSkipGet && !trace_api::Tracer::GetCurrentSpan()->GetContext().IsSampled()) {
+    return;
+  }
+
+  captureStart(&cap, CAPTURE_GET_BEFORE, pHconn, pHobj);
+  captureOptions(&cap, gmo->Options, gmo->Version, 0);
+  cap.rec.bufferLength = *pBufferLength;
 
   // Option combinations:
   // MQGMO_NO_PROPERTIES: Always add our own handle
@@ -138,109 +152,151 @@ void mqotGetBefore(PMQAXP pExitParms, PMQAXC pExitContext, PMQHCONN pHconn, PMQH
   //               FORCE: Any returned properties will be in RFH2
   //                "unknown": Can't guess - may or may not be OK
 
-  MQLONG propGetOptions = gmo->Options & GETPROPSOPTIONS;
-
   if (gmo->Version >= MQGMO_VERSION_4 && isValidHandle(gmo->MsgHandle)) {
     rpt("Using app-supplied msg handle");
+    captureOptions(&cap, gmo->Options, gmo->Version, CAPTURE_FLAG_APP_HANDLE);
   } else {
-    auto o = saveGmo(pHconn, pHobj, gmo);
-
-    string key = objectKey(pHconn, pHobj);
-    propCtl = -1;
-    if (objectOptionsMap.count(key) == 1) {
-      auto opts = objectOptionsMap[key];
-      propCtl = opts->propCtl;
-
-      // Stash a copy of the original GMO and build a new one that
-      // is guaranteed to be at least Version4 length (to recognise handles)
-      PMQGMO myGmo = &o->myGmo;
-      o->myGmo = {MQGMO_DEFAULT};
-      memcpy(myGmo, gmo, gmoLength(gmo));
-
-      if (myGmo->Version < MQGMO_VERSION_4) {
-        myGmo->Version = MQGMO_VERSION_4;
-      }
+    bool needHandle;
+    phobjOptions o = getHobjOptions(pExitParms, pHobj);
+    o->gmo = gmo;
+    cap.rec.propCtl = o->propCtl;
+
+    PMQGMO myGmo = buildGmo(o, gmo, &needHandle);
+    if (needHandle) {
+      myGmo->MsgHandle = getMsgHandle(pExitParms, pHconn);
+    }
 
-      // Make the real MQGET use our GMO instead of the app-supplied version
-      *ppGetMsgOpts = myGmo;
+    // Make the real MQGET use our GMO instead of the app-supplied version
+    *ppGetMsgOpts = myGmo;
+  }
+
+  captureEnd(&cap, *pCompCode, *pReason);
+  return;
+}
 
-      // If we know that the app or queue is configured for not returning any properties, then we will override that into our handle
-      if ((propGetOptions == MQGMO_NO_PROPERTIES) || (propGetOptions == MQGMO_PROPERTIES_AS_Q_DEF && propCtl == MQPROP_NONE)) {
-        gmo->Options &= ~MQGMO_NO_PROPERTIES;
-        gmo->Options |= MQGMO_PROPERTIES_IN_HANDLE;
+// Registering an async consumer works like the Before phase of an MQGET, but the consumer gets
+// its own message handle. The queue manager keeps its own copy of the GMO, so the one we build
+// is only needed until the MQCB returns; after that it is used for showing each callback the
+// application's view of the GMO.
+void mqotCBBefore(PMQAXP pExitParms, PMQAXC pExitContext, PMQHCONN pHconn, PMQLONG pOperation, PPMQCBD ppCallbackDesc, PMQHOBJ pHobj, PPMQMD ppMsgDesc,
+                  PPMQGMO ppGetMsgOpts, PMQLONG pCompCode, PMQLONG pReason) {
+  PMQCBD cbd = *ppCallbackDesc;
+  PMQGMO gmo = *ppGetMsgOpts;
+  captureCall cap;
 
-        myGmo->MsgHandle = getMsgHandle(pExitParms, pHconn, pHobj);
-        rpt("Using mqiotel msg handle. getPropsOptions=%d propCtl=%d\n", propGetOptions, propCtl);
-      } else {
-        // Hopefully they will have set something suitable on the PROPCTL attribute
-        // or are asking specifically for an RFH2-style response
-        rpt("Not setting a message handle. propGetOptions=%08X\n", propGetOptions);
-      }
+  if ((*pOperation & MQOP_REGISTER) == 0 || !cbd || cbd->CallbackType != MQCBT_MESSAGE_CONSUMER || !gmo) {
+    return;
+  }
+
+  captureStart(&cap, CAPTURE_GET_BEFORE, pHconn, pHobj);
+  captureOptions(&cap, gmo->Options, gmo->Version, CAPTURE_FLAG_ASYNC);
+
+  phobjOptions o = getHobjOptions(pExitParms, pHobj);
+  cap.rec.propCtl = o->propCtl;
+
+  if (gmo->Version >= MQGMO_VERSION_4 && isValidHandle(gmo->MsgHandle)) {
+    // Any earlier registration on this hObj is being replaced, so we don't need our handle
+    rpt("Consumer using app-supplied msg handle");
+    captureOptions(&cap, gmo->Options, gmo->Version, CAPTURE_FLAG_ASYNC | CAPTURE_FLAG_APP_HANDLE);
+    deleteConsumerHandle(pExitParms, pHconn, o);
+    o->consumer = false;
+  } else {
+    bool needHandle;
+    o->gmo = gmo;
+    o->consumer = true;
+    o->consumerGmo = {MQGMO_DEFAULT};
+    memcpy(&o->consumerGmo, gmo, gmoLength(gmo));
+
+    PMQGMO myGmo = buildGmo(o, gmo, &needHandle);
+    if (needHandle) {
+      myGmo->MsgHandle = getConsumerHandle(pExitParms, pHconn, o);
+    } else {
+      deleteConsumerHandle(pExitParms, pHconn, o);
     }
+    *ppGetMsgOpts = myGmo;
+  }
+
+  captureEnd(&cap, *pCompCode, *pReason);
+  return;
+}
+
+// Put back the application's GMO after registration, and release the consumer's handle once it
+// has been deregistered. A failed registration leaves any handle in place; it is deleted when
+// the queue is closed.
+void mqotCBAfter(PMQAXP pExitParms, PMQAXC pExitContext, PMQHCONN pHconn, PMQLONG pOperation, PPMQCBD ppCallbackDesc, PMQHOBJ pHobj, PPMQMD ppMsgDesc,
+                 PPMQGMO ppGetMsgOpts, PMQLONG pCompCode, PMQLONG pReason) {
+  phobjOptions o = findHobjOptions(pExitParms, pHobj);
 
+  if (!o) {
     return;
   }
+  if ((*pOperation & MQOP_REGISTER) != 0 && *ppGetMsgOpts == &o->myGmo) {
+    *ppGetMsgOpts = o->gmo;
+  }
+  if ((*pOperation & MQOP_DEREGISTER) != 0 && *pCompCode != MQCC_FAILED && o->consumer) {
+    rpt("Consumer deregistered. Deleting its msg handle");
+    deleteConsumerHandle(pExitParms, pHconn, o);
+    o->consumer = false;
+  }
+  return;
 }
 
 // Extract the properties from the message, either with the properties API
 // or from the RFH2. Construct a new context with the span information from the inbound message and
 // if there's an existing SpanContext, add a link to the original
-// We do not try to extract/propagate any baggage-related fields.
+// Any allowed baggage entries are added to the link as attributes.
 void mqotGetAfter(PMQAXP pExitParms, PMQAXC pExitContext, PMQHCONN pHconn, PMQHOBJ pHobj, PPMQMD ppMsgDesc, PPMQGMO ppGetMsgOpts, PMQLONG pBufferLength,
                   PPMQVOID ppBuffer, PPMQLONG ppDataLength, PMQLONG pCompCode, PMQLONG pReason) {
 
   PMQGMO gmo = *ppGetMsgOpts;
   PMQMD md = *ppMsgDesc;
-  MQLONG CC, RC;
   PMQVOID buffer = *ppBuffer;
 
-  string traceparentVal = "";
-  string tracestateVal = "";
+  MQHMSG propsHandle = MQHM_NONE;
+  const char *rfh2Props = NULL;
+  int rfh2Length = 0;
+  propagatedContext pc;
+  baggageEntry baggage[MAX_BAGGAGE_KEYS];
+  int baggageCount = 0;
 
   bool haveMsg = true;
+  captureCall cap;
+
+  captureStart(&cap, CAPTURE_GET_AFTER, pHconn, pHobj);
+  captureMd(&cap, md);
+  captureOptions(&cap, gmo->Options, gmo->Version, (*pHobj != MQHO_UNUSABLE_HOBJ) ? CAPTURE_FLAG_ASYNC : 0);
+  if (ppDataLength && *ppDataLength) {
+    cap.rec.bufferLength = **ppDataLength;
+  }
 
-  int removed = 0;
   if (*pCompCode != MQCC_OK && *pReason != MQRC_TRUNCATED_MSG_ACCEPTED) {
     haveMsg = false;
   }
-  MQHMSG mh = gmo->MsgHandle;
+  // Give the application back its own GMO. For a sync MQGET that's the one it passed in; a
+  // callback is shown a GMO built from its registration options.
+  phobjOptions o = findHobjOptions(pExitParms, pHobj);
+  if (o && *pHobj == MQHO_UNUSABLE_HOBJ && gmo == &o->myGmo && o->gmo) {
+    rpt("Restoring original GMO");
+    copyGmoOutput(o->gmo, gmo, gmoLength(o->gmo));
+    *ppGetMsgOpts = o->gmo;
+  } else if (o && *pHobj != MQHO_UNUSABLE_HOBJ && o->consumer) {
+    rpt("Restoring consumer's GMO");
+    o->myGmo = o->consumerGmo;
+    copyGmoOutput(&o->myGmo, gmo, gmoLength(&o->consumerGmo));
+    *ppGetMsgOpts = &o->myGmo;
+  }
+
+  auto currentSpan = trace_api::Tracer::GetCurrentSpan();
+  if (unsampledSkipGet && !currentSpan->GetContext().IsSampled()) {
+    captureEnd(&cap, *pCompCode, *pReason);
+    return;
+  }
+
+  MQHMSG mh = (gmo->Version >= MQGMO_VERSION_4) ? gmo->MsgHandle : MQHM_NONE;
   if (isValidHandle(mh)) {
     if (haveMsg) {
       rpt("Looking for context in handle");
-
-      MQPD pd = {MQPD_DEFAULT};
-      MQIMPO impo = {MQIMPO_DEFAULT};
-
-      impo.Options = MQIMPO_CONVERT_VALUE | MQIMPO_INQ_FIRST;
-
-      string val = propsValue(pExitParms, pHconn, mh, TRACEPARENT, &CC, &RC);
-      if (CC == MQCC_OK) {
-        rpt("Found traceparent property: %s", val.c_str());
-        traceparentVal = val;
-      } else {
-        if (RC != MQRC_PROPERTY_NOT_AVAILABLE) {
-          // Should not happen
-          rptmqrc("GetAfter (1)", CC, RC);
-        }
-      }
-
-      val = propsValue(pExitParms, pHconn, mh, TRACESTATE, &CC, &RC);
-      if (CC == MQCC_OK) {
-        rpt("Found tracestate property: %s", val.c_str());
-        tracestateVal = val;
-      } else {
-        if (RC != MQRC_PROPERTY_NOT_AVAILABLE) {
-          // Should not happen
-          rptmqrc("GetAfter (2)", CC, RC);
-        }
-      }
-    }
-
-    // If we added our own handle in the GMO, then reset
-    // but don't do it for async callbacks. Indicated by the HOBJ value.
-    if ((*pHobj == MQHO_UNUSABLE_HOBJ) && compareMsgHandle(pHconn, pHobj, mh)) {
-      *ppGetMsgOpts = restoreGmo(pHconn, pHobj);
-      rpt("Removing our handle");
+      propsHandle = mh;
     }
 
     // Should we also remove the properties?
@@ -264,12 +320,9 @@ void mqotGetAfter(PMQAXP pExitParms, PMQAXC pExitContext, PMQHCONN pHconn, PMQHO
     offset += 4;
     propsLen -= 4;
 
-    char *props = &b[offset];
-
-    traceparentVal = extractRFH2PropVal(props, propsLen, TRACEPARENT);
-    tracestateVal = extractRFH2PropVal(props, propsLen, TRACESTATE);
-
-    rpt("Found parent:%s state:%s", traceparentVal.c_str(), tracestateVal.c_str());
+    rfh2Props = &b[offset];
+    rfh2Length = propsLen;
+    cap.rec.flags |= CAPTURE_FLAG_RFH2;
 
     /*
     if otelOpts.RemoveRFH2 {
@@ -291,53 +344,48 @@ void mqotGetAfter(PMQAXP pExitParms, PMQAXC pExitContext, PMQHCONN pHconn, PMQHO
     rpt("No properties or RFH2 found");
   }
 
+  bool haveNewContext = false;
+  if (propsHandle != MQHM_NONE || rfh2Props) {
+    haveNewContext = EXTRACT_CONTEXT(pExitParms, pHconn, propsHandle, rfh2Props, rfh2Length, &pc, &cap);
+  }
+  if (haveNewContext && baggageKeyCount > 0) {
+    baggageCount = extractBaggage(pExitParms, pHconn, propsHandle, rfh2Props, rfh2Length, baggage, &cap);
+  }
+  // Queues that can't carry properties may have had the context put into the MQMD instead
+  if (!haveNewContext && carriersConfigured && haveMsg && md) {
+    haveNewContext = carrierDecode(md, &pc);
+  }
+
   // We now should have the relevant message properties to pass upwards
-  auto currentSpan = trace_api::Tracer::GetCurrentSpan();
   if (currentSpan->GetContext().IsValid()) {
-    bool haveNewContext = false;
-
-    auto traceId = trace_api::TraceId();
-    auto spanId = trace_api::SpanId();
-    auto traceFlags = trace_api::TraceFlags();
-    auto traceState = trace_api::TraceState::GetDefault();
-
-    if (traceparentVal != "") {
-      // Split the inbound traceparent value into its components to allow
-      // construction of a new context
-      auto elem = split(traceparentVal, "-");
-      if (elem.size() == 4) {
-        // elem[0] = 0 (version indicator. Always 0 for now)
-
-        uint8_t traceIdBuf[trace_api::TraceId::kSize];
-        HexToBinary(elem[1], traceIdBuf, trace_api::TraceId::kSize);
-        traceId = trace_api::TraceId{traceIdBuf};
-
-        uint8_t spanIdBuf[trace_api::SpanId::kSize];
-        HexToBinary(elem[2], spanIdBuf, trace_api::SpanId::kSize);
-        spanId = trace_api::SpanId{spanIdBuf};
-        // Final element can only be 00 or 01 (for now)
-        if (elem[3] == "01") {
-          traceFlags = trace_api::TraceFlags(trace_api::TraceFlags::kIsSampled);
-        }
-        haveNewContext = true;
+    // If there is a current span, and we have a context from the message,
+    // then create a link referencing these values
+    if (haveNewContext) {
+      auto traceId = trace_api::TraceId{pc.traceId};
+      auto spanId = trace_api::SpanId{pc.spanId};
+      auto traceFlags = trace_api::TraceFlags(pc.flags & trace_api::TraceFlags::kIsSampled);
+      auto traceState = trace_api::TraceState::GetDefault();
+
+      if (pc.stateLength > 0) {
+        // Build a TraceState structure by parsing the string
+        traceState = trace_api::TraceState::FromHeader(nostd::string_view(pc.state, pc.stateLength));
       }
-    }
-
-    if (tracestateVal != "") {
-      // Build a TraceState structure by parsing the string
-      traceState = trace_api::TraceState::FromHeader(tracestateVal);
-      haveNewContext = true;
-    }
 
-    // If there is a current span, and we have at least one of the
-    // parent/state properties, then create a link referencing these values
-    if (haveNewContext) {
       auto spanContext = trace_api::SpanContext{traceId, spanId, traceFlags, true, traceState};
       // See https://github.com/open-telemetry/opentelemetry-specification/issues/454 for why this only works
       // with ABI V2
 #if defined OPENTELEMETRY_ABI_VERSION_NO && OPENTELEMETRY_ABI_VERSION_NO >= 2
-      currentSpan->AddLink(spanContext, GetEmptyAttributes());
-      rpt("Added link to current span");
+      if (baggageCount > 0) {
+        linkAttribute attrs[MAX_BAGGAGE_KEYS];
+        for (int i = 0; i < baggageCount; i++) {
+          attrs[i] = {baggage[i].attrName, nostd::string_view(baggage[i].value, baggage[i].length)};
+        }
+        currentSpan->AddLink(spanContext, opentelemetry::common::KeyValueIterableView<nostd::span<const linkAttribute>>(nostd::span<const linkAttribute>(attrs, baggageCount)));
+        rpt("Added link to current span with %d baggage attributes", baggageCount);
+      } else {
+        currentSpan->AddLink(spanContext, GetEmptyAttributes());
+        rpt("Added link to current span");
+      }
 #else
       // Allow compilation to continue, because there may be scenarios where you don't need
       // to call the AddLink function. But issue a compiler warning.
@@ -357,6 +405,7 @@ void mqotGetAfter(PMQAXP pExitParms, PMQAXC pExitContext, PMQHCONN pHconn, PMQHO
     rpt("No current span to update");
   }
 
+  captureEnd(&cap, *pCompCode, *pReason);
   return;
 }
 
@@ -16,6 +16,8 @@
 #include <stdarg.h>
 #include <stdio.h>
 
+#include <cstring>
+
 #include <cmqc.h>
 #include <cmqec.h>
 
@@ -23,15 +25,13 @@
 #include <version.h>
 
 #include "mqiotel.hpp"
+#include "mqiotel_propagator.hpp"
 
 using namespace std;
 
 // What level of the C++ ABI do we need
 #define REQUIRED_ABI 2 // For the AddLink() function on Spans
 
-map<string, MQHMSG> objectHandleMap;
-map<string, phobjOptions> objectOptionsMap;
-
 bool initialised = false;
 
 // Logger function in parent
@@ -45,6 +45,18 @@ bool isValidHandle(MQHMSG mh) {
   return rc;
 }
 
+// Read a property into a caller-supplied buffer, using a prebuilt name
+void propsValueBuf(PMQAXP pExitParms, PMQHCONN pHconn, MQHMSG mh, PMQCHARV propertyNameVS, char *value, MQLONG valueSize, PMQLONG valueLength, PMQLONG pCC,
+                   PMQLONG pRC) {
+  MQIMPO impo = {MQIMPO_DEFAULT};
+  MQPD pd = {MQPD_DEFAULT};
+  MQLONG pType;
+
+  impo.Options = MQIMPO_CONVERT_VALUE | MQIMPO_INQ_FIRST;
+
+  pExitParms->Hconfig->MQINQMP_Call(*pHconn, mh, &impo, propertyNameVS, &pd, &pType, valueSize, value, valueLength, pCC, pRC);
+}
+
 // Is there a property of the given name?
 string propsValue(PMQAXP pExitParms, PMQHCONN pHconn, MQHMSG mh, const char *propertyName, PMQLONG pCC, PMQLONG pRC) {
 
@@ -82,57 +94,123 @@ bool propsContain(PMQAXP pExitParms, PMQHCONN pHconn, MQHMSG mh, const char *pro
   return rc;
 }
 
-// This function can be useful to create a unique key related to the hConn and hObj values
-// where the object name is not sufficiently unique
-std::string objectKey(PMQHCONN hc, PMQHOBJ ho) {
-  string s;
-  if (!ho || *ho == MQHO_UNUSABLE_HOBJ) {
-    s = std::to_string(*hc) + "/*";
-  } else {
-    s = std::to_string(*hc) + "/" + std::to_string(*ho);
+// The connection's state is found through a pointer held in the ExitUserArea, which the
+// queue manager zeroes before the first call on each hConn.
+connState *getConnState(PMQAXP pExitParms) {
+  connState *cs;
+  memcpy(&cs, pExitParms->ExitUserArea, sizeof(cs));
+  if (!cs) {
+    cs = new connState();
+    cs->mh = MQHM_UNUSABLE_HMSG;
+    memcpy(pExitParms->ExitUserArea, &cs, sizeof(cs));
+  }
+  return cs;
+}
+
+// Throw away everything for the connection. Any message handles go away with the hConn itself.
+void freeConnState(PMQAXP pExitParms) {
+  connState *cs;
+  memcpy(&cs, pExitParms->ExitUserArea, sizeof(cs));
+  if (cs) {
+    freeHobjArena(&cs->arena);
+    delete cs;
+    memset(pExitParms->ExitUserArea, 0, sizeof(pExitParms->ExitUserArea));
+  }
+}
+
+// Sync MQGET and MQPUT1 don't have a real hObj. They share an entry under the unusable value.
+static MQHOBJ objectKey(PMQHOBJ ho) {
+  return (ho) ? *ho : MQHO_UNUSABLE_HOBJ;
+}
+
+phobjOptions findHobjOptions(PMQAXP pExitParms, PMQHOBJ pHobj) {
+  connState *cs = getConnState(pExitParms);
+  auto it = cs->objects.find(objectKey(pHobj));
+  return (it == cs->objects.end()) ? NULL : it->second;
+}
+
+phobjOptions getHobjOptions(PMQAXP pExitParms, PMQHOBJ pHobj) {
+  connState *cs = getConnState(pExitParms);
+  phobjOptions &o = cs->objects[objectKey(pHobj)];
+  if (!o) {
+    o = newHobjOptions(&cs->arena);
+  }
+  return o;
+}
+
+// Closing a queue also removes any async consumer on it, so its handle can go too
+void freeHobjOptions(PMQAXP pExitParms, PMQHCONN pHconn, PMQHOBJ pHobj) {
+  connState *cs = getConnState(pExitParms);
+  auto it = cs->objects.find(objectKey(pHobj));
+  if (it != cs->objects.end()) {
+    deleteConsumerHandle(pExitParms, pHconn, it->second);
+    freeHobjRecord(&cs->arena, it->second);
+    cs->objects.erase(it);
   }
-  return s;
 }
 
 // Do we have a MsgHandle for this hConn? If not, create a new one
-MQHMSG getMsgHandle(PMQAXP pExitParms, PMQHCONN pHconn, PMQHOBJ pHobj) {
-  string key;
-  MQHMSG mh = MQHM_UNUSABLE_HMSG;
+MQHMSG getMsgHandle(PMQAXP pExitParms, PMQHCONN pHconn) {
+  connState *cs = getConnState(pExitParms);
 
-  key = objectKey(pHconn, pHobj);
-  if (objectHandleMap.count(key) == 0) {
+  if (cs->mh == MQHM_UNUSABLE_HMSG) {
     MQCMHO cmho = {MQCMHO_DEFAULT};
+    MQHMSG mh = MQHM_UNUSABLE_HMSG;
     MQLONG CC, RC;
 
     pExitParms->Hconfig->MQCRTMH_Call(*pHconn, &cmho, &mh, &CC, &RC);
     if (CC == MQCC_OK) {
-      objectHandleMap[key] = mh;
+      cs->mh = mh;
     }
-  } else {
-    mh = objectHandleMap[key];
   }
-  return mh;
+  return cs->mh;
 }
 
-// Is the GMO/PMO MsgHandle one that we allocated?
-bool compareMsgHandle(PMQHCONN pHconn, PMQHOBJ pHobj, MQHMSG mh) {
-  bool rc = false;
-  string key = objectKey(pHconn, pHobj);
-  if (objectHandleMap.count(key) == 1) {
-    MQHMSG mhLocal = objectHandleMap[key];
-    if (mhLocal == mh) {
-      rc = true;
+// Is the GMO/PMO MsgHandle the one that we allocated for this hConn?
+bool compareMsgHandle(PMQAXP pExitParms, MQHMSG mh) {
+  connState *cs = getConnState(pExitParms);
+  return isValidHandle(mh) && cs->mh == mh;
+}
+
+// Each async consumer gets its own handle. Callbacks for different consumers can then
+// never see each other's properties.
+MQHMSG getConsumerHandle(PMQAXP pExitParms, PMQHCONN pHconn, phobjOptions o) {
+  if (!isValidHandle(o->consumerHandle)) {
+    MQCMHO cmho = {MQCMHO_DEFAULT};
+    MQHMSG mh = MQHM_UNUSABLE_HMSG;
+    MQLONG CC, RC;
+
+    pExitParms->Hconfig->MQCRTMH_Call(*pHconn, &cmho, &mh, &CC, &RC);
+    if (CC == MQCC_OK) {
+      o->consumerHandle = mh;
+    } else {
+      rptmqrc("MQCRTMH", CC, RC);
     }
   }
-  return rc;
+  return o->consumerHandle;
+}
+
+void deleteConsumerHandle(PMQAXP pExitParms, PMQHCONN pHconn, phobjOptions o) {
+  if (isValidHandle(o->consumerHandle)) {
+    MQDMHO dmho = {MQDMHO_DEFAULT};
+    MQLONG CC, RC;
+
+    pExitParms->Hconfig->MQDLTMH_Call(*pHconn, &o->consumerHandle, &dmho, &CC, &RC);
+    if (CC != MQCC_OK) {
+      rptmqrc("MQDLTMH", CC, RC);
+    }
+    o->consumerHandle = MQHM_NONE;
+  }
 }
 
 extern "C" {
 MQ_DISC_EXIT mqotDiscAfter;
+MQ_CONNX_EXIT mqotConnxAfter;
+MQ_TERM_EXIT mqotTerminate;
 
 // Initialise the module. Set up logging, check and report versions. This
 // should be once per process
-MQLONG mqotInit(RPT_FN _rpt, char *buf, size_t len) {
+MQLONG mqotInit(RPT_FN *_rpt, char *buf, size_t len) {
   MQLONG rc = MQRC_NONE;
 
   if (initialised) {
@@ -155,12 +233,21 @@ MQLONG mqotInit(RPT_FN _rpt, char *buf, size_t len) {
   if (abi_ver_int != REQUIRED_ABI) {
     rc = MQRC_WRONG_VERSION; // Another slight misuse of an existing MQRC value
     snprintf(buf, len, "Application built with ABI %d but this exit requires ABI %d", abi_ver_int, REQUIRED_ABI);
+  } else {
+    propagatorInit();
+    carrierInit();
+    rfh2Init();
+    baggageInit();
+    prewarmInit();
+    captureInit();
   }
   return rc;
 }
 
 void mqotTerm() {
   rpt("mqotTerm");
+  reportMemoryUsage();
+  captureTerm();
   initialised = false;
 
   return;
@@ -168,28 +255,27 @@ void mqotTerm() {
 
 void mqotDiscBefore(PMQAXP pExitParms, PMQAXC pExitContext, PPMQHCONN ppHconn, PMQLONG pCompCode, PMQLONG pReason) {
   PMQHCONN pHconn = *ppHconn;
-  // Delete anything in the map for this hConn. Need to know the hConn so can't do it in the After.
-  // It's OK to delete, even if the DISC were to fail
+  captureCall cap;
 
-  // This string is the start of all keys for this hConn
-  string key = std::to_string(*pHconn) + "/";
+  captureStart(&cap, CAPTURE_DISC_BEFORE, pHconn, NULL);
 
-  // The objectHandleMap only holds the HMSG values. No further cleanup needed
-  for (auto it = objectHandleMap.begin(); it != objectHandleMap.end();) {
-    string mapKey = it->first;
-    if (mapKey.find(key, 0) == 0) { // startswith()
-      it = objectHandleMap.erase(it);
-    }
-  }
+  // Delete everything we know about this hConn. It's OK to delete, even if the DISC were to fail
+  freeConnState(pExitParms);
 
-  // The objectOptionsMap holds structures that were malloced
-  for (auto it = objectOptionsMap.begin(); it != objectOptionsMap.end();) {
-    string mapKey = it->first;
-    if (mapKey.find(key, 0) == 0) { // startswith()
-      auto o = objectOptionsMap[key];
-      mqotFree(o);
-      it = objectOptionsMap.erase(it);
-    }
+  captureEnd(&cap, *pCompCode, *pReason);
+}
+
+// A connection can end without an MQDISC, for example when the application exits. The
+// Terminate call still comes, so the connection's state is released here too.
+void mqotTerminate(PMQAXP pExitParms, PMQAXC pExitContext, PMQLONG pCompCode, PMQLONG pReason) {
+  freeConnState(pExitParms);
+}
+
+// The first connection fills the PROPCTL cache, if that has been configured
+void mqotConnxAfter(PMQAXP pExitParms, PMQAXC pExitContext, PMQCHAR pQMgrName, PPMQCNO ppConnectOpts, PPMQHCONN ppHconn, PMQLONG pCompCode,
+                    PMQLONG pReason) {
+  if (*pCompCode != MQCC_FAILED) {
+    propCtlPrewarm(pExitParms, *ppHconn, pQMgrName);
   }
 }
 
@@ -0,0 +1,108 @@
+/*
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+  Copyright (c) IBM Corporation 2024
+*/
+
+// Lets mqioteldl.so be loaded as a plugin by the mqmux exit, instead of through the mqiotel stub.
+// These functions do the same job as the wrappers in mqiotel.c: using a dummy object handle
+// where the core code needs one, and treating a message delivered to a callback as a GET.
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <cmqc.h>
+#include <cmqxc.h>
+
+#include "../mux/mqmux.h"
+#include "mqiotel.hpp"
+
+// Set by higher layers like the Go and Node wrappers that do their own instrumentation
+#define ENV_WRAPPER "AMQ_OTEL_INSTRUMENTED"
+
+extern "C" {
+MQLONG MqmuxPlugin(mqmuxPlugin *p);
+}
+
+static MQLONG muxInit(MQMUX_RPT *rpt, char *buf, size_t len) {
+  if (getenv(ENV_WRAPPER)) {
+    snprintf(buf, len, "Already instrumented by wrapper");
+    return MQRC_ENVIRONMENT_ERROR;
+  }
+  return mqotInit((RPT_FN *)rpt, buf, len);
+}
+
+static void muxTerm() {
+  mqotTerm();
+}
+
+static void MQENTRY muxPut1After(PMQAXP pExitParms, PMQAXC pExitContext, PMQHCONN pHconn, PPMQOD ppObjDesc, PPMQMD ppMsgDesc, PPMQPMO ppPutMsgOpts,
+                                 PMQLONG pBufferLength, PPMQVOID ppBuffer, PMQLONG pCompCode, PMQLONG pReason) {
+  MQHOBJ dummy = MQHO_UNUSABLE_HOBJ;
+  mqotPutAfter(pExitParms, pExitContext, pHconn, &dummy, ppMsgDesc, ppPutMsgOpts, pBufferLength, ppBuffer, pCompCode, pReason);
+}
+
+static void MQENTRY muxGetBefore(PMQAXP pExitParms, PMQAXC pExitContext, PMQHCONN pHconn, PMQHOBJ pHobj, PPMQMD ppMsgDesc, PPMQGMO ppGetMsgOpts,
+                                 PMQLONG pBufferLength, PPMQVOID ppBuffer, PPMQLONG ppDataLength, PMQLONG pCompCode, PMQLONG pReason) {
+  MQHOBJ dummy = MQHO_UNUSABLE_HOBJ;
+  mqotGetBefore(pExitParms, pExitContext, pHconn, &dummy, ppMsgDesc, ppGetMsgOpts, pBufferLength, ppBuffer, ppDataLength, pCompCode, pReason);
+}
+
+static void MQENTRY muxGetAfter(PMQAXP pExitParms, PMQAXC pExitContext, PMQHCONN pHconn, PMQHOBJ pHobj, PPMQMD ppMsgDesc, PPMQGMO ppGetMsgOpts,
+                                PMQLONG pBufferLength, PPMQVOID ppBuffer, PPMQLONG ppDataLength, PMQLONG pCompCode, PMQLONG pReason) {
+  MQHOBJ dummy = MQHO_UNUSABLE_HOBJ;
+  mqotGetAfter(pExitParms, pExitContext, pHconn, &dummy, ppMsgDesc, ppGetMsgOpts, pBufferLength, ppBuffer, ppDataLength, pCompCode, pReason);
+}
+
+static void MQENTRY muxCallbackBefore(PMQAXP pExitParms, PMQAXC pExitContext, PMQHCONN pHconn, PPMQMD ppMsgDesc, PPMQGMO ppGetMsgOpts, PPMQVOID ppBuffer,
+                                      PPMQCBC ppMQCBContext) {
+  PMQCBC cbc = *ppMQCBContext;
+  PMQLONG pDataLength = &cbc->DataLength;
+
+  if (cbc->CallType == MQCBCT_MSG_REMOVED && (cbc->CompCode == MQCC_OK || cbc->Reason == MQRC_TRUNCATED_MSG_ACCEPTED)) {
+    mqotGetAfter(pExitParms, pExitContext, pHconn, &cbc->Hobj, ppMsgDesc, ppGetMsgOpts, &cbc->BufferLength, ppBuffer, &pDataLength, &cbc->CompCode,
+                 &cbc->Reason);
+  }
+}
+
+MQLONG MqmuxPlugin(mqmuxPlugin *p) {
+  if (p->Version < MQMUX_PLUGIN_VERSION_1) {
+    return MQRC_WRONG_VERSION;
+  }
+
+  p->Name = "otel";
+  p->init = muxInit;
+  p->term = muxTerm;
+
+  p->connxAfter = mqotConnxAfter;
+  p->discAfter = mqotDiscBefore; // Registered as an AFTER function in mqiotel.c too
+  if (p->Version >= MQMUX_PLUGIN_VERSION_2) {
+    p->terminate = mqotTerminate;
+  }
+  p->openBefore = mqotOpenBefore;
+  p->openAfter = mqotOpenAfter;
+  p->closeAfter = mqotCloseAfter;
+
+  p->putBefore = mqotPutBefore;
+  p->putAfter = mqotPutAfter;
+  p->put1Before = mqotPut1Before;
+  p->put1After = muxPut1After;
+
+  p->getBefore = muxGetBefore;
+  p->getAfter = muxGetAfter;
+  p->cbBefore = mqotCBBefore;
+  p->cbAfter = mqotCBAfter;
+  p->callbackBefore = muxCallbackBefore;
+
+  return MQRC_NONE;
+}
@@ -29,20 +29,45 @@ using namespace std;
 // Do not include BROWSE variants
 #define OPEN_GET_OPTIONS (MQOO_INPUT_AS_Q_DEF | MQOO_INPUT_SHARED | MQOO_INPUT_EXCLUSIVE)
 
+// Options where the application is already managing the message context
+#define OPEN_CONTEXT_OPTIONS (MQOO_PASS_IDENTITY_CONTEXT | MQOO_PASS_ALL_CONTEXT | MQOO_SET_IDENTITY_CONTEXT | MQOO_SET_ALL_CONTEXT)
+
+// Anything we added to the MQOPEN options in the Before phase. The Before and After
+// calls are always on the same thread.
+static thread_local MQLONG addedOpenOptions = 0;
+
 extern "C" {
+MQ_OPEN_EXIT mqotOpenBefore;
 MQ_OPEN_EXIT mqotOpenAfter;
 MQ_CLOSE_EXIT mqotCloseAfter;
 
 // Get rid of stashed details of the object that's being Closed
 void mqotCloseAfter(PMQAXP pExitParms, PMQAXC pExitContext, PMQHCONN pHconn, PPMQHOBJ ppHobj, PMQLONG pOptions, PMQLONG pCompCode, PMQLONG pReason) {
+  captureCall cap;
 
-  auto key = objectKey(pHconn, *ppHobj);
-  if (objectOptionsMap.count(key) == 1) {
-    auto o = objectOptionsMap[key];
-    mqotFree(o);
-    objectOptionsMap.erase(key);
-  }
+  captureStart(&cap, CAPTURE_CLOSE_AFTER, pHconn, *ppHobj);
+  captureOptions(&cap, *pOptions, 0, 0);
 
+  freeHobjOptions(pExitParms, pHconn, *ppHobj);
+
+  captureEnd(&cap, *pCompCode, *pReason);
+  return;
+}
+
+// Queues that carry the context in the MQMD need to be opened so that we can set the
+// identity context fields.
+void mqotOpenBefore(PMQAXP pExitParms, PMQAXC pExitContext, PMQHCONN pHconn, PPMQOD ppObjDesc, PMQLONG pOptions, PPMQHOBJ ppHobj, PMQLONG pCompCode,
+                    PMQLONG pReason) {
+  PMQOD od = *ppObjDesc;
+
+  addedOpenOptions = 0;
+  if (carriersConfigured && od->ObjectType == MQOT_Q && (*pOptions & MQOO_OUTPUT) != 0 && (*pOptions & OPEN_CONTEXT_OPTIONS) == 0) {
+    if (carrierForQueue(od->ObjectName) != CARRIER_NONE) {
+      addedOpenOptions = MQOO_SET_IDENTITY_CONTEXT;
+      *pOptions |= addedOpenOptions;
+      rpt("open: adding SET_IDENTITY_CONTEXT for MQMD carrier");
+    }
+  }
   return;
 }
 
@@ -60,21 +85,44 @@ void mqotOpenAfter(PMQAXP pExitParms, PMQAXC pExitContext, PMQHCONN pHconn, PPMQ
   PMQHOBJ pHobj = *ppHobj;
   MQLONG propCtl;
   MQLONG openOptions = *pOptions;
+  MQLONG added = addedOpenOptions;
+  captureCall cap;
+
+  addedOpenOptions = 0;
+  if (added != 0) {
+    // Put back what the application asked for. If our extra option was the reason the
+    // MQOPEN failed, try again without it and use properties for this queue instead.
+    openOptions &= ~added;
+    *pOptions = openOptions;
+    if (*pCompCode == MQCC_FAILED && *pReason == MQRC_NOT_AUTHORIZED) {
+      rpt("open: no authority to set identity context. Retrying without it");
+      pExitParms->Hconfig->MQOPEN_Call(*pHconn, od, openOptions, pHobj, pCompCode, pReason);
+      added = 0;
+    }
+  }
+
+  captureStart(&cap, CAPTURE_OPEN_AFTER, pHconn, pHobj);
+  captureOptions(&cap, openOptions, 0, 0);
+
   // Do the MQINQ and stash the information
   // Only care if there's an INPUT option. We do the MQINQ on every relevant MQOPEN
   // because it might change between an MQCLOSE and a subsequent MQOPEN. The MQCLOSE
   // will, in any case, have discarded the entry from this map.
   // If the user opened the queue with MQOO_INQUIRE, then we can reuse the object handle.
-  // Otherwise we have to do our own open/inq/close.
-  if ((od->ObjectType == MQOT_Q) && (openOptions & OPEN_GET_OPTIONS) != 0) {
-    auto key = objectKey(pHconn, pHobj);
+  // Otherwise we have to do our own open/inq/close. Both are avoided if the queue's PROPCTL
+  // was found by the prewarm inquiry.
+  if (*pCompCode == MQCC_FAILED) {
+    rpt("open: failed so nothing to inquire");
+  } else if ((od->ObjectType == MQOT_Q) && (openOptions & OPEN_GET_OPTIONS) != 0) {
     MQLONG CC, RC;
     propCtl = 0;
 
     MQLONG selectors[] = {MQIA_PROPERTY_CONTROL};
     MQLONG values[1];
 
-    if ((openOptions & MQOO_INQUIRE) != 0) {
+    if (cachedPropCtl(pExitParms, od, &propCtl)) {
+      rpt("open: PROPCTL %d from prewarmed cache", propCtl);
+    } else if ((openOptions & MQOO_INQUIRE) != 0) {
       rpt("open: Reusing existing hObj");
       pExitParms->Hconfig->MQINQ_Call(*pHconn, *pHobj, 1, selectors, 1, values, 0, NULL, &CC, &RC);
 
@@ -115,16 +163,24 @@ void mqotOpenAfter(PMQAXP pExitParms, PMQAXC pExitContext, PMQHCONN pHconn, PPMQ
         pExitParms->Hconfig->MQCLOSE_Call(*pHconn, &inqHobj, 0, &CC, &RC); // Ignore any error
       }
     }
-    // Create an object to hold the discovered value
-    phobjOptions o = (hobjOptions *)mqotMalloc(sizeof(hobjOptions));
+    // Create an object to hold the discovered value, or replace any existing
+    // value for this object handle
+    freeHobjOptions(pExitParms, pHconn, pHobj);
+    phobjOptions o = getHobjOptions(pExitParms, pHobj);
     o->propCtl = propCtl;
-    // replace any existing value for this object handle
-    objectOptionsMap[key] = o;
+    cap.rec.propCtl = propCtl;
 
   } else {
     rpt("open: not doing Inquire");
   }
 
+  // Remember to use the MQMD for the context on this object
+  if (added != 0 && *pCompCode != MQCC_FAILED) {
+    phobjOptions o = getHobjOptions(pExitParms, pHobj);
+    o->carrier = carrierForQueue(od->ObjectName);
+  }
+
+  captureEnd(&cap, *pCompCode, *pReason);
   return;
 }
 }
\ No newline at end of file
@@ -0,0 +1,329 @@
+/*
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+  Copyright (c) IBM Corporation 2024
+*/
+
+// Learn the PROPCTL value for a set of queues in one go, instead of needing an extra
+// MQOPEN/MQINQ/MQCLOSE for every queue that an application opens for input. When the
+// process first connects, an Inquire Queue PCF command is sent to the command server for each
+// of the generic names in MQIOTEL_PROPCTL_PREWARM, and all the replies are read back. The
+// results are then used by MQOPENs on connections to the same queue manager for
+// MQIOTEL_PROPCTL_PREWARM_SECS seconds. After that, or for any queue that was not in the
+// replies, the exit goes back to inquiring on each MQOPEN, so a changed PROPCTL is still seen.
+//
+// The application needs authority to put to the command queue, to use the model queue for
+// the replies, and to display the queues. If anything goes wrong, the cache is simply not used.
+
+#include <stdarg.h>
+#include <stdio.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include <time.h>
+
+#include <cmqc.h>
+#include <cmqcfc.h>
+#include <cmqec.h>
+
+#include "mqiotel.hpp"
+
+#define COMMAND_QUEUE "SYSTEM.ADMIN.COMMAND.QUEUE"
+#define REPLY_MODEL_QUEUE "SYSTEM.DEFAULT.MODEL.QUEUE"
+#define REPLY_DYNAMIC_NAME "MQIOTEL.PREWARM.*"
+
+#define MAX_PREWARM_NAMES 16
+#define DEFAULT_PREWARM_SECS 60
+#define REPLY_WAIT_MS 5000
+#define REPLY_BUFFER_SIZE 4096
+#define REQUEST_BUFFER_SIZE (MQCFH_STRUC_LENGTH + MQCFST_STRUC_LENGTH_FIXED + MQ_Q_NAME_LENGTH + MQCFIL_STRUC_LENGTH_FIXED + 2 * sizeof(MQLONG))
+
+#define PREWARM_IDLE 0
+#define PREWARM_RUNNING 1
+#define PREWARM_READY 2
+#define PREWARM_FAILED 3
+
+typedef struct {
+  MQCHAR48 name; // Blank-padded, as in the MQOD
+  MQLONG propCtl;
+} propCtlEntry;
+
+static MQCHAR48 names[MAX_PREWARM_NAMES];
+static int nameCount = 0;
+static int prewarmSecs = DEFAULT_PREWARM_SECS;
+
+// The cache is only written before the state becomes READY, and is read-only after that
+static std::atomic<int> state{PREWARM_IDLE};
+static std::vector<propCtlEntry> cache;
+static time_t expires = 0;
+static MQCHAR48 cacheQMgrName; // As given on the MQCONN that filled the cache
+
+static void padName(MQCHAR48 to, const char *from, size_t l) {
+  if (l > MQ_Q_NAME_LENGTH) {
+    l = MQ_Q_NAME_LENGTH;
+  }
+  memset(to, ' ', MQ_Q_NAME_LENGTH);
+  memcpy(to, from, l);
+}
+
+// Names in the MQI can be padded with blanks or nulls. Compare them as blank-padded.
+static void normaliseName(MQCHAR48 to, const char *from) {
+  size_t l = strnlen(from, MQ_Q_NAME_LENGTH);
+  padName(to, from, l);
+}
+
+static bool entryLess(const propCtlEntry &a, const propCtlEntry &b) {
+  return memcmp(a.name, b.name, MQ_Q_NAME_LENGTH) < 0;
+}
+
+void prewarmInit() {
+  const char *e = getenv(ENV_PROPCTL_PREWARM);
+  const char *s = getenv(ENV_PROPCTL_PREWARM_SECS);
+
+  nameCount = 0;
+  prewarmSecs = DEFAULT_PREWARM_SECS;
+  if (s && atoi(s) > 0) {
+    prewarmSecs = atoi(s);
+  }
+
+  while (e && *e) {
+    size_t l = strcspn(e, ",");
+    while (l > 0 && *e == ' ') {
+      e++;
+      l--;
+    }
+    size_t nl = l;
+    while (nl > 0 && e[nl - 1] == ' ') {
+      nl--;
+    }
+    if (nl > 0 && nl <= MQ_Q_NAME_LENGTH && nameCount < MAX_PREWARM_NAMES) {
+      padName(names[nameCount++], e, nl);
+      rpt("PROPCTL prewarm: %.*s", (int)nl, e);
+    }
+    e += l;
+    if (*e == ',') {
+      e++;
+    }
+  }
+}
+
+// Build an Inquire Queue command asking for just the name and PROPCTL of the matching queues
+static MQLONG buildRequest(char *buf, const MQCHAR48 name) {
+  MQCFH cfh = {MQCFH_DEFAULT};
+  MQCFST cfst = {MQCFST_DEFAULT};
+  MQCFIL cfil = {MQCFIL_DEFAULT};
+  MQLONG attrs[] = {MQCA_Q_NAME, MQIA_PROPERTY_CONTROL};
+  MQLONG o = 0;
+
+  cfh.Type = MQCFT_COMMAND;
+  cfh.Command = MQCMD_INQUIRE_Q;
+  cfh.ParameterCount = 2;
+  memcpy(&buf[o], &cfh, MQCFH_STRUC_LENGTH);
+  o += MQCFH_STRUC_LENGTH;
+
+  cfst.Parameter = MQCA_Q_NAME;
+  cfst.CodedCharSetId = MQCCSI_DEFAULT;
+  cfst.StringLength = MQ_Q_NAME_LENGTH; // Already a multiple of 4
+  cfst.StrucLength = MQCFST_STRUC_LENGTH_FIXED + MQ_Q_NAME_LENGTH;
+  memcpy(&buf[o], &cfst, MQCFST_STRUC_LENGTH_FIXED);
+  memcpy(&buf[o + MQCFST_STRUC_LENGTH_FIXED], name, MQ_Q_NAME_LENGTH);
+  o += cfst.StrucLength;
+
+  cfil.Parameter = MQIACF_Q_ATTRS;
+  cfil.Count = 2;
+  cfil.StrucLength = MQCFIL_STRUC_LENGTH_FIXED + sizeof(attrs);
+  memcpy(&buf[o], &cfil, MQCFIL_STRUC_LENGTH_FIXED);
+  memcpy(&buf[o + MQCFIL_STRUC_LENGTH_FIXED], attrs, sizeof(attrs));
+  o += cfil.StrucLength;
+
+  return o;
+}
+
+// Pull the queue name and PROPCTL out of one reply. Queue types without a PROPCTL
+// attribute (remote queues, for example) do not have the value in their reply.
+static void parseReply(const char *buf, MQLONG length, std::vector<propCtlEntry> &entries) {
+  MQCFH cfh;
+  propCtlEntry e;
+  bool haveName = false;
+  bool haveValue = false;
+
+  memcpy(&cfh, buf, MQCFH_STRUC_LENGTH);
+  if (cfh.CompCode != MQCC_OK) {
+    if (cfh.Reason != MQRC_UNKNOWN_OBJECT_NAME) {
+      rptmqrc("PROPCTL prewarm: Inquire Queue", cfh.CompCode, cfh.Reason);
+    }
+    return;
+  }
+
+  MQLONG o = cfh.StrucLength;
+  for (MQLONG i = 0; i < cfh.ParameterCount && o + MQCFIN_STRUC_LENGTH <= length; i++) {
+    MQCFIN p; // All the parameter types start with the same fields
+    memcpy(&p, &buf[o], MQCFIN_STRUC_LENGTH);
+    if (p.StrucLength <= 0 || o + p.StrucLength > length) {
+      return;
+    }
+    if (p.Type == MQCFT_STRING && p.Parameter == MQCA_Q_NAME) {
+      MQCFST s;
+      memcpy(&s, &buf[o], MQCFST_STRUC_LENGTH_FIXED);
+      padName(e.name, &buf[o + MQCFST_STRUC_LENGTH_FIXED], s.StringLength);
+      haveName = true;
+    } else if (p.Type == MQCFT_INTEGER && p.Parameter == MQIA_PROPERTY_CONTROL) {
+      e.propCtl = p.Value;
+      haveValue = true;
+    }
+    o += p.StrucLength;
+  }
+
+  if (haveName && haveValue) {
+    entries.push_back(e);
+  }
+}
+
+// Send all the requests and then collect the replies. Returns false if the command server
+// could not be used at all.
+static bool inquire(PMQAXP pExitParms, PMQHCONN pHconn, std::vector<propCtlEntry> &entries) {
+  MQOD cmdOd = {MQOD_DEFAULT};
+  MQOD replyOd = {MQOD_DEFAULT};
+  MQHOBJ cmdHobj = MQHO_UNUSABLE_HOBJ;
+  MQHOBJ replyHobj = MQHO_UNUSABLE_HOBJ;
+  MQLONG CC, RC;
+  char request[REQUEST_BUFFER_SIZE];
+  char reply[REPLY_BUFFER_SIZE];
+  int outstanding = 0;
+
+  strncpy(replyOd.ObjectName, REPLY_MODEL_QUEUE, MQ_Q_NAME_LENGTH);
+  strncpy(replyOd.DynamicQName, REPLY_DYNAMIC_NAME, MQ_Q_NAME_LENGTH);
+  pExitParms->Hconfig->MQOPEN_Call(*pHconn, &replyOd, MQOO_INPUT_EXCLUSIVE | MQOO_FAIL_IF_QUIESCING, &replyHobj, &CC, &RC);
+  if (CC != MQCC_OK) {
+    rptmqrc("PROPCTL prewarm: open reply queue", CC, RC);
+    return false;
+  }
+
+  strncpy(cmdOd.ObjectName, COMMAND_QUEUE, MQ_Q_NAME_LENGTH);
+  pExitParms->Hconfig->MQOPEN_Call(*pHconn, &cmdOd, MQOO_OUTPUT | MQOO_FAIL_IF_QUIESCING, &cmdHobj, &CC, &RC);
+  if (CC != MQCC_OK) {
+    rptmqrc("PROPCTL prewarm: open command queue", CC, RC);
+    pExitParms->Hconfig->MQCLOSE_Call(*pHconn, &replyHobj, MQCO_DELETE_PURGE, &CC, &RC);
+    return false;
+  }
+
+  for (int i = 0; i < nameCount; i++) {
+    MQMD md = {MQMD_DEFAULT};
+    MQPMO pmo = {MQPMO_DEFAULT};
+
+    memcpy(md.Format, MQFMT_ADMIN, MQ_FORMAT_LENGTH);
+    md.MsgType = MQMT_REQUEST;
+    md.Report = MQRO_PASS_DISCARD_AND_EXPIRY;
+    md.Expiry = REPLY_WAIT_MS / 100; // Tenths of a second
+    md.Encoding = MQENC_NATIVE;
+    md.CodedCharSetId = MQCCSI_Q_MGR;
+    md.Persistence = MQPER_NOT_PERSISTENT;
+    memcpy(md.ReplyToQ, replyOd.ObjectName, MQ_Q_NAME_LENGTH);
+    pmo.Options = MQPMO_NO_SYNCPOINT | MQPMO_NEW_MSG_ID | MQPMO_FAIL_IF_QUIESCING;
+
+    MQLONG l = buildRequest(request, names[i]);
+    pExitParms->Hconfig->MQPUT_Call(*pHconn, cmdHobj, &md, &pmo, l, request, &CC, &RC);
+    if (CC != MQCC_OK) {
+      rptmqrc("PROPCTL prewarm: put command", CC, RC);
+      break;
+    }
+    outstanding++;
+  }
+
+  // Each request ends with a reply marked as the last one. The replies to the separate
+  // requests can be interleaved, but that doesn't matter as they all go into the same list.
+  while (outstanding > 0) {
+    MQMD md = {MQMD_DEFAULT};
+    MQGMO gmo = {MQGMO_DEFAULT};
+    MQLONG l = 0;
+
+    gmo.Options = MQGMO_WAIT | MQGMO_NO_SYNCPOINT | MQGMO_CONVERT | MQGMO_ACCEPT_TRUNCATED_MSG | MQGMO_FAIL_IF_QUIESCING;
+    gmo.WaitInterval = REPLY_WAIT_MS;
+    md.Encoding = MQENC_NATIVE;
+    md.CodedCharSetId = MQCCSI_Q_MGR;
+
+    pExitParms->Hconfig->MQGET_Call(*pHconn, replyHobj, &md, &gmo, sizeof(reply), reply, &l, &CC, &RC);
+    if (CC == MQCC_FAILED) {
+      rptmqrc("PROPCTL prewarm: get reply", CC, RC);
+      break;
+    }
+    if (l > (MQLONG)sizeof(reply)) {
+      l = sizeof(reply);
+    }
+    if (l >= MQCFH_STRUC_LENGTH) {
+      MQCFH cfh;
+      memcpy(&cfh, reply, MQCFH_STRUC_LENGTH);
+      parseReply(reply, l, entries);
+      if (cfh.Control == MQCFC_LAST) {
+        outstanding--;
+      }
+    }
+  }
+  bool ok = (outstanding == 0);
+
+  pExitParms->Hconfig->MQCLOSE_Call(*pHconn, &cmdHobj, MQCO_NONE, &CC, &RC);
+  pExitParms->Hconfig->MQCLOSE_Call(*pHconn, &replyHobj, MQCO_DELETE_PURGE, &CC, &RC);
+  return ok;
+}
+
+// Called after each successful MQCONN. Only the first one does any work; any connection
+// that arrives while that is still running just doesn't get to use the cache.
+void propCtlPrewarm(PMQAXP pExitParms, PMQHCONN pHconn, PMQCHAR pQMgrName) {
+  connState *cs = getConnState(pExitParms);
+  int expected = PREWARM_IDLE;
+
+  normaliseName(cs->qMgrName, pQMgrName);
+  if (nameCount == 0 || !state.compare_exchange_strong(expected, PREWARM_RUNNING)) {
+    return;
+  }
+
+  std::vector<propCtlEntry> entries;
+  if (inquire(pExitParms, pHconn, entries) || !entries.empty()) {
+    std::sort(entries.begin(), entries.end(), entryLess);
+    cache.swap(entries);
+    memcpy(cacheQMgrName, cs->qMgrName, MQ_Q_MGR_NAME_LENGTH);
+    expires = time(NULL) + prewarmSecs;
+    rpt("PROPCTL prewarm: %lu queues cached for %d seconds", (unsigned long)cache.size(), prewarmSecs);
+    state.store(PREWARM_READY, std::memory_order_release);
+  } else {
+    rpt("PROPCTL prewarm: no information available");
+    state.store(PREWARM_FAILED, std::memory_order_release);
+  }
+}
+
+// Is the PROPCTL for this queue already known?
+bool cachedPropCtl(PMQAXP pExitParms, PMQOD od, PMQLONG propCtl) {
+  if (state.load(std::memory_order_acquire) != PREWARM_READY || time(NULL) >= expires) {
+    return false;
+  }
+  if (od->ObjectQMgrName[0] != ' ' && od->ObjectQMgrName[0] != 0) {
+    return false;
+  }
+  connState *cs = getConnState(pExitParms);
+  if (memcmp(cs->qMgrName, cacheQMgrName, MQ_Q_MGR_NAME_LENGTH)) {
+    return false;
+  }
+
+  propCtlEntry key;
+  normaliseName(key.name, od->ObjectName);
+  auto it = std::lower_bound(cache.begin(), cache.end(), key, entryLess);
+  if (it == cache.end() || memcmp(it->name, key.name, MQ_Q_NAME_LENGTH)) {
+    return false;
+  }
+  *propCtl = it->propCtl;
+  return true;
+}
@@ -0,0 +1,99 @@
+/*
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+  Copyright (c) IBM Corporation 2024
+*/
+
+#include <stdarg.h>
+#include <stdio.h>
+
+#include <cstdlib>
+#include <cstring>
+
+#include <cmqc.h>
+#include <cmqec.h>
+
+#include "mqiotel_propagator.hpp"
+
+#define PROPAGATOR_ENTRY(P) {P::name(), P::parentName(), P::stateName(), injectContext<P>, extractContext<P>, P::serialize}
+
+static const propagatorFns propagators[] = {
+    PROPAGATOR_ENTRY(W3CPropagator),
+    PROPAGATOR_ENTRY(B3Propagator),
+    PROPAGATOR_ENTRY(JaegerPropagator),
+};
+
+const propagatorFns *propagator = &propagators[0];
+
+// Checked before doing anything else in the PUT and GET exits
+bool unsampledSkipPut = false;
+bool unsampledSkipGet = false;
+
+static void unsampledInit() {
+  const char *e = getenv(ENV_UNSAMPLED);
+
+  unsampledSkipPut = false;
+  unsampledSkipGet = false;
+  if (!e || !*e || !strcmp(e, "full")) {
+    return;
+  }
+  if (!strcmp(e, "propagate")) {
+    unsampledSkipGet = true;
+  } else if (!strcmp(e, "skip")) {
+    unsampledSkipPut = true;
+    unsampledSkipGet = true;
+  } else {
+    rpt("Unknown %s value \"%s\". Using \"full\"", ENV_UNSAMPLED, e);
+    return;
+  }
+  rpt("Unsampled traces: %s", e);
+}
+
+// Pick the format to use from the standard OTel environment variable. That can be a list
+// such as "tracecontext,baggage" - we use the first entry that is a context format we know.
+// "b3multi" is not supported as it needs several properties; treat it as "b3".
+void propagatorInit() {
+  unsampledInit();
+
+#if defined(MQIOTEL_PROPAGATOR)
+  static const propagatorFns fixed = PROPAGATOR_ENTRY(MQIOTEL_PROPAGATOR);
+  propagator = &fixed;
+  rpt("Propagator: %s (fixed at build time)", propagator->name);
+#else
+  const char *e = getenv(ENV_PROPAGATORS);
+  const propagatorFns *selected = NULL;
+
+  while (e && *e && !selected) {
+    size_t l = strcspn(e, ",");
+    while (l > 0 && *e == ' ') {
+      e++;
+      l--;
+    }
+    if (l == 7 && !strncmp(e, "b3multi", l)) {
+      selected = &propagators[1];
+    }
+    for (size_t i = 0; !selected && i < sizeof(propagators) / sizeof(propagators[0]); i++) {
+      if (strlen(propagators[i].name) == l && !strncmp(e, propagators[i].name, l)) {
+        selected = &propagators[i];
+      }
+    }
+    e += l;
+    if (*e == ',') {
+      e++;
+    }
+  }
+
+  propagator = selected ? selected : &propagators[0];
+  rpt("Propagator: %s", propagator->name);
+#endif
+}
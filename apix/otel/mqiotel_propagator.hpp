@@ -0,0 +1,368 @@
+/*
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+  Copyright (c) IBM Corporation 2024
+*/
+
+// Propagation formats. Each format is a "policy" class with static methods to turn a
+// SpanContext into a property value and to parse it back again. The inject/extract
+// functions at the bottom of this file are templates over the policy, so the code for
+// each format is generated separately and there is no per-message decision about which
+// format is in use.
+//
+// The format is chosen by the OTEL_PROPAGATORS environment variable when the exit initialises.
+// Building with -DMQIOTEL_PROPAGATOR=<PolicyClass> fixes the format at compile time instead,
+// and the entrypoints then call the template instance directly.
+//
+// MQ property names cannot contain '-' characters. The B3 single-header format is therefore
+// carried as "b3" and the Jaeger header uses the same "$dash$" substitution as the
+// opentracing JMS instrumentation, so the properties can be recognised by JMS applications.
+
+#ifndef MQIOTEL_PROPAGATOR_HPP
+#define MQIOTEL_PROPAGATOR_HPP
+
+#include <cstring>
+
+#include <cmqc.h>
+#include <cmqec.h>
+
+#include <trace/span.h>
+#include <trace/trace_state.h>
+#include <trace/tracer.h>
+
+#include "mqiotel.hpp"
+
+namespace trace_api = opentelemetry::trace;
+namespace nostd = opentelemetry::nostd;
+
+#define ENV_PROPAGATORS "OTEL_PROPAGATORS"
+
+// What to do when the current span is not sampled: "full" (the default) behaves as for sampled
+// spans, "propagate" still sends the context but does not link inbound messages, and "skip" does neither
+#define ENV_UNSAMPLED "MQIOTEL_UNSAMPLED"
+
+#define B3_NAME "b3"
+#define JAEGER_NAME "uber_$dash$_trace_$dash$_id"
+
+// Space for a tracestate value. The W3C standard recommends allowing at least 512 characters
+#define MAX_STATE_LENGTH 1024
+
+// Space for a serialized parent context in any of the formats
+#define MAX_PARENT_LENGTH 64
+
+// The decoded form of an inbound context. No allocation is needed to fill it in.
+typedef struct {
+  uint8_t traceId[trace_api::TraceId::kSize];
+  uint8_t spanId[trace_api::SpanId::kSize];
+  uint8_t flags;
+  char state[MAX_STATE_LENGTH];
+  MQLONG stateLength;
+} propagatedContext;
+
+static inline int hexValue(char c) {
+  if (c >= '0' && c <= '9')
+    return c - '0';
+  if (c >= 'a' && c <= 'f')
+    return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F')
+    return c - 'A' + 10;
+  return -1;
+}
+
+// Convert hex into a binary buffer. Shorter strings are right-aligned and padded with zeros
+// as both B3 and Jaeger allow 64-bit trace ids. An all-zero id is invalid.
+static inline bool hexToBinary(const char *hex, size_t hexLength, uint8_t *buf, size_t bufLength) {
+  uint8_t nonZero = 0;
+  if (hexLength == 0 || hexLength > bufLength * 2) {
+    return false;
+  }
+  memset(buf, 0, bufLength);
+  size_t o = bufLength * 2 - hexLength;
+  for (size_t i = 0; i < hexLength; i++, o++) {
+    int v = hexValue(hex[i]);
+    if (v < 0) {
+      return false;
+    }
+    buf[o / 2] |= (o % 2) ? v : (v << 4);
+    nonZero |= v;
+  }
+  return nonZero != 0;
+}
+
+// The trace/span ids are written straight into the output buffer
+static inline char *writeIds(const trace_api::SpanContext &ctx, char *p, char sep) {
+  ctx.trace_id().ToLowerBase16(nostd::span<char, 2 * trace_api::TraceId::kSize>(p, 2 * trace_api::TraceId::kSize));
+  p += 2 * trace_api::TraceId::kSize;
+  *p++ = sep;
+  ctx.span_id().ToLowerBase16(nostd::span<char, 2 * trace_api::SpanId::kSize>(p, 2 * trace_api::SpanId::kSize));
+  p += 2 * trace_api::SpanId::kSize;
+  return p;
+}
+
+// W3C Trace Context: "version-traceid-spanid-flags" plus a separate tracestate property
+struct W3CPropagator {
+  static const char *name() { return "tracecontext"; }
+  static const char *parentName() { return TRACEPARENT; }
+  static const char *stateName() { return TRACESTATE; }
+  enum { maxLength = 55 };
+
+  static size_t serialize(const trace_api::SpanContext &ctx, char *buf) {
+    char *p = buf;
+    *p++ = '0';
+    *p++ = '0';
+    *p++ = '-';
+    p = writeIds(ctx, p, '-');
+    *p++ = '-';
+    ctx.trace_flags().ToLowerBase16(nostd::span<char, 2>(p, 2));
+    p += 2;
+    return p - buf;
+  }
+
+  static bool parse(const char *v, size_t l, propagatedContext *pc) {
+    int v0, v1, f0, f1;
+    if (l < maxLength || v[2] != '-' || v[35] != '-' || v[52] != '-') {
+      return false;
+    }
+    v0 = hexValue(v[0]);
+    v1 = hexValue(v[1]);
+    f0 = hexValue(v[53]);
+    f1 = hexValue(v[54]);
+    if (v0 < 0 || v1 < 0 || f0 < 0 || f1 < 0 || (v0 == 0xf && v1 == 0xf)) {
+      return false;
+    }
+    // Version 00 has a fixed length. Later versions may append fields.
+    if ((v0 == 0 && v1 == 0 && l != maxLength) || (l > maxLength && v[55] != '-')) {
+      return false;
+    }
+    if (!hexToBinary(&v[3], 32, pc->traceId, sizeof(pc->traceId)) || !hexToBinary(&v[36], 16, pc->spanId, sizeof(pc->spanId))) {
+      return false;
+    }
+    pc->flags = (uint8_t)((f0 << 4) | f1);
+    return true;
+  }
+};
+
+// B3 single header: "traceid-spanid[-sampled[-parentspanid]]"
+struct B3Propagator {
+  static const char *name() { return "b3"; }
+  static const char *parentName() { return B3_NAME; }
+  static const char *stateName() { return NULL; }
+  enum { maxLength = 51 };
+
+  static size_t serialize(const trace_api::SpanContext &ctx, char *buf) {
+    char *p = writeIds(ctx, buf, '-');
+    *p++ = '-';
+    *p++ = ctx.trace_flags().IsSampled() ? '1' : '0';
+    return p - buf;
+  }
+
+  static bool parse(const char *v, size_t l, propagatedContext *pc) {
+    const char *d1 = (const char *)memchr(v, '-', l);
+    if (!d1) {
+      return false; // A lone sampling decision carries no context
+    }
+    const char *s = d1 + 1;
+    const char *end = v + l;
+    const char *d2 = (const char *)memchr(s, '-', end - s);
+    size_t tl = d1 - v;
+    size_t sl = (d2 ? d2 : end) - s;
+
+    if ((tl != 16 && tl != 32) || sl != 16) {
+      return false;
+    }
+    if (!hexToBinary(v, tl, pc->traceId, sizeof(pc->traceId)) || !hexToBinary(s, sl, pc->spanId, sizeof(pc->spanId))) {
+      return false;
+    }
+    pc->flags = 0;
+    if (d2 && d2 + 1 < end && (d2[1] == '1' || d2[1] == 'd')) {
+      pc->flags = trace_api::TraceFlags::kIsSampled;
+    }
+    return true;
+  }
+};
+
+// Jaeger: "traceid:spanid:parentspanid:flags". The parent span id is deprecated and always 0 here
+struct JaegerPropagator {
+  static const char *name() { return "jaeger"; }
+  static const char *parentName() { return JAEGER_NAME; }
+  static const char *stateName() { return NULL; }
+  enum { maxLength = 53 };
+
+  static size_t serialize(const trace_api::SpanContext &ctx, char *buf) {
+    char *p = writeIds(ctx, buf, ':');
+    *p++ = ':';
+    *p++ = '0';
+    *p++ = ':';
+    *p++ = ctx.trace_flags().IsSampled() ? '1' : '0';
+    return p - buf;
+  }
+
+  static bool parse(const char *v, size_t l, propagatedContext *pc) {
+    const char *end = v + l;
+    const char *c1 = (const char *)memchr(v, ':', l);
+    const char *c2 = c1 ? (const char *)memchr(c1 + 1, ':', end - c1 - 1) : NULL;
+    const char *c3 = c2 ? (const char *)memchr(c2 + 1, ':', end - c2 - 1) : NULL;
+    if (!c3 || c3 + 1 >= end || end - c3 - 1 > 2) {
+      return false;
+    }
+    if (!hexToBinary(v, c1 - v, pc->traceId, sizeof(pc->traceId)) || !hexToBinary(c1 + 1, c2 - c1 - 1, pc->spanId, sizeof(pc->spanId))) {
+      return false;
+    }
+    int f = hexValue(c3[1]);
+    if (c3 + 2 < end) {
+      f = (f << 4) | hexValue(c3[2]);
+    }
+    if (f < 0) {
+      return false;
+    }
+    pc->flags = (f & 0x01) ? trace_api::TraceFlags::kIsSampled : 0;
+    return true;
+  }
+};
+
+// Property names, built once so that the MQI calls can use them directly
+template <class P> struct propagatorNames {
+  static MQCHARV parentVS;
+  static MQCHARV stateVS;
+};
+template <class P> MQCHARV propagatorNames<P>::parentVS = {(MQPTR)P::parentName(), 0, 0, (MQLONG)strlen(P::parentName()), MQCCSI_APPL};
+template <class P>
+MQCHARV propagatorNames<P>::stateVS = {(MQPTR)P::stateName(), 0, 0, P::stateName() ? (MQLONG)strlen(P::stateName()) : 0, MQCCSI_APPL};
+
+// Set the context properties for an outbound message
+template <class P>
+void injectContext(PMQAXP pExitParms, PMQHCONN pHconn, MQHMSG mh, const trace_api::SpanContext &ctx, bool skipParent, bool skipState, captureCall *cap) {
+  MQSMPO smpo = {MQSMPO_DEFAULT};
+  MQPD pd = {MQPD_DEFAULT};
+  MQLONG CC, RC;
+
+  if (!skipParent) {
+    char value[P::maxLength];
+    size_t l = P::serialize(ctx, value);
+    rpt("Setting %s to %.*s", P::parentName(), (int)l, value);
+
+    pExitParms->Hconfig->MQSETMP_Call(*pHconn, mh, &smpo, &propagatorNames<P>::parentVS, &pd, MQTYPE_STRING, (MQLONG)l, value, &CC, &RC);
+    if (CC != MQCC_OK) {
+      rptmqrc("MQSETMP", CC, RC);
+    } else {
+      captureProp(cap, P::parentName(), l);
+    }
+  }
+
+  // Formats without a separate state property can skip this entirely at compile time
+  if (P::stateName() && !skipState) {
+    auto ts = ctx.trace_state();
+    if (ts && !ts->Empty()) {
+      // The header must be kept in scope until the property has been set
+      auto value = ts->ToHeader();
+      rpt("Setting %s to \"%s\"", P::stateName(), value.c_str());
+
+      pExitParms->Hconfig->MQSETMP_Call(*pHconn, mh, &smpo, &propagatorNames<P>::stateVS, &pd, MQTYPE_STRING, (MQLONG)value.length(), (PMQVOID)value.c_str(),
+                                        &CC, &RC);
+      if (CC != MQCC_OK) {
+        rptmqrc("MQSETMP", CC, RC);
+      } else {
+        captureProp(cap, P::stateName(), value.length());
+      }
+    }
+  }
+}
+
+// Find the context for an inbound message, either from the message handle or from
+// the first folder of an RFH2. Returns true if there was a usable context.
+template <class P> bool extractContext(PMQAXP pExitParms, PMQHCONN pHconn, MQHMSG mh, const char *rfh2Props, int rfh2Length, propagatedContext *pc, captureCall *cap) {
+  char value[P::maxLength + 64]; // Allow for some unexpected extension fields
+  const char *v = value;
+  MQLONG l = 0;
+  MQLONG CC, RC;
+  bool found = false;
+
+  pc->stateLength = 0;
+
+  if (isValidHandle(mh)) {
+    propsValueBuf(pExitParms, pHconn, mh, &propagatorNames<P>::parentVS, value, sizeof(value), &l, &CC, &RC);
+    if (CC == MQCC_OK) {
+      found = true;
+    } else if (RC != MQRC_PROPERTY_NOT_AVAILABLE) {
+      // Should not happen
+      rptmqrc("GetAfter (1)", CC, RC);
+    }
+    if (P::stateName()) {
+      propsValueBuf(pExitParms, pHconn, mh, &propagatorNames<P>::stateVS, pc->state, sizeof(pc->state), &pc->stateLength, &CC, &RC);
+      if (CC != MQCC_OK) {
+        pc->stateLength = 0;
+        if (RC != MQRC_PROPERTY_NOT_AVAILABLE) {
+          rptmqrc("GetAfter (2)", CC, RC);
+        }
+      }
+    }
+  } else if (rfh2Props) {
+    int vl;
+    const char *sv;
+    if (findRFH2Prop(rfh2Props, rfh2Length, P::parentName(), &v, &vl)) {
+      l = vl;
+      found = true;
+    }
+    if (P::stateName() && findRFH2Prop(rfh2Props, rfh2Length, P::stateName(), &sv, &vl) && vl < (int)sizeof(pc->state)) {
+      memcpy(pc->state, sv, vl);
+      pc->stateLength = vl;
+    }
+  }
+
+  if (found) {
+    rpt("Found %s: %.*s", P::parentName(), (int)l, v);
+    captureProp(cap, P::parentName(), l);
+    if (!P::parse(v, l, pc)) {
+      rpt("Cannot parse %s value", P::parentName());
+      found = false;
+    }
+  }
+  if (pc->stateLength > 0) {
+    rpt("Found %s: %.*s", P::stateName(), (int)pc->stateLength, pc->state);
+    captureProp(cap, P::stateName(), pc->stateLength);
+  }
+
+  return found;
+}
+
+typedef void INJECT_FN(PMQAXP, PMQHCONN, MQHMSG, const trace_api::SpanContext &, bool, bool, captureCall *);
+typedef bool EXTRACT_FN(PMQAXP, PMQHCONN, MQHMSG, const char *, int, propagatedContext *, captureCall *);
+typedef size_t SERIALIZE_FN(const trace_api::SpanContext &, char *);
+
+typedef struct {
+  const char *name;
+  const char *parentName;
+  const char *stateName;
+  INJECT_FN *inject;
+  EXTRACT_FN *extract;
+  SERIALIZE_FN *serialize;
+} propagatorFns;
+
+extern const propagatorFns *propagator;
+extern bool unsampledSkipPut;
+extern bool unsampledSkipGet;
+extern void carrierEncode(int carrier, const trace_api::SpanContext &ctx, PMQMD md);
+extern bool carrierDecode(PMQMD md, propagatedContext *pc);
+extern void propagatorInit();
+
+#if defined(MQIOTEL_PROPAGATOR)
+#define INJECT_CONTEXT injectContext<MQIOTEL_PROPAGATOR>
+#define EXTRACT_CONTEXT extractContext<MQIOTEL_PROPAGATOR>
+#define SERIALIZE_CONTEXT MQIOTEL_PROPAGATOR::serialize
+#else
+#define INJECT_CONTEXT propagator->inject
+#define EXTRACT_CONTEXT propagator->extract
+#define SERIALIZE_CONTEXT propagator->serialize
+#endif
+
+#endif
@@ -20,31 +20,17 @@
 #include <cmqc.h>
 #include <cmqec.h>
 
-#include <trace/span.h>
-#include <trace/trace_state.h>
-#include <trace/tracer.h>
-
-
 #include "mqiotel.hpp"
+#include "mqiotel_propagator.hpp"
 
-namespace trace_api = opentelemetry::trace;
-
-static phobjOptions savePmo(PMQHCONN hc, PMQHOBJ ho, PMQPMO pmo) {
-  phobjOptions o;
-  string key = objectKey(hc, ho);
-  if (objectOptionsMap.count(key) == 0) {
-    o = (hobjOptions *)mqotMalloc(sizeof(hobjOptions));
-    objectOptionsMap[key] = o;
-  } else {
-    o = objectOptionsMap[key];
-  }
+static phobjOptions savePmo(PMQAXP pExitParms, PMQHOBJ ho, PMQPMO pmo) {
+  phobjOptions o = getHobjOptions(pExitParms, ho);
   o->pmo = pmo;
   return o;
 }
 
-static PMQPMO restorePmo(PMQHCONN hc, PMQHOBJ ho) {
-  string key = objectKey(hc, ho);
-  return objectOptionsMap[key]->pmo;
+static PMQPMO restorePmo(PMQAXP pExitParms, PMQHOBJ ho) {
+  return findHobjOptions(pExitParms, ho)->pmo;
 }
 
 static MQLONG pmoLength(PMQPMO pmo) {
@@ -59,16 +45,156 @@ static MQLONG pmoLength(PMQPMO pmo) {
   }
 }
 
+static MQLONG mdLength(PMQMD md) {
+  switch (md->Version) {
+  case MQMD_VERSION_1:
+    return MQMD_LENGTH_1;
+  case MQMD_VERSION_2:
+  default:
+    return MQMD_LENGTH_2;
+  }
+}
+
+// The names in the OD that identify the queue for an MQPUT1. Either may be null-terminated.
+static string put1Key(PMQOD od) {
+  string q(od->ObjectName, strnlen(od->ObjectName, MQ_Q_NAME_LENGTH));
+  string qm(od->ObjectQMgrName, strnlen(od->ObjectQMgrName, MQ_Q_MGR_NAME_LENGTH));
+  return qm + "/" + q;
+}
+
+// Options where the application is already managing the message context
+#define PUT_CONTEXT_OPTIONS (MQPMO_NO_CONTEXT | MQPMO_PASS_IDENTITY_CONTEXT | MQPMO_PASS_ALL_CONTEXT | MQPMO_SET_IDENTITY_CONTEXT | MQPMO_SET_ALL_CONTEXT)
+
+// If the object is configured to carry the context in the MQMD, then use copies of the MD and PMO
+// with the identity context filled in. The identity fields would otherwise be set by the queue
+// manager, so we only need to provide the user id to keep things looking the same.
+static bool putCarrier(PMQAXP pExitParms, PMQAXC pExitContext, PMQHOBJ pHobj, const trace_api::SpanContext &ctx, PPMQMD ppMsgDesc, PPMQPMO ppPutMsgOpts) {
+  PMQPMO pmo = *ppPutMsgOpts;
+  PMQMD md = *ppMsgDesc;
+
+  if (!carriersConfigured || !md) {
+    return false;
+  }
+  phobjOptions o = findHobjOptions(pExitParms, pHobj);
+  if (!o || o->carrier == CARRIER_NONE) {
+    return false;
+  }
+  if ((pmo->Options & PUT_CONTEXT_OPTIONS) != 0) {
+    rpt("Application is setting message context. Using properties instead of MQMD");
+    return false;
+  }
+  if (!ctx.IsValid()) {
+    return false;
+  }
+
+  o->pmo = pmo;
+  o->myPmo = {MQPMO_DEFAULT};
+  memcpy(&o->myPmo, pmo, pmoLength(pmo));
+  o->myPmo.Options |= MQPMO_SET_IDENTITY_CONTEXT;
+
+  o->md = md;
+  o->myMd = {MQMD_DEFAULT};
+  memcpy(&o->myMd, md, mdLength(md));
+  memcpy(o->myMd.UserIdentifier, pExitContext->UserId, MQ_USER_ID_LENGTH);
+  carrierEncode(o->carrier, ctx, &o->myMd);
+
+  *ppPutMsgOpts = &o->myPmo;
+  *ppMsgDesc = &o->myMd;
+  rpt("Context set in MQMD");
+  return true;
+}
+
+// An application that builds its own RFH2 can have the context written straight into it, instead
+// of the queue manager having to merge the properties from a message handle. The MQPUT is given a
+// copy of the message, with the properties added to the <usr> folder.
+static bool putRfh2(PMQAXP pExitParms, PMQHOBJ pHobj, const trace_api::SpanContext &ctx, PMQMD md, PPMQVOID ppBuffer, PMQLONG pBufferLength,
+                    captureCall *cap) {
+  bool skipParent = false;
+  bool skipState = false;
+  bool skipBaggage = (baggageKeyCount == 0);
+  rfh2Prop props[3];
+  int count = 0;
+  char parent[MAX_PARENT_LENGTH];
+  string state; // Must stay in scope until the message has been built
+  PMQVOID newBuffer;
+  MQLONG newLength;
+
+  if (!rfh2InjectEnabled || !md || strncmp(md->Format, MQFMT_RF_HEADER_2, 8) || *pBufferLength < MQRFH_STRUC_LENGTH_FIXED_2) {
+    return false;
+  }
+  if (!ctx.IsValid()) {
+    return false;
+  }
+
+  PMQRFH2 hdr = (PMQRFH2)*ppBuffer;
+  if (hdr->StrucLength < MQRFH_STRUC_LENGTH_FIXED_2 || hdr->StrucLength > *pBufferLength) {
+    return false;
+  }
+  const char *rfh2Props = (char *)*ppBuffer + MQRFH_STRUC_LENGTH_FIXED_2;
+  int propsLen = hdr->StrucLength - MQRFH_STRUC_LENGTH_FIXED_2;
+  const char *v;
+  int vl;
+  if (findRFH2Prop(rfh2Props, propsLen, propagator->parentName, &v, &vl)) {
+    skipParent = true;
+  }
+  if (propagator->stateName && findRFH2Prop(rfh2Props, propsLen, propagator->stateName, &v, &vl)) {
+    skipState = true;
+  }
+  if (!skipBaggage && findRFH2Prop(rfh2Props, propsLen, BAGGAGE_NAME, &v, &vl)) {
+    skipBaggage = true;
+  }
+
+  if (!skipParent) {
+    props[count++] = {propagator->parentName, parent, SERIALIZE_CONTEXT(ctx, parent)};
+  }
+  if (propagator->stateName && !skipState) {
+    auto ts = ctx.trace_state();
+    if (ts && !ts->Empty()) {
+      state = ts->ToHeader();
+      props[count++] = {propagator->stateName, state.c_str(), state.length()};
+    }
+  }
+  if (!skipBaggage) {
+    const char *bv;
+    size_t bl = baggageSerialize(&bv);
+    if (bl > 0) {
+      props[count++] = {BAGGAGE_NAME, bv, bl};
+    }
+  }
+  if (count == 0) {
+    rpt("RFH2 already contains the context");
+    return true;
+  }
+
+  if (!rfh2Inject(md, *ppBuffer, *pBufferLength, props, count, &newBuffer, &newLength)) {
+    rpt("Cannot add the context to this RFH2. Using a message handle");
+    return false;
+  }
+
+  phobjOptions o = getHobjOptions(pExitParms, pHobj);
+  o->appBuffer = *ppBuffer;
+  o->appBufferLength = *pBufferLength;
+  *ppBuffer = newBuffer;
+  *pBufferLength = newLength;
+
+  for (int i = 0; i < count; i++) {
+    rpt("Added %s to RFH2: %.*s", props[i].name, (int)props[i].length, props[i].value);
+    captureProp(cap, props[i].name, props[i].length);
+  }
+  cap->rec.flags |= CAPTURE_FLAG_RFH2;
+  return true;
+}
+
 // These functions need to be available via dlsym, so using the "C" directive around them
 extern "C" {
 
 MQ_PUT_EXIT mqotPutBefore;
 MQ_PUT_EXIT mqotPutAfter;
+MQ_PUT1_EXIT mqotPut1Before;
 
 void mqotPutBefore(PMQAXP pExitParms, PMQAXC pExitContext, PMQHCONN pHconn, PMQHOBJ pHobj, PPMQMD ppMsgDesc, PPMQPMO ppPutMsgOpts, PMQLONG pBufferLength,
                    PPMQVOID ppBuffer, PMQLONG pCompCode, PMQLONG pReason) {
   MQHMSG mh;
-  MQHMSG mho;
 
   PMQPMO pmo = *ppPutMsgOpts;
   PMQMD md = *ppMsgDesc;
@@ -76,9 +202,28 @@ void mqotPutBefore(PMQAXP pExitParms, PMQAXC pExitContext, PMQHCONN pHconn, PMQH
 
   bool skipParent = false;
   bool skipState = false;
+  bool skipBaggage = (baggageKeyCount == 0);
+  captureCall cap;
+
+  // Unsampled traces can be left alone completely, without looking any further at the message
+  auto ctx = trace_api::Tracer::GetCurrentSpan()->GetContext();
+  if (unsampledSkipPut && !ctx.IsSampled()) {
+    return;
+  }
 
   rpt("In mqotPutBefore\n");
 
+  captureStart(&cap, CAPTURE_PUT_BEFORE, pHconn, pHobj);
+  captureMd(&cap, md);
+  captureOptions(&cap, pmo->Options, pmo->Version, 0);
+  cap.rec.bufferLength = *pBufferLength;
+
+  // Queues that carry the context in the MQMD don't need a message handle at all
+  if (putCarrier(pExitParms, pExitContext, pHobj, ctx, ppMsgDesc, ppPutMsgOpts)) {
+    captureEnd(&cap, *pCompCode, *pReason);
+    return;
+  }
+
   // Is the app already using a MsgHandle for its PUT? If so, we
   // can piggy-back on that. If not, then we need to use our
   // own handle. That handle can be reused for all PUTs/GETs on this
@@ -92,36 +237,47 @@ void mqotPutBefore(PMQAXP pExitParms, PMQAXC pExitContext, PMQHCONN pHconn, PMQH
 
   if (pmo->Version >= MQPMO_VERSION_3 && isValidHandle(pmo->NewMsgHandle)) {
     rpt("Using pmo->NewMsgHandle");
+    captureOptions(&cap, pmo->Options, pmo->Version, CAPTURE_FLAG_APP_HANDLE);
 
     mh = pmo->NewMsgHandle;
-    if (propsContain(pExitParms, pHconn, mh, TRACEPARENT)) {
+    if (propsContain(pExitParms, pHconn, mh, propagator->parentName)) {
       skipParent = true;
     }
-    if (propsContain(pExitParms, pHconn, mh, TRACESTATE)) {
+    if (propagator->stateName && propsContain(pExitParms, pHconn, mh, propagator->stateName)) {
       skipState = true;
     }
+    if (!skipBaggage && propsContain(pExitParms, pHconn, mh, BAGGAGE_NAME)) {
+      skipBaggage = true;
+    }
   } else if (pmo->Version >= MQPMO_VERSION_3 && isValidHandle(pmo->OriginalMsgHandle)) {
     mh = pmo->OriginalMsgHandle;
     rpt("Using pmo->OriginalMsgHandle");
+    captureOptions(&cap, pmo->Options, pmo->Version, CAPTURE_FLAG_APP_HANDLE);
 
-    if (propsContain(pExitParms, pHconn, mho, TRACEPARENT)) {
+    if (propsContain(pExitParms, pHconn, mh, propagator->parentName)) {
       skipParent = true;
     }
-    if (propsContain(pExitParms, pHconn, mho, TRACESTATE)) {
+    if (propagator->stateName && propsContain(pExitParms, pHconn, mh, propagator->stateName)) {
       skipState = true;
     }
+    if (!skipBaggage && propsContain(pExitParms, pHconn, mh, BAGGAGE_NAME)) {
+      skipBaggage = true;
+    }
+  } else if (putRfh2(pExitParms, pHobj, ctx, md, ppBuffer, pBufferLength, &cap)) {
+    captureEnd(&cap, *pCompCode, *pReason);
+    return;
   } else {
     rpt("Creating my own handle");
 
     // Stash a copy of the original PMO and build a new one that
     // is guaranteed to be at least Version3 length (to recognise handles)
-    auto o = savePmo(pHconn, pHobj, pmo);
+    auto o = savePmo(pExitParms, pHobj, pmo);
 
     PMQPMO myPmo = &o->myPmo;
     o->myPmo = {MQPMO_DEFAULT};
     memcpy(myPmo, pmo, pmoLength(pmo));
 
-    mh = getMsgHandle(pExitParms, pHconn, NULL);
+    mh = getMsgHandle(pExitParms, pHconn);
     myPmo->OriginalMsgHandle = mh;
     if (myPmo->Version < MQPMO_VERSION_3) {
       myPmo->Version = MQPMO_VERSION_3;
@@ -135,82 +291,42 @@ void mqotPutBefore(PMQAXP pExitParms, PMQAXC pExitContext, PMQHCONN pHconn, PMQH
   // header. If so, then we extract the properties
   // from that header (assuming there's only a single structure, and it's not
   // chained). Then very simply look for the property names in there as strings. These tests would
-  // incorrectly succeed if someone had put "traceparent" into a non-"usr" folder but that would be
+  // incorrectly succeed if someone had put the property into a non-"usr" folder but that would be
   // very unexpected.
   if (md && !strncmp(md->Format, MQFMT_RF_HEADER_2, 8)) {
     PMQRFH2 hdr = (PMQRFH2)buffer;
     MQLONG offset = MQRFH_STRUC_LENGTH_FIXED_2;
 
     int propsLen = hdr->StrucLength - offset;
-    char *b = (char *)buffer;
-    string props = string(&b[offset], propsLen);
+    const char *props = (char *)buffer + offset;
+    const char *v;
+    int vl;
 
-    if (props.find("<" + string(TRACEPARENT) + ">", 0)) {
+    if (findRFH2Prop(props, propsLen, propagator->parentName, &v, &vl)) {
       skipParent = true;
     }
-    if (props.find("<" + string(TRACESTATE) + ">", 0)) {
+    if (propagator->stateName && findRFH2Prop(props, propsLen, propagator->stateName, &v, &vl)) {
       skipState = true;
     }
+    if (!skipBaggage && findRFH2Prop(props, propsLen, BAGGAGE_NAME, &v, &vl)) {
+      skipBaggage = true;
+    }
   }
 
   // We're now ready to extract the context information and set the MQ message property
-  // We are not going to try to propagate baggage via another property
-  auto span = trace_api::Tracer::GetCurrentSpan();
-  if (span->GetContext().IsValid()) {
-    MQSMPO smpo = {MQSMPO_DEFAULT};
-    MQPD pd = {MQPD_DEFAULT};
-    MQLONG CC, RC;
-    MQCHARV propertyNameVS = {MQCHARV_DEFAULT};
-    MQLONG pType = MQTYPE_STRING;
-
+  if (ctx.IsValid()) {
     rpt("About to extract context from an active span");
-    if (!skipParent) {
-      char trace_id_buf[32];
-      char span_id_buf[16];
-      char trace_flags_buf[2];
-      auto trace_id = span->GetContext().trace_id();
-      auto span_id = span->GetContext().span_id();
-      auto trace_flags = span->GetContext().trace_flags();
-
-      trace_id.ToLowerBase16(trace_id_buf);
-      span_id.ToLowerBase16(span_id_buf);
-      trace_flags.ToLowerBase16(trace_flags_buf);
-
-      // This is the W3C-defined format for the trace property
-      char value[128];
-      sprintf(value, "%s-%32.32s-%16.16s-%2.2s", "00", trace_id_buf, span_id_buf, trace_flags_buf);
-      rpt("Setting %s to %s", TRACEPARENT, value);
-
-      propertyNameVS.VSPtr = (PMQVOID)TRACEPARENT;
-      propertyNameVS.VSLength = MQVS_NULL_TERMINATED;
-
-      pExitParms->Hconfig->MQSETMP_Call(*pHconn, mh, &smpo, &propertyNameVS, &pd, pType, strlen(value), value, &CC, &RC);
-      if (CC != MQCC_OK) {
-        rptmqrc("MQSETMP", CC, RC);
-      }
-    }
-
-    if (!skipState) {
-      // Need to convert any traceState map to a single serialised string
-      auto ts = span->GetContext().trace_state();
-      if (ts) {
-        auto value = ts->ToHeader().c_str();
-        if (value != NULL && strlen(value) > 0) {
-          rpt("Setting %s to \"%s\"", TRACESTATE, value);
-          propertyNameVS.VSPtr = (PMQVOID)TRACESTATE;
-          propertyNameVS.VSLength = MQVS_NULL_TERMINATED;
-
-          pExitParms->Hconfig->MQSETMP_Call(*pHconn, mh, &smpo, &propertyNameVS, &pd, pType, strlen(value), (void *)value, &CC, &RC);
-          if (CC != MQCC_OK) {
-            rptmqrc("MQSETMP", CC, RC);
-          }
-        }
-      }
-    }
+    INJECT_CONTEXT(pExitParms, pHconn, mh, ctx, skipParent, skipState, &cap);
   } else {
     rpt("Cannot find active span");
   }
 
+  // Baggage does not depend on there being an active span
+  if (!skipBaggage) {
+    injectBaggage(pExitParms, pHconn, mh, &cap);
+  }
+
+  captureEnd(&cap, *pCompCode, *pReason);
   return;
 }
 
@@ -221,11 +337,82 @@ void mqotPutAfter(PMQAXP pExitParms, PMQAXC pExitContext, PMQHCONN pHconn, PMQHO
                   PPMQVOID ppBuffer, PMQLONG pCompCode, PMQLONG pReason) {
   PMQPMO pmo = *ppPutMsgOpts;
   MQHMSG mh = pmo->OriginalMsgHandle;
-  if (compareMsgHandle(pHconn, NULL, mh)) {
+  captureCall cap;
+
+  captureStart(&cap, CAPTURE_PUT_AFTER, pHconn, pHobj);
+  captureOptions(&cap, pmo->Options, pmo->Version, 0);
+
+  phobjOptions o = findHobjOptions(pExitParms, pHobj);
+  if (o && o->appBuffer) {
+    rpt("Restoring original message buffer");
+    *ppBuffer = o->appBuffer;
+    *pBufferLength = o->appBufferLength;
+    o->appBuffer = NULL;
+  }
+
+  PMQOD put1Od = o ? o->put1Od : NULL;
+  if (o) {
+    o->put1Od = NULL;
+  }
+
+  if (o && *ppMsgDesc == &o->myMd) {
+    // Return the updated MD and PMO, including things like a generated MsgId, but
+    // keep the application's own PMO options
+    rpt("Restoring original MD and PMO");
+    MQLONG options = o->pmo->Options;
+    memcpy(o->md, &o->myMd, mdLength(o->md));
+    memcpy(o->pmo, &o->myPmo, pmoLength(o->pmo));
+    o->pmo->Options = options;
+    *ppMsgDesc = o->md;
+    *ppPutMsgOpts = o->pmo;
+
+    // An MQPUT1 checks the authority to set identity context on each call, where an MQPUT had it
+    // checked by the MQOPEN. If that was why it failed, put the message again with the context
+    // in properties instead, the same as the MQOPEN does. The queue is remembered so that later
+    // MQPUT1 calls to it go straight to properties.
+    if (put1Od && *pCompCode == MQCC_FAILED && *pReason == MQRC_NOT_AUTHORIZED) {
+      rpt("put1: no authority to set identity context. Retrying without it");
+      captureEnd(&cap, *pCompCode, *pReason);
+      getConnState(pExitParms)->put1NoContext.insert(put1Key(put1Od));
+      o->carrier = CARRIER_NONE;
+      *pCompCode = MQCC_OK;
+      *pReason = MQRC_NONE;
+      mqotPutBefore(pExitParms, pExitContext, pHconn, pHobj, ppMsgDesc, ppPutMsgOpts, pBufferLength, ppBuffer, pCompCode, pReason);
+      pExitParms->Hconfig->MQPUT1_Call(*pHconn, put1Od, *ppMsgDesc, *ppPutMsgOpts, *pBufferLength, *ppBuffer, pCompCode, pReason);
+      mqotPutAfter(pExitParms, pExitContext, pHconn, pHobj, ppMsgDesc, ppPutMsgOpts, pBufferLength, ppBuffer, pCompCode, pReason);
+      return;
+    }
+  } else if (compareMsgHandle(pExitParms, mh)) {
     rpt("Restoring original PMO");
-    *ppPutMsgOpts = restorePmo(pHconn, pHobj);
+    *ppPutMsgOpts = restorePmo(pExitParms, pHobj);
   }
 
+  captureEnd(&cap, *pCompCode, *pReason);
   return;
 }
-}
\ No newline at end of file
+
+// MQPUT1 has no object handle, so stash the carrier for this queue against the
+// dummy handle that is used between the Before and After phases. Queues where an earlier
+// MQPUT1 could not set identity context are not given an MQMD carrier again.
+void mqotPut1Before(PMQAXP pExitParms, PMQAXC pExitContext, PMQHCONN pHconn, PPMQOD ppObjDesc, PPMQMD ppMsgDesc, PPMQPMO ppPutMsgOpts, PMQLONG pBufferLength,
+                    PPMQVOID ppBuffer, PMQLONG pCompCode, PMQLONG pReason) {
+  MQHOBJ dummy = MQHO_UNUSABLE_HOBJ;
+  PMQOD od = *ppObjDesc;
+
+  if (carriersConfigured) {
+    int carrier = CARRIER_NONE;
+    if (od->ObjectType == MQOT_Q) {
+      carrier = carrierForQueue(od->ObjectName);
+      if (carrier != CARRIER_NONE && getConnState(pExitParms)->put1NoContext.count(put1Key(od)) != 0) {
+        carrier = CARRIER_NONE;
+      }
+    }
+    auto o = savePmo(pExitParms, &dummy, *ppPutMsgOpts);
+    o->carrier = carrier;
+    o->put1Od = od;
+  }
+
+  mqotPutBefore(pExitParms, pExitContext, pHconn, &dummy, ppMsgDesc, ppPutMsgOpts, pBufferLength, ppBuffer, pCompCode, pReason);
+  return;
+}
+}
@@ -0,0 +1,652 @@
+/*
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+  Copyright (c) IBM Corporation 2024
+*/
+
+// Replay a capture file (written by the exit when MQIOTEL_CAPTURE_FILE is set) directly into
+// the mqioteldl.so module. No queue manager is needed: the Hconfig that the module
+// uses to make its own MQI calls points at a set of stub functions here, which return values
+// consistent with what was seen in the original run.
+//
+// The calls are replayed on a single thread in the order they were recorded. The time spent
+// inside the module for each call is reported alongside the time the same call took when it was
+// captured.
+
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <cmqc.h>
+#include <cmqec.h>
+#include <cmqxc.h>
+
+#include "mqiotel_capture.h"
+#include "mqiotel_entry.h"
+
+#define DLMODULE "mqioteldl.so"
+
+static struct {
+  OTEL_INIT *init;
+  OTEL_TERM *term;
+
+  MQ_OPEN_EXIT *openAfter;
+  MQ_CLOSE_EXIT *closeAfter;
+  MQ_DISC_EXIT *discBefore;
+
+  MQ_PUT_EXIT *putBefore;
+  MQ_PUT_EXIT *putAfter;
+
+  MQ_GET_EXIT *getBefore;
+  MQ_GET_EXIT *getAfter;
+  MQ_CB_EXIT *cbBefore;
+  MQ_CB_EXIT *cbAfter;
+} ot;
+
+static const char *verbNames[CAPTURE_VERB_COUNT] = {"", "OpenAfter", "CloseAfter", "DiscBefore", "PutBefore", "PutAfter", "GetBefore", "GetAfter"};
+
+// State carried between the Before and After calls for an hConn. The module may
+// replace the PMO/GMO pointers in the Before call and expects to see its own version
+// in the After. Each hConn also has its own MQAXP, as the module keeps its per-connection
+// state in the ExitUserArea.
+typedef struct {
+  MQHCONN hConn;
+  MQAXP axp;
+  MQMD md;
+  MQPMO pmo;
+  PMQPMO curPmo;
+  MQGMO gmo;
+  PMQGMO curGmo;
+  MQLONG dataLength;
+} connState;
+
+static connState *conns = NULL;
+static int connCount = 0;
+static MQAXP axpTemplate;
+
+// Durations for each verb, both as captured and as replayed
+typedef struct {
+  uint32_t *captured;
+  uint64_t *replayed;
+  size_t count;
+} verbStats;
+
+static verbStats stats[CAPTURE_VERB_COUNT];
+
+// The record currently being replayed. The stub MQINQMP uses it to decide which
+// properties exist and how long they are
+static captureRecord *curRec = NULL;
+
+static char *buffer = NULL;
+static size_t bufferSize = 0;
+static int verbose = 0;
+static MQHMSG nextHmsg = 1;
+
+static void usage(char *name) {
+  fprintf(stderr, "Usage: %s -f captureFile [-m module] [-n loops] [-p] [-v]\n", name);
+  fprintf(stderr, "  -m Path to the mqioteldl.so module. Default is to search the library path\n");
+  fprintf(stderr, "  -n Number of times to replay the file. Default 1\n");
+  fprintf(stderr, "  -p Pace the replay to match the timing of the original calls\n");
+  fprintf(stderr, "  -v Print the module's debug output\n");
+  exit(1);
+}
+
+static void rptReplay(const char *fmt, ...) {
+  va_list va;
+  va_start(va, fmt);
+  printf("Replay: ");
+  vprintf(fmt, va);
+  printf("\n");
+  va_end(va);
+}
+
+static uint64_t nowNs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*********************************************************************/
+/* Stub versions of the MQI calls that the module makes via Hconfig  */
+/*********************************************************************/
+static void MQENTRY stubCRTMH(MQHCONN Hconn, PMQVOID pCrtMsgHOpts, PMQHMSG pHmsg, PMQLONG pCompCode, PMQLONG pReason) {
+  *pHmsg = nextHmsg++;
+  *pCompCode = MQCC_OK;
+  *pReason = MQRC_NONE;
+}
+
+static void MQENTRY stubDLTMH(MQHCONN Hconn, PMQHMSG pHmsg, PMQVOID pDltMsgHOpts, PMQLONG pCompCode, PMQLONG pReason) {
+  *pHmsg = MQHM_NONE;
+  *pCompCode = MQCC_OK;
+  *pReason = MQRC_NONE;
+}
+
+static void MQENTRY stubSETMP(MQHCONN Hconn, MQHMSG Hmsg, PMQVOID pSetPropOpts, PMQVOID pName, PMQVOID pPropDesc, MQLONG Type, MQLONG ValueLength,
+                              PMQVOID pValue, PMQLONG pCompCode, PMQLONG pReason) {
+  *pCompCode = MQCC_OK;
+  *pReason = MQRC_NONE;
+}
+
+// Build a plausible value for one of the propagated properties, with the
+// same length as the original
+static MQLONG fakeValue(const char *name, int nameLength, uint16_t valueLength, char *value, MQLONG bufferLength) {
+  MQLONG l = valueLength;
+  if (l > bufferLength) {
+    l = bufferLength;
+  }
+  const char *tp = NULL;
+
+  if (nameLength == (int)strlen("traceparent") && !memcmp(name, "traceparent", nameLength)) {
+    tp = "00-4bf92f3577b34da6a3ce929d0e0e4736-00f067aa0ba902b7-01";
+  } else if (nameLength == (int)strlen("b3") && !memcmp(name, "b3", nameLength)) {
+    tp = "4bf92f3577b34da6a3ce929d0e0e4736-00f067aa0ba902b7-1";
+  } else if (nameLength == (int)strlen("uber_$dash$_trace_$dash$_id") && !memcmp(name, "uber_$dash$_trace_$dash$_id", nameLength)) {
+    tp = "4bf92f3577b34da6a3ce929d0e0e4736:00f067aa0ba902b7:0:1";
+  }
+
+  if (tp) {
+    memset(value, '0', l);
+    memcpy(value, tp, (size_t)l < strlen(tp) ? (size_t)l : strlen(tp));
+  } else {
+    memset(value, 'x', l);
+    if (l > 2) {
+      memcpy(value, "k=", 2);
+    }
+  }
+  return l;
+}
+
+// Look through the current record's property list for the name being asked about
+static void MQENTRY stubINQMP(MQHCONN Hconn, MQHMSG Hmsg, PMQVOID pInqPropOpts, PMQVOID pName, PMQVOID pPropDesc, PMQLONG pType, MQLONG ValueLength,
+                              PMQVOID pValue, PMQLONG pDataLength, PMQLONG pCompCode, PMQLONG pReason) {
+  PMQCHARV n = (PMQCHARV)pName;
+  const char *name = (const char *)n->VSPtr;
+  int i;
+
+  *pCompCode = MQCC_FAILED;
+  *pReason = MQRC_PROPERTY_NOT_AVAILABLE;
+
+  // Properties recorded on a PUT were set by the module, not found in the message
+  if (!curRec || curRec->verb != CAPTURE_GET_AFTER) {
+    return;
+  }
+
+  char *p = (char *)curRec + sizeof(captureRecord);
+  for (i = 0; i < curRec->propCount; i++) {
+    int nl = (unsigned char)*p++;
+    uint16_t vl;
+    memcpy(&vl, p + nl, sizeof(vl));
+    if (nl == (int)strlen(name) && !memcmp(p, name, nl)) {
+      *pDataLength = fakeValue(p, nl, vl, (char *)pValue, ValueLength);
+      *pType = MQTYPE_STRING;
+      *pCompCode = MQCC_OK;
+      *pReason = MQRC_NONE;
+      return;
+    }
+    p += nl + sizeof(vl);
+  }
+}
+
+static void MQENTRY stubOPEN(MQHCONN Hconn, PMQVOID pObjDesc, MQLONG Options, PMQHOBJ pHobj, PMQLONG pCompCode, PMQLONG pReason) {
+  *pHobj = 1;
+  *pCompCode = MQCC_OK;
+  *pReason = MQRC_NONE;
+}
+
+// Return the PROPCTL value that was discovered in the original run
+static void MQENTRY stubINQ(MQHCONN Hconn, MQHOBJ Hobj, MQLONG SelectorCount, PMQLONG pSelectors, MQLONG IntAttrCount, PMQLONG pIntAttrs,
+                            MQLONG CharAttrLength, PMQCHAR pCharAttrs, PMQLONG pCompCode, PMQLONG pReason) {
+  if (curRec && curRec->propCtl != -1 && IntAttrCount > 0) {
+    pIntAttrs[0] = curRec->propCtl;
+    *pCompCode = MQCC_OK;
+    *pReason = MQRC_NONE;
+  } else {
+    *pCompCode = MQCC_FAILED;
+    *pReason = MQRC_NOT_AUTHORIZED;
+  }
+}
+
+static void MQENTRY stubCLOSE(MQHCONN Hconn, PMQHOBJ pHobj, MQLONG Options, PMQLONG pCompCode, PMQLONG pReason) {
+  *pHobj = MQHO_UNUSABLE_HOBJ;
+  *pCompCode = MQCC_OK;
+  *pReason = MQRC_NONE;
+}
+
+static connState *findConn(MQHCONN hConn) {
+  int i;
+  for (i = 0; i < connCount; i++) {
+    if (conns[i].hConn == hConn) {
+      return &conns[i];
+    }
+  }
+  conns = realloc(conns, sizeof(connState) * (connCount + 1));
+  if (!conns) {
+    fprintf(stderr, "Cannot allocate memory\n");
+    exit(1);
+  }
+  memset(&conns[connCount], 0, sizeof(connState));
+  conns[connCount].hConn = hConn;
+  conns[connCount].axp = axpTemplate;
+  return &conns[connCount++];
+}
+
+// Set up the MQMD and a message buffer that look like the original message. If the
+// properties were returned in an RFH2, then construct one containing the same property names.
+static void buildMessage(connState *c, captureRecord *r) {
+  MQMD mdDefault = {MQMD_DEFAULT};
+  c->md = mdDefault;
+  memset(buffer, 0, bufferSize);
+  c->dataLength = r->bufferLength;
+
+  if (r->flags & CAPTURE_FLAG_MD) {
+    memcpy(c->md.Format, r->format, MQ_FORMAT_LENGTH);
+    c->md.MsgType = r->msgType;
+    c->md.Persistence = r->persistence;
+    c->md.Encoding = r->encoding;
+    c->md.CodedCharSetId = r->ccsid;
+  }
+
+  if (!memcmp(c->md.Format, MQFMT_RF_HEADER_2, MQ_FORMAT_LENGTH)) {
+    MQRFH2 rfh2Default = {MQRFH2_DEFAULT};
+    PMQRFH2 rfh2 = (PMQRFH2)buffer;
+    char *folder = buffer + MQRFH_STRUC_LENGTH_FIXED_2 + sizeof(MQLONG);
+    char value[CAPTURE_MAX_PROPS_LEN];
+    int o = 0;
+    int i;
+    MQLONG folderLength;
+
+    *rfh2 = rfh2Default;
+    o += sprintf(&folder[o], "<usr>");
+    if (r->verb == CAPTURE_GET_AFTER) {
+      char *p = (char *)r + sizeof(captureRecord);
+      for (i = 0; i < r->propCount; i++) {
+        int nl = (unsigned char)*p++;
+        uint16_t vl;
+        MQLONG l;
+        memcpy(&vl, p + nl, sizeof(vl));
+        l = fakeValue(p, nl, vl, value, sizeof(value));
+        o += sprintf(&folder[o], "<%.*s>%.*s</%.*s>", nl, p, (int)l, value, nl, p);
+        p += nl + sizeof(vl);
+      }
+    }
+    o += sprintf(&folder[o], "</usr>");
+    // Folder lengths must be a multiple of 4
+    while (o % 4) {
+      folder[o++] = ' ';
+    }
+    folderLength = o;
+    memcpy(buffer + MQRFH_STRUC_LENGTH_FIXED_2, &folderLength, sizeof(MQLONG));
+    rfh2->StrucLength = MQRFH_STRUC_LENGTH_FIXED_2 + sizeof(MQLONG) + folderLength;
+    if (c->dataLength < rfh2->StrucLength) {
+      c->dataLength = rfh2->StrucLength;
+    }
+  }
+}
+
+/*********************************************************************/
+/* Replay a single record                                            */
+/*********************************************************************/
+static void replayOne(PMQAXC pExitContext, captureRecord *r) {
+  MQHCONN hConn = r->hConn;
+  PMQHCONN pHconn = &hConn;
+  MQHOBJ hObj = r->hObj;
+  PMQHOBJ pHobj = &hObj;
+  MQLONG cc = r->compCode;
+  MQLONG rc = r->reason;
+  MQLONG options = r->options;
+  MQLONG bufferLength;
+  PMQVOID pBuffer = buffer;
+  PMQLONG pDataLength;
+  PMQMD pMd;
+  connState *c = findConn(hConn);
+  PMQAXP pExitParms = &c->axp;
+  uint64_t start, end = 0;
+
+  MQOD od = {MQOD_DEFAULT};
+  PMQOD pOd = &od;
+  MQPMO pmoDefault = {MQPMO_DEFAULT};
+  MQGMO gmoDefault = {MQGMO_DEFAULT};
+
+  curRec = r;
+  start = nowNs();
+
+  switch (r->verb) {
+  case CAPTURE_OPEN_AFTER:
+    od.ObjectType = MQOT_Q;
+    strncpy(od.ObjectName, "MQIOTEL.REPLAY.QUEUE", MQ_Q_NAME_LENGTH);
+    start = nowNs();
+    ot.openAfter(pExitParms, pExitContext, pHconn, &pOd, &options, &pHobj, &cc, &rc);
+    break;
+
+  case CAPTURE_CLOSE_AFTER:
+    start = nowNs();
+    ot.closeAfter(pExitParms, pExitContext, pHconn, &pHobj, &options, &cc, &rc);
+    break;
+
+  case CAPTURE_DISC_BEFORE:
+    start = nowNs();
+    ot.discBefore(pExitParms, pExitContext, &pHconn, &cc, &rc);
+    break;
+
+  case CAPTURE_PUT_BEFORE:
+    buildMessage(c, r);
+    c->pmo = pmoDefault;
+    c->pmo.Version = r->structVersion;
+    c->pmo.Options = r->options;
+    if (r->flags & CAPTURE_FLAG_APP_HANDLE) {
+      c->pmo.Version = MQPMO_VERSION_3;
+      c->pmo.NewMsgHandle = nextHmsg++;
+    }
+    c->curPmo = &c->pmo;
+    pMd = &c->md;
+    bufferLength = c->dataLength;
+    start = nowNs();
+    ot.putBefore(pExitParms, pExitContext, pHconn, pHobj, &pMd, &c->curPmo, &bufferLength, &pBuffer, &cc, &rc);
+    break;
+
+  case CAPTURE_PUT_AFTER:
+    if (!c->curPmo) {
+      c->pmo = pmoDefault;
+      c->curPmo = &c->pmo;
+    }
+    pMd = &c->md;
+    bufferLength = c->dataLength;
+    start = nowNs();
+    ot.putAfter(pExitParms, pExitContext, pHconn, pHobj, &pMd, &c->curPmo, &bufferLength, &pBuffer, &cc, &rc);
+    c->curPmo = NULL;
+    break;
+
+  case CAPTURE_GET_BEFORE:
+    c->gmo = gmoDefault;
+    c->gmo.Version = r->structVersion;
+    c->gmo.Options = r->options;
+    if (r->flags & CAPTURE_FLAG_APP_HANDLE) {
+      c->gmo.Version = MQGMO_VERSION_4;
+      c->gmo.MsgHandle = nextHmsg++;
+    }
+    c->curGmo = &c->gmo;
+    pMd = &c->md;
+    bufferLength = r->bufferLength;
+    pDataLength = &c->dataLength;
+    if (r->flags & CAPTURE_FLAG_ASYNC) {
+      // Async consumers are captured as they are registered
+      MQCBD cbd = {MQCBD_DEFAULT};
+      PMQCBD pCbd = &cbd;
+      MQLONG operation = MQOP_REGISTER;
+      start = nowNs();
+      ot.cbBefore(pExitParms, pExitContext, pHconn, &operation, &pCbd, pHobj, &pMd, &c->curGmo, &cc, &rc);
+      end = nowNs();
+      ot.cbAfter(pExitParms, pExitContext, pHconn, &operation, &pCbd, pHobj, &pMd, &c->curGmo, &cc, &rc);
+      c->curGmo = &c->gmo;
+      break;
+    }
+    start = nowNs();
+    ot.getBefore(pExitParms, pExitContext, pHconn, pHobj, &pMd, &c->curGmo, &bufferLength, &pBuffer, &pDataLength, &cc, &rc);
+    break;
+
+  case CAPTURE_GET_AFTER:
+    if (!c->curGmo) {
+      c->gmo = gmoDefault;
+      c->gmo.Version = r->structVersion;
+      c->gmo.Options = r->options;
+      c->curGmo = &c->gmo;
+    }
+    // If the properties came back in a handle originally, then there was no RFH2 to rebuild.
+    if (!(r->flags & CAPTURE_FLAG_RFH2)) {
+      memset(r->format, ' ', MQ_FORMAT_LENGTH);
+    }
+    buildMessage(c, r);
+    pMd = &c->md;
+    bufferLength = c->dataLength;
+    pDataLength = &c->dataLength;
+    start = nowNs();
+    ot.getAfter(pExitParms, pExitContext, pHconn, pHobj, &pMd, &c->curGmo, &bufferLength, &pBuffer, &pDataLength, &cc, &rc);
+    c->curGmo = NULL;
+    break;
+
+  default:
+    return;
+  }
+
+  if (end == 0) {
+    end = nowNs();
+  }
+  verbStats *s = &stats[r->verb];
+  s->captured[s->count] = r->durationNs;
+  s->replayed[s->count] = end - start;
+  s->count++;
+}
+
+static int cmp32(const void *a, const void *b) {
+  uint32_t x = *(const uint32_t *)a;
+  uint32_t y = *(const uint32_t *)b;
+  return (x > y) - (x < y);
+}
+
+static int cmp64(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *)a;
+  uint64_t y = *(const uint64_t *)b;
+  return (x > y) - (x < y);
+}
+
+// Values must already be sorted
+#define PCT(v, n, p) (v[(size_t)(((n)-1) * (p))])
+
+static void report(uint64_t elapsed) {
+  int i;
+  size_t j;
+  size_t total = 0;
+
+  printf("%-10s %8s %6s %10s %10s %10s %10s %10s\n", "Verb", "Calls", "", "Mean(ns)", "p50", "p99", "p99.9", "Max");
+  for (i = 1; i < CAPTURE_VERB_COUNT; i++) {
+    verbStats *s = &stats[i];
+    uint64_t sumC = 0, sumR = 0;
+    size_t n = s->count;
+
+    if (n == 0) {
+      continue;
+    }
+    total += n;
+    for (j = 0; j < n; j++) {
+      sumC += s->captured[j];
+      sumR += s->replayed[j];
+    }
+    qsort(s->captured, n, sizeof(uint32_t), cmp32);
+    qsort(s->replayed, n, sizeof(uint64_t), cmp64);
+
+    printf("%-10s %8lu %6s %10lu %10u %10u %10u %10u\n", verbNames[i], (unsigned long)n, "orig", (unsigned long)(sumC / n), PCT(s->captured, n, 0.5),
+           PCT(s->captured, n, 0.99), PCT(s->captured, n, 0.999), s->captured[n - 1]);
+    printf("%-10s %8s %6s %10lu %10lu %10lu %10lu %10lu\n", "", "", "replay", (unsigned long)(sumR / n), (unsigned long)PCT(s->replayed, n, 0.5),
+           (unsigned long)PCT(s->replayed, n, 0.99), (unsigned long)PCT(s->replayed, n, 0.999), (unsigned long)s->replayed[n - 1]);
+  }
+  if (elapsed > 0) {
+    printf("\nReplayed %lu calls in %.3f seconds: %.0f calls/second\n", (unsigned long)total, elapsed / 1e9, total / (elapsed / 1e9));
+  }
+}
+
+int main(int argc, char **argv) {
+  char *fileName = NULL;
+  char *modName = DLMODULE;
+  int loops = 1;
+  int pace = 0;
+  int opt;
+  int rc = 0;
+  int i;
+  struct stat st;
+  char msg[256] = {0};
+
+  while ((opt = getopt(argc, argv, "f:m:n:pv")) != -1) {
+    switch (opt) {
+    case 'f':
+      fileName = optarg;
+      break;
+    case 'm':
+      modName = optarg;
+      break;
+    case 'n':
+      loops = atoi(optarg);
+      break;
+    case 'p':
+      pace = 1;
+      break;
+    case 'v':
+      verbose = 1;
+      break;
+    default:
+      usage(argv[0]);
+    }
+  }
+  if (!fileName || loops < 1) {
+    usage(argv[0]);
+  }
+
+  // Map the capture file and check it's one of ours
+  int fd = open(fileName, O_RDONLY);
+  if (fd == -1 || fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(captureFileHeader)) {
+    fprintf(stderr, "Cannot open capture file %s\n", fileName);
+    exit(1);
+  }
+  // Private mapping so we can adjust records as they are replayed without changing the file
+  char *m = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  if (m == MAP_FAILED) {
+    fprintf(stderr, "Cannot map capture file %s\n", fileName);
+    exit(1);
+  }
+  captureFileHeader *hdr = (captureFileHeader *)m;
+  if (memcmp(hdr->magic, CAPTURE_MAGIC, sizeof(hdr->magic)) || hdr->version != CAPTURE_VERSION) {
+    fprintf(stderr, "File %s is not a capture file\n", fileName);
+    exit(1);
+  }
+  char *first = m + hdr->headerLength;
+  char *last = m + st.st_size;
+  if (hdr->used < (uint64_t)(last - first)) {
+    last = first + hdr->used;
+  }
+  if (hdr->dropped > 0) {
+    printf("Warning: %lu records were dropped during capture\n", (unsigned long)hdr->dropped);
+  }
+
+  // Count the records so the statistics arrays can be sized, and find the largest buffer
+  size_t counts[CAPTURE_VERB_COUNT] = {0};
+  size_t records = 0;
+  char *p;
+  for (p = first; p + sizeof(captureRecord) <= last && ((captureRecord *)p)->length != 0; p += ((captureRecord *)p)->length) {
+    captureRecord *r = (captureRecord *)p;
+    if (r->verb < CAPTURE_VERB_COUNT) {
+      counts[r->verb]++;
+    }
+    if (r->bufferLength > 0 && (size_t)r->bufferLength > bufferSize) {
+      bufferSize = r->bufferLength;
+    }
+    records++;
+  }
+  last = p;
+  printf("Capture file %s contains %lu records\n", fileName, (unsigned long)records);
+
+  // Leave room for an RFH2 header even if the original messages were small
+  bufferSize += MQRFH_STRUC_LENGTH_FIXED_2 + 4 * CAPTURE_MAX_PROPS_LEN;
+  buffer = malloc(bufferSize);
+  for (i = 0; i < CAPTURE_VERB_COUNT; i++) {
+    stats[i].captured = malloc(sizeof(uint32_t) * (counts[i] * loops + 1));
+    stats[i].replayed = malloc(sizeof(uint64_t) * (counts[i] * loops + 1));
+  }
+
+  void *hdl = dlopen(modName, RTLD_LOCAL | RTLD_NOW);
+  if (!hdl) {
+    fprintf(stderr, "Cannot load %s: %s\n", modName, dlerror());
+    exit(1);
+  }
+
+#define DLSYM(FUNC, Name)                                                                                                                                      \
+  {                                                                                                                                                            \
+    FUNC = (void *)dlsym(hdl, Name);                                                                                                                           \
+    if (FUNC == NULL) {                                                                                                                                        \
+      fprintf(stderr, "Cannot find symbol %s\n", Name);                                                                                                        \
+      rc++;                                                                                                                                                    \
+    }                                                                                                                                                          \
+  }
+
+  DLSYM(ot.init, "mqotInit");
+  DLSYM(ot.term, "mqotTerm");
+  DLSYM(ot.openAfter, "mqotOpenAfter");
+  DLSYM(ot.closeAfter, "mqotCloseAfter");
+  DLSYM(ot.discBefore, "mqotDiscBefore");
+  DLSYM(ot.putBefore, "mqotPutBefore");
+  DLSYM(ot.putAfter, "mqotPutAfter");
+  DLSYM(ot.getBefore, "mqotGetBefore");
+  DLSYM(ot.getAfter, "mqotGetAfter");
+  DLSYM(ot.cbBefore, "mqotCBBefore");
+  DLSYM(ot.cbAfter, "mqotCBAfter");
+  if (rc != 0) {
+    exit(1);
+  }
+
+  // Don't let the module start capturing the calls we are replaying
+  unsetenv(ENV_CAPTURE_FILE);
+
+  rc = ot.init(verbose ? rptReplay : NULL, msg, sizeof(msg));
+  printf("Module: %s\n", msg);
+  if (rc != MQRC_NONE) {
+    fprintf(stderr, "Module initialisation failed with %d\n", rc);
+    exit(1);
+  }
+
+  // The only part of the environment the module uses is the set of MQI entrypoints
+  MQIEP iep;
+  memset(&iep, 0, sizeof(iep));
+  memcpy(iep.StrucId, MQIEP_STRUC_ID, sizeof(iep.StrucId));
+  iep.Version = MQIEP_VERSION_1;
+  iep.StrucLength = sizeof(iep);
+  iep.MQCRTMH_Call = (PMQ_CRTMH_CALL)stubCRTMH;
+  iep.MQDLTMH_Call = (PMQ_DLTMH_CALL)stubDLTMH;
+  iep.MQSETMP_Call = (PMQ_SETMP_CALL)stubSETMP;
+  iep.MQINQMP_Call = (PMQ_INQMP_CALL)stubINQMP;
+  iep.MQOPEN_Call = (PMQ_OPEN_CALL)stubOPEN;
+  iep.MQINQ_Call = (PMQ_INQ_CALL)stubINQ;
+  iep.MQCLOSE_Call = (PMQ_CLOSE_CALL)stubCLOSE;
+
+  MQAXC axc;
+  memset(&axpTemplate, 0, sizeof(axpTemplate));
+  memset(&axc, 0, sizeof(axc));
+  axpTemplate.Hconfig = &iep;
+  axpTemplate.APICallerType = MQXACT_EXTERNAL;
+  axc.Environment = MQXE_OTHER;
+
+  uint64_t replayStart = nowNs();
+  for (i = 0; i < loops; i++) {
+    uint64_t loopStart = nowNs();
+    for (p = first; p < last; p += ((captureRecord *)p)->length) {
+      captureRecord *r = (captureRecord *)p;
+      if (pace) {
+        while (nowNs() - loopStart < r->startNs) {
+          ;
+        }
+      }
+      replayOne(&axc, r);
+    }
+  }
+  uint64_t elapsed = nowNs() - replayStart;
+
+  ot.term();
+  report(elapsed);
+
+  return 0;
+}
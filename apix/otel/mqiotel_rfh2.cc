@@ -0,0 +1,258 @@
+/*
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+  Copyright (c) IBM Corporation 2024
+*/
+
+// Applications that build their own RFH2 headers (often for interop with JMS) would normally
+// have the context set in a message handle, which the queue manager then has to merge into the
+// RFH2 during the MQPUT. With MQIOTEL_RFH2_INJECT set, the exit instead writes the properties
+// straight into the <usr> folder of the message's first RFH2, or adds a <usr> folder if there
+// is not one. The modified message is built in a per-thread buffer that is given to the MQPUT in
+// place of the application's buffer. That buffer grows as needed but is never shrunk, so a
+// thread putting similar messages only allocates it once.
+//
+// Only RFH2 headers with native integer encoding and an ASCII-based NameValueCCSID are changed.
+// For anything else, the exit falls back to using a message handle.
+
+#include <stdarg.h>
+#include <stdio.h>
+
+#include <cstdlib>
+#include <cstring>
+
+#include <cmqc.h>
+#include <cmqec.h>
+
+#include "mqiotel.hpp"
+
+#define USR_START "<usr>"
+#define USR_END "</usr>"
+#define MIN_SCRATCH_SIZE 4096
+
+bool rfh2InjectEnabled = false;
+
+// Released when the thread ends
+struct scratchBuffer {
+  char *p = NULL;
+  size_t size = 0;
+  ~scratchBuffer() {
+    mqotFree(p);
+  }
+};
+static thread_local scratchBuffer scratch;
+
+void rfh2Init() {
+  const char *e = getenv(ENV_RFH2_INJECT);
+  rfh2InjectEnabled = (e && *e && strcmp(e, "0") != 0);
+  if (rfh2InjectEnabled) {
+    rpt("RFH2 injection enabled");
+  }
+}
+
+// Make sure the per-thread buffer can hold at least this much, doubling its size as necessary
+static char *scratchFor(size_t need) {
+  if (need > scratch.size) {
+    size_t size = (scratch.size > 0) ? scratch.size : MIN_SCRATCH_SIZE;
+    while (size < need) {
+      size *= 2;
+    }
+    mqotFree(scratch.p);
+    scratch.p = (char *)mqotMalloc(size);
+    scratch.size = size;
+  }
+  return scratch.p;
+}
+
+// Character sets where the XML text we are adding can be written as plain ASCII
+static bool asciiCcsid(MQLONG ccsid) {
+  switch (ccsid) {
+  case 1208:
+  case 819:
+  case 437:
+  case 850:
+  case 1252:
+    return true;
+  default:
+    return false;
+  }
+}
+
+// Length of a value once any XML special characters have been escaped
+static size_t escapedLength(const char *v, size_t l) {
+  size_t el = l;
+  for (size_t i = 0; i < l; i++) {
+    if (v[i] == '<' || v[i] == '>') {
+      el += 3;
+    } else if (v[i] == '&') {
+      el += 4;
+    }
+  }
+  return el;
+}
+
+static char *writeEscaped(char *p, const char *v, size_t l) {
+  for (size_t i = 0; i < l; i++) {
+    switch (v[i]) {
+    case '<':
+      memcpy(p, "&lt;", 4);
+      p += 4;
+      break;
+    case '>':
+      memcpy(p, "&gt;", 4);
+      p += 4;
+      break;
+    case '&':
+      memcpy(p, "&amp;", 5);
+      p += 5;
+      break;
+    default:
+      *p++ = v[i];
+    }
+  }
+  return p;
+}
+
+static char *writeProps(char *p, const rfh2Prop *props, int count) {
+  for (int i = 0; i < count; i++) {
+    size_t nl = strlen(props[i].name);
+    *p++ = '<';
+    memcpy(p, props[i].name, nl);
+    p += nl;
+    *p++ = '>';
+    p = writeEscaped(p, props[i].value, props[i].length);
+    *p++ = '<';
+    *p++ = '/';
+    memcpy(p, props[i].name, nl);
+    p += nl;
+    *p++ = '>';
+  }
+  return p;
+}
+
+// Find the last occurrence of a string within a block
+static const char *findLast(const char *b, size_t l, const char *s) {
+  size_t sl = strlen(s);
+  if (l < sl) {
+    return NULL;
+  }
+  for (const char *p = b + l - sl; p >= b; p--) {
+    if (*p == *s && !memcmp(p, s, sl)) {
+      return p;
+    }
+  }
+  return NULL;
+}
+
+// Build a copy of the message with the properties added to its first RFH2. Returns false,
+// without changing anything, if the RFH2 is not one we can safely modify.
+bool rfh2Inject(PMQMD md, PMQVOID buffer, MQLONG length, const rfh2Prop *props, int count, PMQVOID *newBuffer, PMQLONG newLength) {
+  const char *b = (const char *)buffer;
+  MQRFH2 rfh2;
+  size_t textLength = 0;
+
+  if ((md->Encoding & MQENC_INTEGER_MASK) != (MQENC_NATIVE & MQENC_INTEGER_MASK) || length < MQRFH_STRUC_LENGTH_FIXED_2) {
+    return false;
+  }
+  memcpy(&rfh2, b, MQRFH_STRUC_LENGTH_FIXED_2);
+  if (memcmp(rfh2.StrucId, MQRFH_STRUC_ID, sizeof(rfh2.StrucId)) || rfh2.Version != MQRFH_VERSION_2 || rfh2.StrucLength < MQRFH_STRUC_LENGTH_FIXED_2 ||
+      rfh2.StrucLength > length || !asciiCcsid(rfh2.NameValueCCSID)) {
+    return false;
+  }
+
+  for (int i = 0; i < count; i++) {
+    textLength += 2 * strlen(props[i].name) + 5 + escapedLength(props[i].value, props[i].length);
+  }
+
+  // Look for an existing <usr> folder, checking that all the lengths are consistent
+  MQLONG offset = MQRFH_STRUC_LENGTH_FIXED_2;
+  MQLONG folderOffset = -1;
+  MQLONG folderLength = 0;
+  while (offset + (MQLONG)sizeof(MQLONG) <= rfh2.StrucLength) {
+    MQLONG nvLength;
+    memcpy(&nvLength, b + offset, sizeof(MQLONG));
+    if (nvLength < 0 || offset + (MQLONG)sizeof(MQLONG) + nvLength > rfh2.StrucLength) {
+      return false;
+    }
+    const char *data = b + offset + sizeof(MQLONG);
+    MQLONG skip = 0;
+    while (skip < nvLength && data[skip] == ' ') {
+      skip++;
+    }
+    if (folderOffset < 0 && nvLength - skip >= (MQLONG)strlen(USR_START) && !memcmp(data + skip, USR_START, strlen(USR_START))) {
+      folderOffset = offset;
+      folderLength = nvLength;
+    }
+    offset += sizeof(MQLONG) + nvLength;
+  }
+  if (offset != rfh2.StrucLength) {
+    return false;
+  }
+
+  char *out;
+  char *p;
+  MQLONG added;
+
+  if (folderOffset >= 0) {
+    // Insert the new elements just before the end of the folder, then pad the folder to a multiple of 4
+    const char *data = b + folderOffset + sizeof(MQLONG);
+    const char *end = findLast(data, folderLength, USR_END);
+    if (!end) {
+      return false;
+    }
+    MQLONG newFolderLength = folderLength + (MQLONG)textLength;
+    newFolderLength = (newFolderLength + 3) & ~3;
+    added = newFolderLength - folderLength;
+
+    out = scratchFor(length + added);
+    p = out;
+    memcpy(p, b, end - b);
+    p += end - b;
+    p = writeProps(p, props, count);
+    size_t rest = data + folderLength - end;
+    memcpy(p, end, rest);
+    p += rest;
+    memset(p, ' ', newFolderLength - folderLength - textLength);
+    p += newFolderLength - folderLength - textLength;
+    memcpy(out + folderOffset, &newFolderLength, sizeof(MQLONG));
+  } else {
+    // Add a new folder after the existing ones
+    MQLONG newFolderLength = (MQLONG)(strlen(USR_START) + textLength + strlen(USR_END));
+    MQLONG padding = ((newFolderLength + 3) & ~3) - newFolderLength;
+    newFolderLength += padding;
+    added = sizeof(MQLONG) + newFolderLength;
+
+    out = scratchFor(length + added);
+    p = out;
+    memcpy(p, b, rfh2.StrucLength);
+    p += rfh2.StrucLength;
+    memcpy(p, &newFolderLength, sizeof(MQLONG));
+    p += sizeof(MQLONG);
+    memcpy(p, USR_START, strlen(USR_START));
+    p += strlen(USR_START);
+    p = writeProps(p, props, count);
+    memcpy(p, USR_END, strlen(USR_END));
+    p += strlen(USR_END);
+    memset(p, ' ', padding);
+    p += padding;
+  }
+
+  // Everything after the RFH2 is unchanged
+  memcpy(p, b + rfh2.StrucLength, length - rfh2.StrucLength);
+  rfh2.StrucLength += added;
+  memcpy(out, &rfh2, MQRFH_STRUC_LENGTH_FIXED_2);
+
+  *newBuffer = out;
+  *newLength = length + added;
+  return true;
+}
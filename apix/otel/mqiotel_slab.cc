@@ -0,0 +1,118 @@
+/*
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+  Copyright (c) IBM Corporation 2024
+*/
+
+// The hobjOptions records are fairly large, as they hold complete copies of the PMO, GMO and MD.
+// Applications that open and close many queues (for example, dynamic reply queues) would otherwise
+// be making a malloc/free pair for every object handle. Instead, each connection has an arena of
+// fixed-size slabs. Closed handles put their record on the arena's free list for reuse, and the
+// slabs themselves are only released when the connection goes away.
+//
+// An arena only belongs to one hConn, so needs no locking. The usage counters are shared by all
+// connections and are updated atomically.
+
+#include <stdarg.h>
+#include <stdio.h>
+
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+
+#include <cmqc.h>
+#include <cmqec.h>
+
+#include "mqiotel.hpp"
+
+struct tagHobjSlab {
+  hobjSlab *next;
+  hobjOptions rec[SLAB_RECORDS];
+};
+
+static std::atomic<size_t> slabBytes{0};
+static std::atomic<size_t> peakSlabBytes{0};
+static std::atomic<size_t> recordsInUse{0};
+
+// Take a record from the free list, adding a new slab to the arena if it's empty
+phobjOptions newHobjOptions(hobjArena *a) {
+  phobjOptions o;
+
+  if (!a->freeList) {
+    hobjSlab *s = (hobjSlab *)mqotMalloc(sizeof(hobjSlab));
+    s->next = a->slabs;
+    a->slabs = s;
+    for (int i = SLAB_RECORDS - 1; i >= 0; i--) {
+      s->rec[i].nextFree = a->freeList;
+      a->freeList = &s->rec[i];
+    }
+
+    size_t total = slabBytes.fetch_add(sizeof(hobjSlab), std::memory_order_relaxed) + sizeof(hobjSlab);
+    size_t peak = peakSlabBytes.load(std::memory_order_relaxed);
+    while (total > peak && !peakSlabBytes.compare_exchange_weak(peak, total, std::memory_order_relaxed)) {
+      ;
+    }
+  }
+
+  o = a->freeList;
+  a->freeList = o->nextFree;
+  a->inUse++;
+  recordsInUse.fetch_add(1, std::memory_order_relaxed);
+
+  memset(o, 0, sizeof(hobjOptions));
+  o->propCtl = -1;
+  o->carrier = CARRIER_NONE;
+  o->consumerHandle = MQHM_NONE;
+  return o;
+}
+
+void freeHobjRecord(hobjArena *a, phobjOptions o) {
+  o->nextFree = a->freeList;
+  a->freeList = o;
+  a->inUse--;
+  recordsInUse.fetch_sub(1, std::memory_order_relaxed);
+}
+
+// Release the whole arena in one go, without needing to walk the records
+void freeHobjArena(hobjArena *a) {
+  size_t released = 0;
+
+  for (hobjSlab *s = a->slabs; s;) {
+    hobjSlab *next = s->next;
+    mqotFree(s);
+    released += sizeof(hobjSlab);
+    s = next;
+  }
+
+  slabBytes.fetch_sub(released, std::memory_order_relaxed);
+  recordsInUse.fetch_sub(a->inUse, std::memory_order_relaxed);
+  a->slabs = NULL;
+  a->freeList = NULL;
+  a->inUse = 0;
+}
+
+void reportMemoryUsage() {
+  rpt("Memory: %lu object records in use, %lu bytes in slabs, peak %lu bytes", (unsigned long)recordsInUse.load(), (unsigned long)slabBytes.load(),
+      (unsigned long)peakSlabBytes.load());
+}
+
+extern "C" {
+
+// Let tools like mqiotel_churn see how the arenas are being used
+void mqotMemoryUsage(size_t *recordSize, size_t *inUse, size_t *reserved, size_t *peakReserved) {
+  *recordSize = sizeof(hobjOptions);
+  *inUse = recordsInUse.load(std::memory_order_relaxed);
+  *reserved = slabBytes.load(std::memory_order_relaxed);
+  *peakReserved = peakSlabBytes.load(std::memory_order_relaxed);
+}
+}
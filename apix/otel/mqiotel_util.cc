@@ -25,7 +25,12 @@
 
 #include "mqiotel.hpp"
 
+// In the static build, the debug file is the one opened by the exit's EntryPoint
+#if defined MQIOTEL_STATIC
+extern FILE *fp;
+#else
 FILE *fp;
+#endif
 
 void *mqotMalloc(size_t l) {
   void *p = malloc(l);
@@ -0,0 +1,519 @@
+/*
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+  Copyright (c) IBM Corporation 2024
+*/
+
+// A plugin for the mqmux exit that profiles the messages an application sends and receives.
+// For each queue it counts MQPUT, MQPUT1 and MQGET calls (including messages given to an
+// MQCB callback), keeps a histogram of message sizes, and counts the options used, such as
+// syncpoint, persistence and waits. Every MQPROFILE_INTERVAL seconds, and when the process
+// ends, the totals and the rates since the previous report are appended to a file.
+//
+// Each thread counts into its own blocks, so there are no locks on the MQI path. A thread
+// only ever writes its own counters, and the report reads them without stopping it, so a
+// report may be a call or two behind. A thread's blocks are folded into the totals and
+// freed when it ends.
+
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <unordered_map>
+
+#include <cmqc.h>
+#include <cmqec.h>
+#include <cmqxc.h>
+
+#include "../mux/mqmux_plugin.hpp"
+
+using namespace mqmux;
+
+#define ENV_QUEUES "MQPROFILE_QUEUES"
+#define ENV_FILE "MQPROFILE_FILE"
+#define ENV_INTERVAL "MQPROFILE_INTERVAL"
+
+#define DEFAULT_INTERVAL 60
+#define DEFAULT_FILE "/tmp/mqprofile.%d.txt" // Process id
+
+// Queues are numbered as they are first seen. Any more than this are counted together.
+#define MAX_QUEUES 256
+#define OTHER_QUEUES "(other)"
+
+// Bucket b holds sizes up to 2^b bytes
+#define BUCKETS 28
+
+enum { VERB_PUT, VERB_PUT1, VERB_GET, VERB_COUNT };
+static const char *verbNames[VERB_COUNT] = {"PUT", "PUT1", "GET"};
+
+typedef std::atomic<unsigned long> counter;
+
+struct verbCounters {
+  counter calls;
+  counter failed;
+  counter msgs;
+  counter bytes;
+  counter sizes[BUCKETS];
+  counter syncpoint;
+  counter persistent;
+  counter async;     // MQPUT with MQPMO_ASYNC_RESPONSE
+  counter waits;     // MQGET with MQGMO_WAIT
+  counter waitMsecs; // Total of their WaitIntervals, not counting MQWI_UNLIMITED
+  counter unlimited;
+  counter noMsg;
+  counter truncated; // Delivered with MQRC_TRUNCATED_MSG_ACCEPTED
+  counter retries;   // MQRC_TRUNCATED_MSG_FAILED, so the application has to get the message again
+};
+
+struct queueCounters {
+  verbCounters verbs[VERB_COUNT];
+};
+
+// One thread's counters. Slots are created by the owning thread, and freed when it ends.
+struct threadCounters {
+  std::atomic<queueCounters *> queues[MAX_QUEUES];
+};
+
+// Totals as of the last report, used to work out rates
+struct verbTotals {
+  unsigned long calls;
+  unsigned long failed;
+  unsigned long msgs;
+  unsigned long bytes;
+  unsigned long sizes[BUCKETS];
+  unsigned long syncpoint;
+  unsigned long persistent;
+  unsigned long async;
+  unsigned long waits;
+  unsigned long waitMsecs;
+  unsigned long unlimited;
+  unsigned long noMsg;
+  unsigned long truncated;
+  unsigned long retries;
+};
+
+struct pfConn {
+  std::unordered_map<MQHOBJ, int> handles;
+  std::unordered_map<std::string, int> put1Queues;
+};
+
+static queueList queues;
+static std::string fileName;
+static unsigned long long interval = 0; // Microseconds
+
+static std::mutex registryLock;
+static std::unordered_map<std::string, int> queueIndex;
+static std::vector<std::string> queueNames;
+static std::vector<threadCounters *> threads;
+static std::vector<verbTotals> retired; // Counts from threads that have ended
+
+static std::mutex reportLock;
+static std::atomic<unsigned long long> lastReport{0};
+static std::vector<verbTotals> previous;
+
+// When a thread ends, its counts are added to the retired totals and its counters freed. The
+// report lock is taken first, so a report is never reading the counters as they go.
+struct counterOwner {
+  threadCounters *tc = NULL;
+  ~counterOwner();
+};
+static thread_local counterOwner myCounters;
+
+// Only the owning thread writes a counter, so a plain load and store is enough
+static inline void bump(counter &c, unsigned long n = 1) {
+  c.store(c.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+static int bucket(MQLONG len) {
+  int b = 0;
+  while (b < BUCKETS - 1 && (1L << b) < len) {
+    b++;
+  }
+  return b;
+}
+
+static int indexFor(const MQCHAR *name) {
+  std::string n(name, nameLength(name, MQ_Q_NAME_LENGTH));
+  std::lock_guard<std::mutex> lock(registryLock);
+  auto it = queueIndex.find(n);
+  if (it != queueIndex.end()) {
+    return it->second;
+  }
+  if (queueNames.empty()) {
+    queueNames.push_back(OTHER_QUEUES);
+  }
+  if (queueNames.size() >= MAX_QUEUES) {
+    return 0;
+  }
+  int i = (int)queueNames.size();
+  queueNames.push_back(n);
+  queueIndex[n] = i;
+  return i;
+}
+
+static verbCounters *countersFor(int q, int verb) {
+  threadCounters *tc = myCounters.tc;
+  if (!tc) {
+    tc = myCounters.tc = new threadCounters();
+    std::lock_guard<std::mutex> lock(registryLock);
+    threads.push_back(tc);
+  }
+  queueCounters *qc = tc->queues[q].load(std::memory_order_relaxed);
+  if (!qc) {
+    qc = new queueCounters();
+    tc->queues[q].store(qc, std::memory_order_release);
+  }
+  return &qc->verbs[verb];
+}
+
+static void add(verbTotals *t, verbCounters *c) {
+  t->calls += c->calls.load(std::memory_order_relaxed);
+  t->failed += c->failed.load(std::memory_order_relaxed);
+  t->msgs += c->msgs.load(std::memory_order_relaxed);
+  t->bytes += c->bytes.load(std::memory_order_relaxed);
+  for (int b = 0; b < BUCKETS; b++) {
+    t->sizes[b] += c->sizes[b].load(std::memory_order_relaxed);
+  }
+  t->syncpoint += c->syncpoint.load(std::memory_order_relaxed);
+  t->persistent += c->persistent.load(std::memory_order_relaxed);
+  t->async += c->async.load(std::memory_order_relaxed);
+  t->waits += c->waits.load(std::memory_order_relaxed);
+  t->waitMsecs += c->waitMsecs.load(std::memory_order_relaxed);
+  t->unlimited += c->unlimited.load(std::memory_order_relaxed);
+  t->noMsg += c->noMsg.load(std::memory_order_relaxed);
+  t->truncated += c->truncated.load(std::memory_order_relaxed);
+  t->retries += c->retries.load(std::memory_order_relaxed);
+}
+
+counterOwner::~counterOwner() {
+  if (!tc) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(reportLock);
+  std::lock_guard<std::mutex> rl(registryLock);
+  if (retired.empty()) {
+    retired.resize(MAX_QUEUES * VERB_COUNT);
+    memset(retired.data(), 0, retired.size() * sizeof(verbTotals));
+  }
+  for (int q = 0; q < MAX_QUEUES; q++) {
+    queueCounters *qc = tc->queues[q].load(std::memory_order_relaxed);
+    if (qc) {
+      for (int v = 0; v < VERB_COUNT; v++) {
+        add(&retired[q * VERB_COUNT + v], &qc->verbs[v]);
+      }
+      delete qc;
+    }
+  }
+  threads.erase(std::find(threads.begin(), threads.end(), tc));
+  delete tc;
+  tc = NULL;
+}
+
+static void sizeLabel(char *buf, size_t len, int b) {
+  unsigned long s = 1UL << b;
+  if (s >= 1024 * 1024) {
+    snprintf(buf, len, "%luM", s / (1024 * 1024));
+  } else if (s >= 1024) {
+    snprintf(buf, len, "%luK", s / 1024);
+  } else {
+    snprintf(buf, len, "%lu", s);
+  }
+}
+
+static void writeVerb(FILE *fp, const std::string &q, int verb, const verbTotals *t, const verbTotals *p, double secs) {
+  char label[16];
+
+  fprintf(fp, "%s %s calls=%lu rate=%.1f/s failed=%lu msgs=%lu bytes=%lu", q.c_str(), verbNames[verb], t->calls, secs > 0 ? (t->calls - p->calls) / secs : 0.0,
+          t->failed, t->msgs, t->bytes);
+  fprintf(fp, " sizes=[");
+  bool first = true;
+  for (int b = 0; b < BUCKETS; b++) {
+    if (t->sizes[b] > 0) {
+      sizeLabel(label, sizeof(label), b);
+      fprintf(fp, "%s<=%s:%lu", first ? "" : " ", label, t->sizes[b]);
+      first = false;
+    }
+  }
+  fprintf(fp, "] syncpoint=%lu persistent=%lu", t->syncpoint, t->persistent);
+  if (verb == VERB_GET) {
+    fprintf(fp, " wait=%lu avgwait=%lums unlimited=%lu nomsg=%lu truncated=%lu retries=%lu", t->waits,
+            t->waits > t->unlimited ? t->waitMsecs / (t->waits - t->unlimited) : 0, t->unlimited, t->noMsg, t->truncated, t->retries);
+  } else {
+    fprintf(fp, " async=%lu", t->async);
+  }
+  fprintf(fp, "\n");
+}
+
+// Merge every thread's counters and append them to the file. Rates are for the time since
+// the previous report.
+static void report(unsigned long long last, unsigned long long t) {
+  std::lock_guard<std::mutex> lock(reportLock);
+  std::vector<std::string> names;
+  std::vector<threadCounters *> ts;
+  std::vector<verbTotals> totals;
+  double secs = (t - last) / 1000000.0;
+
+  {
+    std::lock_guard<std::mutex> rl(registryLock);
+    names = queueNames;
+    ts = threads;
+    totals.resize(names.size() * VERB_COUNT);
+    if (retired.empty()) {
+      memset(totals.data(), 0, totals.size() * sizeof(verbTotals));
+    } else {
+      memcpy(totals.data(), retired.data(), totals.size() * sizeof(verbTotals));
+    }
+  }
+  if (previous.size() < totals.size()) {
+    size_t n = previous.size();
+    previous.resize(totals.size());
+    memset(previous.data() + n, 0, (previous.size() - n) * sizeof(verbTotals));
+  }
+
+  for (threadCounters *tc : ts) {
+    for (size_t q = 0; q < names.size(); q++) {
+      queueCounters *qc = tc->queues[q].load(std::memory_order_acquire);
+      if (qc) {
+        for (int v = 0; v < VERB_COUNT; v++) {
+          add(&totals[q * VERB_COUNT + v], &qc->verbs[v]);
+        }
+      }
+    }
+  }
+
+  FILE *fp = fopen(fileName.c_str(), "a");
+  if (!fp) {
+    rpt("Cannot open %s", fileName.c_str());
+    return;
+  }
+  time_t wall = time(NULL);
+  struct tm tm;
+  char stamp[32];
+  localtime_r(&wall, &tm);
+  strftime(stamp, sizeof(stamp), "%Y-%m-%dT%H:%M:%S", &tm);
+  fprintf(fp, "# %s pid=%d interval=%.1fs\n", stamp, (int)getpid(), secs);
+
+  for (size_t q = 0; q < names.size(); q++) {
+    for (int v = 0; v < VERB_COUNT; v++) {
+      const verbTotals *vt = &totals[q * VERB_COUNT + v];
+      if (vt->calls > 0) {
+        writeVerb(fp, names[q], v, vt, &previous[q * VERB_COUNT + v], secs);
+      }
+    }
+  }
+  fclose(fp);
+  memcpy(previous.data(), totals.data(), totals.size() * sizeof(verbTotals));
+}
+
+// Called after each recorded call. One thread at a time gets to write the report.
+static void reportIfDue() {
+  unsigned long long t = now();
+  unsigned long long last = lastReport.load(std::memory_order_relaxed);
+  if (interval > 0 && t - last >= interval && lastReport.compare_exchange_strong(last, t)) {
+    report(last, t);
+  }
+}
+
+static bool wanted(const MQCHAR *name) {
+  return queues.empty() || queues.find(name);
+}
+
+static void recordPut(int q, int verb, PMQMD md, PMQPMO pmo, MQLONG len, MQLONG compCode) {
+  verbCounters *c = countersFor(q, verb);
+  bump(c->calls);
+  if (compCode == MQCC_FAILED) {
+    bump(c->failed);
+  } else {
+    bump(c->msgs);
+    bump(c->bytes, len);
+    bump(c->sizes[bucket(len)]);
+  }
+  if (pmo->Options & MQPMO_SYNCPOINT) {
+    bump(c->syncpoint);
+  }
+  if (md->Persistence == MQPER_PERSISTENT) {
+    bump(c->persistent);
+  }
+  if (pmo->Options & MQPMO_ASYNC_RESPONSE) {
+    bump(c->async);
+  }
+  reportIfDue();
+}
+
+static void recordGet(int q, PMQMD md, PMQGMO gmo, MQLONG len, MQLONG compCode, MQLONG reason) {
+  verbCounters *c = countersFor(q, VERB_GET);
+  bump(c->calls);
+  if (reason == MQRC_TRUNCATED_MSG_FAILED) {
+    // Nothing was delivered. The message stays on the queue for the application's next MQGET.
+    bump(c->retries);
+  } else if (compCode == MQCC_FAILED) {
+    bump(c->failed);
+    if (reason == MQRC_NO_MSG_AVAILABLE) {
+      bump(c->noMsg);
+    }
+  } else {
+    bump(c->msgs);
+    bump(c->bytes, len);
+    bump(c->sizes[bucket(len)]);
+    if (md->Persistence == MQPER_PERSISTENT) {
+      bump(c->persistent);
+    }
+    if (reason == MQRC_TRUNCATED_MSG_ACCEPTED) {
+      bump(c->truncated);
+    }
+  }
+  if (gmo->Options & (MQGMO_SYNCPOINT | MQGMO_SYNCPOINT_IF_PERSISTENT)) {
+    bump(c->syncpoint);
+  }
+  if (gmo->Options & MQGMO_WAIT) {
+    bump(c->waits);
+    if (gmo->WaitInterval == MQWI_UNLIMITED) {
+      bump(c->unlimited);
+    } else if (gmo->WaitInterval > 0) {
+      bump(c->waitMsecs, gmo->WaitInterval);
+    }
+  }
+  reportIfDue();
+}
+
+extern "C" {
+MQLONG MqmuxPlugin(mqmuxPlugin *p);
+}
+
+static MQLONG pfInit(MQMUX_RPT *_rpt, char *buf, size_t len) {
+  char def[64];
+  const char *e;
+
+  rptFn = _rpt;
+  rptPrefix = "profile: ";
+
+  queues.parse(getenv(ENV_QUEUES), 0);
+  interval = (unsigned long long)envLong(ENV_INTERVAL, DEFAULT_INTERVAL, 0, 86400) * 1000000ULL;
+  e = getenv(ENV_FILE);
+  if (e && *e) {
+    fileName = e;
+  } else {
+    snprintf(def, sizeof(def), DEFAULT_FILE, (int)getpid());
+    fileName = def;
+  }
+  lastReport = now();
+
+  for (const queueRule &r : queues.all()) {
+    rpt("Profiling %s%s", r.name.c_str(), r.prefix ? "*" : "");
+  }
+  snprintf(buf, len, "Profiling %s to %s every %lu seconds", queues.empty() ? "all queues" : "selected queues", fileName.c_str(),
+           (unsigned long)(interval / 1000000));
+  return MQRC_NONE;
+}
+
+static void pfTerm() {
+  unsigned long long t = now();
+  report(lastReport.exchange(t), t);
+}
+
+static void MQENTRY pfOpenAfter(PMQAXP pExitParms, PMQAXC pExitContext, PMQHCONN pHconn, PPMQOD ppObjDesc, PMQLONG pOptions, PPMQHOBJ ppHobj,
+                                PMQLONG pCompCode, PMQLONG pReason) {
+  PMQOD od = *ppObjDesc;
+  if (*pCompCode != MQCC_FAILED && od->ObjectType == MQOT_Q && wanted(od->ObjectName)) {
+    pfConn *pc = getConn<pfConn>(pExitParms);
+    pc->handles[**ppHobj] = indexFor(od->ObjectName);
+  }
+}
+
+static void MQENTRY pfCloseBefore(PMQAXP pExitParms, PMQAXC pExitContext, PMQHCONN pHconn, PPMQHOBJ ppHobj, PMQLONG pOptions, PMQLONG pCompCode,
+                                  PMQLONG pReason) {
+  pfConn *pc = findConn<pfConn>(pExitParms);
+  if (pc) {
+    pc->handles.erase(**ppHobj);
+  }
+}
+
+static void MQENTRY pfPutAfter(PMQAXP pExitParms, PMQAXC pExitContext, PMQHCONN pHconn, PMQHOBJ pHobj, PPMQMD ppMsgDesc, PPMQPMO ppPutMsgOpts,
+                               PMQLONG pBufferLength, PPMQVOID ppBuffer, PMQLONG pCompCode, PMQLONG pReason) {
+  pfConn *pc = findConn<pfConn>(pExitParms);
+  if (pc) {
+    auto it = pc->handles.find(*pHobj);
+    if (it != pc->handles.end()) {
+      recordPut(it->second, VERB_PUT, *ppMsgDesc, *ppPutMsgOpts, *pBufferLength, *pCompCode);
+    }
+  }
+}
+
+static void MQENTRY pfPut1After(PMQAXP pExitParms, PMQAXC pExitContext, PMQHCONN pHconn, PPMQOD ppObjDesc, PPMQMD ppMsgDesc, PPMQPMO ppPutMsgOpts,
+                                PMQLONG pBufferLength, PPMQVOID ppBuffer, PMQLONG pCompCode, PMQLONG pReason) {
+  PMQOD od = *ppObjDesc;
+  if (od->ObjectType == MQOT_Q && wanted(od->ObjectName)) {
+    pfConn *pc = getConn<pfConn>(pExitParms);
+    std::string n(od->ObjectName, nameLength(od->ObjectName, MQ_Q_NAME_LENGTH));
+    auto it = pc->put1Queues.find(n);
+    int q = it != pc->put1Queues.end() ? it->second : (pc->put1Queues[n] = indexFor(od->ObjectName));
+    recordPut(q, VERB_PUT1, *ppMsgDesc, *ppPutMsgOpts, *pBufferLength, *pCompCode);
+  }
+}
+
+static void MQENTRY pfGetAfter(PMQAXP pExitParms, PMQAXC pExitContext, PMQHCONN pHconn, PMQHOBJ pHobj, PPMQMD ppMsgDesc, PPMQGMO ppGetMsgOpts,
+                               PMQLONG pBufferLength, PPMQVOID ppBuffer, PPMQLONG ppDataLength, PMQLONG pCompCode, PMQLONG pReason) {
+  pfConn *pc = findConn<pfConn>(pExitParms);
+  if (pc) {
+    auto it = pc->handles.find(*pHobj);
+    if (it != pc->handles.end()) {
+      recordGet(it->second, *ppMsgDesc, *ppGetMsgOpts, *ppDataLength ? **ppDataLength : 0, *pCompCode, *pReason);
+    }
+  }
+}
+
+static void MQENTRY pfCallbackBefore(PMQAXP pExitParms, PMQAXC pExitContext, PMQHCONN pHconn, PPMQMD ppMsgDesc, PPMQGMO ppGetMsgOpts, PPMQVOID ppBuffer,
+                                     PPMQCBC ppMQCBContext) {
+  PMQCBC cbc = *ppMQCBContext;
+  pfConn *pc = findConn<pfConn>(pExitParms);
+  if (pc && cbc->CallType == MQCBCT_MSG_REMOVED) {
+    auto it = pc->handles.find(cbc->Hobj);
+    if (it != pc->handles.end()) {
+      recordGet(it->second, *ppMsgDesc, *ppGetMsgOpts, cbc->DataLength, cbc->CompCode, cbc->Reason);
+    }
+  }
+}
+
+static void MQENTRY pfDiscBefore(PMQAXP pExitParms, PMQAXC pExitContext, PPMQHCONN ppHconn, PMQLONG pCompCode, PMQLONG pReason) {
+  freeConn<pfConn>(pExitParms);
+}
+
+// The connection ended without an MQDISC
+static void MQENTRY pfTerminate(PMQAXP pExitParms, PMQAXC pExitContext, PMQLONG pCompCode, PMQLONG pReason) {
+  freeConn<pfConn>(pExitParms);
+}
+
+MQLONG MqmuxPlugin(mqmuxPlugin *p) {
+  if (p->Version < MQMUX_PLUGIN_VERSION_1) {
+    return MQRC_WRONG_VERSION;
+  }
+
+  p->Name = "profile";
+  p->init = pfInit;
+  p->term = pfTerm;
+
+  p->openAfter = pfOpenAfter;
+  p->closeBefore = pfCloseBefore;
+  p->putAfter = pfPutAfter;
+  p->put1After = pfPut1After;
+  p->getAfter = pfGetAfter;
+  p->callbackBefore = pfCallbackBefore;
+  p->discBefore = pfDiscBefore;
+  if (p->Version >= MQMUX_PLUGIN_VERSION_2) {
+    p->terminate = pfTerminate;
+  }
+
+  return MQRC_NONE;
+}
@@ -0,0 +1,299 @@
+/*
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+  http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+  Copyright (c) IBM Corporation 2024
+*/
+
+// A plugin for the mqmux exit that slows down producers as a queue fills, instead of letting
+// them run until MQRC_Q_FULL. The depth of each queue named in MQTHROTTLE_QUEUES is sampled
+// with MQINQ, at most once every MQTHROTTLE_SAMPLE_MSECS for the whole process. Once the
+// depth is above the queue's high-water mark, each MQPUT and MQPUT1 is delayed. The delay
+// grows in proportion to how far the depth is between the mark and MAXDEPTH.
+//
+// The MQINQ uses a handle that the exit opens itself, as the application's handle probably
+// does not have MQOO_INQUIRE.
+
+#include <unistd.h>
+
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <unordered_map>
+
+#include <cmqc.h>
+#include <cmqec.h>
+#include <cmqxc.h>
+
+#include "../mux/mqmux_plugin.hpp"
+
+using namespace mqmux;
+
+#define ENV_QUEUES "MQTHROTTLE_QUEUES"
+#define ENV_HIGH_PCT "MQTHROTTLE_HIGH_PCT"
+#define ENV_MIN_USECS "MQTHROTTLE_MIN_USECS"
+#define ENV_MAX_USECS "MQTHROTTLE_MAX_USECS"
+#define ENV_SAMPLE_MSECS "MQTHROTTLE_SAMPLE_MSECS"
+
+#define DEFAULT_HIGH_PCT 80
+#define DEFAULT_MIN_USECS 1000
+#define DEFAULT_MAX_USECS 100000
+#define DEFAULT_SAMPLE_MSECS 100
+
+// The latest depth of one queue, shared by all connections in the process
+struct depthSample {
+  std::atomic<long> depth{0};
+  std::atomic<long> maxDepth{0};
+  std::atomic<unsigned long long> taken{0}; // When the sample was taken, or claimed by a connection refreshing it
+  std::atomic<bool> unusable{false};        // The queue's depth can't be inquired
+
+  std::atomic<unsigned long> throttled{0};
+  std::atomic<unsigned long long> delayed{0}; // Microseconds
+};
+
+struct tqQueue {
+  std::string name;
+  long highPct;
+  depthSample *sample;
+  MQHOBJ inqHobj = MQHO_UNUSABLE_HOBJ;
+
+  unsigned long puts = 0;
+  unsigned long throttled = 0;
+  unsigned long long delayed = 0;
+  long highestPct = 0;
+};
+
+struct tqConn {
+  std::map<std::string, tqQueue> queues;
+  std::unordered_map<MQHOBJ, tqQueue *> handles;
+  MQHCONN hConn = MQHC_UNUSABLE_HCONN; // For closing the inquiry handles from Terminate
+};
+
+static queueList queues;
+static long highPct = DEFAULT_HIGH_PCT;
+static long minDelay = DEFAULT_MIN_USECS;
+static long maxDelay = DEFAULT_MAX_USECS;
+static unsigned long long sampleInterval = 0; // Microseconds
+
+static std::mutex sampleLock;
+static std::map<std::string, depthSample> samples;
+
+static tqQueue *queueFor(tqConn *tc, const MQCHAR *name, const queueRule *r) {
+  std::string n(name, nameLength(name, MQ_Q_NAME_LENGTH));
+  auto it = tc->queues.find(n);
+  if (it != tc->queues.end()) {
+    return &it->second;
+  }
+
+  tqQueue &q = tc->queues[n];
+  q.name = n;
+  q.highPct = r->limit > 0 && r->limit < 100 ? r->limit : highPct;
+  std::lock_guard<std::mutex> lock(sampleLock);
+  q.sample = &samples[n];
+  return &q;
+}
+
+// Take a new sample, unless another connection is already doing so
+static void refresh(PMQAXP pExitParms, MQHCONN hConn, tqQueue *q) {
+  depthSample *s = q->sample;
+  unsigned long long t = now();
+  unsigned long long last = s->taken.load();
+  MQLONG CC, RC;
+
+  if (t - last < sampleInterval || !s->taken.compare_exchange_strong(last, t)) {
+    return;
+  }
+
+  if (q->inqHobj == MQHO_UNUSABLE_HOBJ) {
+    MQOD od = {MQOD_DEFAULT};
+    memcpy(od.ObjectName, q->name.data(), q->name.length());
+    memset(od.ObjectName + q->name.length(), ' ', sizeof(od.ObjectName) - q->name.length());
+    od.ObjectType = MQOT_Q;
+    pExitParms->Hconfig->MQOPEN_Call(hConn, &od, MQOO_INQUIRE | MQOO_FAIL_IF_QUIESCING, &q->inqHobj, &CC, &RC);
+    if (CC == MQCC_FAILED) {
+      q->inqHobj = MQHO_UNUSABLE_HOBJ;
+      if (!s->unusable.exchange(true)) {
+        rpt("Cannot open %s to inquire its depth. RC=%d", q->name.c_str(), RC);
+      }
+      return;
+    }
+  }
+
+  MQLONG selectors[2] = {MQIA_CURRENT_Q_DEPTH, MQIA_MAX_Q_DEPTH};
+  MQLONG values[2];
+  pExitParms->Hconfig->MQINQ_Call(hConn, q->inqHobj, 2, selectors, 2, values, 0, NULL, &CC, &RC);
+  if (CC != MQCC_OK) {
+    // An alias or remote queue has no depth
+    if (!s->unusable.exchange(true)) {
+      rpt("Cannot inquire depth of %s. RC=%d", q->name.c_str(), RC);
+    }
+    return;
+  }
+  s->depth = values[0];
+  s->maxDepth = values[1];
+  s->unusable = false;
+}
+
+static void throttle(PMQAXP pExitParms, MQHCONN hConn, tqQueue *q) {
+  depthSample *s = q->sample;
+  long pct;
+  unsigned long long delay;
+
+  q->puts++;
+  refresh(pExitParms, hConn, q);
+  if (s->unusable || s->maxDepth <= 0) {
+    return;
+  }
+
+  pct = (long)((s->depth * 100) / s->maxDepth);
+  if (pct > q->highestPct) {
+    q->highestPct = pct;
+  }
+  if (pct < q->highPct) {
+    return;
+  }
+  if (pct >= 100) {
+    delay = maxDelay;
+  } else {
+    delay = minDelay + (unsigned long long)(maxDelay - minDelay) * (pct - q->highPct) / (100 - q->highPct);
+  }
+
+  usleep((useconds_t)delay);
+  q->throttled++;
+  q->delayed += delay;
+  s->throttled++;
+  s->delayed += delay;
+}
+
+extern "C" {
+MQLONG MqmuxPlugin(mqmuxPlugin *p);
+}
+
+static MQLONG tqInit(MQMUX_RPT *_rpt, char *buf, size_t len) {
+  rptFn = _rpt;
+  rptPrefix = "throttle: ";
+
+  highPct = envLong(ENV_HIGH_PCT, DEFAULT_HIGH_PCT, 1, 99);
+  minDelay = envLong(ENV_MIN_USECS, DEFAULT_MIN_USECS, 0, 10000000);
+  maxDelay = envLong(ENV_MAX_USECS, DEFAULT_MAX_USECS, minDelay, 10000000);
+  sampleInterval = (unsigned long long)envLong(ENV_SAMPLE_MSECS, DEFAULT_SAMPLE_MSECS, 0, 3600000) * 1000ULL;
+  queues.parse(getenv(ENV_QUEUES), highPct);
+
+  for (const queueRule &r : queues.all()) {
+    rpt("Throttling puts to %s%s above %ld%% of MAXDEPTH", r.name.c_str(), r.prefix ? "*" : "", r.limit > 0 && r.limit < 100 ? r.limit : highPct);
+  }
+  if (queues.empty()) {
+    snprintf(buf, len, "No queues configured in %s", ENV_QUEUES);
+    return MQRC_ENVIRONMENT_ERROR;
+  }
+  snprintf(buf, len, "Delays from %ld to %ld microseconds. Depth sampled every %llu ms", minDelay, maxDelay, sampleInterval / 1000);
+  return MQRC_NONE;
+}
+
+static void tqTerm() {
+  for (auto &s : samples) {
+    if (s.second.throttled > 0) {
+      rpt("Process total for %s: %lu puts delayed for %llu ms", s.first.c_str(), s.second.throttled.load(), s.second.delayed.load() / 1000);
+    }
+  }
+}
+
+static void MQENTRY tqOpenAfter(PMQAXP pExitParms, PMQAXC pExitContext, PMQHCONN pHconn, PPMQOD ppObjDesc, PMQLONG pOptions, PPMQHOBJ ppHobj,
+                                PMQLONG pCompCode, PMQLONG pReason) {
+  PMQOD od = *ppObjDesc;
+  const queueRule *r;
+  if (*pCompCode != MQCC_FAILED && od->ObjectType == MQOT_Q && (*pOptions & MQOO_OUTPUT) != 0 && (r = queues.find(od->ObjectName)) != NULL) {
+    tqConn *tc = getConn<tqConn>(pExitParms);
+    tc->hConn = *pHconn;
+    tc->handles[**ppHobj] = queueFor(tc, od->ObjectName, r);
+  }
+}
+
+static void MQENTRY tqCloseBefore(PMQAXP pExitParms, PMQAXC pExitContext, PMQHCONN pHconn, PPMQHOBJ ppHobj, PMQLONG pOptions, PMQLONG pCompCode,
+                                  PMQLONG pReason) {
+  tqConn *tc = findConn<tqConn>(pExitParms);
+  if (tc) {
+    tc->handles.erase(**ppHobj);
+  }
+}
+
+static void MQENTRY tqPutBefore(PMQAXP pExitParms, PMQAXC pExitContext, PMQHCONN pHconn, PMQHOBJ pHobj, PPMQMD ppMsgDesc, PPMQPMO ppPutMsgOpts,
+                                PMQLONG pBufferLength, PPMQVOID ppBuffer, PMQLONG pCompCode, PMQLONG pReason) {
+  tqConn *tc = findConn<tqConn>(pExitParms);
+  if (tc) {
+    auto it = tc->handles.find(*pHobj);
+    if (it != tc->handles.end()) {
+      throttle(pExitParms, *pHconn, it->second);
+    }
+  }
+}
+
+static void MQENTRY tqPut1Before(PMQAXP pExitParms, PMQAXC pExitContext, PMQHCONN pHconn, PPMQOD ppObjDesc, PPMQMD ppMsgDesc, PPMQPMO ppPutMsgOpts,
+                                 PMQLONG pBufferLength, PPMQVOID ppBuffer, PMQLONG pCompCode, PMQLONG pReason) {
+  PMQOD od = *ppObjDesc;
+  const queueRule *r;
+  if (od->ObjectType == MQOT_Q && (r = queues.find(od->ObjectName)) != NULL) {
+    tqConn *tc = getConn<tqConn>(pExitParms);
+    tc->hConn = *pHconn;
+    throttle(pExitParms, *pHconn, queueFor(tc, od->ObjectName, r));
+  }
+}
+
+// Close the inquiry handles, report and release the connection's state
+static void tqEnd(PMQAXP pExitParms, MQHCONN hConn) {
+  tqConn *tc = findConn<tqConn>(pExitParms);
+  MQLONG CC, RC;
+
+  if (tc) {
+    for (auto &e : tc->queues) {
+      tqQueue &q = e.second;
+      if (q.inqHobj != MQHO_UNUSABLE_HOBJ) {
+        pExitParms->Hconfig->MQCLOSE_Call(hConn, &q.inqHobj, MQCO_NONE, &CC, &RC);
+      }
+      rpt("%s: puts: %lu. Delayed: %lu for %llu ms. Highest depth: %ld%%", q.name.c_str(), q.puts, q.throttled, q.delayed / 1000, q.highestPct);
+    }
+    freeConn<tqConn>(pExitParms);
+  }
+}
+
+static void MQENTRY tqDiscBefore(PMQAXP pExitParms, PMQAXC pExitContext, PPMQHCONN ppHconn, PMQLONG pCompCode, PMQLONG pReason) {
+  tqEnd(pExitParms, **ppHconn);
+}
+
+// The connection ended without an MQDISC
+static void MQENTRY tqTerminate(PMQAXP pExitParms, PMQAXC pExitContext, PMQLONG pCompCode, PMQLONG pReason) {
+  tqConn *tc = findConn<tqConn>(pExitParms);
+  if (tc) {
+    tqEnd(pExitParms, tc->hConn);
+  }
+}
+
+MQLONG MqmuxPlugin(mqmuxPlugin *p) {
+  if (p->Version < MQMUX_PLUGIN_VERSION_1) {
+    return MQRC_WRONG_VERSION;
+  }
+
+  p->Name = "throttle";
+  p->init = tqInit;
+  p->term = tqTerm;
+
+  p->openAfter = tqOpenAfter;
+  p->closeBefore = tqCloseBefore;
+  p->putBefore = tqPutBefore;
+  p->put1Before = tqPut1Before;
+  p->discBefore = tqDiscBefore;
+  if (p->Version >= MQMUX_PLUGIN_VERSION_2) {
+    p->terminate = tqTerminate;
+  }
+
+  return MQRC_NONE;
+}
@@ -458,13 +458,78 @@ static char *trim(char *s)
 /****************************************************************************/
 /* Report the activity if the log file is open                              */
 /* Make sure the output does end with '\n'                                  */
+/* The prefix is built the same way as in oamlog.c, which explains it.      */
 /****************************************************************************/
-#define TIMEBUF 26 /* The buffer length required for ctime_r */
-static char *v_ctime(char *tb)
+#define TIMEBUF 64
+#ifdef CLOCK_REALTIME_COARSE
+#define OA_CLOCK CLOCK_REALTIME_COARSE
+#else
+#define OA_CLOCK CLOCK_REALTIME
+#endif
+
+typedef struct {
+  pid_t  pid;                    /* 0 until set, and after a fork */
+  time_t sec;
+  long   usec;
+  int    headLen;
+  char   head[TIMEBUF];          /* "pid.tid @ Www Mmm dd hh:mm:ss" */
+  char   year[8];                /* " yyyy" */
+} oaStamp;
+
+static __thread oaStamp stamp;
+static pthread_once_t stampOnce = PTHREAD_ONCE_INIT;
+
+static void stampFork(void)
+{
+  stamp.pid = 0;
+}
+
+static void stampInit(void)
 {
-  time_t t = time(NULL);
-  return ctime_r(&t,tb);
+  pthread_atfork(NULL,NULL,stampFork);
 }
+
+static char *v_prefix(char *tb)
+{
+  struct timespec ts;
+  char ct[26];                   /* The buffer length required for ctime_r */
+  char *p;
+  long u;
+  int i;
+
+  clock_gettime(OA_CLOCK,&ts);
+  u = ts.tv_nsec / 1000;
+
+  if (stamp.pid == 0 || ts.tv_sec != stamp.sec)
+  {
+    if (stamp.pid == 0)
+    {
+      pthread_once(&stampOnce,stampInit);
+      stamp.pid = getpid();
+    }
+    stamp.sec = ts.tv_sec;
+    ctime_r(&ts.tv_sec,ct);
+    stamp.headLen = sprintf(stamp.head,"%d.%d @ %19.19s",stamp.pid,gettid(),ct);
+    sprintf(stamp.year,"%5.5s",ct+19);
+  }
+  else if (u <= stamp.usec)
+  {
+    u = (stamp.usec < 999999) ? stamp.usec + 1 : 999999;
+  }
+  stamp.usec = u;
+
+  memcpy(tb,stamp.head,stamp.headLen);
+  p = tb + stamp.headLen;
+  *p++ = '.';
+  for (i=5;i>=0;i--)
+  {
+    p[i] = '0' + (u % 10);
+    u /= 10;
+  }
+  strcpy(p+6,stamp.year);
+  return tb;
+}
+
 static void rpt(char *func, char *fmt,...)
 {
   char tb[TIMEBUF];
@@ -473,7 +538,7 @@ static void rpt(char *func, char *fmt,...)
   va_start(va,fmt);
   int l;
   if (fp) {
-    fprintf(fp, "%d.%d @ %24.24s %s: ",getpid(),gettid(),v_ctime(tb),func);
+    fprintf(fp, "%s %s: ",v_prefix(tb),func);
 
     vfprintf(fp,fmt,va);
     l = strlen(fmt);
@@ -37,6 +37,8 @@
 
 #include <stdio.h>
 #include <stdarg.h>
+#include <stdlib.h>
+#include <stddef.h>
 #include <string.h>
 #include <time.h>
 
@@ -57,6 +59,10 @@ extern int getpid(void);
 
 #if MQAT_DEFAULT == MQAT_UNIX
 #include <pthread.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/uio.h>
+#include <sys/stat.h>
 #else
 #include <windows.h>
 #endif
@@ -106,9 +112,20 @@ static MQZ_AUTHENTICATE_USER        OAAuthUser;
 static MQZ_FREE_USER                OAFreeUser;
 static MQZ_INQUIRE                  OAInquire;
 static MQZ_REFRESH_CACHE            OARefreshCache;
+static MQZ_TERM_AUTHORITY           OATermRecord;
+static MQZ_CHECK_AUTHORITY_2        OACheckAuthRecord;
+static MQZ_SET_AUTHORITY_2          OASetAuthRecord;
+static MQZ_DELETE_AUTHORITY         OADeleteAuthRecord;
+static MQZ_REFRESH_CACHE            OARefreshCacheRecord;
+static MQZ_GET_AUTHORITY_2          OAGetAuthTime;
+static MQZ_AUTHENTICATE_USER        OAAuthUserTime;
 
 static char *trim(char *s);
 static void rpt(char *fmt,...);
+static void rptRecord(char *s,int l);
+static void auditStart(void);
+static void auditStop(void);
+static void auditFlush(void);
 
 /****************************************************************************/
 /* This is where we'll write the logged information. Make sure the          */
@@ -125,6 +142,7 @@ static void rpt(char *fmt,...);
 /* A group  of process-wide global variables.                               */
 /****************************************************************************/
 FILE *fp = NULL;
+static volatile long auditDropped = 0;
 
 int primary_process = 0;
 static MQLONG SupportedVersion = 0;
@@ -134,32 +152,105 @@ static MQLONG SupportedVersion = 0;
 /****************************************************************************/
 
 /*
- * Note the incredibly inefficient way we do a getpid/gettid on
- * every function call ... This ought to be done with a per-thread
- * setup into a thread-specific area but then the code gets tied to a platform
- * that way (eg pthreads, thread-local-storage, etc).
+ * The pid and tid are found once per thread, and found again in the
+ * child after a fork. The time comes from the coarse realtime clock,
+ * which does not need a system call, and ctime_r is only called once a
+ * second on each thread. The cached text is then copied into the
+ * caller's buffer with the microseconds put in after the seconds, like
+ *   16890.16890 @ Tue Aug 25 12:57:49.123456 2020
+ * The coarse clock only moves every few milliseconds, so the
+ * microseconds are also pushed on by one for each record from the
+ * thread. That keeps the records from one thread in order.
  *
  * ctime returns a 26 character buffer, of which the final two
- * bytes are '\n\0' so we explicitly print 24 characters from it.
+ * bytes are '\n\0'. The year is the last 5 characters we use.
  */
-#define TIMEBUF 26
-#define PRS "%d.%d @ %24.24s"
+#define TIMEBUF 64
+#define PRS "%s"
+#define RPTBUF 4096              /* Longest single record */
 
 #if MQAT_DEFAULT == MQAT_UNIX
-static char *v_ctime(char *tb)
+#ifdef CLOCK_REALTIME_COARSE
+#define OA_CLOCK CLOCK_REALTIME_COARSE
+#else
+#define OA_CLOCK CLOCK_REALTIME
+#endif
+
+extern pid_t gettid();
+
+typedef struct {
+  pid_t  pid;                    /* 0 until set, and after a fork */
+  time_t sec;
+  long   usec;
+  int    headLen;
+  char   head[TIMEBUF];          /* "pid.tid @ Www Mmm dd hh:mm:ss" */
+  char   year[8];                /* " yyyy" */
+} oaStamp;
+
+static __thread oaStamp stamp;
+static pthread_once_t stampOnce = PTHREAD_ONCE_INIT;
+
+static void stampFork(void)
 {
-  time_t t = time(NULL);
-  return ctime_r(&t,tb);
+  stamp.pid = 0;
 }
-extern pid_t gettid();
-#define prefix(tb) getpid(),gettid(),v_ctime(tb)
+
+static void stampInit(void)
+{
+  pthread_atfork(NULL,NULL,stampFork);
+}
+
+static char *v_prefix(char *tb)
+{
+  struct timespec ts;
+  char ct[26];
+  char *p;
+  long u;
+  int i;
+
+  clock_gettime(OA_CLOCK,&ts);
+  u = ts.tv_nsec / 1000;
+
+  if (stamp.pid == 0 || ts.tv_sec != stamp.sec)
+  {
+    if (stamp.pid == 0)
+    {
+      pthread_once(&stampOnce,stampInit);
+      stamp.pid = getpid();
+    }
+    stamp.sec = ts.tv_sec;
+    ctime_r(&ts.tv_sec,ct);
+    stamp.headLen = sprintf(stamp.head,"%d.%d @ %19.19s",stamp.pid,gettid(),ct);
+    sprintf(stamp.year,"%5.5s",ct+19);
+  }
+  else if (u <= stamp.usec)
+  {
+    u = (stamp.usec < 999999) ? stamp.usec + 1 : 999999;
+  }
+  stamp.usec = u;
+
+  memcpy(tb,stamp.head,stamp.headLen);
+  p = tb + stamp.headLen;
+  *p++ = '.';
+  for (i=5;i>=0;i--)
+  {
+    p[i] = '0' + (u % 10);
+    u /= 10;
+  }
+  strcpy(p+6,stamp.year);
+  return tb;
+}
+#define prefix(tb) v_prefix(tb)
 #else
-static char *v_ctime(char *tb)
+static char *v_prefix(char *tb)
 {
-	time_t t = time(NULL);
-	return ctime(&t); /* ought to use a thread-safe version */
+  time_t t = time(NULL);
+  char *ct = ctime(&t); /* ought to use a thread-safe version */
+  sprintf(tb,"%d.%d @ %19.19s.000000%5.5s",
+          GetCurrentProcessId(),GetCurrentThreadId(),ct,ct+19);
+  return tb;
 }
-#define prefix(tb) GetCurrentProcessId(),GetCurrentThreadId(),v_ctime(tb)
+#define prefix(tb) v_prefix(tb)
 #endif
 
 /*
@@ -199,58 +290,121 @@ static char *v_ctime(char *tb)
 #endif
 
 /*
- * Print the Object Type
+ * Length of a blank-padded name that may also be null-terminated
  */
-static char *OAOTStr(MQLONG x)
+static int nameLen(PMQCHAR p,int max)
 {
-  /*
-   * There are other defined MQOT_* values, but they should never get
-   * sent to the OAM.
-   */
-  switch (x)
+  int l = 0;
+  while (l < max && p[l] != 0)
+    l++;
+  while (l > 0 && p[l-1] == ' ')
+    l--;
+  return l;
+}
+
+/*
+ * Channel names are shorter than other object names
+ */
+static int objNameLen(PMQCHAR p,MQLONG t)
+{
+  switch (t)
   {
-  case 0:              return "Any"; /* Used by dmpmqaut filter */
-  case MQOT_Q:         return "Queue";
-  case MQOT_NAMELIST:  return "NameList";
-  case MQOT_PROCESS:   return "Process";
-  case MQOT_Q_MGR:     return "QMgr";
-  case MQOT_AUTH_INFO: return "AuthInfo";
+  case MQOT_CHANNEL:
+  case MQOT_SENDER_CHANNEL:
+  case MQOT_SERVER_CHANNEL:
+  case MQOT_REQUESTER_CHANNEL:
+  case MQOT_RECEIVER_CHANNEL:
+  case MQOT_SVRCONN_CHANNEL:
+  case MQOT_CLNTCONN_CHANNEL:
+    return nameLen(p,MQ_CHANNEL_NAME_LENGTH);
+  default:
+    return nameLen(p,MQ_OBJECT_NAME_LENGTH);
+  }
+}
 
-  /* Queue subtypes */
-  case MQOT_ALIAS_Q:   return "Alias Queue";
-  case MQOT_MODEL_Q:   return "Model Queue";
-  case MQOT_LOCAL_Q:   return "Local Queue";
-  case MQOT_REMOTE_Q:  return "Remote Queue";
+/*
+ * A name and its length, so that formatting can be done with memcpy.
+ * The N() macro computes the length at compile time.
+ */
+typedef struct {
+  char *name;
+  int   len;
+} oaName;
+#define N(s) {s,sizeof(s)-1}
 
-  /* More types from V6 */
-  case MQOT_LISTENER:  return "Listener";
-  case MQOT_SERVICE:   return "Service";
-  case MQOT_CHANNEL:   return "Channel";
+/*
+ * Print the Object Type
+ *
+ * There are other defined MQOT_* values, but they should never get
+ * sent to the OAM. The values come in two groups, below and just above
+ * 1000, so there is a table for each.
+ */
+#define OT_LOW   32
+#define OT_HIGH  1000
+#define OT_HIGHN 32
+
+static const oaName otLow[OT_LOW] = {
+  [0]              = N("Any"), /* Used by dmpmqaut filter */
+  [MQOT_Q]         = N("Queue"),
+  [MQOT_NAMELIST]  = N("NameList"),
+  [MQOT_PROCESS]   = N("Process"),
+  [MQOT_Q_MGR]     = N("QMgr"),
+  [MQOT_AUTH_INFO] = N("AuthInfo"),
 
-  /* Channel subtypes */
-  case MQOT_SENDER_CHANNEL:     return "Channel Sender";
-  case MQOT_SERVER_CHANNEL:     return "Channel Server";
-  case MQOT_REQUESTER_CHANNEL:  return "Channel Requester";
-  case MQOT_RECEIVER_CHANNEL:   return "Channel Receiver";
-  case MQOT_SVRCONN_CHANNEL:    return "Channel SvrConn";
-  case MQOT_CLNTCONN_CHANNEL:   return "Channel ClientConn";
+  /* More types from V6 */
+  [MQOT_LISTENER]  = N("Listener"),
+  [MQOT_SERVICE]   = N("Service"),
+  [MQOT_CHANNEL]   = N("Channel"),
 
   /* More types from V7 */
 #ifdef MQOT_TOPIC
-  case MQOT_TOPIC: return "Topic";
+  [MQOT_TOPIC]     = N("Topic"),
 #endif
 
   /* Added in V7.1 */
 #ifdef MQOT_COMM_INFO
-  case MQOT_COMM_INFO:       return "Comm Info";
-  case MQOT_CHLAUTH:         return "Channel Auth";
-  case MQOT_REMOTE_Q_MGR_NAME: return "Remote QMgr";
+  [MQOT_COMM_INFO] = N("Comm Info"),
 #endif
+};
 
-  default:             return "Invalid Object Type";
-  }
+static const oaName otHigh[OT_HIGHN] = {
+  /* Queue subtypes */
+  [MQOT_ALIAS_Q  - OT_HIGH]  = N("Alias Queue"),
+  [MQOT_MODEL_Q  - OT_HIGH]  = N("Model Queue"),
+  [MQOT_LOCAL_Q  - OT_HIGH]  = N("Local Queue"),
+  [MQOT_REMOTE_Q - OT_HIGH]  = N("Remote Queue"),
+
+  /* Channel subtypes */
+  [MQOT_SENDER_CHANNEL    - OT_HIGH] = N("Channel Sender"),
+  [MQOT_SERVER_CHANNEL    - OT_HIGH] = N("Channel Server"),
+  [MQOT_REQUESTER_CHANNEL - OT_HIGH] = N("Channel Requester"),
+  [MQOT_RECEIVER_CHANNEL  - OT_HIGH] = N("Channel Receiver"),
+  [MQOT_SVRCONN_CHANNEL   - OT_HIGH] = N("Channel SvrConn"),
+  [MQOT_CLNTCONN_CHANNEL  - OT_HIGH] = N("Channel ClientConn"),
+
+  /* Added in V7.1 */
+#ifdef MQOT_COMM_INFO
+  [MQOT_CHLAUTH           - OT_HIGH] = N("Channel Auth"),
+  [MQOT_REMOTE_Q_MGR_NAME - OT_HIGH] = N("Remote QMgr"),
+#endif
+};
+
+static const oaName otInvalid = N("Invalid Object Type");
+
+static const oaName *OAOTName(MQLONG x)
+{
+  const oaName *n = NULL;
+
+  if (x >= 0 && x < OT_LOW)
+    n = &otLow[x];
+  else if (x >= OT_HIGH && x < OT_HIGH + OT_HIGHN)
+    n = &otHigh[x - OT_HIGH];
+
+  return (n && n->name) ? n : &otInvalid;
 }
 
+#define OAOTStr(x) (OAOTName(x)->name)
+
 /*
  * This is the Environment value that's available for authentication.
  * It is the same as defined for API Exits.
@@ -295,9 +449,6 @@ static char *OABTStr(MQLONG x)
  * of the module. The buffer needs to be big enough to hold a complete
  * set of permissions; there is no error checking.
  *
- * This may not be the most efficient way of doing it, but I'm more
- * interested in readability than performance.
- *
  * It'll return a string looking something like
  *   0x00000024 [get set ]
  *
@@ -306,144 +457,1517 @@ static char *OABTStr(MQLONG x)
  * group of operations, and to save space I'll print that instead of
  * the individual operations if all bits are set.
  *
+ * The names are held in tables with their lengths, and are copied into
+ * place with a moving pointer instead of repeated strcat calls. The
+ * handful of authorities that make up nearly all checks are formatted
+ * once during MQStart, and then just copied.
+ */
+#define AUTHBUF 128
+#define unknownauthfmt "\tUnk Flag: 0x%08X\n"
+
+typedef struct {
+  MQLONG bit;
+  oaName n;
+} oaFlag;
+#define F(b,s) {b,N(s)}
+#define FLAGS(t) ((int)(sizeof(t)/sizeof(t[0])))
+
+static const oaFlag mqiFlags[] = {
+  F(MQZAO_CONNECT,                  "connect "),
+  F(MQZAO_BROWSE,                   "browse "),
+  F(MQZAO_INPUT,                    "get "),
+  F(MQZAO_OUTPUT,                   "put "),
+  F(MQZAO_INQUIRE,                  "inq "),
+  F(MQZAO_SET,                      "set "),
+#ifdef MQZAO_PUBLISH
+  F(MQZAO_PUBLISH,                  "pub "),
+  F(MQZAO_SUBSCRIBE,                "sub "),
+  F(MQZAO_RESUME,                   "resume "),
+#endif
+  F(MQZAO_PASS_IDENTITY_CONTEXT,    "passid "),
+  F(MQZAO_PASS_ALL_CONTEXT,         "passall "),
+  F(MQZAO_SET_IDENTITY_CONTEXT,     "setid "),
+  F(MQZAO_SET_ALL_CONTEXT,          "setall "),
+  F(MQZAO_ALTERNATE_USER_AUTHORITY, "altusr "),
+};
+
+static const oaFlag admFlags[] = {
+  F(MQZAO_DELETE,                   "dlt "),
+  F(MQZAO_DISPLAY,                  "dsp "),
+  F(MQZAO_CHANGE,                   "chg "),
+  F(MQZAO_CLEAR,                    "clr "),
+
+  /* Added for WMQ V6 */
+  F(MQZAO_CONTROL,                  "ctrl "),
+  F(MQZAO_CONTROL_EXTENDED,         "ctrlx "),
+  F(MQZAO_AUTHORIZE,                "auth "),
+};
+
+/*
+ * Options used by dmpmqaut. They tell the OAM how to
+ * interpret the entity and object/profile names passed as part
+ * of the filter.
+ */
+static const oaFlag optFlags[] = {
+  F(MQAUTHOPT_CUMULATIVE,           "cum "),
+  F(MQAUTHOPT_ENTITY_EXPLICIT,      "ent_explicit "),
+  F(MQAUTHOPT_ENTITY_SET,           "ent_set "),
+  F(MQAUTHOPT_NAME_ALL_MATCHING,    "name_all "),
+  F(MQAUTHOPT_NAME_AS_WILDCARD,     "name_wildcard "),
+  F(MQAUTHOPT_NAME_EXPLICIT,        "name_explicit "),
+  F(MQAUTHOPT_EXCLUDE_TEMP,         "excl_temp "),
+};
+
+static const oaName allMqi  = N("allmqi ");
+static const oaName allAdm  = N("alladm ");
+static const oaName crt     = N("crt ");
+#ifdef MQZAO_SYSTEM
+static const oaName sys     = N("system ");
+#endif
+static const oaName rem     = N("rem ");
+static const oaName none    = N("none ");
+static const oaName unknown = N("unknown ");
+
+static char *putName(char *p,const oaName *n)
+{
+  memcpy(p,n->name,n->len);
+  return p + n->len;
+}
+
+static char *putFlags(char *p,MQLONG x,const oaFlag *f,int count)
+{
+  int i;
+  for (i=0;i<count;i++)
+  {
+    if (x & f[i].bit)
+      p = putName(p,&f[i].n);
+  }
+  return p;
+}
+
+/*
+ * Writes "0x%08X" without going through printf
+ */
+static char *putHex(char *p,MQLONG x)
+{
+  static const char hex[] = "0123456789ABCDEF";
+  int i;
+
+  *p++ = '0';
+  *p++ = 'x';
+  for (i=28;i>=0;i-=4)
+    *p++ = hex[((unsigned long)x >> i) & 0xF];
+  return p;
+}
+
+/*
+ * See if there are any unrecognised flags set.
+ * Can't easily format the unknown flags because we are
+ * already in the middle of an fprintf, and that seems
+ * to be (on some platforms at least) non-nestable.
+ *
+ * Instead, we return the unknown flags and let the
+ * caller decide whether to format them.
+ *
+ * The formatted length is returned.
+ */
+static int OAAuthFmt(MQLONG x,char *buf,int *unknownFlags)
+{
+  int  notAllFlags  = ~(MQZAO_CREATE | MQZAO_REMOVE | MQZAO_ALL);
+  char *p = putHex(buf,x);
+
+  *p++ = ' ';
+  *p++ = '[';
+  if ((x & MQZAO_ALL_MQI)== MQZAO_ALL_MQI)
+    p = putName(p,&allMqi);
+  else
+    p = putFlags(p,x,mqiFlags,FLAGS(mqiFlags));
+
+  if (x & MQZAO_CREATE)
+    p = putName(p,&crt);
+
+  if ((x & MQZAO_ALL_ADMIN) == MQZAO_ALL_ADMIN)
+    p = putName(p,&allAdm);
+  else
+    p = putFlags(p,x,admFlags,FLAGS(admFlags));
+
+  /* Added for WMQ V7.0.1 - not part of "alladm" collection */
+#ifdef MQZAO_SYSTEM
+  if (x & MQZAO_SYSTEM)
+    p = putName(p,&sys);
+#endif
+
+  if (x & MQZAO_REMOVE)
+    p = putName(p,&rem);
+
+  if (x == MQZAO_NONE)
+    p = putName(p,&none);
+
+  *unknownFlags = notAllFlags & x;
+  if (*unknownFlags != 0)
+    p = putName(p,&unknown);
+
+  *p++ = ']';
+  *p = 0;
+  return (int)(p - buf);
+}
+
+/*
+ * The authorities seen in almost every log. They are formatted by
+ * OAAuthInit during MQStart, before any other thread can read them.
+ */
+static const MQLONG commonAuths[] = {
+  MQZAO_CONNECT,
+#ifdef MQZAO_SYSTEM
+  MQZAO_CONNECT | MQZAO_SYSTEM,
+#endif
+  MQZAO_BROWSE,
+  MQZAO_INPUT,
+  MQZAO_OUTPUT,
+  MQZAO_INQUIRE,
+  MQZAO_SET,
+  MQZAO_DISPLAY,
+  MQZAO_CREATE,
+  MQZAO_CHANGE,
+  MQZAO_INPUT | MQZAO_BROWSE,
+  MQZAO_OUTPUT | MQZAO_INQUIRE,
+  MQZAO_PASS_ALL_CONTEXT,
+  MQZAO_SET_ALL_CONTEXT,
+  MQZAO_ALTERNATE_USER_AUTHORITY,
+#ifdef MQZAO_PUBLISH
+  MQZAO_PUBLISH,
+  MQZAO_SUBSCRIBE,
+#endif
+  MQZAO_NONE,
+};
+
+typedef struct {
+  MQLONG mask;
+  int    len;
+  int    unknownFlags;
+  char   str[AUTHBUF];
+} oaAuthCache;
+
+static oaAuthCache authCache[FLAGS(commonAuths)];
+static int authCached = 0;
+
+static void OAAuthInit(void)
+{
+  int i;
+  if (!authCached)
+  {
+    for (i=0;i<FLAGS(commonAuths);i++)
+    {
+      authCache[i].mask = commonAuths[i];
+      authCache[i].len  = OAAuthFmt(commonAuths[i],authCache[i].str,&authCache[i].unknownFlags);
+    }
+    authCached = 1;
+  }
+}
+
+/*
+ * Copy the formatted authority into buf, returning its length
+ */
+static int OAAuthCopy(MQLONG x,char *buf,int *unknownFlags)
+{
+  int i;
+  if (authCached)
+  {
+    for (i=0;i<FLAGS(commonAuths);i++)
+    {
+      if (authCache[i].mask == x)
+      {
+        memcpy(buf,authCache[i].str,authCache[i].len+1);
+        *unknownFlags = authCache[i].unknownFlags;
+        return authCache[i].len;
+      }
+    }
+  }
+  return OAAuthFmt(x,buf,unknownFlags);
+}
+
+static char *OAAuthStr(MQLONG x,char *buf, int *unknownFlags)
+{
+  OAAuthCopy(x,buf,unknownFlags);
+  return buf;
+}
+
+static char *OAEnumOptStr(MQLONG x,char *buf)
+{
+  char *p = putHex(buf,x);
+
+  *p++ = ' ';
+  *p++ = '[';
+  if (x == 0)
+    p = putName(p,&none);
+  else
+    p = putFlags(p,x,optFlags,FLAGS(optFlags));
+
+  *p++ = ']';
+  *p = 0;
+  return buf;
+}
+
+/*
+ * Format a pointer. Don't like the default
+ * printing style for "%p"...
+ */
+static char *OAPtrStr(MQPTR p, char *buf)
+{
+  if (p)
+    sprintf(buf,"0x%016lX",(unsigned long)p);
+  else
+    sprintf(buf,"%s","NULL");
+  return buf;
+}
+
+/*
+ * Attributes that might be inquired upon to see what
+ * capabilities the components can support
+ */
+static char *OAAttrStr(MQLONG x)
+{
+  switch (x)
+  {
+  case MQIACF_USER_ID_SUPPORT:   return "UserId Support";
+  case MQIACF_INTERFACE_VERSION: return "Interface Version";
+  default:                       return "Unknown attribute";
+  }
+}
+
+/****************************************************************************/
+/* Authorisation cache                                                      */
+/*                                                                          */
+/* When connections and opens arrive in a storm, the OAM can spend a lot    */
+/* of time repeating the same checks. This module can keep the positive     */
+/* answers and return them itself, stopping the chain before amqzfu.        */
+/*                                                                          */
+/* We never see the OAM's answer from in front of it. So the same module    */
+/* is also configured AFTER amqzfu, in the way that the oamok sample works. */
+/* That second instance is only called when the OAM has granted the         */
+/* request, and it records the answer. The ComponentDataSize in each qm.ini */
+/* stanza tells MQStart which job the instance has:                         */
+/*   0                    - log only, as the module has always done         */
+/*   OA_CACHE_COMPSIZE+   - log and answer from the cache (before amqzfu)   */
+/*   1 to the size above  - record granted requests (after amqzfu)          */
+/*   OA_TIME_COMPSIZE+    - also time the OAM (after amqzfu, see below)     */
+/* Both stanzas must name the same Module so that they share one copy of    */
+/* the cache in each process.                                               */
+/*                                                                          */
+/* Changes to authorities are made in whichever process runs the command,  */
+/* so the invalidation counts live in the ComponentData block which is     */
+/* shared by all processes for the queue manager. OASetAuth and            */
+/* OARefreshCache bump the global count. OADeleteAuth only bumps the count */
+/* for the deleted object's name, which shares one of a table of slots     */
+/* with other names; the rest of the block after the global count is used */
+/* for that table. OACopyAllAuth sets up a new object, so it can't change  */
+/* an answer already in the cache, and does nothing.                       */
+/*                                                                          */
+/* The counts are bumped both before and after amqzfu. A check that misses */
+/* while a change is being made may be answered by the OAM from the old    */
+/* authorities, and would otherwise be recorded under the new count. The   */
+/* second bump makes sure that it is ignored. The recording instance also  */
+/* refuses an answer if either count has moved since the check started.    */
+/* Entries with an older count are ignored, and entries also expire after  */
+/* AMQ_OAMLOG_CACHE_TTL seconds, to pick up changes in group membership.    */
+/*                                                                          */
+/* The cache needs pthreads and thread-local storage, so it is only built   */
+/* for Unix platforms.                                                      */
+/****************************************************************************/
+#if MQAT_DEFAULT == MQAT_UNIX
+#define OA_CACHE
+#endif
+
+#define OA_CACHE_COMPSIZE 64     /* Smallest ComponentDataSize for the cache */
+#define OA_CACHE_ENV      "AMQ_OAMLOG_CACHE_TTL"
+#define OA_CACHE_TTL      60     /* Seconds */
+#define OA_SHARED_ID      "OALC"
+
+/*
+ * The start of the shared ComponentData block
+ */
+typedef struct {
+  MQCHAR4         StrucId;
+  volatile MQLONG Generation;
+  volatile MQLONG ObjectGeneration[1]; /* As many as fit in the block */
+} OASHARED;
+
+static OASHARED *shared = NULL;
+static int objectSlots = 0;
+static int cacheTTL = OA_CACHE_TTL;
+
+#ifdef OA_CACHE
+#define CACHE_BUCKETS 4096       /* Must be a power of 2 */
+#define CACHE_LOCKS   64         /* Each lock covers BUCKETS/LOCKS chains */
+#define CACHE_MAX     50000      /* Entries per process */
+#define CACHE_ENTITY  1024       /* Longer names are not cached */
+
+typedef struct oaCacheKey {
+  unsigned int hash;
+  MQLONG       generation;
+  MQLONG       objectGeneration;
+  int          objectSlot;
+  MQLONG       entityType;
+  MQLONG       objectType;
+  MQLONG       authority;
+  int          entityLen;
+  char         objectName[MQ_OBJECT_NAME_LENGTH+1];
+  char         entityName[CACHE_ENTITY+1];
+} oaCacheKey;
+
+typedef struct oaCacheEntry {
+  struct oaCacheEntry *next;
+  unsigned int hash;
+  MQLONG       generation;
+  MQLONG       objectGeneration;
+  int          objectSlot;
+  time_t       expires;
+  MQLONG       entityType;
+  MQLONG       objectType;
+  MQLONG       authority;
+  int          entityLen;
+  char         objectName[MQ_OBJECT_NAME_LENGTH+1];
+  char         entityName[1];    /* Allocated to the real length */
+} oaCacheEntry;
+
+static oaCacheEntry    *cacheBuckets[CACHE_BUCKETS];
+static pthread_rwlock_t cacheLocks[CACHE_LOCKS];
+static pthread_once_t   cacheOnce = PTHREAD_ONCE_INIT;
+
+static volatile long cacheCount  = 0;
+static volatile long cacheHits   = 0;
+static volatile long cacheMisses = 0;
+static volatile long cacheAdds   = 0;
+
+/*
+ * The key of a check that missed, so the instance after amqzfu
+ * knows what to record. All the calls for one check are made on
+ * the same thread.
+ */
+static __thread int        cachePending = 0;
+static __thread oaCacheKey pendingKey;
+
+static void cacheInit(void)
+{
+  int i;
+  for (i=0;i<CACHE_LOCKS;i++)
+    pthread_rwlock_init(&cacheLocks[i],NULL);
+}
+
+#define cacheLock(h) (&cacheLocks[((h) & (CACHE_BUCKETS-1)) % CACHE_LOCKS])
+
+static unsigned int fnv(unsigned int h,void *p,int l)
+{
+  unsigned char *c = p;
+  while (l-- > 0)
+  {
+    h ^= *c++;
+    h *= 16777619U;
+  }
+  return h;
+}
+
+/*
+ * The slot in the shared block that holds an object's invalidation count
+ */
+static int objectSlot(PMQCHAR pObjectName,MQLONG ObjectType)
+{
+  return (int)(fnv(2166136261U,pObjectName,objNameLen(pObjectName,ObjectType)) % objectSlots);
+}
+
+/*
+ * Build the key for a check, with the current invalidation counts.
+ * Returns 0 if it can't be cached.
+ */
+static int cacheKey(oaCacheKey *k,PMQZED pEntityData,MQLONG EntityType,
+                    PMQCHAR pObjectName,MQLONG ObjectType,MQLONG Authority)
+{
+  int objLen;
+  unsigned int h = 2166136261U;
+
+  if (!pEntityData || !pEntityData->EntityNamePtr)
+    return 0;
+  k->entityLen = nameLen(pEntityData->EntityNamePtr,CACHE_ENTITY+1);
+  if (k->entityLen > CACHE_ENTITY)
+    return 0;
+
+  objLen = objNameLen(pObjectName,ObjectType);
+
+  memcpy(k->entityName,pEntityData->EntityNamePtr,k->entityLen);
+  k->entityName[k->entityLen] = 0;
+  memcpy(k->objectName,pObjectName,objLen);
+  k->objectName[objLen] = 0;
+  k->entityType = EntityType;
+  k->objectType = ObjectType;
+  k->authority  = Authority;
+  k->objectSlot = objectSlot(pObjectName,ObjectType);
+  k->generation = shared->Generation;
+  k->objectGeneration = shared->ObjectGeneration[k->objectSlot];
+
+  h = fnv(h,k->entityName,k->entityLen);
+  h = fnv(h,k->objectName,objLen);
+  h = fnv(h,&EntityType,sizeof(EntityType));
+  h = fnv(h,&ObjectType,sizeof(ObjectType));
+  h = fnv(h,&Authority,sizeof(Authority));
+  k->hash = h;
+  return 1;
+}
+
+#define sameKey(e,k) \
+  ((e)->hash == (k)->hash && (e)->authority == (k)->authority && \
+   (e)->objectType == (k)->objectType && (e)->entityType == (k)->entityType && \
+   (e)->entityLen == (k)->entityLen && \
+   !strcmp((e)->objectName,(k)->objectName) && \
+   !memcmp((e)->entityName,(k)->entityName,(k)->entityLen))
+
+static int cacheLookup(oaCacheKey *k)
+{
+  oaCacheEntry *e;
+  time_t now = time(NULL);
+  int found = 0;
+  pthread_rwlock_t *l = cacheLock(k->hash);
+
+  pthread_rwlock_rdlock(l);
+  for (e = cacheBuckets[k->hash & (CACHE_BUCKETS-1)];e;e = e->next)
+  {
+    if (sameKey(e,k))
+    {
+      found = (e->generation == k->generation &&
+               e->objectGeneration == k->objectGeneration &&
+               e->expires > now);
+      break;
+    }
+  }
+  pthread_rwlock_unlock(l);
+  return found;
+}
+
+/*
+ * Add or refresh an entry. Stale entries in the same chain are
+ * freed on the way past, which stops the table filling with entries
+ * that an invalidation has made useless.
+ */
+static void cacheAdd(oaCacheKey *k)
+{
+  oaCacheEntry **pe;
+  oaCacheEntry *e;
+  oaCacheEntry *match = NULL;
+  time_t now = time(NULL);
+  MQLONG current = shared->Generation;
+  pthread_rwlock_t *l = cacheLock(k->hash);
+
+  pthread_rwlock_wrlock(l);
+  pe = &cacheBuckets[k->hash & (CACHE_BUCKETS-1)];
+  while ((e = *pe) != NULL)
+  {
+    if (sameKey(e,k))
+    {
+      match = e;
+    }
+    else if (e->generation != current || e->expires <= now ||
+             e->objectGeneration != shared->ObjectGeneration[e->objectSlot])
+    {
+      *pe = e->next;
+      free(e);
+      __sync_fetch_and_sub(&cacheCount,1);
+      continue;
+    }
+    pe = &e->next;
+  }
+
+  if (!match && cacheCount < CACHE_MAX)
+  {
+    match = malloc(sizeof(oaCacheEntry) + k->entityLen);
+    if (match)
+    {
+      match->hash       = k->hash;
+      match->entityType = k->entityType;
+      match->objectType = k->objectType;
+      match->authority  = k->authority;
+      match->objectSlot = k->objectSlot;
+      match->entityLen  = k->entityLen;
+      strcpy(match->objectName,k->objectName);
+      memcpy(match->entityName,k->entityName,k->entityLen);
+      match->entityName[k->entityLen] = 0;
+      match->next = cacheBuckets[k->hash & (CACHE_BUCKETS-1)];
+      cacheBuckets[k->hash & (CACHE_BUCKETS-1)] = match;
+      __sync_fetch_and_add(&cacheCount,1);
+    }
+  }
+  if (match)
+  {
+    match->generation = k->generation;
+    match->objectGeneration = k->objectGeneration;
+    match->expires    = now + cacheTTL;
+    __sync_fetch_and_add(&cacheAdds,1);
+  }
+  pthread_rwlock_unlock(l);
+}
+#endif
+
+/*
+ * A change to authorities makes every cached answer suspect. Deleting
+ * an object only affects the answers for its name.
+ */
+static void cacheInvalidate(void)
+{
+#ifdef OA_CACHE
+  if (shared)
+    __sync_fetch_and_add(&shared->Generation,1);
+#endif
+}
+
+static void cacheInvalidateObject(PMQCHAR pObjectName,MQLONG ObjectType)
+{
+#ifdef OA_CACHE
+  if (shared)
+    __sync_fetch_and_add(&shared->ObjectGeneration[objectSlot(pObjectName,ObjectType)],1);
+#endif
+}
+
+
+/****************************************************************************/
+/* Audit filter                                                             */
+/*                                                                          */
+/* OACheckAuth is called very often, but usually only a few objects or      */
+/* users are of interest. Rules in FILTERFILE say which calls are logged.   */
+/* They are read by MQStart and again by OARefreshCache, so that a          */
+/* REFRESH SECURITY command picks up any changes. Each line is a rule:      */
+/*   include func=OACheckAuth entity=app* object=APP.*.IN type=queue        */
+/*   exclude object=SYSTEM.* auth=inq,dsp                                   */
+/* Any of the conditions can be left out. The first rule that matches       */
+/* decides whether the call is logged. If no rule matches, the call is      */
+/* logged only when there are no include rules. '*' and '?' can be used     */
+/* in entity and object names. A rule with an auth condition matches if     */
+/* any of its authorities are asked for. OAInit, OATerm and OARefreshCache  */
+/* are always logged, as they report on the log and the filter itself.      */
+/*                                                                          */
+/* The rules are compiled into 64-bit masks with one bit per rule: one      */
+/* mask for each function, for each authority bit and for each object       */
+/* type. Entity and object names are matched by walking a prefix trie       */
+/* built from the text before the first wildcard. ANDing the masks leaves   */
+/* the rules that match, and the lowest bit is the first of them. All       */
+/* this is done before the timestamp or any formatting.                     */
+/****************************************************************************/
+#if MQAT_DEFAULT == MQAT_UNIX
+#define OA_FILTER
+#define FILTERFILE "/var/mqm/audit/oamlog.ini"
+#else
+#define FILTERFILE "c:\\mqm\\audit\\oamlog.ini"
+#endif
+
+enum { FN_INIT, FN_TERM, FN_CHECKAUTH, FN_COPYALL, FN_DELETE, FN_SET,
+       FN_GET, FN_GETEXPLICIT, FN_REFRESH, FN_ENUM, FN_AUTHUSER,
+       FN_FREEUSER, FN_INQUIRE, FN_CHECKPRIV, FN_COUNT };
+
+#define FILTER_ENTITY 1024       /* Longest entity name to look for the end of */
+
+static const oaName fnNames[FN_COUNT] = {
+  N("OAInit"), N("OATerm"), N("OACheckAuth"), N("OACopyAllAuth"),
+  N("OADeleteAuth"), N("OASetAuth"), N("OAGetAuth"), N("OAGetExplicitAuth"),
+  N("OARefreshCache"), N("OAEnumAuth"), N("OAAuthUser"), N("OAFreeUser"),
+  N("OAInquire"), N("OACheckPriv")
+};
+
+#ifdef OA_FILTER
+#define FILTER_RULES 64          /* One bit each in an unsigned long long */
+#define FILTER_TYPES 16          /* Different object types named in rules */
+#define FILTER_LINE  512
+
+typedef unsigned long long oaMask;
+#define BIT(i) (((oaMask)1) << (i))
+
+typedef struct oaTrie {
+  struct oaTrie *child;
+  struct oaTrie *sibling;
+  char           c;
+  oaMask         exact;          /* Patterns that end here              */
+  oaMask         star;           /* Patterns that end here with '*'     */
+  oaMask         glob;           /* Patterns with more wildcards to try */
+} oaTrie;
+
+typedef struct oaFilter {
+  struct oaFilter *retired;      /* Older sets, kept until OATerm */
+  int     count;
+  int     includes;
+  oaMask  include;               /* Rules that include rather than exclude */
+  oaMask  fn[FN_COUNT];
+  oaMask  authAny;
+  oaMask  auth[32];
+  oaMask  typeAny;
+  int     typeCount;
+  MQLONG  types[FILTER_TYPES];
+  oaMask  typeMask[FILTER_TYPES];
+  oaMask  entAny;
+  oaTrie  entTrie;
+  char   *entRest[FILTER_RULES];
+  oaMask  objAny;
+  oaTrie  objTrie;
+  char   *objRest[FILTER_RULES];
+} oaFilter;
+
+static oaFilter *filter  = NULL;
+static oaFilter *retired = NULL;       /* Replaced by a reload */
+static pthread_mutex_t filterLock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * '*' matches any string, '?' any one character
+ */
+static int glob(const char *p,const char *s,int l)
+{
+  for (;*p;p++)
+  {
+    if (*p == '*')
+    {
+      for (;;)
+      {
+        if (glob(p+1,s,l))
+          return 1;
+        if (l == 0)
+          return 0;
+        s++;
+        l--;
+      }
+    }
+    if (l == 0 || (*p != '?' && *p != *s))
+      return 0;
+    s++;
+    l--;
+  }
+  return l == 0;
+}
+
+static oaTrie *trieChild(oaTrie *t,char c,int add)
+{
+  oaTrie *n;
+  for (n = t->child;n;n = n->sibling)
+  {
+    if (n->c == c)
+      return n;
+  }
+  if (add && (n = calloc(1,sizeof(oaTrie))) != NULL)
+  {
+    n->c = c;
+    n->sibling = t->child;
+    t->child = n;
+  }
+  return n;
+}
+
+static int trieAdd(oaTrie *t,char **rest,int rule,char *pattern)
+{
+  char *p;
+
+  for (p = pattern;*p && *p != '*' && *p != '?';p++)
+  {
+    t = trieChild(t,*p,1);
+    if (!t)
+      return 0;
+  }
+  if (*p == 0)
+    t->exact |= BIT(rule);
+  else if (p[0] == '*' && p[1] == 0)
+    t->star |= BIT(rule);
+  else
+  {
+    rest[rule] = strdup(p);
+    if (!rest[rule])
+      return 0;
+    t->glob |= BIT(rule);
+  }
+  return 1;
+}
+
+static oaMask trieMatch(oaTrie *t,char **rest,PMQCHAR s,int l)
+{
+  oaMask m = 0;
+  oaMask g;
+  int    i = 0;
+  int    b;
+
+  for (;;)
+  {
+    m |= t->star;
+    for (g = t->glob;g;g &= g-1)
+    {
+      b = __builtin_ctzll(g);
+      if (glob(rest[b],s+i,l-i))
+        m |= BIT(b);
+    }
+    if (i == l)
+    {
+      m |= t->exact;
+      break;
+    }
+    t = trieChild(t,s[i++],0);
+    if (!t)
+      break;
+  }
+  return m;
+}
+
+static void trieFree(oaTrie *t)
+{
+  oaTrie *n;
+  while ((n = t->child) != NULL)
+  {
+    t->child = n->sibling;
+    trieFree(n);
+    free(n);
+  }
+}
+
+static void filterFree(oaFilter *f)
+{
+  int i;
+  trieFree(&f->entTrie);
+  trieFree(&f->objTrie);
+  for (i=0;i<FILTER_RULES;i++)
+  {
+    free(f->entRest[i]);
+    free(f->objRest[i]);
+  }
+  free(f);
+}
+
+/*
+ * Compare ignoring case and spaces, so "localqueue" matches "Local Queue"
+ */
+static int sameWord(const char *a,const char *b)
+{
+  for (;;)
+  {
+    while (*a == ' ') a++;
+    while (*b == ' ') b++;
+    if ((*a | 0x20) != (*b | 0x20))
+      return 0;
+    if (*a == 0)
+      return 1;
+    a++;
+    b++;
+  }
+}
+
+/*
+ * Authority names are the ones shown in the log
+ */
+static MQLONG authValue(char *v)
+{
+  char n[32];
+  int  i;
+
+  if (v[0] == '0' && (v[1] == 'x' || v[1] == 'X'))
+    return (MQLONG)strtoul(v,NULL,16);
+
+  for (i=0;i<FLAGS(mqiFlags);i++)
+  {
+    sprintf(n,"%.*s",mqiFlags[i].n.len-1,mqiFlags[i].n.name);
+    if (sameWord(n,v))
+      return mqiFlags[i].bit;
+  }
+  for (i=0;i<FLAGS(admFlags);i++)
+  {
+    sprintf(n,"%.*s",admFlags[i].n.len-1,admFlags[i].n.name);
+    if (sameWord(n,v))
+      return admFlags[i].bit;
+  }
+  if (sameWord(v,"allmqi")) return MQZAO_ALL_MQI;
+  if (sameWord(v,"alladm")) return MQZAO_ALL_ADMIN;
+  if (sameWord(v,"crt"))    return MQZAO_CREATE;
+  if (sameWord(v,"rem"))    return MQZAO_REMOVE;
+#ifdef MQZAO_SYSTEM
+  if (sameWord(v,"system")) return MQZAO_SYSTEM;
+#endif
+  return 0;
+}
+
+/*
+ * Object type names are the ones shown in the log, or a number
+ */
+static int typeValue(char *v,MQLONG *t)
+{
+  int i;
+
+  if (v[0] >= '0' && v[0] <= '9')
+  {
+    *t = atoi(v);
+    return 1;
+  }
+  for (i=0;i<OT_LOW;i++)
+  {
+    if (otLow[i].name && sameWord(otLow[i].name,v))
+    {
+      *t = i;
+      return 1;
+    }
+  }
+  for (i=0;i<OT_HIGHN;i++)
+  {
+    if (otHigh[i].name && sameWord(otHigh[i].name,v))
+    {
+      *t = OT_HIGH + i;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static int typeIndex(oaFilter *f,MQLONG t)
+{
+  int i;
+  for (i=0;i<f->typeCount;i++)
+  {
+    if (f->types[i] == t)
+      return i;
+  }
+  return -1;
+}
+
+/*
+ * Add one rule. The whole line is checked before anything is
+ * compiled, so a rule that can't be understood leaves no trace.
+ * Returns 1 if the rule was added, 0 if it was not understood and
+ * -1 if there was no memory for it.
+ */
+static int filterRule(oaFilter *f,char *line)
+{
+  int    r = f->count;
+  int    include;
+  char  *entity = NULL;
+  char  *object = NULL;
+  oaMask fns = 0;
+  MQLONG auth = 0;
+  MQLONG types[FILTER_TYPES];
+  int    typeCount = 0;
+  char  *tok;
+  char  *val;
+  char  *v;
+  char  *save1;
+  char  *save2;
+  int    i,j;
+
+  tok = strtok_r(line," \t\r\n",&save1);
+  if (!strcmp(tok,"include"))
+    include = 1;
+  else if (!strcmp(tok,"exclude"))
+    include = 0;
+  else
+    return 0;
+
+  while ((tok = strtok_r(NULL," \t\r\n",&save1)) != NULL)
+  {
+    val = strchr(tok,'=');
+    if (!val || !val[1])
+      return 0;
+    *val++ = 0;
+
+    if (!strcmp(tok,"entity"))
+      entity = val;
+    else if (!strcmp(tok,"object"))
+      object = val;
+    else if (!strcmp(tok,"func"))
+    {
+      for (v = strtok_r(val,",",&save2);v;v = strtok_r(NULL,",",&save2))
+      {
+        for (i=0;i<FN_COUNT && !sameWord(fnNames[i].name,v);i++)
+          ;
+        if (i == FN_COUNT)
+          return 0;
+        fns |= BIT(i);
+      }
+    }
+    else if (!strcmp(tok,"type"))
+    {
+      for (v = strtok_r(val,",",&save2);v;v = strtok_r(NULL,",",&save2))
+      {
+        if (typeCount == FILTER_TYPES || !typeValue(v,&types[typeCount]))
+          return 0;
+        typeCount++;
+      }
+    }
+    else if (!strcmp(tok,"auth"))
+    {
+      for (v = strtok_r(val,",",&save2);v;v = strtok_r(NULL,",",&save2))
+      {
+        if ((i = authValue(v)) == 0)
+          return 0;
+        auth |= i;
+      }
+    }
+    else
+      return 0;
+  }
+
+  /* Room for any new object types */
+  j = f->typeCount;
+  for (i=0;i<typeCount;i++)
+  {
+    if (typeIndex(f,types[i]) < 0)
+      j++;
+  }
+  if (j > FILTER_TYPES)
+    return 0;
+
+  /* Only running out of memory can stop the rule now */
+  if ((entity && !trieAdd(&f->entTrie,f->entRest,r,entity)) ||
+      (object && !trieAdd(&f->objTrie,f->objRest,r,object)))
+    return -1;
+
+  if (include)
+  {
+    f->include |= BIT(r);
+    f->includes++;
+  }
+  if (!entity)
+    f->entAny |= BIT(r);
+  if (!object)
+    f->objAny |= BIT(r);
+  if (typeCount == 0)
+    f->typeAny |= BIT(r);
+  for (i=0;i<typeCount;i++)
+  {
+    j = typeIndex(f,types[i]);
+    if (j < 0)
+    {
+      j = f->typeCount++;
+      f->types[j] = types[i];
+    }
+    f->typeMask[j] |= BIT(r);
+  }
+  if (auth == 0)
+    f->authAny |= BIT(r);
+  for (i=0;i<32;i++)
+  {
+    if (auth & (1UL << i))
+      f->auth[i] |= BIT(r);
+  }
+  for (i=0;i<FN_COUNT;i++)
+  {
+    if (fns == 0 || (fns & BIT(i)))
+      f->fn[i] |= BIT(r);
+  }
+  f->count++;
+  return 1;
+}
+
+/*
+ * Read the rules and swap them in. Other threads may still be looking
+ * at the old set, so it is only freed by the final OATerm. With no file,
+ * everything is logged.
+ */
+static void filterLoad(void)
+{
+  FILE     *cf;
+  oaFilter *f = NULL;
+  oaFilter *old;
+  char      line[FILTER_LINE];
+  char      copy[FILTER_LINE];
+  char     *p;
+  int       n = 0;
+  int       rc = 1;
+
+  cf = fopen(FILTERFILE,"r");
+  if (cf)
+  {
+    f = calloc(1,sizeof(oaFilter));
+    while (f && rc >= 0 && fgets(line,sizeof(line),cf))
+    {
+      n++;
+      for (p = line;*p == ' ' || *p == '\t';p++)
+        ;
+      if (*p == '#' || *p == '\n' || *p == '\r' || *p == 0)
+        continue;
+      strcpy(copy,p);
+      if (f->count == FILTER_RULES)
+        rpt("\tFilter  : Too many rules. Line %d ignored\n",n);
+      else if ((rc = filterRule(f,p)) == 0)
+        rpt("\tFilter  : Line %d ignored: %s",n,copy);
+    }
+    fclose(cf);
+
+    if (!f || rc < 0)
+    {
+      rpt("\tFilter  : No memory for rules in %s\n",FILTERFILE);
+      if (f)
+        filterFree(f);
+      return;
+    }
+    rpt("\tFilter  : %d rules from %s\n",f->count,FILTERFILE);
+  }
+
+  pthread_mutex_lock(&filterLock);
+  old = __atomic_exchange_n(&filter,f,__ATOMIC_ACQ_REL);
+  if (old)
+  {
+    old->retired = retired;
+    retired = old;
+  }
+  pthread_mutex_unlock(&filterLock);
+}
+
+/*
+ * Only called when the log is closed, so no other thread is filtering
+ */
+static void filterTerm(void)
+{
+  oaFilter *f;
+
+  if (filter)
+  {
+    filter->retired = retired;
+    retired = filter;
+    filter = NULL;
+  }
+  while ((f = retired) != NULL)
+  {
+    retired = f->retired;
+    filterFree(f);
+  }
+}
+#endif
+
+/*
+ * Should this call be logged?
+ */
+static int audited(int fn,PMQCHAR entity,int entityMax,PMQCHAR object,
+                   MQLONG type,MQLONG auth)
+{
+#ifdef OA_FILTER
+  oaFilter *f = __atomic_load_n(&filter,__ATOMIC_ACQUIRE);
+  oaMask    m;
+  oaMask    a;
+  unsigned long bits;
+  int       i;
+
+  if (!f)
+    return 1;
+
+  m = f->fn[fn];
+  if (m & ~f->typeAny)
+  {
+    a = f->typeAny;
+    for (i=0;i<f->typeCount;i++)
+    {
+      if (f->types[i] == type)
+        a |= f->typeMask[i];
+    }
+    m &= a;
+  }
+  if (m & ~f->authAny)
+  {
+    a = f->authAny;
+    for (bits = (unsigned long)auth & 0xFFFFFFFFUL;bits;bits &= bits-1)
+      a |= f->auth[__builtin_ctzl(bits)];
+    m &= a;
+  }
+  if (m & ~f->entAny)
+  {
+    a = f->entAny;
+    if (entity)
+      a |= trieMatch(&f->entTrie,f->entRest,entity,nameLen(entity,entityMax));
+    m &= a;
+  }
+  if (m & ~f->objAny)
+  {
+    a = f->objAny;
+    if (object)
+      a |= trieMatch(&f->objTrie,f->objRest,object,objNameLen(object,type));
+    m &= a;
+  }
+
+  if (m == 0)
+    return f->includes == 0;
+  return (f->include >> __builtin_ctzll(m)) & 1;
+#else
+  return 1;
+#endif
+}
+
+
+/****************************************************************************/
+/* OAM timing                                                               */
+/*                                                                          */
+/* Some users, such as those in a lot of groups, can make the OAM slow, but */
+/* from in front of it we can't tell how long it takes. An instance after   */
+/* amqzfu with a ComponentDataSize from OA_TIME_COMPSIZE up to the cache    */
+/* size turns on timing. The instance before amqzfu notes the time in a     */
+/* thread-local variable as it passes OACheckAuth, OAAuthUser or OAGetAuth  */
+/* on. Both instances are the same module, so when the OAM passes the call  */
+/* on to the instance after it, that instance sees the start time and      */
+/* knows how long the OAM took. A refused check stops the chain, so only    */
+/* the calls that the OAM passes on are timed.                              */
+/*                                                                          */
+/* Times are kept in histograms with power-of-2 buckets, one for each       */
+/* function and one for each entity, along with the slowest calls since     */
+/* the last dump. Each process keeps its own figures. They are written to   */
+/* the log by OARefreshCache, by OATerm, and whenever TIMEFILE is touched.  */
+/****************************************************************************/
+#if MQAT_DEFAULT == MQAT_UNIX
+#define OA_TIMING
+#endif
+
+#define OA_TIME_COMPSIZE 32      /* Smallest ComponentDataSize for timing */
+
+#ifdef OA_TIMING
+#define TIMEFILE     "/var/mqm/audit/oamlog.dump"
+#define TIME_BUCKETS 24          /* The last holds everything from 4 seconds */
+#define TIME_HASH    1024        /* Must be a power of 2 */
+#define TIME_LOCKS   16
+#define TIME_MAX     1000        /* Entities per process */
+#define TIME_TOP     20          /* Entities in a dump */
+#define TIME_SLOW    16          /* Slowest calls in a dump */
+#define TIME_NAME    64          /* Longer entity names are cut short */
+
+typedef struct {
+  volatile unsigned long      count;
+  volatile unsigned long long total;       /* Microseconds */
+  volatile unsigned long long max;
+  volatile unsigned long      bucket[TIME_BUCKETS];
+} oaHist;
+
+typedef struct oaTimeEntry {
+  struct oaTimeEntry *next;
+  unsigned int hash;
+  oaHist       hist;
+  int          nameLen;
+  char         name[1];          /* Allocated to the real length */
+} oaTimeEntry;
+
+typedef struct {
+  unsigned long long usecs;
+  int     fn;
+  time_t  when;
+  MQLONG  objectType;
+  char    entity[TIME_NAME+1];
+  char    object[MQ_OBJECT_NAME_LENGTH+1];
+} oaSlow;
+
+static int              timing = 0;
+static oaHist           timeFn[FN_COUNT];
+static oaHist           timeOther;       /* Entities after TIME_MAX */
+static oaTimeEntry     *timeBuckets[TIME_HASH];
+static pthread_rwlock_t timeLocks[TIME_LOCKS];
+static pthread_once_t   timeOnce = PTHREAD_ONCE_INIT;
+static volatile long    timeCount = 0;
+
+static pthread_mutex_t  slowLock = PTHREAD_MUTEX_INITIALIZER;
+static oaSlow           slow[TIME_SLOW];
+static int              slowCount = 0;
+static volatile unsigned long long slowFloor = 0; /* Fastest in a full list */
+
+/*
+ * Set by the instance before amqzfu, used by the one after it
  */
-#define AUTHBUF 128
-#define unknownauthfmt "\tUnk Flag: 0x%08X\n"
+static __thread int                timeFunc = -1;
+static __thread unsigned long long timeStart;
 
-static char *OAAuthStr(MQLONG x,char *buf, int *unknownFlags)
+static void timeInit(void)
 {
-	int  notAllFlags  = ~(MQZAO_CREATE | MQZAO_REMOVE | MQZAO_ALL);
+  int i;
+  for (i=0;i<TIME_LOCKS;i++)
+    pthread_rwlock_init(&timeLocks[i],NULL);
+}
 
+#define timeLock(h) (&timeLocks[((h) & (TIME_HASH-1)) % TIME_LOCKS])
 
-  sprintf(buf,"0x%08X [",x);
+static unsigned long long usecs(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC,&ts);
+  return (unsigned long long)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
 
-  if ((x & MQZAO_ALL_MQI)== MQZAO_ALL_MQI)
-    strcat(buf,"allmqi ");
-  else
+/*
+ * Bucket b holds times below 2^b microseconds
+ */
+static void histAdd(oaHist *h,unsigned long long us)
+{
+  unsigned long long m;
+  int b = us ? 64 - __builtin_clzll(us) : 0;
+
+  if (b >= TIME_BUCKETS)
+    b = TIME_BUCKETS - 1;
+  __sync_fetch_and_add(&h->count,1);
+  __sync_fetch_and_add(&h->total,us);
+  __sync_fetch_and_add(&h->bucket[b],1);
+  for (m = h->max;us > m;m = h->max)
   {
+    if (__sync_bool_compare_and_swap(&h->max,m,us))
+      break;
+  }
+}
 
-    if (x & MQZAO_CONNECT)               strcat(buf,"connect ");
-    if (x & MQZAO_BROWSE )               strcat(buf,"browse ");
-    if (x & MQZAO_INPUT  )               strcat(buf,"get ");
-    if (x & MQZAO_OUTPUT )               strcat(buf,"put ");
-    if (x & MQZAO_INQUIRE)               strcat(buf,"inq ");
-    if (x & MQZAO_SET    )               strcat(buf,"set ");
-#ifdef MQZAO_PUBLISH
-    if (x & MQZAO_PUBLISH)               strcat(buf,"pub ");
-    if (x & MQZAO_SUBSCRIBE)             strcat(buf,"sub ");
-    if (x & MQZAO_RESUME)                strcat(buf,"resume ");
-#endif
+/*
+ * Entries are never removed, so the histogram can be updated
+ * after the lock is released.
+ */
+static oaHist *entityHist(PMQCHAR name,int len)
+{
+  oaTimeEntry *e;
+  unsigned int h = fnv(2166136261U,name,len);
+  oaTimeEntry **b = &timeBuckets[h & (TIME_HASH-1)];
+  pthread_rwlock_t *l = timeLock(h);
 
-    if (x & MQZAO_PASS_IDENTITY_CONTEXT) strcat(buf,"passid ");
-    if (x & MQZAO_PASS_ALL_CONTEXT)      strcat(buf,"passall ");
-    if (x & MQZAO_SET_IDENTITY_CONTEXT)  strcat(buf,"setid ");
-    if (x & MQZAO_SET_ALL_CONTEXT)       strcat(buf,"setall ");
-    if (x & MQZAO_ALTERNATE_USER_AUTHORITY) strcat(buf,"altusr ");
+  pthread_rwlock_rdlock(l);
+  for (e = *b;e;e = e->next)
+  {
+    if (e->hash == h && e->nameLen == len && !memcmp(e->name,name,len))
+      break;
+  }
+  pthread_rwlock_unlock(l);
+  if (e)
+    return &e->hist;
+  if (timeCount >= TIME_MAX)
+    return &timeOther;
+
+  pthread_rwlock_wrlock(l);
+  for (e = *b;e;e = e->next)
+  {
+    if (e->hash == h && e->nameLen == len && !memcmp(e->name,name,len))
+      break;
+  }
+  if (!e && (e = calloc(1,sizeof(oaTimeEntry) + len)) != NULL)
+  {
+    e->hash = h;
+    e->nameLen = len;
+    memcpy(e->name,name,len);
+    e->next = *b;
+    *b = e;
+    __sync_fetch_and_add(&timeCount,1);
   }
+  pthread_rwlock_unlock(l);
+  return e ? &e->hist : &timeOther;
+}
 
-  if (x & MQZAO_CREATE)                strcat(buf,"crt ");
+/*
+ * Keep the slowest calls. Most calls are quicker than all of them,
+ * and are turned away without taking the lock.
+ */
+static void slowAdd(int fn,unsigned long long us,PMQCHAR entity,int entityLen,
+                    PMQCHAR object,MQLONG type)
+{
+  oaSlow *s;
+  int     i;
 
-  if ((x & MQZAO_ALL_ADMIN) == MQZAO_ALL_ADMIN)
-    strcat(buf,"alladm");
+  if (us <= slowFloor)
+    return;
+
+  pthread_mutex_lock(&slowLock);
+  if (slowCount < TIME_SLOW)
+    s = &slow[slowCount++];
   else
   {
-    if (x & MQZAO_DELETE)                strcat(buf,"dlt ");
-    if (x & MQZAO_DISPLAY)               strcat(buf,"dsp ");
-    if (x & MQZAO_CHANGE)                strcat(buf,"chg ");
-    if (x & MQZAO_CLEAR)                 strcat(buf,"clr ");
+    s = &slow[0];
+    for (i=1;i<TIME_SLOW;i++)
+    {
+      if (slow[i].usecs < s->usecs)
+        s = &slow[i];
+    }
+    if (us <= s->usecs)
+    {
+      pthread_mutex_unlock(&slowLock);
+      return;
+    }
+  }
 
-    /* Added for WMQ V6 */
-    if (x & MQZAO_CONTROL)               strcat(buf,"ctrl ");
-    if (x & MQZAO_CONTROL_EXTENDED)      strcat(buf,"ctrlx ");
-    if (x & MQZAO_AUTHORIZE)             strcat(buf,"auth ");
+  s->usecs = us;
+  s->fn    = fn;
+  s->when  = time(NULL);
+  s->objectType = type;
+  if (entityLen > TIME_NAME)
+    entityLen = TIME_NAME;
+  memcpy(s->entity,entity,entityLen);
+  s->entity[entityLen] = 0;
+  i = object ? objNameLen(object,type) : 0;
+  memcpy(s->object,object,i);
+  s->object[i] = 0;
+
+  if (slowCount == TIME_SLOW)
+  {
+    slowFloor = slow[0].usecs;
+    for (i=1;i<TIME_SLOW;i++)
+    {
+      if (slow[i].usecs < slowFloor)
+        slowFloor = slow[i].usecs;
+    }
   }
+  pthread_mutex_unlock(&slowLock);
+}
 
-  /* Added for WMQ V7.0.1 - not part of "alladm" collection */
-#ifdef MQZAO_SYSTEM
-   if (x & MQZAO_SYSTEM)               strcat(buf,"system ");
-#endif
+static char *timefmt = \
+  "[" PRS "] OATiming\n"\
+  "\tReason  : %s\n"\
+  ;
+static char *histfmt = \
+  "\t%-8.8s: \"%.*s\"  Calls %lu  Avg %lluus  Max %lluus\n"\
+  "\tHist    :%s\n"\
+  ;
+static char *slowfmt = \
+  "\tSlow    : %lluus %s \"%s\" \"%s\" [%s] at %s"\
+  ;
 
-  if (x & MQZAO_REMOVE)                strcat(buf,"rem ");
-
-  if (x == MQZAO_NONE)                 strcat(buf,"none ");
-
-  /*
-   * See if there are any unrecognised flags set.
-   * Can't easily format the unknown flags because we are
-   * already in the middle of an fprintf, and that seems
-   * to be (on some platforms at least) non-nestable. Runtime
-   * dumps happened if I tried to use the commented code.
-   *
-   * Other number-formatting functions such as itoa are not
-   * available everywhere.
-   *
-   * Instead, we return the unknown flags and let the
-   * caller decide whether to format them.
-   */
-  *unknownFlags = notAllFlags & x;
-  if (*unknownFlags != 0)
+static void histRpt(char *label,char *name,int len,oaHist *h)
+{
+  char  buf[TIME_BUCKETS * 32];
+  char *p = buf;
+  int   b;
+
+  for (b=0;b<TIME_BUCKETS;b++)
   {
-#if 0
-    char unkbuf[64] = {0};
-    sprintf(unkbuf,"unknown (0x%08X) ",unknownFlags);
-    strcat(buf,unkbuf);
-#else
-    strcat(buf,"unknown ");
-#endif
+    if (h->bucket[b] == 0)
+      continue;
+    if (b < TIME_BUCKETS - 1)
+      p += sprintf(p," <%lluus:%lu",1ULL << b,h->bucket[b]);
+    else
+      p += sprintf(p," >=%lluus:%lu",1ULL << (b-1),h->bucket[b]);
   }
+  *p = 0;
+  rpt(histfmt,label,len,name,h->count,h->total / h->count,h->max,buf);
+}
 
-  strcat(buf,"]");
-  return buf;
+static int byTotal(const void *a,const void *b)
+{
+  unsigned long long x = (*(oaTimeEntry **)a)->hist.total;
+  unsigned long long y = (*(oaTimeEntry **)b)->hist.total;
+  return (x < y) - (x > y);
+}
+
+static int bySlowest(const void *a,const void *b)
+{
+  unsigned long long x = ((oaSlow *)a)->usecs;
+  unsigned long long y = ((oaSlow *)b)->usecs;
+  return (x < y) - (x > y);
 }
 
 /*
- * Options used by dmpmqaut. They tell the OAM how to
- * interpret the entity and object/profile names passed as part
- * of the filter.
+ * Write the figures so far. The entities that have spent the most time
+ * in the OAM are shown. The list of slow calls starts again afterwards.
  */
-static char *OAEnumOptStr(MQLONG x,char *buf)
+static void timeDump(char *reason)
 {
-  sprintf(buf,"0x%08X [",x);
-  if (x == 0)                 strcat(buf,"none ");
-  else
+  char          tb[TIMEBUF];
+  char          when[32];
+  oaTimeEntry **all;
+  oaTimeEntry  *e;
+  oaSlow        s[TIME_SLOW];
+  int           count;
+  int           n = 0;
+  int           i;
+
+  if (!timing || !fp)
+    return;
+
+  rpt(timefmt,prefix(tb),reason);
+  for (i=0;i<FN_COUNT;i++)
   {
-   if (x & MQAUTHOPT_CUMULATIVE)             strcat(buf,"cum ");
-   if (x & MQAUTHOPT_ENTITY_EXPLICIT)        strcat(buf,"ent_explicit ");
-   if (x & MQAUTHOPT_ENTITY_SET)             strcat(buf,"ent_set ");
-   if (x & MQAUTHOPT_NAME_ALL_MATCHING)      strcat(buf,"name_all ");
-   if (x & MQAUTHOPT_NAME_AS_WILDCARD)       strcat(buf,"name_wildcard ");
-   if (x & MQAUTHOPT_NAME_EXPLICIT)          strcat(buf,"name_explicit ");
-   if (x & MQAUTHOPT_EXCLUDE_TEMP)              strcat(buf,"excl_temp ");
+    if (timeFn[i].count)
+      histRpt("Function",fnNames[i].name,fnNames[i].len,&timeFn[i]);
+  }
+
+  all = malloc((TIME_MAX + TIME_LOCKS) * sizeof(oaTimeEntry *));
+  if (all)
+  {
+    for (i=0;i<TIME_HASH;i++)
+    {
+      pthread_rwlock_rdlock(timeLock(i));
+      for (e = timeBuckets[i];e && n < TIME_MAX + TIME_LOCKS;e = e->next)
+      {
+        if (e->hist.count)
+          all[n++] = e;
+      }
+      pthread_rwlock_unlock(timeLock(i));
+    }
+    qsort(all,n,sizeof(oaTimeEntry *),byTotal);
+    for (i=0;i<n && i<TIME_TOP;i++)
+      histRpt("Entity",all[i]->name,all[i]->nameLen,&all[i]->hist);
+    free(all);
+  }
+  if (timeOther.count)
+    histRpt("Entity","(others)",8,&timeOther);
+
+  pthread_mutex_lock(&slowLock);
+  count = slowCount;
+  memcpy(s,slow,count * sizeof(oaSlow));
+  slowCount = 0;
+  slowFloor = 0;
+  memset(slow,0,sizeof(slow));
+  pthread_mutex_unlock(&slowLock);
+
+  qsort(s,count,sizeof(oaSlow),bySlowest);
+  for (i=0;i<count;i++)
+  {
+    ctime_r(&s[i].when,when);
+    rpt(slowfmt,s[i].usecs,fnNames[s[i].fn].name,s[i].entity,
+        s[i].object,s[i].object[0] ? OAOTStr(s[i].objectType) : "",when);
   }
-  strcat(buf,"]");
-  return buf;
 }
 
 /*
- * Format a pointer. Don't like the default
- * printing style for "%p"...
+ * Called once a second by the log writer thread. Touching TIMEFILE
+ * makes every process write its figures.
  */
-static char *OAPtrStr(MQPTR p, char *buf)
+static void timePoll(void)
 {
-  if (p)
-    sprintf(buf,"0x%016lX",(unsigned long)p);
+  static time_t lastPoll = 0;
+  static time_t seen = 0;
+  static int    polled = 0;
+  struct stat   st;
+  time_t        now;
+
+  if (!timing)
+    return;
+  now = time(NULL);
+  if (now == lastPoll)
+    return;
+  lastPoll = now;
+
+  if (stat(TIMEFILE,&st) == 0)
+  {
+    if (polled && st.st_mtime != seen)
+      timeDump("Requested");
+    seen = st.st_mtime;
+  }
   else
-    sprintf(buf,"%s","NULL");
-  return buf;
+    seen = 0;
+  polled = 1;
 }
+#endif
 
 /*
- * Attributes that might be inquired upon to see what
- * capabilities the components can support
+ * The instance before amqzfu is passing a call on
  */
-static char *OAAttrStr(MQLONG x)
+static void timeMark(int fn)
 {
-  switch (x)
+#ifdef OA_TIMING
+  if (timing)
   {
-  case MQIACF_USER_ID_SUPPORT:   return "UserId Support";
-  case MQIACF_INTERFACE_VERSION: return "Interface Version";
-  default:                       return "Unknown attribute";
+    timeFunc  = fn;
+    timeStart = usecs();
   }
+#endif
+}
+
+/*
+ * The instance after amqzfu has been called. Anything but the call
+ * that was marked on this thread is ignored.
+ */
+static void timeTaken(int fn,PMQCHAR entity,int entityMax,PMQCHAR object,
+                      MQLONG type)
+{
+#ifdef OA_TIMING
+  unsigned long long us;
+  int l;
+
+  if (timeFunc != fn)
+    return;
+  us = usecs() - timeStart;
+  timeFunc = -1;
+
+  l = entity ? nameLen(entity,entityMax) : 0;
+  histAdd(&timeFn[fn],us);
+  histAdd(entityHist(entity,l),us);
+  slowAdd(fn,us,entity,l,object,type);
+#endif
 }
 
 
@@ -474,6 +1998,12 @@ static char *termfmt = \
   "\tQMgr    : \"%48.48s\"\n"\
   "\tOpts    : 0x%08X [%s]\n"\
   ;
+static char *cachefmt = \
+  "\tCache   : Hits %ld  Misses %ld  Recorded %ld  Entries %ld\n"\
+  ;
+static char *dropfmt = \
+  "\tDropped : %ld records\n"\
+  ;
 
 static void MQENTRY OATerm(
   MQHCONFIG  hc,
@@ -486,16 +2016,34 @@ static void MQENTRY OATerm(
   char tb[TIMEBUF];
 
   rpt(termfmt,prefix(tb),pQMgrName,Options,OATermOptStr(Options));
+#ifdef OA_CACHE
+  if (shared)
+    rpt(cachefmt,cacheHits,cacheMisses,cacheAdds,cacheCount);
+#endif
+  if (auditDropped > 0)
+    rpt(dropfmt,auditDropped);
+#ifdef OA_TIMING
+  timeDump("Termination");
+#endif
 
   /* Don't close the logfile if we're in the primary process unless  */
-  /* it is also a primary shutdown                                   */
+  /* it is also a primary shutdown. Either way, everything that has  */
+  /* been logged so far is on disk before we return.                 */
   if ((primary_process && Options == MQZTO_PRIMARY) || !primary_process)
   {
+    auditStop();
     if (fp)
     {
       fclose(fp);
       fp = NULL;
     }
+#ifdef OA_FILTER
+    filterTerm();
+#endif
+  }
+  else
+  {
+    auditFlush();
   }
   *pCompCode = MQCC_OK;
   *pReason   = MQRC_NONE;
@@ -527,10 +2075,12 @@ static void MQENTRY OADeleteAuth(
   PMQLONG  pReason)
 {
   char tb[TIMEBUF];
-  rpt(delfmt,
-      prefix(tb),
-	   pObjectName,
-	   OAOTStr(ObjectType));
+  if (audited(FN_DELETE,NULL,0,pObjectName,ObjectType,0))
+    rpt(delfmt,
+        prefix(tb),
+        pObjectName,
+        OAOTStr(ObjectType));
+  cacheInvalidateObject(pObjectName,ObjectType);
   *pCompCode = OA_DEF_CC;
   *pReason   = MQRC_NONE;
   *pContinuation = MQZCI_CONTINUE;
@@ -557,6 +2107,13 @@ static void MQENTRY OARefreshCache(
 {
   char tb[TIMEBUF];
   rpt("[" PRS "] OARefreshCache\n", prefix(tb));
+#ifdef OA_FILTER
+  filterLoad();
+#endif
+#ifdef OA_TIMING
+  timeDump("Refresh");
+#endif
+  cacheInvalidate();
   *pCompCode = MQCC_OK;
   *pReason   = MQRC_NONE;
   *pContinuation = MQZCI_CONTINUE;
@@ -593,12 +2150,14 @@ static void MQENTRY OAGetAuth(
   PMQLONG  pReason)
 {
   char tb[TIMEBUF];
-  rpt(getauthfmt,
-	  prefix(tb),
-	  pObjectName,
-	  OAOTStr(ObjectType),
-	  OAETStr(EntityType),
-	  OAEntityStr(pEntityData));
+  if (audited(FN_GET,pEntityData->EntityNamePtr,FILTER_ENTITY,pObjectName,ObjectType,0))
+    rpt(getauthfmt,
+        prefix(tb),
+        pObjectName,
+        OAOTStr(ObjectType),
+        OAETStr(EntityType),
+        OAEntityStr(pEntityData));
+  timeMark(FN_GET);
   *pCompCode = OA_DEF_CC;
   *pReason   = MQRC_NONE;
   *pContinuation = MQZCI_CONTINUE;
@@ -637,12 +2196,13 @@ static void MQENTRY OAGetExplicitAuth(
   PMQLONG  pReason)
 {
   char tb[TIMEBUF];
-  rpt(explauthfmt,
-	  prefix(tb),
-	  pObjectName,
-	  OAOTStr(ObjectType),
-	  OAETStr(EntityType),
-	  OAEntityStr(pEntityData));
+  if (audited(FN_GETEXPLICIT,pEntityData->EntityNamePtr,FILTER_ENTITY,pObjectName,ObjectType,0))
+    rpt(explauthfmt,
+        prefix(tb),
+        pObjectName,
+        OAOTStr(ObjectType),
+        OAETStr(EntityType),
+        OAEntityStr(pEntityData));
 
   *pCompCode = OA_DEF_CC;
   *pReason   = MQRC_NONE;
@@ -681,9 +2241,9 @@ static void MQENTRY OASetAuth(
   char tb[TIMEBUF];
   int  unknownAuthFlags = 0;
 
-  if (fp)
+  if (fp && audited(FN_SET,pEntityData->EntityNamePtr,FILTER_ENTITY,pObjectName,ObjectType,Authority))
   {
-  	fprintf(fp,setauthfmt,
+  	rpt(setauthfmt,
 	    prefix(tb),
 	    pObjectName,
 	    OAOTStr(ObjectType),
@@ -691,36 +2251,278 @@ static void MQENTRY OASetAuth(
 	    OAEntityStr(pEntityData),
 	    OAAuthStr(Authority,buf,&unknownAuthFlags));
     if (unknownAuthFlags != 0)
-    	fprintf(fp,unknownauthfmt,unknownAuthFlags);
+    	rpt(unknownauthfmt,unknownAuthFlags);
   }
+  cacheInvalidate();
+
+  *pCompCode = OA_DEF_CC;
+  *pReason   = MQRC_NONE;
+  *pContinuation = MQZCI_CONTINUE;
+  return;
+}
+
+/****************************************************************************/
+/* Function: OACopyAllAuth                                                  */
+/*                                                                          */
+/* Description:                                                             */
+/*   Sets the authority for a new object, based on a reference set of       */
+/*   permissions. Obviously both the reference and the new object have      */
+/*   the same object type. In fact, it's only called (today) during         */
+/*   creation of a dynamic queue. Unfortunately there's nothing in this     */
+/*   interface which says whether or not it's a temporary or permanent      */
+/*   dynamic queue, which could be useful to know, as TDQs expire along     */
+/*   with the qmgr and info about them need not be hardened.                */
+/****************************************************************************/
+static char *copyallfmt = \
+  "[" PRS "] OACopyAllAuth\n"\
+  "\tFrom    : \"%48.48s\" [%s]\n"\
+  "\tTo      : \"%48.48s\"\n"\
+  ;
 
+static void MQENTRY OACopyAllAuth(
+  PMQCHAR  pQMgrName,
+  PMQCHAR  pRefObjectName,
+  PMQCHAR  pObjectName,
+  MQLONG   ObjectType,
+  PMQBYTE  pComponentData,
+  PMQLONG  pContinuation,
+  PMQLONG  pCompCode,
+  PMQLONG  pReason)
+{
+  char tb[TIMEBUF];
+  if (audited(FN_COPYALL,NULL,0,pObjectName,ObjectType,0))
+    rpt(copyallfmt,
+        prefix(tb),
+        pRefObjectName,
+        OAOTStr(ObjectType),
+        pObjectName);
   *pCompCode = OA_DEF_CC;
   *pReason   = MQRC_NONE;
   *pContinuation = MQZCI_CONTINUE;
   return;
 }
 
-/****************************************************************************/
-/* Function: OACopyAllAuth                                                  */
-/*                                                                          */
-/* Description:                                                             */
-/*   Sets the authority for a new object, based on a reference set of       */
-/*   permissions. Obviously both the reference and the new object have      */
-/*   the same object type. In fact, it's only called (today) during         */
-/*   creation of a dynamic queue. Unfortunately there's nothing in this     */
-/*   interface which says whether or not it's a temporary or permanent      */
-/*   dynamic queue, which could be useful to know, as TDQs expire along     */
-/*   with the qmgr and info about them need not be hardened.                */
-/****************************************************************************/
-static char *copyallfmt = \
-  "[" PRS "] OACopyAllAuth\n"\
-  "\tFrom    : \"%48.48s\" [%s]\n"\
-  "\tTo      : \"%48.48s\"\n"\
-  ;
-
-static void MQENTRY OACopyAllAuth(
+/****************************************************************************/
+/* Function: OACheckAuth                                                    */
+/*                                                                          */
+/* Description:                                                             */
+/*   Called whenever the qmgr wants to see if someone can do something.     */
+/*   Typically this will be during MQCONN, MQOPEN or MQSUB. Remember, we're */
+/*   never called during MQPUT/MQGET.                                       */
+/*                                                                          */
+/*   The qmgr code will break out of the chaining loop whatever the CC      */
+/*   and whatever the Continuation parameters say,                          */
+/*   unless some very specific error codes happen. This is so that          */
+/*   one, and only one, service returns a response granting access to the   */
+/*   object. But for this particular service we want the chain always to    */
+/*   continue. So I set a combination of Reason/CC/Continuation which will  */
+/*   pass the qmgr checks and then move on to the real OAM.                 */
+/*                                                                          */
+/*   A proper authorisation component would do some real work here! And     */
+/*   then set MQCC_OK (or FAILED) and some appropriate error code.          */
+/*                                                                          */
+/*   When the cache is enabled, a request that the OAM has already granted  */
+/*   is answered here with MQCC_OK and MQZCI_STOP, so amqzfu is not called. */
+/****************************************************************************/
+static char *checkauthfmt = \
+  "[" PRS "] OACheckAuth\n" \
+  "\tObject  : \"%48.48s\" [%s]\n" \
+  "\t%-6.6s  : " OAES "\n" \
+  "\tAuth    : %s\n"\
+  ;
+
+/*
+ * OACheckAuth is by far the most frequent call, so its record is put
+ * together with memcpy instead of going through rpt and vsnprintf.
+ * The output is the same as checkauthfmt and unknownauthfmt would give.
+ */
+#define PUTS(p,s) (memcpy(p,s,sizeof(s)-1),p += sizeof(s)-1)
+#define ENTITYMAX 1024           /* Keeps the record inside RPTBUF */
+
+static const oaName etNames[] = { N("User  "), N("Group "), N("Any   ") };
+
+static int checkAuthRecord(char *rec,char *tb,PMQZED pEntityData,MQLONG EntityType,
+                           PMQCHAR pObjectName,MQLONG ObjectType,MQLONG Authority)
+{
+  char *p = rec;
+  int  l;
+  int  unknownAuthFlags = 0;
+
+  *p++ = '[';
+  l = strlen(prefix(tb));
+  memcpy(p,tb,l);
+  p += l;
+  PUTS(p,"] OACheckAuth\n\tObject  : \"");
+
+  /* Same as %48.48s */
+  for (l = 0;l < MQ_OBJECT_NAME_LENGTH && pObjectName[l] != 0;l++)
+    ;
+  memset(p,' ',MQ_OBJECT_NAME_LENGTH - l);
+  p += MQ_OBJECT_NAME_LENGTH - l;
+  memcpy(p,pObjectName,l);
+  p += l;
+
+  PUTS(p,"\" [");
+  p = putName(p,OAOTName(ObjectType));
+  PUTS(p,"]\n\t");
+  p = putName(p,&etNames[EntityType==MQZAET_PRINCIPAL?0:(EntityType==MQZAET_GROUP?1:2)]);
+  PUTS(p,"  : \"");
+
+  l = nameLen(pEntityData->EntityNamePtr,ENTITYMAX);
+  memcpy(p,pEntityData->EntityNamePtr,l);
+  p += l;
+#if MQAT_DEFAULT != MQAT_UNIX
+  *p++ = '@';
+  if (pEntityData->EntityDomainPtr)
+  {
+    l = nameLen(pEntityData->EntityDomainPtr,ENTITYMAX);
+    memcpy(p,pEntityData->EntityDomainPtr,l);
+    p += l;
+  }
+  else
+    PUTS(p,"No Domain");
+#endif
+
+  PUTS(p,"\"\n\tAuth    : ");
+  p += OAAuthCopy(Authority,p,&unknownAuthFlags);
+  *p++ = '\n';
+  if (unknownAuthFlags != 0)
+  {
+    PUTS(p,"\tUnk Flag: ");
+    p = putHex(p,unknownAuthFlags);
+    *p++ = '\n';
+  }
+  return (int)(p - rec);
+}
+
+static void MQENTRY OACheckAuth (
+  PMQCHAR  pQMgrName,
+  PMQZED   pEntityData,
+  MQLONG   EntityType,
+  PMQCHAR  pObjectName,
+  MQLONG   ObjectType,
+  MQLONG   Authority,
+  PMQBYTE  pComponentData,
+  PMQLONG  pContinuation,
+  PMQLONG  pCompCode,
+  PMQLONG  pReason)
+{
+  char rec[RPTBUF];
+  char tb[TIMEBUF];
+  int  logged = 0;
+#ifdef OA_CACHE
+  oaCacheKey k;
+#endif
+
+  if (fp && audited(FN_CHECKAUTH,pEntityData->EntityNamePtr,FILTER_ENTITY,pObjectName,ObjectType,Authority))
+  {
+    logged = 1;
+    rptRecord(rec,checkAuthRecord(rec,tb,pEntityData,EntityType,
+                                  pObjectName,ObjectType,Authority));
+  }
+
+#ifdef OA_CACHE
+  cachePending = 0;
+  if (shared && cacheTTL > 0 &&
+      cacheKey(&k,pEntityData,EntityType,pObjectName,ObjectType,Authority))
+  {
+    if (cacheLookup(&k))
+    {
+      __sync_fetch_and_add(&cacheHits,1);
+      if (logged)
+        rpt("\tCache   : Granted\n");
+      *pCompCode = MQCC_OK;
+      *pReason   = MQRC_NONE;
+      *pContinuation = MQZCI_STOP;
+      return;
+    }
+    __sync_fetch_and_add(&cacheMisses,1);
+    pendingKey = k;
+    cachePending = 1;
+  }
+#endif
+
+  timeMark(FN_CHECKAUTH);
+  *pCompCode = OA_DEF_CC;
+  *pReason   = MQRC_UNKNOWN_OBJECT_NAME;
+  *pContinuation = MQZCI_CONTINUE;
+  return;
+}
+
+/****************************************************************************/
+/* Function: OACheckAuthRecord                                              */
+/*                                                                          */
+/* Description:                                                             */
+/*   Registered by the instance configured after amqzfu. The OAM only lets  */
+/*   the chain continue to here when it has granted the request, with       */
+/*   MQCC_OK and MQRC_NONE. Anything else is left alone. The answer is kept */
+/*   under the invalidation counts seen when the check was first made, and  */
+/*   only if they have not moved since, so that a change made in the        */
+/*   meantime is not hidden.                                                */
+/*                                                                          */
+/*   The CompCode and Reason from the OAM are passed on unchanged.          */
+/****************************************************************************/
+static void MQENTRY OACheckAuthRecord (
+  PMQCHAR  pQMgrName,
+  PMQZED   pEntityData,
+  MQLONG   EntityType,
+  PMQCHAR  pObjectName,
+  MQLONG   ObjectType,
+  MQLONG   Authority,
+  PMQBYTE  pComponentData,
+  PMQLONG  pContinuation,
+  PMQLONG  pCompCode,
+  PMQLONG  pReason)
+{
+#ifdef OA_CACHE
+  oaCacheKey k;
+
+  if (cachePending && shared &&
+      *pCompCode == MQCC_OK && *pReason == MQRC_NONE &&
+      cacheKey(&k,pEntityData,EntityType,pObjectName,ObjectType,Authority) &&
+      sameKey(&pendingKey,&k) &&
+      k.generation == pendingKey.generation &&
+      k.objectGeneration == pendingKey.objectGeneration)
+  {
+    cacheAdd(&pendingKey);
+  }
+  cachePending = 0;
+#endif
+
+  timeTaken(FN_CHECKAUTH,pEntityData->EntityNamePtr,FILTER_ENTITY,
+            pObjectName,ObjectType);
+  *pContinuation = MQZCI_CONTINUE;
+  return;
+}
+
+/****************************************************************************/
+/* Function: OASetAuthRecord, OADeleteAuthRecord, OARefreshCacheRecord      */
+/*                                                                          */
+/* Description:                                                             */
+/*   Registered by the instance configured after amqzfu. The OAM has made   */
+/*   the change by now, so the invalidation count is bumped again. Any      */
+/*   answer found while the change was being made is then ignored.         */
+/*   The CompCode and Reason from the OAM are passed on unchanged.          */
+/****************************************************************************/
+static void MQENTRY OASetAuthRecord(
+  PMQCHAR  pQMgrName,
+  PMQZED   pEntityData,
+  MQLONG   EntityType,
+  PMQCHAR  pObjectName,
+  MQLONG   ObjectType,
+  MQLONG   Authority,
+  PMQBYTE  pComponentData,
+  PMQLONG  pContinuation,
+  PMQLONG  pCompCode,
+  PMQLONG  pReason)
+{
+  cacheInvalidate();
+  *pContinuation = MQZCI_CONTINUE;
+  return;
+}
+
+static void MQENTRY OADeleteAuthRecord(
   PMQCHAR  pQMgrName,
-  PMQCHAR  pRefObjectName,
   PMQCHAR  pObjectName,
   MQLONG   ObjectType,
   PMQBYTE  pComponentData,
@@ -728,78 +2530,68 @@ static void MQENTRY OACopyAllAuth(
   PMQLONG  pCompCode,
   PMQLONG  pReason)
 {
-  char tb[TIMEBUF];
-  rpt(copyallfmt,
-	  prefix(tb),
-	  pRefObjectName,
-	  OAOTStr(ObjectType),
-	  pObjectName);
-  *pCompCode = OA_DEF_CC;
-  *pReason   = MQRC_NONE;
+  cacheInvalidateObject(pObjectName,ObjectType);
+  *pContinuation = MQZCI_CONTINUE;
+  return;
+}
+
+static void MQENTRY OARefreshCacheRecord(
+  PMQCHAR  pQMgrName,
+  PMQBYTE  pComponentData,
+  PMQLONG  pContinuation,
+  PMQLONG  pCompCode,
+  PMQLONG  pReason)
+{
+  cacheInvalidate();
   *pContinuation = MQZCI_CONTINUE;
   return;
 }
 
 /****************************************************************************/
-/* Function: OACheckAuth                                                    */
+/* Function: OAGetAuthTime                                                  */
 /*                                                                          */
 /* Description:                                                             */
-/*   Called whenever the qmgr wants to see if someone can do something.     */
-/*   Typically this will be during MQCONN, MQOPEN or MQSUB. Remember, we're */
-/*   never called during MQPUT/MQGET.                                       */
-/*                                                                          */
-/*   The qmgr code will break out of the chaining loop whatever the CC      */
-/*   and whatever the Continuation parameters say,                          */
-/*   unless some very specific error codes happen. This is so that          */
-/*   one, and only one, service returns a response granting access to the   */
-/*   object. But for this particular service we want the chain always to    */
-/*   continue. So I set a combination of Reason/CC/Continuation which will  */
-/*   pass the qmgr checks and then move on to the real OAM.                 */
-/*                                                                          */
-/*   A proper authorisation component would do some real work here! And     */
-/*   then set MQCC_OK (or FAILED) and some appropriate error code.          */
+/*   Registered by the instance after amqzfu when it is timing the OAM.     */
+/*   The authority found by the OAM is passed on unchanged.                 */
 /****************************************************************************/
-static char *checkauthfmt = \
-  "[" PRS "] OACheckAuth\n" \
-  "\tObject  : \"%48.48s\" [%s]\n" \
-  "\t%-6.6s  : " OAES "\n" \
-  "\tAuth    : %s\n"\
-  ;
-
-static void MQENTRY OACheckAuth (
+static void MQENTRY OAGetAuthTime(
   PMQCHAR  pQMgrName,
   PMQZED   pEntityData,
   MQLONG   EntityType,
   PMQCHAR  pObjectName,
   MQLONG   ObjectType,
-  MQLONG   Authority,
+  PMQLONG  pAuthority,
   PMQBYTE  pComponentData,
   PMQLONG  pContinuation,
   PMQLONG  pCompCode,
   PMQLONG  pReason)
 {
-  char buf[AUTHBUF] = {0};
-  char tb[TIMEBUF];
-  int  unknownAuthFlags = 0;
-  if (fp)
-  {
-  	fprintf(fp,checkauthfmt,
-	    prefix(tb),
-	    pObjectName,
-	    OAOTStr(ObjectType),
-	    OAETStr(EntityType),
-	    OAEntityStr(pEntityData),
-	    OAAuthStr(Authority,buf,&unknownAuthFlags));
-    if (unknownAuthFlags != 0)
-    	fprintf(fp,unknownauthfmt,unknownAuthFlags);
-  }
-
-  *pCompCode = OA_DEF_CC;
-  *pReason   = MQRC_UNKNOWN_OBJECT_NAME;
+  timeTaken(FN_GET,pEntityData->EntityNamePtr,FILTER_ENTITY,
+            pObjectName,ObjectType);
   *pContinuation = MQZCI_CONTINUE;
   return;
 }
 
+/****************************************************************************/
+/* Function: OATermRecord                                                   */
+/*                                                                          */
+/* Description:                                                             */
+/*   Termination for the instance after amqzfu. The logfile belongs to the  */
+/*   first instance, so there is nothing to do here.                        */
+/****************************************************************************/
+static void MQENTRY OATermRecord(
+  MQHCONFIG  hc,
+  MQLONG     Options,
+  PMQCHAR    pQMgrName,
+  PMQBYTE    pComponentData,
+  PMQLONG    pCompCode,
+  PMQLONG    pReason)
+{
+  *pCompCode = MQCC_OK;
+  *pReason   = MQRC_NONE;
+  return;
+}
+
 
 #ifdef MQZID_AUTHENTICATE_USER
 /****************************************************************************/
@@ -862,27 +2654,53 @@ static void MQENTRY OAAuthUser (
   char buf[32] = {0};
   char tb[TIMEBUF];
 
-  rpt(authuserfmt,
-	  prefix(tb),
-	  pIdentityContext->UserIdentifier,
-	  pApplicationContext->EffectiveUserID,
-	  pApplicationContext->ApplName,
-	  pIdentityContext->ApplIdentityData,
-	  OAEnvStr(pApplicationContext->Environment),
-	  OACTStr(pApplicationContext->CallerType),
-	  OAATStr(pApplicationContext->AuthenticationType),
-	  OABTStr(pApplicationContext->BindType),
-	  pApplicationContext->ProcessId,
-	  pApplicationContext->ThreadId,
-	  OAPtrStr(*pCorrelationPtr,buf)
-	  );
-
+  if (audited(FN_AUTHUSER,pIdentityContext->UserIdentifier,MQ_USER_ID_LENGTH,NULL,0,0))
+    rpt(authuserfmt,
+        prefix(tb),
+        pIdentityContext->UserIdentifier,
+        pApplicationContext->EffectiveUserID,
+        pApplicationContext->ApplName,
+        pIdentityContext->ApplIdentityData,
+        OAEnvStr(pApplicationContext->Environment),
+        OACTStr(pApplicationContext->CallerType),
+        OAATStr(pApplicationContext->AuthenticationType),
+        OABTStr(pApplicationContext->BindType),
+        pApplicationContext->ProcessId,
+        pApplicationContext->ThreadId,
+        OAPtrStr(*pCorrelationPtr,buf)
+        );
+
+  timeMark(FN_AUTHUSER);
   *pCompCode = OA_DEF_CC;
   *pReason   = MQRC_NONE;
   *pContinuation = MQZCI_CONTINUE;
   return;
 }
 
+/****************************************************************************/
+/* Function: OAAuthUserTime                                                 */
+/*                                                                          */
+/* Description:                                                             */
+/*   Registered by the instance after amqzfu when it is timing the OAM.     */
+/*   Whatever the OAM has set is passed on unchanged.                       */
+/****************************************************************************/
+static void MQENTRY OAAuthUserTime (
+     PMQCHAR  pQMgrName,
+     PMQCSP   pSecurityParms,
+     PMQZAC   pApplicationContext,
+     PMQZIC   pIdentityContext,
+     PMQPTR   pCorrelationPtr,
+     PMQBYTE  pComponentData,
+     PMQLONG  pContinuation,
+     PMQLONG  pCompCode,
+     PMQLONG  pReason)
+{
+  timeTaken(FN_AUTHUSER,pIdentityContext->UserIdentifier,MQ_USER_ID_LENGTH,
+            NULL,0);
+  *pContinuation = MQZCI_CONTINUE;
+  return;
+}
+
 /****************************************************************************/
 /* Function:  OAFreeUser                                                    */
 /*                                                                          */
@@ -913,9 +2731,10 @@ static void MQENTRY OAFreeUser (
   char buf[32] = {0};
   char tb[TIMEBUF];
 
-  rpt(freeuserfmt,
-    prefix(tb),
-    OAPtrStr(pFreeParms->CorrelationPtr,buf));
+  if (audited(FN_FREEUSER,NULL,0,NULL,0,0))
+    rpt(freeuserfmt,
+      prefix(tb),
+      OAPtrStr(pFreeParms->CorrelationPtr,buf));
 
   *pCompCode = OA_DEF_CC;
   *pReason   = MQRC_NONE;
@@ -973,22 +2792,25 @@ static void MQENTRY OAInquire( MQCHAR48 QMgrName
 
   char tb[TIMEBUF];
 
-  rpt("[" PRS "] OAInquire\n", prefix(tb));
-
-  if( SelectorCount == 0)
-  {
-    rpt("\tNo selectors\n");
-  }
-  else
+  if (audited(FN_INQUIRE,NULL,0,NULL,0,0))
   {
-    for(i=0;i<SelectorCount;i++)
+    rpt("[" PRS "] OAInquire\n", prefix(tb));
+
+    if( SelectorCount == 0)
+    {
+      rpt("\tNo selectors\n");
+    }
+    else
     {
-      attr = pSelectors[i];
-      val  = pIntAttrs[i];
-      rpt(attrfmt,
-	      OAAttrStr(attr),
-	      attr,
-	      val);
+      for(i=0;i<SelectorCount;i++)
+      {
+        attr = pSelectors[i];
+        val  = pIntAttrs[i];
+        rpt(attrfmt,
+            OAAttrStr(attr),
+            attr,
+            val);
+      }
     }
   }
 
@@ -1057,9 +2879,11 @@ static void MQENTRY OAEnumAuth(
       pFilter->EntityType == MQZAET_GROUP)
       decodeEnt = 1;
 
-  if (fp)
+  if (fp && audited(FN_ENUM,decodeEnt ? pFilter->EntityDataPtr->EntityNamePtr : NULL,
+                    FILTER_ENTITY,pFilter->ProfileName,pFilter->ObjectType,
+                    pFilter->Authority))
   {
-  	fprintf(fp, authenumfmt,
+  	rpt(authenumfmt,
 	    prefix(tb),
   	  ((StartEnumeration == 0)?"No":"Yes"),
 	    OAEnumOptStr(pFilter->Options,buf),
@@ -1070,7 +2894,7 @@ static void MQENTRY OAEnumAuth(
 	    OAAuthStr(pFilter->Authority,buf2,&unknownAuthFlags)
 	  );
     if (unknownAuthFlags != 0)
-    	fprintf(fp,unknownauthfmt,unknownAuthFlags);
+    	rpt(unknownauthfmt,unknownAuthFlags);
   }
   *pCompCode = OA_DEF_CC;
   *pReason   = MQRC_NONE;
@@ -1108,9 +2932,10 @@ static void MQENTRY OACheckPrivileged( MQCHAR48 QMgrName,
 	      EntityType == MQZAET_GROUP)
 	      decodeEnt = 1;
 
-	  if (fp)
+	  if (fp && audited(FN_CHECKPRIV,decodeEnt ? pEntityData->EntityNamePtr : NULL,
+	                    FILTER_ENTITY,NULL,0,0))
 	  {
-	  	fprintf(fp, checkprivfmt,
+	  	rpt(checkprivfmt,
 		    prefix(tb),
 		    OAETStr(EntityType),
 	        (decodeEnt!=0) ? OAEntityStr(pEntityData): "Not Specified"
@@ -1146,7 +2971,7 @@ static void MQENTRY OACheckPrivileged( MQCHAR48 QMgrName,
 /*                                                                          */
 /* ComponentDataSize and ComponentData :                                    */
 /*                                                                          */
-/*   We do not use ComponentData at all in this module so the               */
+/*   For plain logging we do not use ComponentData at all, and the          */
 /*   ComponentDataSize should be set to zero. If it's                       */
 /*   non-zero, then a block of data is allocated from a chunk of            */
 /*   shared memory and available for all processes running this module      */
@@ -1154,6 +2979,10 @@ static void MQENTRY OACheckPrivileged( MQCHAR48 QMgrName,
 /*   state info, but then you'd also need to manage potential simultaneous  */
 /*   updates to it.                                                         */
 /*                                                                          */
+/*   The authorisation cache uses the size to pick the role of each         */
+/*   instance, and keeps its invalidation count in the block. See the       */
+/*   description of the cache near the top of this file.                    */
+/*                                                                          */
 /* Note:                                                                    */
 /*   This function MUST be called MQStart on some platforms, so we'll use   */
 /*   the same name for all of them.                                         */
@@ -1181,6 +3010,49 @@ void MQENTRY MQStart(
   MQLONG Reason   = MQRC_NONE;
   char tb[TIMEBUF];
 
+  /**************************************************************************/
+  /* The instance configured after amqzfu only records granted requests for */
+  /* the cache, bumps the invalidation counts again once the OAM has made a */
+  /* change, and times the OAM if it has been asked to. It has no logfile   */
+  /* of its own.                                                            */
+  /**************************************************************************/
+  if (ComponentDataLength > 0 && ComponentDataLength < OA_CACHE_COMPSIZE)
+  {
+    MQZEP(hc, MQZID_INIT_AUTHORITY,(PMQFUNC)MQStart,&CC,&Reason);
+    if (CC == MQCC_OK)
+      MQZEP(hc,MQZID_TERM_AUTHORITY,(PMQFUNC)OATermRecord,&CC,&Reason);
+    if (CC == MQCC_OK)
+      MQZEP(hc,MQZID_CHECK_AUTHORITY,(PMQFUNC)OACheckAuthRecord,&CC,&Reason);
+    if (CC == MQCC_OK)
+      MQZEP(hc,MQZID_SET_AUTHORITY,(PMQFUNC)OASetAuthRecord,&CC,&Reason);
+    if (CC == MQCC_OK)
+      MQZEP(hc,MQZID_DELETE_AUTHORITY,(PMQFUNC)OADeleteAuthRecord,&CC,&Reason);
+    if (CC == MQCC_OK)
+      MQZEP(hc,MQZID_REFRESH_CACHE,(PMQFUNC)OARefreshCacheRecord,&CC,&Reason);
+#ifdef OA_TIMING
+    if (ComponentDataLength >= OA_TIME_COMPSIZE)
+    {
+      if (CC == MQCC_OK)
+        MQZEP(hc,MQZID_GET_AUTHORITY,(PMQFUNC)OAGetAuthTime,&CC,&Reason);
+#ifdef MQZID_AUTHENTICATE_USER
+      if (CC == MQCC_OK)
+        MQZEP(hc,MQZID_AUTHENTICATE_USER,(PMQFUNC)OAAuthUserTime,&CC,&Reason);
+#endif
+      pthread_once(&timeOnce,timeInit);
+      timing = 1;
+    }
+#endif
+    if (CC != MQCC_OK)
+    {
+      CC       = MQCC_FAILED;
+      Reason   = MQRC_INITIALIZATION_FAILED;
+    }
+    *Version   = MQZAS_VERSION_6;
+    *pCompCode = CC;
+    *pReason   = Reason;
+    return;
+  }
+
   /**************************************************************************/
   /* Only 1 process (amqzxma0) gets this per qmgr but that process may      */
   /* still also get a 2ary init later so we don't have an 'else' clause -   */
@@ -1195,6 +3067,8 @@ void MQENTRY MQStart(
     if (fp)
     {
       setbuf(fp,NULL);    /* try to reduce interleaved output; auto-flush */
+      auditStart();
+      OAAuthInit();
     }
     else
     {
@@ -1202,6 +3076,30 @@ void MQENTRY MQStart(
     }
   }
 
+#ifdef OA_CACHE
+  /**************************************************************************/
+  /* A large enough block turns on the cache. The qmgr gives us zeroed      */
+  /* storage during the primary initialisation, before any other process   */
+  /* can use it.                                                            */
+  /**************************************************************************/
+  if (ComponentDataLength >= OA_CACHE_COMPSIZE)
+  {
+    char *ttl;
+
+    shared = (OASHARED *)ComponentData;
+    objectSlots = (int)((ComponentDataLength - offsetof(OASHARED,ObjectGeneration)) / sizeof(MQLONG));
+    if (memcmp(shared->StrucId,OA_SHARED_ID,sizeof(shared->StrucId)))
+    {
+      memset(ComponentData,0,ComponentDataLength);
+      memcpy(shared->StrucId,OA_SHARED_ID,sizeof(shared->StrucId));
+    }
+    ttl = getenv(OA_CACHE_ENV);
+    if (ttl)
+      cacheTTL = atoi(ttl);
+    pthread_once(&cacheOnce,cacheInit);
+  }
+#endif
+
   /************************************************************************/
   /* Initialise the entry point vectors.  This is performed for both      */
   /* global and process initialisation, ie whatever the value of the      */
@@ -1273,6 +3171,12 @@ void MQENTRY MQStart(
 	    ComponentDataLength,
 	    Options,
 	    OAInitOptStr(Options));
+  if (shared)
+    rpt("\tCache   : %d seconds\n",cacheTTL);
+#ifdef OA_FILTER
+  if (fp)
+    filterLoad();
+#endif
 
 
   if ((!fp) || (CC != MQCC_OK))
@@ -1330,22 +3234,325 @@ static char *trim(char *s)
 	return s;
 }
 
+/****************************************************************************/
+/* Asynchronous audit writer                                                */
+/*                                                                          */
+/* Agent threads used to write every record straight to the unbuffered     */
+/* log file. That meant several system calls per record, with all the      */
+/* threads queueing on the stdio lock. Now each thread formats its records */
+/* into a ring buffer that only it writes to, and a writer thread takes     */
+/* whatever is in all the rings every AUDIT_MSECS and writes it with one    */
+/* writev. A thread also wakes the writer when its ring is half full.       */
+/*                                                                          */
+/* A thread never waits for the writer. If its ring has no room, the        */
+/* record is thrown away and counted, and the count is logged by OATerm.   */
+/* OATerm also drains all the rings before it returns.                      */
+/*                                                                          */
+/* Each record is written in one piece, but the pieces from one callback   */
+/* could still be separated if the writer runs between them.                */
+/*                                                                          */
+/* Other platforms keep writing directly to the file.                       */
+/****************************************************************************/
+#if MQAT_DEFAULT == MQAT_UNIX
+#define AUDIT_RING  32768        /* Per thread. Must be a power of 2 */
+#define AUDIT_MSECS 50
+#if defined(IOV_MAX) && IOV_MAX < 512
+#define AUDIT_IOV   IOV_MAX
+#else
+#define AUDIT_IOV   512          /* Two for each ring in a batch */
+#endif
+
+typedef struct oaRing {
+  struct oaRing          *next;
+  volatile unsigned long  head;  /* Only moved by the owning thread */
+  volatile unsigned long  tail;  /* Only moved by auditDrain        */
+  volatile int            ended; /* The owning thread has gone      */
+  char                    buf[AUDIT_RING];
+} oaRing;
+
+static oaRing          *rings = NULL;
+static pthread_mutex_t  ringLock   = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t  drainLock  = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t  writerLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t   writerCond = PTHREAD_COND_INITIALIZER;
+static pthread_once_t   ringOnce   = PTHREAD_ONCE_INIT;
+static pthread_key_t    ringKey;
+static pthread_t        writer;
+static int              writerRunning = 0;
+static volatile int     writerStop = 0;
+
+static __thread oaRing *myRing = NULL;
+
+/*
+ * Called when a thread ends. Its ring is freed once it is empty.
+ */
+static void ringEnd(void *p)
+{
+  ((oaRing *)p)->ended = 1;
+}
+
+/*
+ * The writer thread does not exist in a child process. Forget the
+ * parent's rings, and let records be written directly until the
+ * child terminates.
+ */
+static void ringFork(void)
+{
+  pthread_mutex_init(&ringLock,NULL);
+  pthread_mutex_init(&drainLock,NULL);
+  pthread_mutex_init(&writerLock,NULL);
+  pthread_cond_init(&writerCond,NULL);
+  rings = NULL;
+  myRing = NULL;
+  writerRunning = 0;
+}
+
+static void ringInit(void)
+{
+  pthread_key_create(&ringKey,ringEnd);
+  pthread_atfork(NULL,NULL,ringFork);
+}
+
+static oaRing *ringFor(void)
+{
+  if (!myRing)
+  {
+    pthread_once(&ringOnce,ringInit);
+    myRing = calloc(1,sizeof(oaRing));
+    if (myRing)
+    {
+      pthread_setspecific(ringKey,myRing);
+      pthread_mutex_lock(&ringLock);
+      myRing->next = rings;
+      rings = myRing;
+      pthread_mutex_unlock(&ringLock);
+    }
+  }
+  return myRing;
+}
+
+/*
+ * writev may write less than it was asked to
+ */
+static void writeAll(int fd,struct iovec *iov,int n)
+{
+  ssize_t w;
+  while (n > 0)
+  {
+    w = writev(fd,iov,n);
+    if (w < 0)
+      return;
+    while (n > 0 && (size_t)w >= iov->iov_len)
+    {
+      w -= iov->iov_len;
+      iov++;
+      n--;
+    }
+    if (n > 0)
+    {
+      iov->iov_base = (char *)iov->iov_base + w;
+      iov->iov_len -= w;
+    }
+  }
+}
+
+/*
+ * Write out everything in all the rings. Only one thread at a time
+ * can do this, which makes it the single consumer of every ring.
+ */
+static void auditDrain(void)
+{
+  struct iovec   iov[AUDIT_IOV];
+  oaRing        *done[AUDIT_IOV/2];
+  unsigned long  ends[AUDIT_IOV/2];
+  oaRing       **pr;
+  oaRing        *r;
+  unsigned long  h,t,len,off;
+  int            i,n,c,more;
+
+  pthread_mutex_lock(&drainLock);
+  do
+  {
+    n = c = more = 0;
+    pthread_mutex_lock(&ringLock);
+    for (r = rings;r;r = r->next)
+    {
+      h = __atomic_load_n(&r->head,__ATOMIC_ACQUIRE);
+      t = r->tail;
+      if (h == t)
+        continue;
+      if (c == AUDIT_IOV/2)
+      {
+        more = 1;
+        break;
+      }
+      off = t & (AUDIT_RING-1);
+      len = h - t;
+      iov[n].iov_base = r->buf + off;
+      iov[n].iov_len  = (len < AUDIT_RING - off) ? len : AUDIT_RING - off;
+      if (len > iov[n].iov_len)
+      {
+        iov[n+1].iov_base = r->buf;
+        iov[n+1].iov_len  = len - iov[n].iov_len;
+        n++;
+      }
+      n++;
+      done[c] = r;
+      ends[c++] = h;
+    }
+    pthread_mutex_unlock(&ringLock);
+
+    if (n > 0 && fp)
+      writeAll(fileno(fp),iov,n);
+    for (i=0;i<c;i++)
+      __atomic_store_n(&done[i]->tail,ends[i],__ATOMIC_RELEASE);
+  } while (more);
+
+  pthread_mutex_lock(&ringLock);
+  for (pr = &rings;(r = *pr) != NULL;)
+  {
+    if (r->ended && r->head == r->tail)
+    {
+      *pr = r->next;
+      free(r);
+    }
+    else
+      pr = &r->next;
+  }
+  pthread_mutex_unlock(&ringLock);
+  pthread_mutex_unlock(&drainLock);
+}
+
+static void *auditWriter(void *arg)
+{
+  struct timespec ts;
+
+  pthread_mutex_lock(&writerLock);
+  while (!writerStop)
+  {
+    clock_gettime(CLOCK_REALTIME,&ts);
+    ts.tv_nsec += AUDIT_MSECS * 1000000L;
+    if (ts.tv_nsec >= 1000000000L)
+    {
+      ts.tv_sec++;
+      ts.tv_nsec -= 1000000000L;
+    }
+    pthread_cond_timedwait(&writerCond,&writerLock,&ts);
+    pthread_mutex_unlock(&writerLock);
+#ifdef OA_TIMING
+    timePoll();
+#endif
+    auditDrain();
+    pthread_mutex_lock(&writerLock);
+  }
+  pthread_mutex_unlock(&writerLock);
+  return NULL;
+}
+
+/*
+ * If the writer can't be started, records are written by the
+ * thread that makes them.
+ */
+static void auditStart(void)
+{
+  pthread_once(&ringOnce,ringInit);
+  if (!writerRunning)
+  {
+    writerStop = 0;
+    if (pthread_create(&writer,NULL,auditWriter,NULL) == 0)
+      writerRunning = 1;
+  }
+}
+
+static void auditStop(void)
+{
+  if (writerRunning)
+  {
+    pthread_mutex_lock(&writerLock);
+    writerStop = 1;
+    pthread_cond_signal(&writerCond);
+    pthread_mutex_unlock(&writerLock);
+    pthread_join(writer,NULL);
+    writerRunning = 0;
+  }
+  auditDrain();
+}
+
+static void auditFlush(void)
+{
+  auditDrain();
+}
+
+static void auditPut(char *s,int l)
+{
+  oaRing *r = ringFor();
+  unsigned long h,t,off,first;
+  unsigned long len = (unsigned long)l;
+
+  if (r)
+  {
+    h = r->head;
+    t = __atomic_load_n(&r->tail,__ATOMIC_ACQUIRE);
+    if (AUDIT_RING - (h - t) < len)
+    {
+      __sync_fetch_and_add(&auditDropped,1);
+      pthread_cond_signal(&writerCond);
+      return;
+    }
+    off = h & (AUDIT_RING-1);
+    first = (len < AUDIT_RING - off) ? len : AUDIT_RING - off;
+    memcpy(r->buf + off,s,first);
+    memcpy(r->buf,s + first,len - first);
+    __atomic_store_n(&r->head,h + len,__ATOMIC_RELEASE);
+
+    if (!writerRunning)
+      auditDrain();
+    else if (h + len - t > AUDIT_RING/2)
+      pthread_cond_signal(&writerCond);
+  }
+  else
+  {
+    __sync_fetch_and_add(&auditDropped,1);
+  }
+}
+#else
+static void auditStart(void) {}
+static void auditStop(void)  {}
+static void auditFlush(void) {}
+static void auditPut(char *s,int l)
+{
+  fwrite(s,1,l,fp);
+}
+#endif
+
 /****************************************************************************/
 /* Report the activity if the log file is open                              */
 /* Make sure the output does end with '\n'                                  */
+/* rptRecord takes a record that has already been formatted.                */
 /****************************************************************************/
+static void rptRecord(char *s,int l)
+{
+  if (fp)
+    auditPut(s,l);
+}
+
 static void rpt(char *fmt,...)
 {
   va_list va;
-  va_start(va,fmt);
+  char line[RPTBUF];
   int l;
-  if (fp) {
-    vfprintf(fp,fmt,va);
-    l = strlen(fmt);
-    if (l>0 && fmt[l-1] != '\n')
-    {
-      fprintf(fp,"\n");
-    }
-  }
+
+  if (!fp)
+    return;
+
+  va_start(va,fmt);
+  l = vsnprintf(line,sizeof(line),fmt,va);
   va_end(va);
+  if (l < 0)
+    return;
+  if (l >= (int)sizeof(line) - 1)
+    l = sizeof(line) - 2;
+  if (l == 0 || line[l-1] != '\n')
+    line[l++] = '\n';
+  auditPut(line,l);
 }